@@ -0,0 +1,44 @@
+#include"TikiBench.h"
+#include<fstream>
+#include<sstream>
+
+void write_bench_result(const bench_result& r,TikiJsonWriter* json,std::ostream& out)
+{
+    auto per_op= r.ops? r.ns/r.ops : 0;
+    auto per_sec=[&r](uint64_t n){return r.ns? static_cast<uint64_t>(n*1e9/r.ns) : 0;};
+    std::string unit_rate= r.unit? std::string{r.unit}+"_per_sec" : std::string{};
+    if(json)
+    {
+        json->begin("bench").str("name",r.name).str("program",r.program).num("threads",r.threads)
+            .num("ops",r.ops).num("ns",r.ns).num("ns_per_op",per_op).num("ops_per_sec",per_sec(r.ops));
+        if(r.unit) json->num(r.unit,r.units).num(unit_rate.c_str(),per_sec(r.units));
+        if(r.first_ns) json->num("first_ns",r.first_ns);
+        json->end();
+        return;
+    }
+    out << std::dec << "bench " << r.name << " program=" << r.program << " threads=" << r.threads
+        << " ops=" << r.ops << " ns=" << r.ns << " ns_per_op=" << per_op << " ops_per_sec=" << per_sec(r.ops);
+    if(r.unit) out << ' ' << r.unit << '=' << r.units << ' ' << unit_rate << '=' << per_sec(r.units);
+    if(r.first_ns) out << " first_ns=" << r.first_ns;
+    out << std::endl;
+}
+
+bool largest_writable_mapping(pid_t pid,uint64_t& start,uint64_t& size)
+{
+    //55d0c0a00000-55d0c0a21000 rw-p 00000000 00:00 0    [heap]
+    std::ifstream maps("/proc/"+std::to_string(pid)+"/maps");
+    std::string line;
+    size=0;
+    while(std::getline(maps,line))
+    {
+        std::istringstream ss{line};
+        uint64_t lo,hi;
+        char dash;
+        std::string perms;
+        if(!(ss >> std::hex >> lo >> dash >> hi >> perms) || perms.size()<2) continue;
+        if(perms[0]!='r' || perms[1]!='w' || hi-lo<=size) continue;
+        start=lo;
+        size=hi-lo;
+    }
+    return size!=0;
+}
@@ -0,0 +1,34 @@
+#ifndef __TIKIBENCH_H__
+#define __TIKIBENCH_H__
+
+#include<iostream>
+#include<sys/types.h>
+#include<string>
+#include<cstdint>
+#include"TikiJson.h"
+
+/*
+    bench WHAT N [ARG]: 调试器热路径的基准, 在 junk_demo/bench_*.c 这些专门写的被调试程序上跑, 驱动脚本是 junk_demo/bench.sh
+    每项一条结果, 字段固定, 方便按提交保存和比较:
+        --interpreter=json  {"type":"bench","name":..,"program":..,"threads":N,"ops":N,"ns":N,"ns_per_op":N,"ops_per_sec":N
+                             [,UNIT:N,"UNIT_per_sec":N] [,"first_ns":N]}
+        文本                bench NAME program=.. threads=N ops=N ns=N ns_per_op=N ops_per_sec=N [UNIT=N UNIT_per_sec=N] [first_ns=N]
+    UNIT 是所有操作处理的总量 (读内存的 bytes, 回溯的 frames, 找到的符号 found), first_ns 是第一次 (冷) 的耗时, 比如符号表的加载
+    读内存的 NAME 带上每次读的大小 (read-4096), 大小不同的结果不混在一起
+*/
+struct bench_result {
+    std::string name;
+    std::string program;        // 被调试程序的文件名, 同一项在不同程序上的结果靠它区分
+    uint64_t threads=0;
+    uint64_t ops=0;
+    uint64_t ns=0;
+    const char* unit=nullptr;
+    uint64_t units=0;
+    uint64_t first_ns=0;
+};
+
+void write_bench_result(const bench_result& r,TikiJsonWriter* json,std::ostream& out);
+// /proc/pid/maps 里最大的可读写映射 (大堆)
+bool largest_writable_mapping(pid_t pid,uint64_t& start,uint64_t& size);
+
+#endif
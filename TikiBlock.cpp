@@ -0,0 +1,102 @@
+#include"TikiBlock.h"
+
+static const size_t max_block_insns=64;
+static const size_t max_block_chain=16;
+
+static branch_kind classify(csh handle,const cs_insn* insn)
+{
+    if(cs_insn_group(handle,insn,CS_GRP_CALL)) return branch_kind::call;
+    if(cs_insn_group(handle,insn,CS_GRP_RET) || cs_insn_group(handle,insn,CS_GRP_IRET)) return branch_kind::ret;
+    if(cs_insn_group(handle,insn,CS_GRP_JUMP))
+    {
+        return insn->id==X86_INS_JMP || insn->id==X86_INS_LJMP? branch_kind::jump : branch_kind::cond;
+    }
+    return branch_kind::none;
+}
+
+const std::vector<block_insn>& TikiBlockCache::get(uint64_t start)
+{
+    auto it=blocks.find(start);
+    if(it!=blocks.end())
+    {
+        return it->second;
+    }
+
+    auto& block=blocks[start];
+    uint8_t code[max_block_insns*15];
+    auto size=b_read(start,code,sizeof(code));
+    const uint8_t* p=code;
+    uint64_t addr=start;
+    auto insn=cs_malloc(b_handle);
+    while(block.size()<max_block_insns && cs_disasm_iter(b_handle,&p,&size,&addr,insn))
+    {
+        block_insn bi{insn->address,static_cast<uint8_t>(insn->size),classify(b_handle,insn),0,
+            std::string{insn->mnemonic}+"\t"+insn->op_str};
+        if(bi.kind!=branch_kind::none && insn->detail && insn->detail->x86.op_count==1
+            && insn->detail->x86.operands[0].type==X86_OP_IMM)
+        {
+            bi.target=insn->detail->x86.operands[0].imm;
+        }
+        block.push_back(bi);
+        if(bi.kind!=branch_kind::none && bi.kind!=branch_kind::cond)
+        {
+            break;
+        }
+    }
+    cs_free(insn,1);
+    return block;
+}
+
+bool TikiBlockCache::find_branch(uint64_t start,uint64_t pc,uint64_t& from)
+{
+    auto addr=start;
+    for(size_t n=0; n<max_block_chain; n++)
+    {
+        auto& block=get(addr);
+        if(block.empty())
+        {
+            return false;
+        }
+        for(auto& in:block)
+        {
+            if(in.addr==pc && in.addr!=start)
+            {//顺序执行过来的 (单步, 或者块里的 int3)
+                return false;
+            }
+            if(in.kind==branch_kind::cond && in.target!=pc)
+            {//没跳
+                continue;
+            }
+            if(in.kind!=branch_kind::none)
+            {
+                from=in.addr;
+                return true;
+            }
+        }
+        //块太长被截断, 接着往下找
+        addr=block.back().addr+block.back().size;
+    }
+    return false;
+}
+
+void TikiBlockCache::walk(uint64_t start,uint64_t end,const std::function<void(const block_insn&)>& fn)
+{
+    auto addr=start;
+    for(size_t n=0; n<max_block_chain; n++)
+    {
+        auto& block=get(addr);
+        if(block.empty())
+        {
+            return;
+        }
+        for(auto& in:block)
+        {
+            fn(in);
+            if(in.addr==end || (in.kind!=branch_kind::none && in.kind!=branch_kind::cond))
+            {
+                return;
+            }
+        }
+        addr=block.back().addr+block.back().size;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef __TIKIBLOCK_H__
+#define __TIKIBLOCK_H__
+
+#include<iostream>
+#include<vector>
+#include<string>
+#include<functional>
+#include<unordered_map>
+#include<capstone/capstone.h>
+
+enum class branch_kind {
+    none,
+    cond,       // jcc/loop/jrcxz, 不跳转时 BTF 不会停
+    jump,
+    call,
+    ret,
+};
+
+struct block_insn {
+    uint64_t addr;
+    uint8_t size;
+    branch_kind kind;
+    uint64_t target;        // 直接跳转的目标, 间接跳转为 0
+    std::string text;
+};
+
+struct branch_edge {
+    uint64_t from;
+    uint64_t to;
+};
+
+/*
+    PTRACE_SINGLEBLOCK 只在跳转发生后停下, 中间执行过的指令靠这里缓存的反汇编还原
+    一个 "块" 从起始地址一直译码到第一条无条件跳转, 条件跳转不结束块
+*/
+class TikiBlockCache{
+    public:
+        // 读被调试进程的代码 (断点处要换回原字节), 返回实际读到的字节数
+        using code_reader = std::function<size_t(uint64_t,uint8_t*,size_t)>;
+
+        TikiBlockCache(csh handle,code_reader reader):b_handle{handle},b_read{std::move(reader)}{};
+
+        const std::vector<block_insn>& get(uint64_t start);
+        // 从 start 开始执行, 停在 pc 时经过的那条跳转; 顺序执行到 pc (没有跳转) 返回 false
+        bool find_branch(uint64_t start,uint64_t pc,uint64_t& from);
+        // 顺序列出 start 到 end (含) 之间执行过的指令
+        void walk(uint64_t start,uint64_t end,const std::function<void(const block_insn&)>& fn);
+        void clear(){blocks.clear();}
+
+    private:
+        csh b_handle;
+        code_reader b_read;
+        std::unordered_map<uint64_t,std::vector<block_insn>> blocks;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include"TikiCommand.h"
+#include<charconv>
+#include<stdexcept>
+
+bool tokenize_command(std::string_view line,cmd_args& out)
+{
+    out.line=line;
+    out.count=0;
+    size_t pos=0;
+    while(true)
+    {
+        auto b=line.find_first_not_of(" \t\r\n",pos);
+        if(b==std::string_view::npos) return true;
+        auto e=line.find_first_of(" \t\r\n",b);
+        if(e==std::string_view::npos) e=line.size();
+        if(out.count==max_command_words) return false;
+        out.words[out.count++]=line.substr(b,e-b);
+        pos=e;
+    }
+}
+
+uint64_t cmd_number(std::string_view s,int base)
+{
+    auto text=s;
+    bool negative= !text.empty() && text[0]=='-';
+    if(negative || (!text.empty() && text[0]=='+')) text.remove_prefix(1);
+    bool has_0x= text.size()>2 && text[0]=='0' && (text[1]=='x' || text[1]=='X');
+    if(base==0)
+    {
+        base= has_0x? 16 : (text.size()>1 && text[0]=='0')? 8 : 10;
+    }
+    if(base==16 && has_0x) text.remove_prefix(2);
+    uint64_t v=0;
+    auto r=std::from_chars(text.data(),text.data()+text.size(),v,base);
+    if(text.empty() || r.ec!=std::errc{} || r.ptr!=text.data()+text.size())
+    {
+        //std::stoull 会忽略后面的非数字字符, 这里按错误处理
+        throw std::invalid_argument{"Bad number "+std::string{s}};
+    }
+    return negative? 0-v : v;
+}
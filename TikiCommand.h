@@ -0,0 +1,116 @@
+#ifndef __TIKICOMMAND_H__
+#define __TIKICOMMAND_H__
+
+#include<array>
+#include<string>
+#include<string_view>
+#include<algorithm>
+#include<cstdint>
+#include<cstddef>
+
+/*
+    命令表: 名字, 处理函数, 参数个数, 提示
+    表按优先级书写 (前缀冲突时排在前面的优先, 比如 d 是 delete 不是 detach)
+    编译期算出每个命令的最短前缀, 再按名字排序
+    查找: 二分找到以输入开头的那一段, 其中输入长度不小于最短前缀的命令至多一个
+    分派时命令行切成 string_view 放在定长数组里, 不分配内存
+*/
+static const size_t max_command_words=32;
+
+struct cmd_args {
+    std::string_view line;      // 原始的一行, call 这类命令自己解析
+    std::array<std::string_view,max_command_words> words;
+    size_t count=0;
+
+    auto size() const -> size_t {return count;}
+    auto operator[](size_t i) const -> std::string_view {return words[i];}
+    auto back() const -> std::string_view {return words[count-1];}
+    auto begin() const {return words.begin();}
+    auto end() const {return words.begin()+count;}
+    // 接口要 std::string 时用
+    auto str(size_t i) const -> std::string {return std::string{words[i]};}
+};
+
+// 按空白切分, 连续的空白算一个; 超过 max_command_words 个返回 false
+bool tokenize_command(std::string_view line,cmd_args& out);
+// 格式同 std::stoull(s,0,base): base 0 时 0x 开头十六进制, 0 开头八进制; 失败抛出 std::invalid_argument
+uint64_t cmd_number(std::string_view s,int base=0);
+
+template<class Handler>
+struct command_desc {
+    std::string_view name;
+    Handler handler;
+    uint8_t min_args,max_args;      // 不含命令名
+    const char* hint;               // 输入完命令名后显示, 空格开头
+    bool exact;                     // 只接受全名
+    size_t min_prefix;              // build_command_table 填写
+};
+
+// 按优先级顺序, prefix 会被解析成哪个命令; 没有返回 N
+template<class Handler,size_t N>
+constexpr size_t resolve_command_prefix(const std::array<command_desc<Handler>,N>& t,std::string_view prefix)
+{
+    for(size_t i=0;i<N;i++)
+    {
+        if(t[i].exact? t[i].name==prefix : t[i].name.substr(0,prefix.size())==prefix) return i;
+    }
+    return N;
+}
+
+template<class Handler,size_t N>
+constexpr std::array<command_desc<Handler>,N> build_command_table(const command_desc<Handler> (&entries)[N])
+{
+    std::array<command_desc<Handler>,N> t{};
+    for(size_t i=0;i<N;i++)
+    {
+        t[i]=entries[i];
+    }
+    for(size_t i=0;i<N;i++)
+    {
+        auto& name=t[i].name;
+        //被前面的命令完全遮住时是 name.size()+1, 由 command_table_reachable 检查
+        t[i].min_prefix=name.size()+1;
+        for(size_t len= t[i].exact? name.size() : 1;len<=name.size();len++)
+        {
+            if(resolve_command_prefix(t,name.substr(0,len))==i)
+            {
+                t[i].min_prefix=len;
+                break;
+            }
+        }
+    }
+    //插入排序, std::sort 在 C++17 里不是 constexpr
+    for(size_t i=1;i<N;i++)
+    {
+        for(size_t j=i;j>0 && t[j].name<t[j-1].name;j--)
+        {
+            auto tmp=t[j];
+            t[j]=t[j-1];
+            t[j-1]=tmp;
+        }
+    }
+    return t;
+}
+
+template<class Handler,size_t N>
+constexpr bool command_table_reachable(const std::array<command_desc<Handler>,N>& t)
+{
+    for(auto& d:t)
+    {
+        if(d.min_prefix>d.name.size()) return false;
+    }
+    return true;
+}
+
+template<class Handler,size_t N>
+const command_desc<Handler>* find_command(const std::array<command_desc<Handler>,N>& t,std::string_view word)
+{
+    auto it=std::lower_bound(t.begin(),t.end(),word,[](const command_desc<Handler>& d,std::string_view w){return d.name<w;});
+    for(;it!=t.end() && it->name.substr(0,word.size())==word;++it)
+    {
+        if(word.size()>=it->min_prefix) return &*it;
+    }
+    return nullptr;
+}
+
+#endif
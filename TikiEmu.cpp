@@ -0,0 +1,550 @@
+#include"TikiEmu.h"
+#include"TikiMem.h"
+#include<fstream>
+#include<sstream>
+#include<cstring>
+
+static const uint64_t flag_cf=0x1;
+static const uint64_t flag_pf=0x4;
+static const uint64_t flag_af=0x10;
+static const uint64_t flag_zf=0x40;
+static const uint64_t flag_sf=0x80;
+static const uint64_t flag_of=0x800;
+static const uint64_t flags_arith=flag_cf|flag_pf|flag_af|flag_zf|flag_sf|flag_of;
+
+struct gpr_ref {
+    unsigned long long user_regs_struct::* field;
+    uint8_t size;           // 0 表示不是通用寄存器
+    uint8_t shift;          // ah/bh/ch/dh 为 8
+};
+
+static const std::vector<gpr_ref>& gpr_table()
+{
+    static std::vector<gpr_ref> table=[]{
+        std::vector<gpr_ref> t(X86_REG_ENDING,gpr_ref{nullptr,0,0});
+        struct family{unsigned long long user_regs_struct::* field; x86_reg r64,r32,r16,r8;};
+        const family families[]={
+            {&user_regs_struct::rax,X86_REG_RAX,X86_REG_EAX,X86_REG_AX,X86_REG_AL},
+            {&user_regs_struct::rbx,X86_REG_RBX,X86_REG_EBX,X86_REG_BX,X86_REG_BL},
+            {&user_regs_struct::rcx,X86_REG_RCX,X86_REG_ECX,X86_REG_CX,X86_REG_CL},
+            {&user_regs_struct::rdx,X86_REG_RDX,X86_REG_EDX,X86_REG_DX,X86_REG_DL},
+            {&user_regs_struct::rsi,X86_REG_RSI,X86_REG_ESI,X86_REG_SI,X86_REG_SIL},
+            {&user_regs_struct::rdi,X86_REG_RDI,X86_REG_EDI,X86_REG_DI,X86_REG_DIL},
+            {&user_regs_struct::rbp,X86_REG_RBP,X86_REG_EBP,X86_REG_BP,X86_REG_BPL},
+            {&user_regs_struct::rsp,X86_REG_RSP,X86_REG_ESP,X86_REG_SP,X86_REG_SPL},
+            {&user_regs_struct::r8,X86_REG_R8,X86_REG_R8D,X86_REG_R8W,X86_REG_R8B},
+            {&user_regs_struct::r9,X86_REG_R9,X86_REG_R9D,X86_REG_R9W,X86_REG_R9B},
+            {&user_regs_struct::r10,X86_REG_R10,X86_REG_R10D,X86_REG_R10W,X86_REG_R10B},
+            {&user_regs_struct::r11,X86_REG_R11,X86_REG_R11D,X86_REG_R11W,X86_REG_R11B},
+            {&user_regs_struct::r12,X86_REG_R12,X86_REG_R12D,X86_REG_R12W,X86_REG_R12B},
+            {&user_regs_struct::r13,X86_REG_R13,X86_REG_R13D,X86_REG_R13W,X86_REG_R13B},
+            {&user_regs_struct::r14,X86_REG_R14,X86_REG_R14D,X86_REG_R14W,X86_REG_R14B},
+            {&user_regs_struct::r15,X86_REG_R15,X86_REG_R15D,X86_REG_R15W,X86_REG_R15B},
+        };
+        for(auto& f:families)
+        {
+            t[f.r64]={f.field,8,0};
+            t[f.r32]={f.field,4,0};
+            t[f.r16]={f.field,2,0};
+            t[f.r8]={f.field,1,0};
+        }
+        t[X86_REG_AH]={&user_regs_struct::rax,1,8};
+        t[X86_REG_BH]={&user_regs_struct::rbx,1,8};
+        t[X86_REG_CH]={&user_regs_struct::rcx,1,8};
+        t[X86_REG_DH]={&user_regs_struct::rdx,1,8};
+        return t;
+    }();
+    return table;
+}
+
+static uint64_t size_mask(size_t size)
+{
+    return size>=8? ~0ull : (1ull<<(size*8))-1;
+}
+
+static uint64_t sign_extend(uint64_t v,size_t size)
+{
+    if(size>=8) return v;
+    auto shift=64-size*8;
+    return static_cast<uint64_t>(static_cast<int64_t>(v<<shift)>>shift);
+}
+
+static bool get_gpr(const user_regs_struct& regs,unsigned r,uint64_t& value)
+{
+    auto& table=gpr_table();
+    if(r>=table.size() || table[r].size==0) return false;
+    auto& g=table[r];
+    value=(regs.*g.field>>g.shift)&size_mask(g.size);
+    return true;
+}
+
+static bool set_gpr(user_regs_struct& regs,unsigned r,uint64_t value)
+{
+    auto& table=gpr_table();
+    if(r>=table.size() || table[r].size==0) return false;
+    auto& g=table[r];
+    if(g.size==4)
+    {//写 32 位寄存器会清掉高 32 位
+        regs.*g.field=value&0xffffffff;
+    }
+    else{
+        auto m=size_mask(g.size)<<g.shift;
+        regs.*g.field=(regs.*g.field&~m)|((value<<g.shift)&m);
+    }
+    return true;
+}
+
+static uint64_t result_flags(uint64_t res,size_t size)
+{
+    uint64_t f=0;
+    if(res==0) f|=flag_zf;
+    if((res>>(size*8-1))&1) f|=flag_sf;
+    if(!__builtin_parityll(res&0xff)) f|=flag_pf;
+    return f;
+}
+
+static bool cond_taken(unsigned id,uint64_t fl,bool& taken)
+{
+    bool cf=fl&flag_cf, pf=fl&flag_pf, zf=fl&flag_zf, sf=fl&flag_sf, of=fl&flag_of;
+    switch(id)
+    {
+        case X86_INS_JO:  taken=of; break;
+        case X86_INS_JNO: taken=!of; break;
+        case X86_INS_JB:  taken=cf; break;
+        case X86_INS_JAE: taken=!cf; break;
+        case X86_INS_JE:  taken=zf; break;
+        case X86_INS_JNE: taken=!zf; break;
+        case X86_INS_JBE: taken=cf||zf; break;
+        case X86_INS_JA:  taken=!cf&&!zf; break;
+        case X86_INS_JS:  taken=sf; break;
+        case X86_INS_JNS: taken=!sf; break;
+        case X86_INS_JP:  taken=pf; break;
+        case X86_INS_JNP: taken=!pf; break;
+        case X86_INS_JL:  taken=sf!=of; break;
+        case X86_INS_JGE: taken=sf==of; break;
+        case X86_INS_JLE: taken=zf||sf!=of; break;
+        case X86_INS_JG:  taken=!zf&&sf==of; break;
+        default: return false;
+    }
+    return true;
+}
+
+void TikiEmu::reset(pid_t pid)
+{
+    e_pid=pid;
+    pages.clear();
+    last_page=nullptr;
+    last_page_addr=UINT64_MAX;
+}
+
+void TikiEmu::load_maps()
+{
+    //写权限以 maps 为准, /proc/pid/mem 写回时不检查页属性
+    maps.clear();
+    std::ifstream map("/proc/"+std::to_string(e_pid)+"/maps");
+    std::string line;
+    while(std::getline(map,line))
+    {
+        std::istringstream ls{line};
+        std::string addrs,perms;
+        ls >> addrs >> perms;
+        auto dash=addrs.find('-');
+        if(dash==std::string::npos || perms.size()<2) continue;
+        maps.push_back({std::stoull(addrs.substr(0,dash),0,16),std::stoull(addrs.substr(dash+1),0,16),
+            perms[0]=='r',perms[1]=='w'});
+    }
+}
+
+TikiEmu::emu_page* TikiEmu::get_page(uint64_t addr)
+{
+    auto base=addr&~0xfffull;
+    if(base==last_page_addr)
+    {
+        return last_page;
+    }
+    auto it=pages.find(base);
+    if(it==pages.end())
+    {
+        std::unique_ptr<emu_page> page{new emu_page};
+        page->dirty=false;
+        page->writable=false;
+        bool readable=false;
+        for(auto& m:maps)
+        {
+            if(base>=m.start && base<m.end)
+            {
+                readable=m.readable;
+                page->writable=m.writable;
+                break;
+            }
+        }
+        if(!readable || !read_remote(e_pid,base,page->data,sizeof(page->data)))
+        {
+            return nullptr;
+        }
+        it=pages.emplace(base,std::move(page)).first;
+    }
+    last_page_addr=base;
+    last_page=it->second.get();
+    return last_page;
+}
+
+bool TikiEmu::read_mem(uint64_t addr,size_t size,uint64_t& value)
+{
+    value=0;
+    auto off=addr&0xfff;
+    if(off+size<=0x1000)
+    {
+        auto page=get_page(addr);
+        if(!page) return false;
+        std::memcpy(&value,page->data+off,size);
+        return true;
+    }
+    //跨页
+    for(size_t i=0;i<size;i++)
+    {
+        auto page=get_page(addr+i);
+        if(!page) return false;
+        value|=static_cast<uint64_t>(page->data[(addr+i)&0xfff])<<(i*8);
+    }
+    return true;
+}
+
+bool TikiEmu::check_write(uint64_t addr,size_t size)
+{
+    auto first=get_page(addr);
+    auto last=get_page(addr+size-1);
+    return first && last && first->writable && last->writable;
+}
+
+void TikiEmu::write_mem(uint64_t addr,size_t size,uint64_t value)
+{
+    //调用前已经 check_write 过
+    for(size_t i=0;i<size;i++)
+    {
+        auto page=get_page(addr+i);
+        page->data[(addr+i)&0xfff]=static_cast<uint8_t>(value>>(i*8));
+        page->dirty=true;
+    }
+}
+
+bool TikiEmu::flush()
+{
+    bool ok=true;
+    for(auto& p:pages)
+    {
+        if(!p.second->dirty) continue;
+        ok&=write_remote(e_pid,p.first,p.second->data,sizeof(p.second->data));
+        p.second->dirty=false;
+    }
+    return ok;
+}
+
+bool TikiEmu::compare_memory(uint64_t& bad_addr)
+{
+    uint8_t real[0x1000];
+    for(auto& p:pages)
+    {
+        if(!p.second->dirty) continue;
+        if(!read_remote(e_pid,p.first,real,sizeof(real))) return false;
+        for(size_t i=0;i<sizeof(real);i++)
+        {
+            if(real[i]!=p.second->data[i])
+            {
+                bad_addr=p.first+i;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+const TikiEmu::emu_insn* TikiEmu::decode(uint64_t addr)
+{
+    auto it=insns.find(addr);
+    if(it!=insns.end())
+    {
+        return it->second.id==X86_INS_INVALID? nullptr : &it->second;
+    }
+
+    auto& in=insns[addr];
+    in.id=X86_INS_INVALID;
+    uint8_t code[15];
+    size_t n=0;
+    uint64_t byte;
+    while(n<sizeof(code) && read_mem(addr+n,1,byte))
+    {
+        code[n++]=static_cast<uint8_t>(byte);
+    }
+    cs_insn* insn;
+    if(n==0 || cs_disasm(e_handle,code,n,addr,1,&insn)!=1)
+    {
+        return nullptr;
+    }
+    if(insn->detail==nullptr || insn->detail->x86.op_count>4)
+    {
+        cs_free(insn,1);
+        return nullptr;
+    }
+    auto& x86=insn->detail->x86;
+    in.id=insn->id;
+    in.size=static_cast<uint8_t>(insn->size);
+    in.op_count=x86.op_count;
+    in.addr_size=x86.addr_size;
+    std::copy(x86.operands,x86.operands+x86.op_count,in.ops);
+    in.text=std::string{insn->mnemonic}+"\t"+insn->op_str;
+    cs_free(insn,1);
+    return &in;
+}
+
+std::string TikiEmu::describe(uint64_t addr)
+{
+    auto in=decode(addr);
+    return in? in->text : "(bad)";
+}
+
+bool TikiEmu::mem_writes(const user_regs_struct& regs,std::vector<std::pair<uint64_t,size_t>>& out)
+{
+    out.clear();
+    auto in=decode(regs.rip);
+    if(in==nullptr)
+    {
+        return false;
+    }
+    //隐式写栈
+    if(in->id==X86_INS_PUSH || in->id==X86_INS_CALL)
+    {
+        out.push_back({regs.rsp-8,8});
+    }
+    for(int i=0;i<in->op_count;i++)
+    {
+        auto& op=in->ops[i];
+        uint64_t addr;
+        if(op.type!=X86_OP_MEM || !(op.access&CS_AC_WRITE) || op.size==0) continue;
+        if(effective_addr(regs,*in,op,addr)) out.push_back({addr,op.size});
+    }
+    return true;
+}
+
+bool TikiEmu::effective_addr(const user_regs_struct& regs,const emu_insn& in,const cs_x86_op& op,uint64_t& addr)
+{
+    if(op.type!=X86_OP_MEM) return false;
+    auto& m=op.mem;
+    uint64_t a=m.disp,v;
+    if(m.base==X86_REG_RIP)
+    {
+        a+=regs.rip+in.size;
+    }
+    else if(m.base!=X86_REG_INVALID)
+    {
+        if(!get_gpr(regs,m.base,v)) return false;
+        a+=v;
+    }
+    if(m.index!=X86_REG_INVALID)
+    {
+        if(!get_gpr(regs,m.index,v)) return false;
+        a+=v*m.scale;
+    }
+    if(in.addr_size==4)
+    {
+        a&=0xffffffff;
+    }
+    if(m.segment==X86_REG_FS) a+=regs.fs_base;
+    else if(m.segment==X86_REG_GS) a+=regs.gs_base;
+    addr=a;
+    return true;
+}
+
+bool TikiEmu::read_op(const user_regs_struct& regs,const emu_insn& in,const cs_x86_op& op,uint64_t& value)
+{
+    switch(op.type)
+    {
+        case X86_OP_REG:
+            return get_gpr(regs,op.reg,value);
+        case X86_OP_IMM:
+            value=static_cast<uint64_t>(op.imm)&size_mask(op.size? op.size : 8);
+            return true;
+        case X86_OP_MEM:
+        {
+            uint64_t addr;
+            if(op.size==0 || op.size>8 || !effective_addr(regs,in,op,addr)) return false;
+            return read_mem(addr,op.size,value);
+        }
+        default:
+            return false;
+    }
+}
+
+bool TikiEmu::check_dest(const user_regs_struct& regs,const emu_insn& in,const cs_x86_op& op,uint64_t& addr)
+{
+    if(op.type==X86_OP_REG)
+    {
+        uint64_t v;
+        return get_gpr(regs,op.reg,v);
+    }
+    if(op.type!=X86_OP_MEM || op.size==0 || op.size>8 || !effective_addr(regs,in,op,addr))
+    {
+        return false;
+    }
+    return check_write(addr,op.size);
+}
+
+void TikiEmu::write_op(user_regs_struct& regs,const cs_x86_op& op,uint64_t addr,uint64_t value)
+{
+    if(op.type==X86_OP_REG)
+    {
+        set_gpr(regs,op.reg,value);
+    }
+    else{
+        write_mem(addr,op.size,value);
+    }
+}
+
+bool TikiEmu::step(user_regs_struct& regs)
+{
+    auto in=decode(regs.rip);
+    if(in==nullptr)
+    {
+        return false;
+    }
+    //先在副本上算, 所有检查都通过后才写内存和寄存器
+    auto r=regs;
+    auto next=regs.rip+in->size;
+    r.rip=next;
+    flags_defined=flags_arith;
+    uint64_t a,b,addr=0;
+    auto& dst=in->ops[0];
+    auto& src=in->ops[1];
+
+    switch(in->id)
+    {
+        case X86_INS_NOP:
+        case X86_INS_ENDBR64:
+            break;
+
+        case X86_INS_MOV:
+        case X86_INS_MOVABS:
+            if(in->op_count!=2 || !read_op(regs,*in,src,a) || !check_dest(regs,*in,dst,addr)) return false;
+            write_op(r,dst,addr,a);
+            break;
+
+        case X86_INS_MOVZX:
+        case X86_INS_MOVSX:
+        case X86_INS_MOVSXD:
+            if(in->op_count!=2 || !read_op(regs,*in,src,a) || !check_dest(regs,*in,dst,addr)) return false;
+            if(in->id!=X86_INS_MOVZX) a=sign_extend(a,src.size);
+            write_op(r,dst,addr,a);
+            break;
+
+        case X86_INS_LEA:
+            if(in->op_count!=2 || !effective_addr(regs,*in,src,a) || !check_dest(regs,*in,dst,addr)) return false;
+            //lea 不加段基址
+            if(src.mem.segment==X86_REG_FS) a-=regs.fs_base;
+            else if(src.mem.segment==X86_REG_GS) a-=regs.gs_base;
+            write_op(r,dst,addr,a);
+            break;
+
+        case X86_INS_ADD:
+        case X86_INS_SUB:
+        case X86_INS_CMP:
+        case X86_INS_AND:
+        case X86_INS_OR:
+        case X86_INS_XOR:
+        case X86_INS_TEST:
+        {
+            if(in->op_count!=2 || !read_op(regs,*in,dst,a) || !read_op(regs,*in,src,b)) return false;
+            auto size=dst.size;
+            if(size==0 || size>8) return false;
+            auto m=size_mask(size);
+            auto bits=size*8-1;
+            a&=m;
+            b&=m;
+            uint64_t res,fl;
+            switch(in->id)
+            {
+                case X86_INS_ADD:
+                    res=(a+b)&m;
+                    fl=result_flags(res,size)|((a^b^res)&flag_af);
+                    if(res<a) fl|=flag_cf;
+                    if((((a^res)&(b^res))>>bits)&1) fl|=flag_of;
+                    break;
+                case X86_INS_SUB:
+                case X86_INS_CMP:
+                    res=(a-b)&m;
+                    fl=result_flags(res,size)|((a^b^res)&flag_af);
+                    if(a<b) fl|=flag_cf;
+                    if((((a^b)&(a^res))>>bits)&1) fl|=flag_of;
+                    break;
+                default:
+                    res= in->id==X86_INS_OR? a|b : in->id==X86_INS_XOR? a^b : a&b;
+                    //AF 未定义, 按 0 处理
+                    fl=result_flags(res,size);
+                    flags_defined=flags_arith&~flag_af;
+                    break;
+            }
+            if(in->id!=X86_INS_CMP && in->id!=X86_INS_TEST)
+            {
+                if(!check_dest(regs,*in,dst,addr)) return false;
+                write_op(r,dst,addr,res);
+            }
+            r.eflags=(r.eflags&~flags_arith)|fl;
+            break;
+        }
+
+        case X86_INS_JMP:
+        case X86_INS_CALL:
+            //直接跳转的 imm 已经是目标地址, 不按操作数大小截断
+            if(in->op_count!=1) return false;
+            if(dst.type==X86_OP_IMM) a=static_cast<uint64_t>(dst.imm);
+            else if(dst.size!=8 || !read_op(regs,*in,dst,a)) return false;
+            if(in->id==X86_INS_JMP)
+            {
+                r.rip=a;
+                break;
+            }
+            if(!check_write(regs.rsp-8,8)) return false;
+            write_mem(regs.rsp-8,8,next);
+            r.rsp-=8;
+            r.rip=a;
+            break;
+
+        case X86_INS_RET:
+            if(!read_mem(regs.rsp,8,a)) return false;
+            r.rsp+=8;
+            if(in->op_count==1) r.rsp+=dst.imm;
+            r.rip=a;
+            break;
+
+        case X86_INS_PUSH:
+            if(in->op_count!=1 || !read_op(regs,*in,dst,a) || !check_write(regs.rsp-8,8)) return false;
+            if(dst.type!=X86_OP_IMM && dst.size!=8) return false;
+            if(dst.type==X86_OP_IMM) a=static_cast<uint64_t>(dst.imm);
+            write_mem(regs.rsp-8,8,a);
+            r.rsp-=8;
+            break;
+
+        case X86_INS_POP:
+            if(in->op_count!=1 || dst.size!=8 || !read_mem(regs.rsp,8,a)) return false;
+            r.rsp+=8;
+            //pop [rsp+x] 的地址按弹出后的 rsp 计算
+            if(!check_dest(r,*in,dst,addr)) return false;
+            write_op(r,dst,addr,a);
+            break;
+
+        case X86_INS_LEAVE:
+            if(!read_mem(regs.rbp,8,a)) return false;
+            r.rsp=regs.rbp+8;
+            r.rbp=a;
+            break;
+
+        default:
+        {
+            bool taken;
+            if(!cond_taken(in->id,regs.eflags,taken) || in->op_count!=1 || dst.type!=X86_OP_IMM) return false;
+            if(taken) r.rip=static_cast<uint64_t>(dst.imm);
+            break;
+        }
+    }
+    regs=r;
+    return true;
+}
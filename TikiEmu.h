@@ -0,0 +1,84 @@
+#ifndef __TIKIEMU_H__
+#define __TIKIEMU_H__
+
+#include<iostream>
+#include<sys/user.h>
+#include<vector>
+#include<string>
+#include<memory>
+#include<unordered_map>
+#include<capstone/capstone.h>
+
+/*
+    在调试器里直接模拟常见的简单指令, 不经过内核:
+        mov/movabs/movzx/movsx/movsxd/lea
+        add/sub/cmp/and/or/xor/test
+        jcc/jmp/call/ret/push/pop/nop
+    寄存器在本地的 user_regs_struct 上修改, 内存按页缓存一份镜像, 写过的页在 flush 时写回
+    其他指令 (syscall, SSE, 字符串指令 ...) 返回 false, 由调用者交给内核单步
+    只适合其他线程都停着的情况 (all-stop), 否则镜像会和实际内存不一致
+*/
+class TikiEmu{
+    public:
+        TikiEmu(csh handle):e_handle{handle}{};
+
+        // 开始一批模拟: 丢掉内存镜像
+        void reset(pid_t pid);
+        // 读 /proc/pid/maps 里的页属性, 映射可能变了 (系统调用之后) 要重新读
+        void load_maps();
+        // 模拟 regs.rip 处的一条指令; 不支持或者访问出错时返回 false, 此时 regs 和内存都不变
+        bool step(user_regs_struct& regs);
+        // 把写过的页写回被调试进程
+        bool flush();
+        // 代码可能变了, 丢掉译码缓存
+        void clear_code(){insns.clear();}
+
+        // 上一条模拟的指令之后哪些标志位是确定的 (校验时只比较这些)
+        auto get_flags_defined() const -> uint64_t {return flags_defined;}
+        // 写过的页与实际内存比较, 不一致时给出第一个不同的地址
+        bool compare_memory(uint64_t& bad_addr);
+        std::string describe(uint64_t addr);
+        // 不执行, 只算出 regs.rip 处的指令会写哪些内存 (地址, 长度); 译码失败返回 false
+        bool mem_writes(const user_regs_struct& regs,std::vector<std::pair<uint64_t,size_t>>& out);
+
+    private:
+        struct emu_insn {
+            unsigned id;
+            uint8_t size;
+            uint8_t op_count;
+            uint8_t addr_size;
+            cs_x86_op ops[4];
+            std::string text;
+        };
+        struct emu_page {
+            uint8_t data[0x1000];
+            bool writable;
+            bool dirty;
+        };
+        struct map_range {
+            uint64_t start,end;
+            bool readable,writable;
+        };
+
+        const emu_insn* decode(uint64_t addr);
+        emu_page* get_page(uint64_t addr);
+        bool read_mem(uint64_t addr,size_t size,uint64_t& value);
+        bool check_write(uint64_t addr,size_t size);
+        void write_mem(uint64_t addr,size_t size,uint64_t value);
+
+        bool effective_addr(const user_regs_struct& regs,const emu_insn& in,const cs_x86_op& op,uint64_t& addr);
+        bool read_op(const user_regs_struct& regs,const emu_insn& in,const cs_x86_op& op,uint64_t& value);
+        bool check_dest(const user_regs_struct& regs,const emu_insn& in,const cs_x86_op& op,uint64_t& addr);
+        void write_op(user_regs_struct& regs,const cs_x86_op& op,uint64_t addr,uint64_t value);
+
+        csh e_handle;
+        pid_t e_pid=0;
+        std::vector<map_range> maps;
+        std::unordered_map<uint64_t,std::unique_ptr<emu_page>> pages;
+        std::unordered_map<uint64_t,emu_insn> insns;
+        uint64_t last_page_addr=UINT64_MAX;
+        emu_page* last_page=nullptr;
+        uint64_t flags_defined=0;
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include"TikiEventLoop.h"
+#include<csignal>
+#include<cerrno>
+#include<ctime>
+#include<unistd.h>
+#include<sys/epoll.h>
+#include<sys/signalfd.h>
+#include<sys/timerfd.h>
+#include<sys/prctl.h>
+
+static uint64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000ull+ts.tv_nsec;
+}
+
+bool TikiEventLoop::open(int fd)
+{
+    close();
+    //默认 50us 的 timer slack 会直接加在每次唤醒上
+    prctl(PR_SET_TIMERSLACK,1,0,0,0);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask,SIGCHLD);
+    sigaddset(&mask,SIGINT);
+    //屏蔽之后 SIGCHLD 不会因为默认忽略而被丢掉
+    if(sigprocmask(SIG_BLOCK,&mask,nullptr)<0)
+    {
+        return false;
+    }
+    sigfd=signalfd(-1,&mask,SFD_NONBLOCK|SFD_CLOEXEC);
+    timerfd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+    epfd=epoll_create1(EPOLL_CLOEXEC);
+    if(sigfd<0 || timerfd<0 || epfd<0)
+    {
+        close();
+        return false;
+    }
+    epoll_event ev{};
+    ev.events=EPOLLIN;
+    ev.data.u32=src_child|src_interrupt;
+    epoll_ctl(epfd,EPOLL_CTL_ADD,sigfd,&ev);
+    ev.data.u32=src_timer;
+    epoll_ctl(epfd,EPOLL_CTL_ADD,timerfd,&ev);
+    //stdin 只在需要时加入 epoll, 这里先试一次能不能加
+    input_fd=fd;
+    input_always=false;
+    input_watched=false;
+    if(input_fd<0) return true;
+    ev.data.u32=src_input;
+    if(epoll_ctl(epfd,EPOLL_CTL_ADD,input_fd,&ev)<0)
+    {//普通文件不能加入 epoll, 当作总是可读
+        input_fd=-1;
+        input_always=true;
+        return true;
+    }
+    epoll_ctl(epfd,EPOLL_CTL_DEL,input_fd,nullptr);
+    return true;
+}
+
+void TikiEventLoop::close()
+{
+    for(auto fd:{epfd,sigfd,timerfd})
+    {
+        if(fd>=0) ::close(fd);
+    }
+    epfd=sigfd=timerfd=-1;
+    input_fd=-1;
+    input_always=false;
+    input_watched=false;
+}
+
+uint32_t TikiEventLoop::wait(uint32_t watch,int timeout_ms)
+{
+    bool want_input=(watch&src_input)!=0;
+    if(want_input && input_always)
+    {
+        return src_input;
+    }
+    if(input_fd>=0 && want_input!=input_watched)
+    {//stdin 是水平触发, 不关心时要从 epoll 里删掉: 空事件掩码也会报告 EPOLLHUP/EPOLLERR, 关掉的管道会让这里一直醒
+        epoll_event ev{};
+        ev.events=EPOLLIN;
+        ev.data.u32=src_input;
+        epoll_ctl(epfd,want_input? EPOLL_CTL_ADD : EPOLL_CTL_DEL,input_fd,&ev);
+        input_watched=want_input;
+    }
+    epoll_event evs[3];
+    uint32_t ready=0;
+    while(!(ready&watch))
+    {
+        auto n=epoll_wait(epfd,evs,3,timeout_ms);
+        if(n<0 && errno==EINTR) continue;
+        if(n<=0) break;
+        ++wakeups;
+        for(int i=0;i<n;i++)
+        {
+            auto src=evs[i].data.u32;
+            if(src==src_timer)
+            {
+                read_timer();
+                ready|=src_timer;
+            }
+            else if(src==src_input)
+            {
+                ready|=src_input;
+            }
+            else{
+                read_signals(ready);
+            }
+        }
+    }
+    return ready;
+}
+
+void TikiEventLoop::read_signals(uint32_t& ready)
+{
+    signalfd_siginfo si[8];
+    ssize_t n;
+    while((n=read(sigfd,si,sizeof(si)))>0)
+    {
+        for(size_t i=0;i<n/sizeof(si[0]);i++)
+        {
+            ready|= si[i].ssi_signo==SIGINT? src_interrupt : src_child;
+        }
+    }
+}
+
+void TikiEventLoop::drain_interrupts()
+{
+    //SIGCHLD 顺带读掉也没关系, 调用者随后总会用 WNOHANG 收一遍
+    uint32_t ready=0;
+    if(sigfd>=0) read_signals(ready);
+}
+
+void TikiEventLoop::read_timer()
+{
+    uint64_t expired=0;
+    if(read(timerfd,&expired,sizeof(expired))!=sizeof(expired) || expired==0 || timer_interval==0)
+    {
+        return;
+    }
+    //错过的几次按最后一次到期计算
+    auto due=timer_next+(expired-1)*timer_interval;
+    auto now=now_ns();
+    timer_next=due+timer_interval;
+    if(now<due) return;
+    auto lat=now-due;
+    ++timer_fires;
+    latency_sum+=lat;
+    if(lat<latency_min) latency_min=lat;
+    if(lat>latency_max) latency_max=lat;
+}
+
+void TikiEventLoop::start_timer(uint64_t interval_us)
+{
+    if(timerfd<0 || timer_interval!=0) return;
+    timer_interval=interval_us*1000;
+    timer_next=now_ns()+timer_interval;
+    //绝对时间, 到期时刻就是 timer_next
+    itimerspec its{};
+    its.it_value.tv_sec=timer_next/1000000000ull;
+    its.it_value.tv_nsec=timer_next%1000000000ull;
+    its.it_interval.tv_sec=timer_interval/1000000000ull;
+    its.it_interval.tv_nsec=timer_interval%1000000000ull;
+    timerfd_settime(timerfd,TFD_TIMER_ABSTIME,&its,nullptr);
+}
+
+void TikiEventLoop::stop_timer()
+{
+    if(timerfd<0 || timer_interval==0) return;
+    itimerspec its{};
+    timerfd_settime(timerfd,0,&its,nullptr);
+    uint64_t expired;
+    while(read(timerfd,&expired,sizeof(expired))>0);
+    timer_interval=0;
+}
+
+void TikiEventLoop::show_stats() const
+{
+    std::cout << std::dec << wakeups << " wakeups, " << timer_fires << " timer ticks";
+    if(timer_fires)
+    {
+        std::cout << ", wakeup latency min " << latency_min/1000.0 << " us, avg "
+            << latency_sum/timer_fires/1000.0 << " us, max " << latency_max/1000.0 << " us";
+    }
+    std::cout << std::endl;
+}
@@ -0,0 +1,62 @@
+#ifndef __TIKIEVENTLOOP_H__
+#define __TIKIEVENTLOOP_H__
+
+#include<iostream>
+#include<cstdint>
+
+/*
+    调试器的等待都经过这里: 一个 epoll 同时等
+        signalfd    SIGCHLD (被调试进程的 ptrace-stop/退出) 和 SIGINT (Ctrl-C)
+        stdin       后台运行时用 linenoise 的 EditStart/Feed 接着编辑命令
+        timerfd     运行期间定时读 ftrace-fast 的环形缓冲区
+    两个信号在调试器里一直屏蔽, 只通过 signalfd 读取; SIGCHLD 会合并, 收到后要用 WNOHANG 收完所有事件
+    pidfd 只在进程退出时可读, ptrace-stop 不会通知, 所以不用它
+*/
+enum loop_source : uint32_t {
+    src_child=1,
+    src_interrupt=2,
+    src_input=4,
+    src_timer=8,
+};
+
+class TikiEventLoop{
+    public:
+        TikiEventLoop()=default;
+        ~TikiEventLoop(){close();}
+        TikiEventLoop(const TikiEventLoop&)=delete;
+        TikiEventLoop& operator=(const TikiEventLoop&)=delete;
+
+        bool open(int input_fd);
+        void close();
+        auto is_open() const -> bool {return epfd>=0;}
+
+        // 阻塞到 watch 中的某个来源就绪, 返回就绪的来源; 不关心 stdin 时终端留给被调试进程
+        uint32_t wait(uint32_t watch,int timeout_ms=-1);
+        // 丢掉已经收到的 Ctrl-C (被调试进程自己也收到了, 已经作为信号报告)
+        void drain_interrupts();
+
+        void start_timer(uint64_t interval_us);
+        void stop_timer();
+
+        // 定时器的到期时间是确定的, 用它衡量从到期到调试器醒来的延迟
+        void show_stats() const;
+
+    private:
+        void read_signals(uint32_t& ready);
+        void read_timer();
+
+        int epfd=-1;
+        int sigfd=-1;
+        int timerfd=-1;
+        int input_fd=-1;                // -1: 没有输入 (批处理, profile)
+        bool input_always=false;        // 不能加入 epoll 的输入 (普通文件), 总是可读
+        bool input_watched=false;
+
+        uint64_t timer_interval=0;      // ns
+        uint64_t timer_next=0;          // 下一次到期, CLOCK_MONOTONIC ns
+        uint64_t wakeups=0;
+        uint64_t timer_fires=0;
+        uint64_t latency_sum=0,latency_min=UINT64_MAX,latency_max=0;
+};
+
+#endif
@@ -0,0 +1,321 @@
+#include"TikiFastTrace.h"
+#include<fstream>
+#include<sstream>
+#include<cstring>
+#include<cstdlib>
+#include<algorithm>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+
+static const size_t ring_records=1<<16;
+static const size_t ring_header=64;
+static const int64_t code_reach=1ll<<30;       // 离被修改的地址最多 1GB, rip 相对的操作数也能换算过来
+
+// 被调试进程里 trampoline 开头的记录代码, 两个 imm64 在 build 时填入
+static void put_record_code(std::vector<uint8_t>& out,uint64_t ring,uint64_t addr)
+{
+    auto put64=[&out](uint64_t v){
+        for(int i=0;i<8;i++) out.push_back(static_cast<uint8_t>(v>>(i*8)));
+    };
+    out.insert(out.end(),{
+        0x48,0x8d,0x64,0x24,0x80,               // lea rsp,[rsp-0x80]    跳过 red zone
+        0x9c,                                   // pushfq
+        0x50,0x51,0x52,                         // push rax; push rcx; push rdx
+        0x48,0xb9});                            // movabs rcx, ring
+    put64(ring);
+    out.insert(out.end(),{
+        0xb8,0x01,0x00,0x00,0x00,               // mov eax,1
+        0xf0,0x48,0x0f,0xc1,0x01,               // lock xadd [rcx],rax   取槽位
+        0x48,0x23,0x41,0x08,                    // and rax,[rcx+8]       & mask
+        0x48,0xc1,0xe0,0x05,                    // shl rax,5             * sizeof(fast_record)
+        0x48,0x8d,0x4c,0x01,0x40,               // lea rcx,[rcx+rax+0x40]
+        0x48,0x89,0x79,0x10,                    // mov [rcx+0x10],rdi
+        0x48,0x89,0x71,0x18,                    // mov [rcx+0x18],rsi
+        0x0f,0x31,                              // rdtsc
+        0x48,0xc1,0xe2,0x20,                    // shl rdx,32
+        0x48,0x09,0xd0,                         // or rax,rdx
+        0x48,0x89,0x41,0x08,                    // mov [rcx+8],rax
+        0x48,0xb8});                            // movabs rax, addr
+    put64(addr);
+    out.insert(out.end(),{
+        0x48,0x89,0x01,                         // mov [rcx],rax         最后写 addr
+        0x5a,0x59,0x58,                         // pop rdx; pop rcx; pop rax
+        0x9d,                                   // popfq
+        0x48,0x8d,0xa4,0x24,0x80,0x00,0x00,0x00});  // lea rsp,[rsp+0x80]
+}
+
+static bool fits_rel32(int64_t v)
+{
+    return v==static_cast<int32_t>(v);
+}
+
+static void put32(std::vector<uint8_t>& out,int64_t v)
+{
+    for(int i=0;i<4;i++) out.push_back(static_cast<uint8_t>(v>>(i*8)));
+}
+
+bool TikiFastTrace::create_ring(pid_t pid)
+{
+    reset();
+    shm_path="/dev/shm/tiki-"+std::to_string(getpid())+"-"+std::to_string(pid);
+    ring_bytes=(ring_header+ring_records*sizeof(fast_record)+0xfff)&~0xfffull;
+    auto fd=open(shm_path.c_str(),O_RDWR|O_CREAT|O_TRUNC,0600);
+    if(fd<0)
+    {
+        return false;
+    }
+    void* p=MAP_FAILED;
+    if(ftruncate(fd,ring_bytes)==0)
+    {
+        p=mmap(nullptr,ring_bytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    }
+    close(fd);
+    if(p==MAP_FAILED)
+    {
+        unlink_ring();
+        return false;
+    }
+    ring=static_cast<uint8_t*>(p);
+    auto hdr=reinterpret_cast<uint64_t*>(ring);
+    hdr[0]=0;
+    hdr[1]=ring_records-1;
+    tail=0;
+    return true;
+}
+
+void TikiFastTrace::unlink_ring()
+{
+    //两边都映射之后文件就不需要了
+    if(!shm_path.empty())
+    {
+        unlink(shm_path.c_str());
+        shm_path.clear();
+    }
+}
+
+void TikiFastTrace::reset()
+{
+    unlink_ring();
+    if(ring)
+    {
+        munmap(ring,ring_bytes);
+        ring=nullptr;
+    }
+    remote_ring=0;
+    tail=0;
+    regions.clear();
+    tracepoints.clear();
+}
+
+uint64_t TikiFastTrace::find_code_gap(pid_t pid,uint64_t near,size_t size)
+{
+    std::ifstream map("/proc/"+std::to_string(pid)+"/maps");
+    std::string line;
+    uint64_t prev_end=0x10000;      // mmap_min_addr
+    uint64_t best=0,best_dist=UINT64_MAX;
+    auto consider=[&](uint64_t lo,uint64_t hi){
+        if(hi<=lo || hi-lo<size) return;
+        //gap 中离 near 最近的位置
+        uint64_t cand= near<lo? lo : near+size>hi? hi-size : (near&~0xfffull);
+        if(cand<lo) cand=lo;
+        uint64_t dist= cand>near? cand+size-near : near-cand;
+        if(dist<static_cast<uint64_t>(code_reach) && dist<best_dist)
+        {
+            best=cand;
+            best_dist=dist;
+        }
+    };
+    while(std::getline(map,line))
+    {
+        auto dash=line.find('-');
+        if(dash==std::string::npos) continue;
+        auto start=std::stoull(line.substr(0,dash),0,16);
+        auto end=std::stoull(line.substr(dash+1),0,16);
+        consider(prev_end,start);
+        prev_end=std::max<uint64_t>(prev_end,end);
+    }
+    consider(prev_end,0x7ffffffff000ull);
+    return best;
+}
+
+uint64_t TikiFastTrace::alloc_code(uint64_t near,size_t size)
+{
+    for(auto& r:regions)
+    {
+        auto addr=r.addr+r.used;
+        if(r.used+size>r.size) continue;
+        auto lo=static_cast<int64_t>(addr-near);
+        auto hi=static_cast<int64_t>(addr+size-near);
+        if(std::abs(lo)<code_reach && std::abs(hi)<code_reach)
+        {
+            r.used+=size;
+            return addr;
+        }
+    }
+    return 0;
+}
+
+bool TikiFastTrace::build(csh handle,uint64_t addr,const uint8_t* code,size_t avail,uint64_t tramp,
+    std::vector<uint8_t>& out,size_t& patch_len,std::string& err)
+{
+    out.clear();
+    put_record_code(out,remote_ring,addr);
+
+    //搬走覆盖到的整条指令, 至少 5 字节
+    cs_insn* insn=cs_malloc(handle);
+    const uint8_t* p=code;
+    size_t left=avail;
+    uint64_t a=addr;
+    size_t off=0;
+    bool ok=true;
+    while(ok && off<5)
+    {
+        if(!cs_disasm_iter(handle,&p,&left,&a,insn))
+        {
+            err="cannot decode the instruction";
+            ok=false;
+            break;
+        }
+        auto from=addr+off;
+        auto to=tramp+out.size();
+        off+=insn->size;
+        auto& x86=insn->detail->x86;
+        bool jump=cs_insn_group(handle,insn,X86_GRP_JUMP);
+        bool call=cs_insn_group(handle,insn,X86_GRP_CALL);
+        bool other=cs_insn_group(handle,insn,X86_GRP_RET) || cs_insn_group(handle,insn,X86_GRP_INT)
+            || cs_insn_group(handle,insn,X86_GRP_IRET);
+        if((jump || call || other) && off<5)
+        {//跳转之后的字节可能是别处的跳转目标
+            err="control transfer inside the patched bytes";
+            ok=false;
+            break;
+        }
+        if((jump || call) && x86.op_count==1 && x86.operands[0].type==X86_OP_IMM)
+        {//相对跳转统一换成 rel32 形式
+            auto target=static_cast<uint64_t>(x86.operands[0].imm);
+            auto& b=insn->bytes;
+            auto n=insn->size;
+            size_t len=5;
+            if(call)
+            {
+                out.push_back(0xe8);
+            }
+            else if(insn->id==X86_INS_JMP)
+            {
+                out.push_back(0xe9);
+            }
+            else if(n>=6 && b[n-6]==0x0f && (b[n-5]&0xf0)==0x80)
+            {
+                out.insert(out.end(),{0x0f,static_cast<uint8_t>(b[n-5])});
+                len=6;
+            }
+            else if(n>=2 && (b[n-2]&0xf0)==0x70)
+            {
+                out.insert(out.end(),{0x0f,static_cast<uint8_t>(0x80|(b[n-2]&0xf))});
+                len=6;
+            }
+            else{
+                err="jrcxz/loop cannot be relocated";
+                ok=false;
+                break;
+            }
+            auto rel=static_cast<int64_t>(target-(to+len));
+            if(!fits_rel32(rel))
+            {
+                err="branch target out of range";
+                ok=false;
+                break;
+            }
+            put32(out,rel);
+            continue;
+        }
+        auto start=out.size();
+        out.insert(out.end(),insn->bytes,insn->bytes+insn->size);
+        for(int i=0;i<x86.op_count;i++)
+        {
+            if(x86.operands[i].type!=X86_OP_MEM || x86.operands[i].mem.base!=X86_REG_RIP) continue;
+            //rip 相对: capstone 给出编码里 disp32 的位置, 按新位置修正
+            auto disp=static_cast<int32_t>(x86.operands[i].mem.disp);
+            auto new_disp=static_cast<int64_t>(disp)+static_cast<int64_t>(from-to);
+            size_t pos=x86.encoding.disp_offset;
+            if(x86.encoding.disp_size!=4 || pos==0 || pos+4>insn->size || !fits_rel32(new_disp))
+            {
+                err="cannot relocate rip-relative operand";
+                ok=false;
+                break;
+            }
+            auto d32=static_cast<int32_t>(new_disp);
+            std::memcpy(out.data()+start+pos,&d32,4);
+        }
+    }
+    cs_free(insn,1);
+    if(!ok)
+    {
+        return false;
+    }
+
+    //跳回被覆盖的指令之后
+    auto rel=static_cast<int64_t>(addr+off-(tramp+out.size()+5));
+    if(!fits_rel32(rel) || out.size()+5>tramp_size)
+    {
+        err="trampoline out of range";
+        return false;
+    }
+    out.push_back(0xe9);
+    put32(out,rel);
+    patch_len=off;
+    return true;
+}
+
+uint64_t TikiFastTrace::drain(std::vector<fast_record>& out)
+{
+    if(!ring)
+    {
+        return 0;
+    }
+    auto hdr=reinterpret_cast<uint64_t*>(ring);
+    auto mask=hdr[1];
+    auto head=__atomic_load_n(&hdr[0],__ATOMIC_ACQUIRE);
+    uint64_t lost=0;
+    if(head-tail>mask+1)
+    {//写得比读得快, 最老的已经被覆盖
+        lost=head-tail-(mask+1);
+        tail=head-(mask+1);
+    }
+    auto recs=reinterpret_cast<fast_record*>(ring+ring_header);
+    auto first=out.size();
+    while(tail<head)
+    {
+        auto& r=recs[tail&mask];
+        auto a=__atomic_load_n(&r.addr,__ATOMIC_ACQUIRE);
+        if(a==0)
+        {//槽位已经分出去, 还没写完
+            break;
+        }
+        out.push_back({a,r.tsc,r.arg0,r.arg1});
+        __atomic_store_n(&r.addr,0,__ATOMIC_RELAXED);
+        ++tail;
+    }
+    for(auto i=first;i<out.size();i++)
+    {
+        auto it=tracepoints.find(out[i].addr);
+        if(it!=tracepoints.end()) ++it->second.hits;
+    }
+    return lost;
+}
+
+fast_tracepoint* TikiFastTrace::find(uint64_t addr)
+{
+    auto it=tracepoints.find(addr);
+    return it==tracepoints.end()? nullptr : &it->second;
+}
+
+fast_tracepoint* TikiFastTrace::find_overlap(uint64_t addr,size_t len)
+{
+    for(auto& t:tracepoints)
+    {
+        if(t.first<addr+len && addr<t.first+t.second.patch_len) return &t.second;
+    }
+    return nullptr;
+}
@@ -0,0 +1,89 @@
+#ifndef __TIKIFASTTRACE_H__
+#define __TIKIFASTTRACE_H__
+
+#include<iostream>
+#include<sys/types.h>
+#include<vector>
+#include<map>
+#include<string>
+#include<cstdint>
+#include<capstone/capstone.h>
+
+/*
+    ftrace-fast: 不用 int3, 把被跟踪地址的前几条指令换成 5 字节 jmp, 跳到被调试进程里的 trampoline:
+        保存 rax/rcx/rdx/rflags -> lock xadd 取一个槽位 -> 写记录 -> 恢复 -> 执行搬过来的原指令 -> jmp 回去
+    记录写在调试器和被调试进程共享的环形缓冲区 (/dev/shm) 里, 命中时没有任何上下文切换
+    调试器只负责读缓冲区
+
+    环形缓冲区: 64 字节头 {head, mask}, 之后是 fast_record 数组
+    写入方先写数据再写 addr, 读出方看到 addr==0 表示这个槽位还没写完
+*/
+struct fast_record {
+    uint64_t addr;
+    uint64_t tsc;
+    uint64_t arg0,arg1;     // rdi, rsi
+};
+
+struct fast_tracepoint {
+    uint64_t addr;
+    uint64_t tramp;
+    size_t patch_len;
+    uint8_t orig[16];       // 被 jmp 覆盖的原指令
+    uint64_t hits;          // 已经读出的记录数
+};
+
+class TikiFastTrace{
+    public:
+        TikiFastTrace()=default;
+        ~TikiFastTrace(){reset();}
+        TikiFastTrace(const TikiFastTrace&)=delete;
+        TikiFastTrace& operator=(const TikiFastTrace&)=delete;
+
+        // 调试器这边建共享内存并映射, 被调试进程随后 open 同一路径
+        bool create_ring(pid_t pid);
+        void attach_ring(uint64_t remote){remote_ring=remote;}
+        void unlink_ring();
+        // 进程没了 (exec, restart): 丢掉所有状态
+        void reset();
+
+        auto get_shm_path() const -> const std::string& {return shm_path;}
+        auto get_ring_bytes() const -> size_t {return ring_bytes;}
+        auto get_remote_ring() const -> uint64_t {return remote_ring;}
+
+        // 被调试进程里靠近 near 的空闲地址, 保证 trampoline 在 rel32 范围内
+        static uint64_t find_code_gap(pid_t pid,uint64_t near,size_t size);
+        void add_code_region(uint64_t addr,size_t size){regions.push_back({addr,size,0});}
+        uint64_t alloc_code(uint64_t near,size_t size);
+
+        // 生成 trampoline; 指令没法搬 (被覆盖的范围中间有跳转等) 时返回 false 并给出原因
+        bool build(csh handle,uint64_t addr,const uint8_t* code,size_t avail,uint64_t tramp,
+            std::vector<uint8_t>& out,size_t& patch_len,std::string& err);
+
+        // 取出所有写完的新记录, 返回被覆盖掉的条数
+        uint64_t drain(std::vector<fast_record>& out);
+
+        fast_tracepoint* find(uint64_t addr);
+        // 与 [addr, addr+len) 重叠的跟踪点
+        fast_tracepoint* find_overlap(uint64_t addr,size_t len);
+        void add(const fast_tracepoint& tp){tracepoints[tp.addr]=tp;}
+        void remove(uint64_t addr){tracepoints.erase(addr);}
+        auto get_tracepoints() -> std::map<uint64_t,fast_tracepoint>& {return tracepoints;}
+
+        static const size_t tramp_size=192;
+
+    private:
+        struct code_region {
+            uint64_t addr;
+            size_t size,used;
+        };
+
+        std::string shm_path;
+        uint8_t* ring=nullptr;
+        size_t ring_bytes=0;
+        uint64_t remote_ring=0;
+        uint64_t tail=0;
+        std::vector<code_region> regions;
+        std::map<uint64_t,fast_tracepoint> tracepoints;
+};
+
+#endif
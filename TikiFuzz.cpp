@@ -0,0 +1,191 @@
+#include"TikiFuzz.h"
+#include"TikiMem.h"
+#include<fstream>
+#include<sstream>
+#include<cstring>
+#include<climits>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/uio.h>
+
+static const uint64_t page_size=0x1000;
+static const uint64_t pm_soft_dirty=1ull<<55;
+
+bool TikiSnapshot::take(pid_t pid)
+{
+    clear();
+    s_pid=pid;
+    std::ifstream map("/proc/"+std::to_string(pid)+"/maps");
+    std::string line;
+    while(std::getline(map,line))
+    {
+        std::istringstream ls{line};
+        std::string addrs,perms;
+        ls >> addrs >> perms;
+        auto dash=addrs.find('-');
+        //只要私有可写的映射, 代码段和只读数据不会变
+        if(dash==std::string::npos || perms.size()<4 || perms[1]!='w' || perms[3]!='p') continue;
+        snap_range r{std::stoull(addrs.substr(0,dash),0,16),std::stoull(addrs.substr(dash+1),0,16),{}};
+        r.data.resize(r.end-r.start);
+        if(!read_remote(pid,r.start,r.data.data(),r.data.size()))
+        {//文件映射超出文件末尾的部分读不出来
+            continue;
+        }
+        n_pages+=r.data.size()/page_size;
+        ranges.push_back(std::move(r));
+    }
+    if(ranges.empty())
+    {
+        return false;
+    }
+    pagemap_fd=open(("/proc/"+std::to_string(pid)+"/pagemap").c_str(),O_RDONLY);
+    soft_dirty= pagemap_fd>=0 && clear_soft_dirty() && probe_soft_dirty();
+    return true;
+}
+
+void TikiSnapshot::clear()
+{
+    if(pagemap_fd>=0)
+    {
+        close(pagemap_fd);
+        pagemap_fd=-1;
+    }
+    ranges.clear();
+    n_pages=0;
+    soft_dirty=false;
+}
+
+bool TikiSnapshot::clear_soft_dirty()
+{
+    auto fd=open(("/proc/"+std::to_string(s_pid)+"/clear_refs").c_str(),O_WRONLY);
+    if(fd<0) return false;
+    auto n=write(fd,"4",1);
+    close(fd);
+    return n==1;
+}
+
+bool TikiSnapshot::probe_soft_dirty()
+{
+    //没开 CONFIG_MEM_SOFT_DIRTY 时 clear_refs 照样成功, pagemap 里这一位总是 0
+    //所以原样写回一个字节, 看那一页有没有被标记
+    auto addr=ranges.front().start;
+    if(!write_remote(s_pid,addr,ranges.front().data.data(),1))
+    {
+        return false;
+    }
+    uint64_t entry=0;
+    bool marked= pread(pagemap_fd,&entry,sizeof(entry),(addr/page_size)*sizeof(entry))==sizeof(entry)
+        && (entry&pm_soft_dirty);
+    return marked && clear_soft_dirty();
+}
+
+void TikiSnapshot::find_dirty(std::vector<std::pair<uint64_t,const uint8_t*>>& out)
+{
+    for(auto& r:ranges)
+    {
+        auto n=r.data.size()/page_size;
+        if(soft_dirty)
+        {
+            pagemap_buf.resize(n);
+            auto want=static_cast<ssize_t>(n*sizeof(uint64_t));
+            if(pread(pagemap_fd,pagemap_buf.data(),want,(r.start/page_size)*sizeof(uint64_t))!=want)
+            {//读不了就整段写回
+                pagemap_buf.assign(n,pm_soft_dirty);
+            }
+            for(size_t i=0;i<n;i++)
+            {
+                if(pagemap_buf[i]&pm_soft_dirty) out.push_back({r.start+i*page_size,r.data.data()+i*page_size});
+            }
+            continue;
+        }
+        //逐页比较: 读的量是整个快照, 写的量仍然只是改过的页
+        compare_buf.resize(r.data.size());
+        if(!read_remote(s_pid,r.start,compare_buf.data(),compare_buf.size()))
+        {
+            compare_buf.clear();
+        }
+        for(size_t i=0;i<n;i++)
+        {
+            auto off=i*page_size;
+            if(compare_buf.empty() || std::memcmp(compare_buf.data()+off,r.data.data()+off,page_size)!=0)
+            {
+                out.push_back({r.start+off,r.data.data()+off});
+            }
+        }
+    }
+}
+
+ssize_t TikiSnapshot::restore()
+{
+    std::vector<std::pair<uint64_t,const uint8_t*>> dirty;
+    find_dirty(dirty);
+
+    //相邻的页合并成一个 iovec, 每次系统调用最多 IOV_MAX 个
+    std::vector<iovec> local,remote;
+    for(auto& d:dirty)
+    {
+        if(!remote.empty() && reinterpret_cast<uint64_t>(remote.back().iov_base)+remote.back().iov_len==d.first
+            && static_cast<const uint8_t*>(local.back().iov_base)+local.back().iov_len==d.second)
+        {
+            remote.back().iov_len+=page_size;
+            local.back().iov_len+=page_size;
+            continue;
+        }
+        remote.push_back({reinterpret_cast<void*>(d.first),page_size});
+        local.push_back({const_cast<uint8_t*>(d.second),page_size});
+    }
+    bool ok=true;
+    for(size_t i=0;i<local.size();i+=IOV_MAX)
+    {
+        auto cnt=std::min<size_t>(IOV_MAX,local.size()-i);
+        size_t want=0;
+        for(size_t j=i;j<i+cnt;j++) want+=local[j].iov_len;
+        if(process_vm_writev(s_pid,&local[i],cnt,&remote[i],cnt,0)!=static_cast<ssize_t>(want))
+        {
+            ok=false;
+        }
+    }
+    //写回本身也会置 soft-dirty
+    if(soft_dirty && !clear_soft_dirty())
+    {
+        ok=false;
+    }
+    return ok? static_cast<ssize_t>(dirty.size()) : -1;
+}
+
+
+void TikiMutator::mutate(const std::vector<uint8_t>& seed,std::vector<uint8_t>& out)
+{
+    static const uint8_t interesting[]={0x00,0x01,0x7f,0x80,0xff,0x10,0x20,0x40,0x64};
+    out=seed;
+    if(out.empty()) return;
+    auto pick=[this](size_t n){return static_cast<size_t>(rng()%n);};
+    auto rounds=1+pick(8);
+    for(size_t r=0;r<rounds;r++)
+    {
+        auto pos=pick(out.size());
+        switch(pick(5))
+        {
+            case 0:
+                out[pos]^=1u<<pick(8);
+                break;
+            case 1:
+                out[pos]=static_cast<uint8_t>(rng());
+                break;
+            case 2:
+                out[pos]=interesting[pick(sizeof(interesting))];
+                break;
+            case 3:
+                out[pos]+=static_cast<uint8_t>(pick(35))-17;
+                break;
+            case 4:
+            {
+                auto len=1+pick(std::min<size_t>(out.size(),32));
+                auto from=pick(out.size()-len+1);
+                auto to=pick(out.size()-len+1);
+                std::memmove(out.data()+to,out.data()+from,len);
+                break;
+            }
+        }
+    }
+}
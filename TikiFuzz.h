@@ -0,0 +1,59 @@
+#ifndef __TIKIFUZZ_H__
+#define __TIKIFUZZ_H__
+
+#include<iostream>
+#include<sys/types.h>
+#include<vector>
+#include<random>
+#include<cstdint>
+
+/*
+    可写内存快照, 给 fuzz 循环反复回到起点用:
+        take 时把所有私有可写映射读一份, 再写 /proc/pid/clear_refs 清掉 soft-dirty 位
+        restore 时从 /proc/pid/pagemap 找出置了 soft-dirty 的页, 只把这些页用 process_vm_writev 写回
+    内核没有 CONFIG_MEM_SOFT_DIRTY 时退化为整块读回来逐页比较, 仍然只写回改过的页
+    快照之后新建的映射 (mmap, brk 扩展的部分) 不恢复
+*/
+class TikiSnapshot{
+    public:
+        TikiSnapshot()=default;
+        ~TikiSnapshot(){clear();}
+
+        bool take(pid_t pid);
+        // 写回改过的页, 返回页数; 失败返回 -1
+        ssize_t restore();
+        void clear();
+
+        auto has_soft_dirty() const -> bool {return soft_dirty;}
+        auto get_pages() const -> size_t {return n_pages;}
+
+    private:
+        struct snap_range {
+            uint64_t start,end;
+            std::vector<uint8_t> data;
+        };
+
+        bool clear_soft_dirty();
+        bool probe_soft_dirty();
+        void find_dirty(std::vector<std::pair<uint64_t,const uint8_t*>>& out);
+
+        pid_t s_pid=0;
+        int pagemap_fd=-1;
+        bool soft_dirty=false;
+        size_t n_pages=0;
+        std::vector<snap_range> ranges;
+        std::vector<uint64_t> pagemap_buf;
+        std::vector<uint8_t> compare_buf;
+};
+
+// 简单的随机变异 (翻转位, 替换字节, 边界值, 小幅加减, 块复制)
+class TikiMutator{
+    public:
+        TikiMutator(uint64_t seed):rng{seed}{};
+        void mutate(const std::vector<uint8_t>& seed,std::vector<uint8_t>& out);
+
+    private:
+        std::mt19937_64 rng;
+};
+
+#endif
@@ -0,0 +1,532 @@
+#include"TikiGdbServer.h"
+#include<cstring>
+#include<charconv>
+#include<cerrno>
+#include<unistd.h>
+#include<poll.h>
+#include<csignal>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<netinet/in.h>
+#include<netinet/tcp.h>
+#include<arpa/inet.h>
+
+bool TikiRspConnection::listen(const std::string& spec)
+{
+    close();
+    if(spec.compare(0,5,"unix:")==0)
+    {
+        sockaddr_un addr{};
+        addr.sun_family=AF_UNIX;
+        unix_path=spec.substr(5);
+        if(unix_path.empty() || unix_path.size()>=sizeof(addr.sun_path))
+        {
+            return false;
+        }
+        std::strcpy(addr.sun_path,unix_path.c_str());
+        unlink(unix_path.c_str());
+        listen_fd=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+        if(listen_fd<0 || bind(listen_fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr))<0)
+        {
+            close();
+            return false;
+        }
+    }
+    else{
+        auto colon=spec.rfind(':');
+        if(colon==std::string::npos)
+        {
+            return false;
+        }
+        sockaddr_in addr{};
+        addr.sin_family=AF_INET;
+        addr.sin_port=htons(std::stoi(spec.substr(colon+1)));
+        addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+        listen_fd=socket(AF_INET,SOCK_STREAM|SOCK_CLOEXEC,0);
+        int one=1;
+        if(listen_fd>=0) setsockopt(listen_fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+        if(listen_fd<0 || bind(listen_fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr))<0)
+        {
+            close();
+            return false;
+        }
+    }
+    if(::listen(listen_fd,1)<0)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool TikiRspConnection::accept()
+{
+    fd=::accept4(listen_fd,nullptr,nullptr,SOCK_CLOEXEC);
+    if(fd<0)
+    {
+        return false;
+    }
+    //小包一问一答, 不能等 Nagle
+    int one=1;
+    setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    return true;
+}
+
+void TikiRspConnection::close()
+{
+    if(fd>=0) ::close(fd);
+    if(listen_fd>=0) ::close(listen_fd);
+    fd=listen_fd=-1;
+    if(!unix_path.empty())
+    {
+        unlink(unix_path.c_str());
+        unix_path.clear();
+    }
+}
+
+bool TikiRspConnection::fill()
+{
+    char buf[0x10000];
+    ssize_t n;
+    while((n=read(fd,buf,sizeof(buf)))<0 && errno==EINTR);
+    if(n<=0)
+    {
+        return false;
+    }
+    in.append(buf,n);
+    return true;
+}
+
+bool TikiRspConnection::next_packet(std::string& payload,bool& interrupt)
+{
+    interrupt=false;
+    while(!in.empty())
+    {
+        auto c=in[0];
+        if(c=='\x03')
+        {
+            in.erase(0,1);
+            interrupt=true;
+            return true;
+        }
+        if(c=='-' && !no_ack)
+        {
+            in.erase(0,1);
+            out+=last_sent;
+            continue;
+        }
+        if(c!='$')
+        {//'+' 和噪声
+            in.erase(0,1);
+            continue;
+        }
+        auto hash=in.find('#');
+        if(hash==std::string::npos || hash+3>in.size())
+        {//包还没收完
+            return false;
+        }
+        payload=in.substr(1,hash-1);
+        unsigned sum=0;
+        for(auto ch:payload) sum+=static_cast<uint8_t>(ch);
+        auto cs=std::strtoul(in.substr(hash+1,2).c_str(),nullptr,16);
+        in.erase(0,hash+3);
+        if(no_ack)
+        {
+            return true;
+        }
+        if((sum&0xff)!=cs)
+        {
+            out+='-';
+            continue;
+        }
+        out+='+';
+        return true;
+    }
+    return false;
+}
+
+bool TikiRspConnection::take_interrupt()
+{
+    bool interrupt=false;
+    size_t keep=0;
+    while(keep<in.size() && in[keep]!='$')
+    {
+        if(in[keep]=='\x03') interrupt=true;
+        ++keep;
+    }
+    //后面的完整包留到停下之后再处理
+    in.erase(0,keep);
+    return interrupt;
+}
+
+bool TikiRspConnection::poll_interrupt()
+{
+    pollfd p{fd,POLLIN,0};
+    if(poll(&p,1,0)<=0)
+    {
+        return false;
+    }
+    return !fill() || take_interrupt();
+}
+
+void TikiRspConnection::send(const std::string& payload)
+{
+    static const char digits[]="0123456789abcdef";
+    unsigned sum=0;
+    for(auto ch:payload) sum+=static_cast<uint8_t>(ch);
+    std::string pkt;
+    pkt.reserve(payload.size()+4);
+    pkt+='$';
+    pkt+=payload;
+    pkt+='#';
+    pkt+=digits[(sum>>4)&0xf];
+    pkt+=digits[sum&0xf];
+    out+=pkt;
+    if(!no_ack) last_sent=std::move(pkt);
+}
+
+bool TikiRspConnection::flush()
+{
+    size_t done=0;
+    while(done<out.size())
+    {
+        auto n=write(fd,out.data()+done,out.size()-done);
+        if(n<0 && errno==EINTR) continue;
+        if(n<=0)
+        {
+            out.clear();
+            return false;
+        }
+        done+=n;
+    }
+    out.clear();
+    return true;
+}
+
+std::string rsp_hex(const void* data,size_t len)
+{
+    static const char digits[]="0123456789abcdef";
+    auto p=static_cast<const uint8_t*>(data);
+    std::string s(len*2,'0');
+    for(size_t i=0;i<len;i++)
+    {
+        s[i*2]=digits[p[i]>>4];
+        s[i*2+1]=digits[p[i]&0xf];
+    }
+    return s;
+}
+
+std::string rsp_hex_number(uint64_t v)
+{
+    static const char digits[]="0123456789abcdef";
+    char buf[16];
+    int n=16;
+    do{
+        buf[--n]=digits[v&0xf];
+        v>>=4;
+    }while(v);
+    return std::string(buf+n,16-n);
+}
+
+// gdb 编号 -> Linux 编号, 下标是 gdb 编号, 0 表示没有对应
+static const int gdb_to_host[]={
+    0,SIGHUP,SIGINT,SIGQUIT,SIGILL,SIGTRAP,SIGABRT,0,SIGFPE,SIGKILL,                // 0-9
+    SIGBUS,SIGSEGV,SIGSYS,SIGPIPE,SIGALRM,SIGTERM,SIGURG,SIGSTOP,SIGTSTP,SIGCONT,   // 10-19
+    SIGCHLD,SIGTTIN,SIGTTOU,SIGIO,SIGXCPU,SIGXFSZ,SIGVTALRM,SIGPROF,SIGWINCH,0,     // 20-29
+    SIGUSR1,SIGUSR2,SIGPWR,                                                         // 30-32
+};
+
+int gdb_signal_from_host(int sig)
+{
+    //实时信号: 32 -> 77, 33..63 -> 45..75, 64 及以上 -> 78..
+    if(sig==32) return 77;
+    if(sig>=33 && sig<=63) return sig-33+45;
+    if(sig>=64) return sig-64+78;
+    for(int i=1;i<static_cast<int>(sizeof(gdb_to_host)/sizeof(gdb_to_host[0]));i++)
+    {
+        if(gdb_to_host[i]==sig) return i;
+    }
+    return 143;     // GDB_SIGNAL_UNKNOWN
+}
+
+int gdb_signal_to_host(int gdb_sig)
+{
+    if(gdb_sig>0 && gdb_sig<static_cast<int>(sizeof(gdb_to_host)/sizeof(gdb_to_host[0]))) return gdb_to_host[gdb_sig];
+    if(gdb_sig==77) return 32;
+    if(gdb_sig>=45 && gdb_sig<=75) return gdb_sig-45+33;
+    if(gdb_sig>=78 && gdb_sig<=108) return gdb_sig-78+64;
+    return 0;
+}
+
+static int hex_value(char c)
+{
+    if(c>='0' && c<='9') return c-'0';
+    if(c>='a' && c<='f') return c-'a'+10;
+    if(c>='A' && c<='F') return c-'A'+10;
+    return -1;
+}
+
+bool rsp_parse_number(std::string_view s,uint64_t& v,size_t* used)
+{
+    auto r=std::from_chars(s.data(),s.data()+s.size(),v,16);
+    if(r.ec!=std::errc{}) return false;
+    size_t n=r.ptr-s.data();
+    if(used)
+    {
+        *used=n;
+        return true;
+    }
+    return n==s.size();
+}
+
+bool rsp_parse_thread(std::string_view s,pid_t& tid)
+{
+    if(s=="-1")
+    {
+        tid=-1;
+        return true;
+    }
+    uint64_t v;
+    if(!rsp_parse_number(s,v) || v>INT32_MAX) return false;
+    tid=static_cast<pid_t>(v);
+    return true;
+}
+
+bool rsp_unhex(const std::string& hex,std::vector<uint8_t>& out)
+{
+    if(hex.size()%2)
+    {
+        return false;
+    }
+    out.resize(hex.size()/2);
+    for(size_t i=0;i<out.size();i++)
+    {
+        auto hi=hex_value(hex[i*2]),lo=hex_value(hex[i*2+1]);
+        if(hi<0 || lo<0) return false;
+        out[i]=static_cast<uint8_t>(hi<<4|lo);
+    }
+    return true;
+}
+
+std::string rsp_escape(const std::string& data)
+{
+    std::string s;
+    s.reserve(data.size());
+    for(auto c:data)
+    {
+        if(c=='#' || c=='$' || c=='}' || c=='*')
+        {
+            s+='}';
+            s+=static_cast<char>(c^0x20);
+        }
+        else{
+            s+=c;
+        }
+    }
+    return s;
+}
+
+std::string rsp_unescape(const std::string& data)
+{
+    std::string s;
+    s.reserve(data.size());
+    for(size_t i=0;i<data.size();i++)
+    {
+        if(data[i]=='}' && i+1<data.size())
+        {
+            s+=static_cast<char>(data[++i]^0x20);
+        }
+        else{
+            s+=data[i];
+        }
+    }
+    return s;
+}
+
+const char* rsp_target_xml()
+{
+    //只有 gdb 校验的三个 feature, 寄存器名和编号决定 g 包的布局
+    return "<?xml version=\"1.0\"?>"
+        "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+        "<target version=\"1.0\">"
+        "<architecture>i386:x86-64</architecture>"
+        "<osabi>GNU/Linux</osabi>"
+        "<feature name=\"org.gnu.gdb.i386.core\">"
+        "<reg name=\"rax\" bitsize=\"64\" type=\"int64\" regnum=\"0\"/>"
+        "<reg name=\"rbx\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"rcx\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"rdx\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"rsi\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"rdi\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"rbp\" bitsize=\"64\" type=\"data_ptr\"/>"
+        "<reg name=\"rsp\" bitsize=\"64\" type=\"data_ptr\"/>"
+        "<reg name=\"r8\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"r9\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"r10\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"r11\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"r12\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"r13\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"r14\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"r15\" bitsize=\"64\" type=\"int64\"/>"
+        "<reg name=\"rip\" bitsize=\"64\" type=\"code_ptr\"/>"
+        "<reg name=\"eflags\" bitsize=\"32\" type=\"int32\"/>"
+        "<reg name=\"cs\" bitsize=\"32\" type=\"int32\"/>"
+        "<reg name=\"ss\" bitsize=\"32\" type=\"int32\"/>"
+        "<reg name=\"ds\" bitsize=\"32\" type=\"int32\"/>"
+        "<reg name=\"es\" bitsize=\"32\" type=\"int32\"/>"
+        "<reg name=\"fs\" bitsize=\"32\" type=\"int32\"/>"
+        "<reg name=\"gs\" bitsize=\"32\" type=\"int32\"/>"
+        "<reg name=\"st0\" bitsize=\"80\" type=\"i387_ext\"/>"
+        "<reg name=\"st1\" bitsize=\"80\" type=\"i387_ext\"/>"
+        "<reg name=\"st2\" bitsize=\"80\" type=\"i387_ext\"/>"
+        "<reg name=\"st3\" bitsize=\"80\" type=\"i387_ext\"/>"
+        "<reg name=\"st4\" bitsize=\"80\" type=\"i387_ext\"/>"
+        "<reg name=\"st5\" bitsize=\"80\" type=\"i387_ext\"/>"
+        "<reg name=\"st6\" bitsize=\"80\" type=\"i387_ext\"/>"
+        "<reg name=\"st7\" bitsize=\"80\" type=\"i387_ext\"/>"
+        "<reg name=\"fctrl\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+        "<reg name=\"fstat\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+        "<reg name=\"ftag\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+        "<reg name=\"fiseg\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+        "<reg name=\"fioff\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+        "<reg name=\"foseg\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+        "<reg name=\"fooff\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+        "<reg name=\"fop\" bitsize=\"32\" type=\"int\" group=\"float\"/>"
+        "</feature>"
+        "<feature name=\"org.gnu.gdb.i386.sse\">"
+        "<vector id=\"v4f\" type=\"ieee_single\" count=\"4\"/>"
+        "<vector id=\"v2d\" type=\"ieee_double\" count=\"2\"/>"
+        "<vector id=\"v16i8\" type=\"int8\" count=\"16\"/>"
+        "<vector id=\"v8i16\" type=\"int16\" count=\"8\"/>"
+        "<vector id=\"v4i32\" type=\"int32\" count=\"4\"/>"
+        "<vector id=\"v2i64\" type=\"int64\" count=\"2\"/>"
+        "<union id=\"vec128\">"
+        "<field name=\"v4_float\" type=\"v4f\"/><field name=\"v2_double\" type=\"v2d\"/>"
+        "<field name=\"v16_int8\" type=\"v16i8\"/><field name=\"v8_int16\" type=\"v8i16\"/>"
+        "<field name=\"v4_int32\" type=\"v4i32\"/><field name=\"v2_int64\" type=\"v2i64\"/>"
+        "<field name=\"uint128\" type=\"uint128\"/>"
+        "</union>"
+        "<reg name=\"xmm0\" bitsize=\"128\" type=\"vec128\" regnum=\"40\"/>"
+        "<reg name=\"xmm1\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm2\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm3\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm4\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm5\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm6\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm7\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm8\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm9\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm10\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm11\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm12\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm13\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm14\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"xmm15\" bitsize=\"128\" type=\"vec128\"/>"
+        "<reg name=\"mxcsr\" bitsize=\"32\" type=\"int\" group=\"vector\"/>"
+        "</feature>"
+        "<feature name=\"org.gnu.gdb.i386.linux\">"
+        "<reg name=\"orig_rax\" bitsize=\"64\" type=\"int\" regnum=\"57\"/>"
+        "</feature>"
+        "</target>";
+}
+
+// 0-15 通用寄存器在 user_regs_struct 里的位置
+static unsigned long long user_regs_struct::* const gpr_order[]={
+    &user_regs_struct::rax,&user_regs_struct::rbx,&user_regs_struct::rcx,&user_regs_struct::rdx,
+    &user_regs_struct::rsi,&user_regs_struct::rdi,&user_regs_struct::rbp,&user_regs_struct::rsp,
+    &user_regs_struct::r8,&user_regs_struct::r9,&user_regs_struct::r10,&user_regs_struct::r11,
+    &user_regs_struct::r12,&user_regs_struct::r13,&user_regs_struct::r14,&user_regs_struct::r15};
+static unsigned long long user_regs_struct::* const seg_order[]={
+    &user_regs_struct::cs,&user_regs_struct::ss,&user_regs_struct::ds,
+    &user_regs_struct::es,&user_regs_struct::fs,&user_regs_struct::gs};
+
+int rsp_register_count()
+{
+    return 58;
+}
+
+size_t rsp_register_size(int num)
+{
+    if(num<17 || num==57) return 8;
+    if(num>=24 && num<32) return 10;
+    if(num>=40 && num<56) return 16;
+    return 4;
+}
+
+size_t rsp_register_offset(int num)
+{
+    size_t off=0;
+    for(int i=0;i<num;i++) off+=rsp_register_size(i);
+    return off;
+}
+
+std::vector<uint8_t> rsp_pack_registers(const user_regs_struct& regs,const user_fpregs_struct& fpregs)
+{
+    std::vector<uint8_t> img(rsp_register_offset(rsp_register_count()));
+    auto p=img.data();
+    auto put=[&p](const void* v,size_t n){std::memcpy(p,v,n);p+=n;};
+    for(auto r:gpr_order) put(&(regs.*r),8);
+    put(&regs.rip,8);
+    put(&regs.eflags,4);
+    for(auto r:seg_order) put(&(regs.*r),4);
+    for(int i=0;i<8;i++) put(reinterpret_cast<const uint8_t*>(fpregs.st_space)+i*16,10);
+    //fxsave 里是简化的标记字 (每个寄存器一位), 展开成 2 位: 有值记为 valid, 否则 empty
+    uint32_t ftag=0;
+    for(int i=0;i<8;i++)
+    {
+        if(!(fpregs.ftw&(1u<<i))) ftag|=3u<<(i*2);
+    }
+    uint32_t x87[8]={fpregs.cwd,fpregs.swd,ftag,static_cast<uint32_t>((fpregs.rip>>32)&0xffff),
+        static_cast<uint32_t>(fpregs.rip),static_cast<uint32_t>((fpregs.rdp>>32)&0xffff),
+        static_cast<uint32_t>(fpregs.rdp),fpregs.fop};
+    put(x87,sizeof(x87));
+    put(fpregs.xmm_space,256);
+    put(&fpregs.mxcsr,4);
+    put(&regs.orig_rax,8);
+    return img;
+}
+
+void rsp_unpack_registers(const std::vector<uint8_t>& image,user_regs_struct& regs,user_fpregs_struct& fpregs)
+{
+    auto p=image.data();
+    auto end=p+image.size();
+    //G 包可以比完整的短, 只改给出的部分
+    auto get=[&p,end](void* v,size_t n){
+        if(p+n>end) return false;
+        std::memcpy(v,p,n);
+        p+=n;
+        return true;
+    };
+    for(auto r:gpr_order)
+    {
+        if(!get(&(regs.*r),8)) return;
+    }
+    if(!get(&regs.rip,8)) return;
+    uint32_t v32;
+    if(!get(&v32,4)) return;
+    regs.eflags=v32;
+    for(auto r:seg_order)
+    {
+        if(!get(&v32,4)) return;
+        regs.*r=v32;
+    }
+    for(int i=0;i<8;i++)
+    {
+        if(!get(reinterpret_cast<uint8_t*>(fpregs.st_space)+i*16,10)) return;
+    }
+    uint32_t x87[8];
+    if(!get(x87,sizeof(x87))) return;
+    fpregs.cwd=x87[0];
+    fpregs.swd=x87[1];
+    fpregs.ftw=0;
+    for(int i=0;i<8;i++)
+    {
+        if(((x87[2]>>(i*2))&3)!=3) fpregs.ftw|=1u<<i;
+    }
+    fpregs.rip=(static_cast<uint64_t>(x87[3])<<32)|x87[4];
+    fpregs.rdp=(static_cast<uint64_t>(x87[5])<<32)|x87[6];
+    fpregs.fop=x87[7];
+    if(!get(fpregs.xmm_space,256)) return;
+    if(!get(&fpregs.mxcsr,4)) return;
+    get(&regs.orig_rax,8);
+}
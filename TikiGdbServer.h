@@ -0,0 +1,87 @@
+#ifndef __TIKIGDBSERVER_H__
+#define __TIKIGDBSERVER_H__
+
+#include<iostream>
+#include<sys/types.h>
+#include<sys/user.h>
+#include<cstdint>
+#include<string>
+#include<string_view>
+#include<vector>
+
+/*
+    --gdbserver: GDB 远程串行协议 (RSP) 的传输层和寄存器编码, 命令本身在 TikiDbg::serve_gdb 里处理
+    包格式 $payload#cs, cs 是 payload 字节和的低 8 位; 单独的 0x03 是中断
+    QStartNoAckMode 之后双方都不再发送 +/-
+    读到的数据可能含有多个包, 全部处理完再一次写回所有回复
+*/
+class TikiRspConnection{
+    public:
+        TikiRspConnection()=default;
+        ~TikiRspConnection(){close();}
+        TikiRspConnection(const TikiRspConnection&)=delete;
+        TikiRspConnection& operator=(const TikiRspConnection&)=delete;
+
+        // "unix:/path" 或 ":PORT" (只监听 127.0.0.1)
+        bool listen(const std::string& spec);
+        bool accept();
+        void close();
+        auto get_fd() const -> int {return fd;}
+
+        // 读一次 socket 追加到输入缓冲区, 对方断开返回 false
+        bool fill();
+        // 取出下一个完整的包; 中断字节单独报告
+        bool next_packet(std::string& payload,bool& interrupt);
+        auto has_input() const -> bool {return !in.empty();}
+        // 运行期间 gdb 只会发 0x03 (和 ack), 取走它们; 收到中断返回 true
+        bool take_interrupt();
+        // 不阻塞地看一眼 socket, 断开也当作中断
+        bool poll_interrupt();
+
+        // 回复先放进输出缓冲区, flush 时一次写出
+        void send(const std::string& payload);
+        bool flush();
+        void set_no_ack(){no_ack=true;}
+
+    private:
+        int listen_fd=-1;
+        int fd=-1;
+        std::string unix_path;
+        std::string in;
+        std::string out;
+        std::string last_sent;      // 收到 '-' 时重发
+        bool no_ack=false;
+};
+
+std::string rsp_hex(const void* data,size_t len);
+// 线程号, 地址: 不补零的大端十六进制
+std::string rsp_hex_number(uint64_t v);
+// 失败 (长度为奇数, 非十六进制字符) 返回 false
+bool rsp_unhex(const std::string& hex,std::vector<uint8_t>& out);
+// 包里的十六进制数; used 为空时整个 s 都必须是数字, 否则写入用掉的字符数; 没有数字或溢出返回 false
+bool rsp_parse_number(std::string_view s,uint64_t& v,size_t* used=nullptr);
+// 线程号: 十六进制, 或者 -1 (全部线程)
+bool rsp_parse_thread(std::string_view s,pid_t& tid);
+// 二进制数据中的 # $ } * 写成 } 加上异或 0x20
+std::string rsp_escape(const std::string& data);
+std::string rsp_unescape(const std::string& data);
+
+// 协议里的信号编号是 gdb 自己的 (GDB_SIGNAL_*), 只有前 15 个和 Linux 一样
+int gdb_signal_from_host(int sig);
+int gdb_signal_to_host(int gdb_sig);
+
+/*
+    寄存器按 target.xml 的顺序排列:
+        0-15 rax rbx rcx rdx rsi rdi rbp rsp r8-r15    16 rip    17 eflags    18-23 cs ss ds es fs gs
+        24-31 st0-st7 (10 字节)    32-39 fctrl fstat ftag fiseg fioff foseg fooff fop
+        40-55 xmm0-xmm15    56 mxcsr    57 orig_rax
+*/
+const char* rsp_target_xml();
+int rsp_register_count();
+// 单个寄存器在 g 包里的字节偏移和长度
+size_t rsp_register_offset(int num);
+size_t rsp_register_size(int num);
+std::vector<uint8_t> rsp_pack_registers(const user_regs_struct& regs,const user_fpregs_struct& fpregs);
+void rsp_unpack_registers(const std::vector<uint8_t>& image,user_regs_struct& regs,user_fpregs_struct& fpregs);
+
+#endif
@@ -0,0 +1,215 @@
+#include"TikiJson.h"
+#include<charconv>
+#include<algorithm>
+#include<cstring>
+#include<cerrno>
+#include<unistd.h>
+
+static const size_t json_flush_size=1<<16;
+
+char* TikiJsonWriter::reserve(size_t n)
+{
+    if(len+n>buf.size())
+    {
+        buf.resize(std::max(buf.size()*2,len+n+json_flush_size));
+    }
+    return buf.data()+len;
+}
+
+void TikiJsonWriter::put(std::string_view s)
+{
+    std::memcpy(reserve(s.size()),s.data(),s.size());
+    len+=s.size();
+}
+
+void TikiJsonWriter::put_key(const char* key)
+{
+    //前一个元素之后加逗号
+    if(len>0 && buf[len-1]!='{' && buf[len-1]!='[') put(",");
+    if(key)
+    {
+        auto p=reserve(std::strlen(key)+3);
+        *p++='"';
+        auto n=std::strlen(key);
+        std::memcpy(p,key,n);
+        p+=n;
+        *p++='"';
+        *p++=':';
+        len=p-buf.data();
+    }
+}
+
+TikiJsonWriter& TikiJsonWriter::begin(const char* type)
+{
+    put("{\"type\":\"");
+    put(type);
+    put("\"");
+    return *this;
+}
+
+void TikiJsonWriter::end()
+{
+    put("}\n");
+    ++lines;
+    if(len>=json_flush_size) flush();
+}
+
+TikiJsonWriter& TikiJsonWriter::num(const char* key,int64_t v)
+{
+    put_key(key);
+    auto p=reserve(24);
+    len=std::to_chars(p,p+24,v).ptr-buf.data();
+    return *this;
+}
+
+TikiJsonWriter& TikiJsonWriter::hex(const char* key,uint64_t v)
+{
+    put_key(key);
+    auto p=reserve(24);
+    *p++='"';
+    *p++='0';
+    *p++='x';
+    p=std::to_chars(p,p+16,v,16).ptr;
+    *p++='"';
+    len=p-buf.data();
+    return *this;
+}
+
+TikiJsonWriter& TikiJsonWriter::str(const char* key,std::string_view v)
+{
+    static const char digits[]="0123456789abcdef";
+    put_key(key);
+    //最坏每个字节变成 \u00XX
+    auto p=reserve(v.size()*6+2);
+    *p++='"';
+    for(auto ch:v)
+    {
+        auto c=static_cast<unsigned char>(ch);
+        if(c=='"' || c=='\\')
+        {
+            *p++='\\';
+            *p++=ch;
+        }
+        else if(c>=0x20)
+        {
+            *p++=ch;
+        }
+        else if(c=='\n')
+        {
+            *p++='\\';
+            *p++='n';
+        }
+        else if(c=='\t')
+        {
+            *p++='\\';
+            *p++='t';
+        }
+        else{
+            std::memcpy(p,"\\u00",4);
+            p+=4;
+            *p++=digits[c>>4];
+            *p++=digits[c&0xf];
+        }
+    }
+    *p++='"';
+    len=p-buf.data();
+    return *this;
+}
+
+TikiJsonWriter& TikiJsonWriter::open_object(const char* key)
+{
+    put_key(key);
+    put("{");
+    return *this;
+}
+
+TikiJsonWriter& TikiJsonWriter::close_object()
+{
+    put("}");
+    return *this;
+}
+
+TikiJsonWriter& TikiJsonWriter::open_array(const char* key)
+{
+    put_key(key);
+    put("[");
+    return *this;
+}
+
+TikiJsonWriter& TikiJsonWriter::close_array()
+{
+    put("]");
+    return *this;
+}
+
+bool TikiJsonWriter::flush()
+{
+    size_t done=0;
+    bool ok=true;
+    while(done<len)
+    {
+        auto n=write(fd,buf.data()+done,len-done);
+        if(n<0 && errno==EINTR) continue;
+        if(n<=0)
+        {
+            ok=false;
+            break;
+        }
+        done+=n;
+    }
+    len=0;
+    return ok;
+}
+
+
+TikiJsonConsole::~TikiJsonConsole()
+{
+    //没有换行结尾的最后一段
+    if(!line.empty()) writer.begin(kind).str("text",line).end();
+}
+
+TikiJsonConsole::int_type TikiJsonConsole::overflow(int_type c)
+{
+    if(traits_type::eq_int_type(c,traits_type::eof()))
+    {
+        return traits_type::not_eof(c);
+    }
+    auto ch=traits_type::to_char_type(c);
+    if(ch=='\n')
+    {
+        writer.begin(kind).str("text",line).end();
+        line.clear();
+    }
+    else{
+        line+=ch;
+    }
+    return c;
+}
+
+std::streamsize TikiJsonConsole::xsputn(const char* s,std::streamsize n)
+{
+    std::string_view text{s,static_cast<size_t>(n)};
+    size_t nl;
+    while((nl=text.find('\n'))!=std::string_view::npos)
+    {
+        line.append(text.substr(0,nl));
+        writer.begin(kind).str("text",line).end();
+        line.clear();
+        text.remove_prefix(nl+1);
+    }
+    line.append(text);
+    return n;
+}
+
+
+TikiJsonStreams::TikiJsonStreams(TikiJsonWriter& w): out{w,"console"},err{w,"error"}
+{
+    old_out=std::cout.rdbuf(&out);
+    old_err=std::cerr.rdbuf(&err);
+}
+
+TikiJsonStreams::~TikiJsonStreams()
+{
+    std::cout.rdbuf(old_out);
+    std::cerr.rdbuf(old_err);
+}
@@ -0,0 +1,99 @@
+#ifndef __TIKIJSON_H__
+#define __TIKIJSON_H__
+
+#include<iostream>
+#include<streambuf>
+#include<string>
+#include<string_view>
+#include<vector>
+#include<cstdint>
+
+/*
+    --interpreter=json: 标准输出的每一行都是一个 JSON 对象, 第一个字段总是 "type"
+    地址和寄存器的值是 "0x..." 字符串 (64 位整数在很多解析器里会丢精度), 计数是数字
+
+    {"type":"stop","reason":R,"thread":N,"tid":N,"pc":"0x.."  ...}
+        R = "breakpoint"  "addr","symbol"(可选),"file","line"(可选)
+            "step"
+            "syscall"     "call":"open(\"/etc/passwd\", 0x0)"
+            "watch"       "num","addr","write_pc","old","new"      (watch 命令的 perf 断点没有 write_pc)
+            "signal"      "signal":"SIGSEGV","desc","code"
+            "interrupt"
+    {"type":"exit","pid":N,"code":N}  或  {"type":"exit","pid":N,"signal":"SIGKILL"}
+    {"type":"registers","thread":N,"values":{"rax":"0x..",...}}        顺序同 register 命令
+    {"type":"memory","addr":"0x..","value":"0x.."}                     8 字节
+    {"type":"counters","task-clock":N,"page-faults":N,...}            set counters on 时, 命令执行期间的计数
+    {"type":"disassembly","insns":[{"addr":"0x..","size":N,"mnemonic":"..","operands":".."},...]}
+    {"type":"bench","name":..,"program":..,"ops":N,"ns":N,"ns_per_op":N,...}   bench 命令的结果, 字段见 TikiBench.h
+    {"type":"console","text":".."}      其他人类可读的输出, 一行一个
+    {"type":"error","text":".."}        原来写到 stderr 的内容
+
+    字符串里 " \ 和控制字符按 JSON 转义, 其他字节原样输出
+    输出先放在缓冲区里, 读下一条命令之前, 后台事件处理完以及超过 64KB 时写出
+*/
+class TikiJsonWriter{
+    public:
+        explicit TikiJsonWriter(int fd=1): fd{fd}{}
+        ~TikiJsonWriter(){flush();}
+        TikiJsonWriter(const TikiJsonWriter&)=delete;
+        TikiJsonWriter& operator=(const TikiJsonWriter&)=delete;
+
+        // {"type":TYPE 开始一行, end() 结束
+        TikiJsonWriter& begin(const char* type);
+        void end();
+
+        // key 都是代码里的常量, 不转义; 在数组里 key 传 nullptr
+        TikiJsonWriter& num(const char* key,int64_t v);
+        TikiJsonWriter& hex(const char* key,uint64_t v);
+        TikiJsonWriter& str(const char* key,std::string_view v);
+        TikiJsonWriter& open_object(const char* key);
+        TikiJsonWriter& close_object();
+        TikiJsonWriter& open_array(const char* key);
+        TikiJsonWriter& close_array();
+
+        bool flush();
+        auto get_lines() const -> uint64_t {return lines;}
+
+    private:
+        // 保证末尾还有 n 字节可写, 返回写入位置
+        char* reserve(size_t n);
+        void put(std::string_view s);
+        void put_key(const char* key);
+
+        int fd;
+        std::vector<char> buf;
+        size_t len=0;
+        uint64_t lines=0;
+};
+
+// 把写进来的文本按行包成 {"type":KIND,"text":..}
+class TikiJsonConsole: public std::streambuf{
+    public:
+        TikiJsonConsole(TikiJsonWriter& w,const char* kind): writer{w},kind{kind}{}
+        ~TikiJsonConsole() override;
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* s,std::streamsize n) override;
+
+    private:
+        TikiJsonWriter& writer;
+        const char* kind;
+        std::string line;
+};
+
+// 构造时把 std::cout/std::cerr 换成 console/error 记录, 析构时换回来
+class TikiJsonStreams{
+    public:
+        explicit TikiJsonStreams(TikiJsonWriter& w);
+        ~TikiJsonStreams();
+        TikiJsonStreams(const TikiJsonStreams&)=delete;
+        TikiJsonStreams& operator=(const TikiJsonStreams&)=delete;
+
+    private:
+        TikiJsonConsole out,err;
+        std::streambuf* old_out;
+        std::streambuf* old_err;
+};
+
+#endif
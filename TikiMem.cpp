@@ -0,0 +1,87 @@
+#include<string>
+#include<algorithm>
+#include"TikiMem.h"
+#include<fcntl.h>
+#include<sys/uio.h>
+
+bool read_remote(pid_t pid,uint64_t addr,void* buf,size_t size)
+{
+    struct iovec local[1];
+    struct iovec remote[1];
+    local[0].iov_base = buf;
+    local[0].iov_len = size;
+    remote[0].iov_base = reinterpret_cast<void*>(addr);
+    remote[0].iov_len = size;
+    return process_vm_readv(pid, local, 1, remote, 1, 0) == static_cast<ssize_t>(size);
+}
+
+size_t read_remote_some(pid_t pid,uint64_t addr,void* buf,size_t size)
+{
+    //process_vm_readv 遇到不可读的页时返回已经读到的部分
+    struct iovec local[1];
+    struct iovec remote[1];
+    local[0].iov_base = buf;
+    local[0].iov_len = size;
+    remote[0].iov_base = reinterpret_cast<void*>(addr);
+    remote[0].iov_len = size;
+    auto n = process_vm_readv(pid, local, 1, remote, 1, 0);
+    return n < 0 ? 0 : static_cast<size_t>(n);
+}
+
+std::string read_remote_string(pid_t pid,uint64_t addr)
+{
+    //按页读, 字符串可能刚好落在映射的末尾
+    std::string out;
+    char buf[0x100];
+    while(addr!=0 && out.size()<0x1000)
+    {
+        size_t len = 0x1000 - (addr & 0xfff);
+        if(len > sizeof(buf)) len = sizeof(buf);
+        if(!read_remote(pid,addr,buf,len)) break;
+        auto end = std::find(buf,buf+len,'\0');
+        out.append(buf,end);
+        if(end!=buf+len) break;
+        addr+=len;
+    }
+    return out;
+}
+
+bool write_remote(pid_t pid,uint64_t addr,const void* buf,size_t size)
+{
+    auto path = "/proc/" + std::to_string(pid) + "/mem";
+    auto fd = open(path.c_str(),O_RDWR);
+    if(fd < 0) return false;
+    auto n = pwrite(fd,buf,size,static_cast<off_t>(addr));
+    close(fd);
+    return n == static_cast<ssize_t>(size);
+}
+
+bool write_remote_bytes(pid_t pid,std::vector<std::pair<uint64_t,uint8_t>> patches)
+{
+    auto path = "/proc/" + std::to_string(pid) + "/mem";
+    auto fd = open(path.c_str(),O_RDWR);
+    if(fd < 0) return false;
+
+    std::sort(patches.begin(),patches.end());
+    bool ok = true;
+    uint8_t buf[0x1000];
+    for(size_t i=0; i<patches.size();)
+    {
+        //[first, last] 落在同一页
+        auto first = patches[i].first;
+        auto j = i;
+        while(j+1<patches.size() && (patches[j+1].first & ~0xfffull)==(first & ~0xfffull)) ++j;
+        auto len = patches[j].first - first + 1;
+        if(pread(fd,buf,len,static_cast<off_t>(first)) != static_cast<ssize_t>(len))
+        {
+            ok = false;
+            i = j+1;
+            continue;
+        }
+        for(auto k=i; k<=j; ++k) buf[patches[k].first-first] = patches[k].second;
+        if(pwrite(fd,buf,len,static_cast<off_t>(first)) != static_cast<ssize_t>(len)) ok = false;
+        i = j+1;
+    }
+    close(fd);
+    return ok;
+}
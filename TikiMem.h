@@ -0,0 +1,22 @@
+#ifndef __TIKIMEM_H__
+#define __TIKIMEM_H__
+
+#include<unistd.h>
+#include<sys/types.h>
+#include<cstdint>
+#include<cstddef>
+#include<string>
+#include<vector>
+
+// process_vm_readv, 一次系统调用读完一整块
+bool read_remote(pid_t pid,uint64_t addr,void* buf,size_t size);
+// 同上, 但允许读到映射末尾为止, 返回读到的字节数 (第一页就不可读时为 0)
+size_t read_remote_some(pid_t pid,uint64_t addr,void* buf,size_t size);
+// 读到 '\0' 为止, 最多 0x1000 字节
+std::string read_remote_string(pid_t pid,uint64_t addr);
+// 通过 /proc/pid/mem 写, 可以写只读的代码段, 而且不要求线程处于停止状态
+bool write_remote(pid_t pid,uint64_t addr,const void* buf,size_t size);
+// 一组单字节修改 (地址, 新值), 同一页内的合并成一次读和一次写
+bool write_remote_bytes(pid_t pid,std::vector<std::pair<uint64_t,uint8_t>> patches);
+
+#endif
@@ -0,0 +1,314 @@
+#include"TikiModule.h"
+#include"TikiMem.h"
+#include<fstream>
+#include<sstream>
+#include<algorithm>
+#include<cstring>
+#include<fcntl.h>
+#include<elf.h>
+#include<link.h>
+
+std::string TikiModule::get_name() const
+{
+    auto pos = m_path.rfind('/');
+    return pos==std::string::npos? m_path : m_path.substr(pos+1);
+}
+
+const elf::elf& TikiModule::get_elf()
+{
+    if(!elf_loaded)
+    {
+        elf_loaded = true;
+        auto fd = open(m_path.c_str(),O_RDONLY);
+        if(fd >= 0)
+        {
+            try{
+                m_elf = elf::elf{elf::create_mmap_loader(fd)};
+            }catch(std::exception& e){
+                std::cerr << "Failed to load ELF " << m_path << ": " << e.what() << std::endl;
+            }
+        }
+    }
+    return m_elf;
+}
+
+const dwarf::dwarf* TikiModule::get_dwarf()
+{
+    if(!dwarf_loaded)
+    {
+        dwarf_loaded = true;
+        auto& ef = get_elf();
+        if(ef.valid())
+        {
+            try{
+                m_dwarf.reset(new dwarf::dwarf{dwarf::elf::create_loader(ef)});
+            }catch(std::exception&){
+                //没有调试信息
+                m_dwarf.reset();
+            }
+        }
+    }
+    return m_dwarf.get();
+}
+
+void TikiModule::load_symbols()
+{
+    symbols_loaded = true;
+    auto& ef = get_elf();
+    if(!ef.valid()) return;
+
+    for(auto& sec : ef.sections())
+    {
+        if(sec.get_hdr().type != elf::sht::symtab && sec.get_hdr().type != elf::sht::dynsym)
+            continue;
+        for(auto sym : sec.as_symtab())
+        {
+            auto& d = sym.get_data();
+            if(d.value == 0) continue;
+            if(d.type() != elf::stt::func && d.type() != elf::stt::object) continue;
+            auto name = sym.get_name();
+            if(name.empty()) continue;
+            if(by_name.emplace(name,d.value).second)
+            {
+                by_addr.push_back({d.value,d.size,name});
+            }
+        }
+    }
+    std::sort(by_addr.begin(),by_addr.end(),[](auto&& a,auto&& b){return a.value<b.value;});
+}
+
+uint64_t TikiModule::lookup_symbol(const std::string& name)
+{
+    if(!symbols_loaded) load_symbols();
+    auto it = by_name.find(name);
+    if(it == by_name.end()) return 0;
+    return it->second + m_bias;
+}
+
+bool TikiModule::symbolize(uint64_t addr,std::string& out)
+{
+    if(!symbols_loaded) load_symbols();
+    uint64_t off = addr - m_bias;
+    auto it = std::upper_bound(by_addr.begin(),by_addr.end(),off,[](uint64_t v,auto&& e){return v<e.value;});
+    if(it == by_addr.begin()) return false;
+    --it;
+    if(it->size != 0 && off >= it->value + it->size) return false;
+
+    std::stringstream ss;
+    ss << it->name;
+    if(off != it->value) ss << "+0x" << std::hex << off - it->value;
+    out = ss.str();
+    return true;
+}
+
+bool TikiModule::lookup_line(uint64_t addr,std::string& file,unsigned& line)
+{
+    auto dw = get_dwarf();
+    if(dw == nullptr) return false;
+    uint64_t off = addr - m_bias;
+    try{
+        for(auto& cu : dw->compilation_units())
+        {
+            if(die_pc_range(cu.root()).contains(off))
+            {
+                auto& lt = cu.get_line_table();
+                auto it = lt.find_address(off);
+                if(it == lt.end()) return false;
+                file = it->file_name();
+                line = it->line;
+                return true;
+            }
+        }
+    }catch(std::exception&){
+    }
+    return false;
+}
+
+
+bool TikiModuleTable::read_image_range(uint64_t header_addr,uint64_t bias,uint64_t& start,uint64_t& end)
+{
+    Elf64_Ehdr ehdr;
+    if(!read_remote(t_pid,header_addr,&ehdr,sizeof(ehdr))) return false;
+    if(std::memcmp(ehdr.e_ident,ELFMAG,SELFMAG)!=0 || ehdr.e_phnum==0) return false;
+
+    std::vector<Elf64_Phdr> phdrs(ehdr.e_phnum);
+    if(!read_remote(t_pid,header_addr+ehdr.e_phoff,phdrs.data(),phdrs.size()*sizeof(Elf64_Phdr))) return false;
+
+    start = UINT64_MAX;
+    end = 0;
+    for(auto& ph : phdrs)
+    {
+        if(ph.p_type != PT_LOAD) continue;
+        start = std::min<uint64_t>(start, bias + (ph.p_vaddr & ~0xfffull));
+        end = std::max<uint64_t>(end, bias + ph.p_vaddr + ph.p_memsz);
+    }
+    return start < end;
+}
+
+void TikiModuleTable::load_from_maps()
+{
+    //只在启动时完整读一次, 之后依赖 link_map 增量更新
+    std::ifstream map("/proc/"+ std::to_string(t_pid)+"/maps");
+    std::string line;
+    struct range{uint64_t start,end,header;};
+    std::vector<std::pair<std::string,range>> found;
+
+    modules.clear();
+    main_start = 0;
+    while(std::getline(map,line))
+    {
+        std::istringstream ls{line};
+        std::string addrs,perms,offset,dev,inode,path;
+        ls >> addrs >> perms >> offset >> dev >> inode >> path;
+        if(path.empty() || path[0]!='/') continue;
+
+        auto dash = addrs.find('-');
+        uint64_t start = std::stoull(addrs.substr(0,dash),0,16);
+        uint64_t end = std::stoull(addrs.substr(dash+1),0,16);
+        uint64_t off = std::stoull(offset,0,16);
+
+        auto it = std::find_if(found.begin(),found.end(),[&](auto&& f){return f.first==path;});
+        if(it == found.end())
+        {
+            found.push_back({path,{start,end,off==0?start:0}});
+            continue;
+        }
+        it->second.start = std::min(it->second.start,start);
+        it->second.end = std::max(it->second.end,end);
+        if(off==0 && it->second.header==0) it->second.header=start;
+    }
+
+    for(auto& f : found)
+    {
+        uint64_t bias = 0;
+        Elf64_Ehdr ehdr;
+        if(f.second.header && read_remote(t_pid,f.second.header,&ehdr,sizeof(ehdr)) && ehdr.e_type==ET_DYN)
+        {
+            std::vector<Elf64_Phdr> phdrs(ehdr.e_phnum);
+            bias = f.second.header;
+            if(read_remote(t_pid,f.second.header+ehdr.e_phoff,phdrs.data(),phdrs.size()*sizeof(Elf64_Phdr)))
+            {
+                for(auto& ph : phdrs)
+                {
+                    if(ph.p_type == PT_LOAD){
+                        bias = f.second.header - (ph.p_vaddr & ~0xfffull);
+                        break;
+                    }
+                }
+            }
+        }
+        if(main_start == 0) main_start = f.second.start;
+        modules.emplace(f.second.start,TikiModule{f.first,bias,f.second.start,f.second.end});
+    }
+}
+
+uint64_t TikiModuleTable::find_solib_event_addr()
+{
+    for(auto& m : modules)
+    {
+        if(m.second.get_name().compare(0,3,"ld-")!=0) continue;
+        r_debug_addr = m.second.lookup_symbol("_r_debug");
+        return m.second.lookup_symbol("_dl_debug_state");
+    }
+    return 0;
+}
+
+void TikiModuleTable::update_from_link_map()
+{
+    if(r_debug_addr == 0) return;
+    struct r_debug rd;
+    if(!read_remote(t_pid,r_debug_addr,&rd,sizeof(rd))) return;
+    //dlopen/dlclose 会在 RT_ADD/RT_DELETE 与 RT_CONSISTENT 两次调用 _dl_debug_state, 只在链表稳定时同步
+    if(rd.r_state != r_debug::RT_CONSISTENT) return;
+
+    std::vector<uint64_t> alive;
+    uint64_t lm_addr = reinterpret_cast<uint64_t>(rd.r_map);
+    while(lm_addr != 0 && alive.size() < 0x1000)
+    {
+        struct link_map lm;
+        if(!read_remote(t_pid,lm_addr,&lm,sizeof(lm))) break;
+        lm_addr = reinterpret_cast<uint64_t>(lm.l_next);
+
+        auto name = read_remote_string(t_pid,reinterpret_cast<uint64_t>(lm.l_name));
+        //主程序的 l_name 为空, vdso 没有路径
+        if(name.empty() || name[0]!='/') continue;
+
+        uint64_t start,end;
+        if(!read_image_range(lm.l_addr,lm.l_addr,start,end)) continue;
+        alive.push_back(start);
+        if(modules.count(start)) continue;
+
+        modules.emplace(start,TikiModule{name,lm.l_addr,start,end});
+        std::cout << "Loaded " << name << " at 0x" << std::hex << start << std::endl;
+    }
+
+    for(auto it = modules.begin(); it!=modules.end();)
+    {
+        if(it->first == main_start || std::find(alive.begin(),alive.end(),it->first)!=alive.end())
+        {
+            ++it;
+            continue;
+        }
+        std::cout << "Unloaded " << it->second.get_path() << std::endl;
+        it = modules.erase(it);
+    }
+}
+
+TikiModule* TikiModuleTable::get_main()
+{
+    auto it = modules.find(main_start);
+    return it==modules.end()? nullptr : &it->second;
+}
+
+TikiModule* TikiModuleTable::find_by_addr(uint64_t addr)
+{
+    auto it = modules.upper_bound(addr);
+    if(it == modules.begin()) return nullptr;
+    --it;
+    return it->second.contains(addr)? &it->second : nullptr;
+}
+
+TikiModule* TikiModuleTable::find_by_name(const std::string& name)
+{
+    TikiModule* partial = nullptr;
+    for(auto& m : modules)
+    {
+        auto n = m.second.get_name();
+        if(n == name || m.second.get_path() == name) return &m.second;
+        //"libc" 也能匹配 "libc.so.6"
+        if(partial == nullptr && n.compare(0,name.size(),name)==0) partial = &m.second;
+    }
+    return partial;
+}
+
+uint64_t TikiModuleTable::resolve(const std::string& spec)
+{
+    auto pos = spec.rfind(':');
+    if(pos == std::string::npos)
+    {
+        auto m = get_main();
+        return m? m->lookup_symbol(spec) : 0;
+    }
+    auto m = find_by_name(spec.substr(0,pos));
+    if(m == nullptr) return 0;
+    return m->lookup_symbol(spec.substr(pos+1));
+}
+
+std::string TikiModuleTable::symbolize(uint64_t addr)
+{
+    auto m = find_by_addr(addr);
+    if(m == nullptr) return "";
+    std::string sym;
+    if(!m->symbolize(addr,sym)) return m->get_name();
+    return sym + " in " + m->get_name();
+}
+
+void TikiModuleTable::dump()
+{
+    for(auto& m : modules)
+    {
+        std::cout << "0x" << std::hex << m.second.get_start() << "-0x" << m.second.get_end()
+            << "  bias 0x" << m.second.get_bias() << "  " << m.second.get_path()
+            << (m.second.is_symbols_loaded()? "  (symbols)" : "") << std::endl;
+    }
+}
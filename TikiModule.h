@@ -0,0 +1,98 @@
+#ifndef __TIKIMODULE_H__
+#define __TIKIMODULE_H__
+
+#include<iostream>
+#include<unistd.h>
+#include<sys/types.h>
+#include<map>
+#include<unordered_map>
+#include<vector>
+#include<memory>
+#include"libelfin/elf/elf++.hh"
+#include"libelfin/dwarf/dwarf++.hh"
+
+/*
+    一个被加载的 ELF 映像 (主程序 / ld.so / libc.so.6 ...)
+    ELF 符号表与 DWARF 都是第一次用到时才构建, 没碰过的库不会被读取
+*/
+class TikiModule{
+    public:
+        TikiModule(std::string path,uint64_t bias,uint64_t start,uint64_t end)
+            :m_path{std::move(path)},m_bias{bias},m_start{start},m_end{end}{};
+
+        auto get_path() const -> const std::string& {return m_path;}
+        std::string get_name() const;
+        auto get_bias() const -> uint64_t {return m_bias;}
+        auto get_start() const -> uint64_t {return m_start;}
+        auto get_end() const -> uint64_t {return m_end;}
+        auto contains(uint64_t addr) const -> bool {return addr>=m_start && addr<m_end;}
+        auto is_symbols_loaded() const -> bool {return symbols_loaded;}
+
+        // 返回运行时地址, 找不到返回 0
+        uint64_t lookup_symbol(const std::string& name);
+        // addr 为运行时地址, 成功时写入 "name+0xoff"
+        bool symbolize(uint64_t addr,std::string& out);
+        bool lookup_line(uint64_t addr,std::string& file,unsigned& line);
+
+        const elf::elf& get_elf();
+        const dwarf::dwarf* get_dwarf();
+
+    private:
+        struct sym_entry{
+            uint64_t value;
+            uint64_t size;
+            std::string name;
+        };
+        void load_symbols();
+
+        std::string m_path;
+        uint64_t m_bias;
+        uint64_t m_start;
+        uint64_t m_end;
+
+        bool elf_loaded=false;
+        bool symbols_loaded=false;
+        bool dwarf_loaded=false;
+        elf::elf m_elf;
+        std::shared_ptr<dwarf::dwarf> m_dwarf;    // fork 出来的进程复制模块表时共用
+        std::unordered_map<std::string,uint64_t> by_name;
+        std::vector<sym_entry> by_addr;   // 按 value 排序
+};
+
+/*
+    进程地址空间里的全部模块
+    启动时解析一次 /proc/pid/maps, 之后由 _dl_debug_state 断点驱动,
+    遍历 r_debug->r_map 做增量更新 (dlopen/dlclose)
+*/
+class TikiModuleTable{
+    public:
+        TikiModuleTable():t_pid{0}{};
+        explicit TikiModuleTable(pid_t pid):t_pid{pid}{};
+
+        void load_from_maps();
+        // 返回 _dl_debug_state 的地址, 没找到 ld.so 时返回 0
+        uint64_t find_solib_event_addr();
+        // 在 _dl_debug_state 处调用, 同步 link_map 链表
+        void update_from_link_map();
+
+        TikiModule* find_by_addr(uint64_t addr);
+        TikiModule* find_by_name(const std::string& name);
+        TikiModule* get_main();
+        // "libc.so.6:malloc" 或 "malloc" (主程序)
+        uint64_t resolve(const std::string& spec);
+        std::string symbolize(uint64_t addr);
+        void dump();
+
+        void set_pid(pid_t pid){t_pid=pid;}
+        auto get_main_start() const -> uint64_t {return main_start;}
+
+    private:
+        bool read_image_range(uint64_t header_addr,uint64_t bias,uint64_t& start,uint64_t& end);
+
+        pid_t t_pid;
+        uint64_t main_start=0;
+        uint64_t r_debug_addr=0;
+        std::map<uint64_t,TikiModule> modules;      // start -> module
+};
+
+#endif
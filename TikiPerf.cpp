@@ -0,0 +1,262 @@
+#include"TikiPerf.h"
+#include<linux/hw_breakpoint.h>
+#include<sys/syscall.h>
+#include<sys/ioctl.h>
+#include<unistd.h>
+#include<cerrno>
+#include<cstring>
+#include<sstream>
+#include<iomanip>
+
+static const perf_counter_desc perf_candidates[]={
+    {"instructions",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cycles",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"branch-misses",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"task-clock",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"page-faults",     PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static int perf_open(perf_event_attr& attr,pid_t tid,int group_fd)
+{
+    return static_cast<int>(syscall(SYS_perf_event_open,&attr,tid,-1,group_fd,PERF_FLAG_FD_CLOEXEC));
+}
+
+static perf_event_attr counter_attr(const perf_counter_desc& d)
+{
+    perf_event_attr attr{};
+    attr.size=sizeof(attr);
+    attr.type=d.type;
+    attr.config=d.config;
+    //perf_event_paranoid=2 时只能计用户态
+    attr.exclude_kernel=1;
+    attr.exclude_hv=1;
+    attr.read_format=PERF_FORMAT_GROUP|PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return attr;
+}
+
+bool TikiPerfCounters::open_group(pid_t tid,counter_group& g,std::string& err)
+{
+    if(!probed)
+    {//能打开的事件就用, 硬件事件没有时只剩软件事件
+        for(auto& d:perf_candidates)
+        {
+            auto attr=counter_attr(d);
+            auto fd=perf_open(attr,tid,g.fds.empty()? -1 : g.fds[0]);
+            if(fd<0)
+            {
+                if(err.empty()) err=std::strerror(errno);
+                continue;
+            }
+            g.fds.push_back(fd);
+            events.push_back(d);
+        }
+        //有事件打不开时 err 留着第一个错误, 调用者可以说明原因
+        if(events.empty()) return false;
+        probed=true;
+        return true;
+    }
+    for(auto& d:events)
+    {
+        auto attr=counter_attr(d);
+        auto fd=perf_open(attr,tid,g.fds.empty()? -1 : g.fds[0]);
+        if(fd<0)
+        {
+            err=std::strerror(errno);
+            for(auto f:g.fds) close(f);
+            g.fds.clear();
+            return false;
+        }
+        g.fds.push_back(fd);
+    }
+    return true;
+}
+
+bool TikiPerfCounters::add_thread(pid_t tid,std::string& err)
+{
+    if(groups.count(tid)) return true;
+    counter_group g;
+    if(!open_group(tid,g,err)) return false;
+    groups.emplace(tid,std::move(g));
+    return true;
+}
+
+void TikiPerfCounters::remove_thread(pid_t tid)
+{
+    auto it=groups.find(tid);
+    if(it==groups.end()) return;
+    for(auto fd:it->second.fds) close(fd);
+    groups.erase(it);
+}
+
+void TikiPerfCounters::close_all()
+{
+    for(auto& g:groups)
+    {
+        for(auto fd:g.second.fds) close(fd);
+    }
+    groups.clear();
+}
+
+bool TikiPerfCounters::read_and_reset(std::vector<uint64_t>& values,const std::function<bool(pid_t)>& live)
+{
+    values.assign(events.size(),0);
+    //{nr, time_enabled, time_running, value[nr]}
+    std::vector<uint64_t> buf(3+events.size());
+    bool ok=false;
+    for(auto it=groups.begin();it!=groups.end();)
+    {
+        auto& g=it->second;
+        auto n=read(g.fds[0],buf.data(),buf.size()*sizeof(buf[0]));
+        if(n==static_cast<ssize_t>(buf.size()*sizeof(buf[0])))
+        {
+            //计数器不够用时内核轮流计数, 按这段时间实际计数的比例放大
+            auto enabled=buf[1]-g.enabled;
+            auto running=buf[2]-g.running;
+            g.enabled=buf[1];
+            g.running=buf[2];
+            for(size_t i=0;i<events.size() && i<buf[0];i++)
+            {
+                auto v=buf[3+i];
+                if(running!=0 && running<enabled) v=static_cast<uint64_t>(static_cast<double>(v)*enabled/running);
+                values[i]+=v;
+            }
+            ioctl(g.fds[0],PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+            ok=true;
+        }
+        if(!live(it->first))
+        {
+            for(auto fd:g.fds) close(fd);
+            it=groups.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+    return ok;
+}
+
+
+int TikiPerfWatches::open_breakpoint(pid_t tid,const hw_watch& w)
+{
+    perf_event_attr attr{};
+    attr.size=sizeof(attr);
+    attr.type=PERF_TYPE_BREAKPOINT;
+    attr.bp_type=HW_BREAKPOINT_W;
+    attr.bp_addr=w.addr;
+    attr.bp_len=w.len;
+    attr.sample_period=1;
+    //每次命中都同步给写入的线程发 SIGTRAP, 不需要 mmap 缓冲区
+    attr.sigtrap=1;
+    attr.remove_on_exec=1;
+    attr.sig_data=w.num;
+    attr.exclude_kernel=1;
+    attr.exclude_hv=1;
+    return perf_open(attr,tid,-1);
+}
+
+int TikiPerfWatches::add(uint64_t addr,size_t len,uint64_t value,const std::vector<pid_t>& tids,std::string& err)
+{
+    if((len!=1 && len!=2 && len!=4 && len!=8) || addr%len!=0)
+    {
+        err="length must be 1, 2, 4 or 8 and the address aligned to it";
+        return 0;
+    }
+    hw_watch w{next_num,addr,len,value,0,{}};
+    for(auto tid:tids)
+    {
+        auto fd=open_breakpoint(tid,w);
+        if(fd<0)
+        {
+            //ENOSPC: 这个线程的 4 个调试寄存器用完了
+            err=errno==ENOSPC? "no free debug registers" : std::strerror(errno);
+            for(auto& f:w.fds) close(f.second);
+            return 0;
+        }
+        w.fds[tid]=fd;
+    }
+    watches.emplace(next_num,std::move(w));
+    return next_num++;
+}
+
+bool TikiPerfWatches::remove(int num)
+{
+    auto it=watches.find(num);
+    if(it==watches.end()) return false;
+    for(auto& f:it->second.fds) close(f.second);
+    watches.erase(it);
+    return true;
+}
+
+void TikiPerfWatches::add_thread(pid_t tid)
+{
+    for(auto& w:watches)
+    {
+        if(w.second.fds.count(tid)) continue;
+        auto fd=open_breakpoint(tid,w.second);
+        if(fd<0)
+        {
+            std::cerr << "Couldn't add watch " << std::dec << w.first << " to thread " << tid << ": " << std::strerror(errno) << std::endl;
+            continue;
+        }
+        w.second.fds[tid]=fd;
+    }
+}
+
+void TikiPerfWatches::prune(const std::function<bool(pid_t)>& live)
+{
+    for(auto& w:watches)
+    {
+        auto& fds=w.second.fds;
+        for(auto it=fds.begin();it!=fds.end();)
+        {
+            if(live(it->first))
+            {
+                ++it;
+                continue;
+            }
+            close(it->second);
+            it=fds.erase(it);
+        }
+    }
+}
+
+void TikiPerfWatches::clear()
+{
+    for(auto& w:watches)
+    {
+        for(auto& f:w.second.fds) close(f.second);
+    }
+    watches.clear();
+}
+
+hw_watch* TikiPerfWatches::find(int num)
+{
+    auto it=watches.find(num);
+    return it==watches.end()? nullptr : &it->second;
+}
+
+
+uint64_t perf_sig_data(const siginfo_t& info)
+{
+    //内核的 _sigfault: void* _addr 之后的联合里, _perf._data 紧跟在 _addr 后面
+    uint64_t data;
+    std::memcpy(&data,reinterpret_cast<const char*>(&info.si_addr)+sizeof(void*),sizeof(data));
+    return data;
+}
+
+std::string format_count(uint64_t v)
+{
+    if(v<10000) return std::to_string(v);
+    static const char units[]="KMGT";
+    double d=static_cast<double>(v);
+    size_t u=0;
+    d/=1000;
+    while(d>=1000 && u+1<sizeof(units)-1)
+    {
+        d/=1000;
+        ++u;
+    }
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(d<100? 2 : 1) << d << units[u];
+    return ss.str();
+}
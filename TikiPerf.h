@@ -0,0 +1,104 @@
+#ifndef __TIKIPERF_H__
+#define __TIKIPERF_H__
+
+#include<iostream>
+#include<sys/types.h>
+#include<signal.h>
+#include<linux/perf_event.h>
+#include<cstdint>
+#include<functional>
+#include<map>
+#include<string>
+#include<vector>
+
+/*
+    perf_event_open 接到被调试进程的每个线程上 (pid=tid, cpu=-1, 只计用户态)
+    set counters on: 每个线程一组计数器, 组内一次 read 读出全部; 每条命令执行完读出并清零, 报告这段时间执行了多少
+        硬件事件 instructions, cycles, branch-misses 打不开时 (虚拟机里常见) 跳过, 软件事件 task-clock, page-faults 总是有
+    watch ADDR [LEN]: PERF_TYPE_BREAKPOINT 写断点, sigtrap=1
+        写入之后内核直接给写的线程发 SIGTRAP, si_code 是 TRAP_PERF, si_perf_data 是 watch 编号
+        调试寄存器由内核分配 (每个线程最多 4 个), 不用 PTRACE_POKEUSER 改 DR0-DR7
+        remove_on_exec: exec 之后自动失效
+*/
+#ifndef TRAP_PERF
+#define TRAP_PERF 6
+#endif
+
+struct perf_counter_desc {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+};
+
+class TikiPerfCounters{
+    public:
+        TikiPerfCounters()=default;
+        ~TikiPerfCounters(){close_all();}
+        TikiPerfCounters(const TikiPerfCounters&)=delete;
+        TikiPerfCounters& operator=(const TikiPerfCounters&)=delete;
+
+        // 第一次调用时探测哪些事件能打开
+        bool add_thread(pid_t tid,std::string& err);
+        // 丢掉一个线程的计数 (不读出)
+        void remove_thread(pid_t tid);
+        void close_all();
+        auto is_enabled() const -> bool {return !groups.empty();}
+        auto get_events() const -> const std::vector<perf_counter_desc>& {return events;}
+
+        // 所有线程的计数之和, 顺序同 get_events(); 读完清零; live(tid) 为 false 的线程读完后关闭
+        bool read_and_reset(std::vector<uint64_t>& values,const std::function<bool(pid_t)>& live);
+
+    private:
+        struct counter_group {
+            std::vector<int> fds;           // fds[0] 是组长
+            uint64_t enabled=0,running=0;   // 上次读出时的累计时间, 算多路复用的缩放比例
+        };
+        bool open_group(pid_t tid,counter_group& g,std::string& err);
+
+        bool probed=false;
+        std::vector<perf_counter_desc> events;
+        std::map<pid_t,counter_group> groups;
+};
+
+struct hw_watch {
+    int num;
+    uint64_t addr;
+    size_t len;
+    uint64_t value;             // 上次报告时的值
+    uint64_t hits;
+    std::map<pid_t,int> fds;    // 每个线程一个事件
+};
+
+class TikiPerfWatches{
+    public:
+        TikiPerfWatches()=default;
+        ~TikiPerfWatches(){clear();}
+        TikiPerfWatches(const TikiPerfWatches&)=delete;
+        TikiPerfWatches& operator=(const TikiPerfWatches&)=delete;
+
+        // 在 tids 的每个线程上打开, 有一个失败就全部撤销; 成功返回编号
+        int add(uint64_t addr,size_t len,uint64_t value,const std::vector<pid_t>& tids,std::string& err);
+        bool remove(int num);
+        // 新线程加上已有的 watch
+        void add_thread(pid_t tid);
+        // 关掉已经不存在的线程的事件
+        void prune(const std::function<bool(pid_t)>& live);
+        void clear();
+
+        hw_watch* find(int num);
+        auto get_watches() const -> const std::map<int,hw_watch>& {return watches;}
+        auto empty() const -> bool {return watches.empty();}
+
+    private:
+        static int open_breakpoint(pid_t tid,const hw_watch& w);
+
+        std::map<int,hw_watch> watches;
+        int next_num=1;
+};
+
+// TRAP_PERF 的 si_perf_data (glibc 的 siginfo_t 里没有这个字段)
+uint64_t perf_sig_data(const siginfo_t& info);
+// 1234 -> "1234", 1234567 -> "1.23M"
+std::string format_count(uint64_t v);
+
+#endif
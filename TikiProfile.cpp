@@ -0,0 +1,140 @@
+#include"TikiProfile.h"
+#include"TikiMem.h"
+#include<algorithm>
+#include<charconv>
+#include<iomanip>
+#include<map>
+
+static const size_t stack_window=32*1024;
+
+void TikiProfile::clear()
+{
+    stacks.clear();
+    stop_ns.clear();
+    samples=0;
+}
+
+size_t TikiProfile::stack_hash::operator()(const std::vector<uint64_t>& v) const
+{
+    //FNV-1a, 按 8 字节一组
+    uint64_t h=0xcbf29ce484222325ull;
+    for(auto x:v)
+    {
+        h^=x;
+        h*=0x100000001b3ull;
+    }
+    return h;
+}
+
+void TikiProfile::add_sample(pid_t tgid,const uint64_t* frames,size_t n)
+{
+    key.clear();
+    key.push_back(tgid);
+    key.insert(key.end(),frames,frames+n);
+    auto it=stacks.find(key);
+    if(it!=stacks.end())
+    {
+        ++it->second;
+    }
+    else{
+        stacks.emplace(key,1);
+    }
+    ++samples;
+}
+
+size_t TikiProfile::write_folded(std::ostream& out,const std::function<std::string(pid_t)>& root,
+    const std::function<std::string(uint64_t)>& name) const
+{
+    //不同的地址序列符号化之后可能相同 (同一个函数里的不同 pc), 合并后按字典序输出
+    std::unordered_map<uint64_t,std::string> names;
+    std::unordered_map<pid_t,std::string> roots;
+    std::map<std::string,uint64_t> folded;
+    std::string line;
+    for(auto& s:stacks)
+    {
+        auto& k=s.first;
+        pid_t tgid=static_cast<pid_t>(k[0]);
+        auto r=roots.find(tgid);
+        if(r==roots.end()) r=roots.emplace(tgid,root(tgid)).first;
+        line=r->second;
+        for(size_t i=k.size()-1;i>=1;i--)
+        {
+            auto n=names.find(k[i]);
+            if(n==names.end()) n=names.emplace(k[i],name(k[i])).first;
+            line+=';';
+            line+=n->second;
+        }
+        folded[line]+=s.second;
+    }
+    for(auto& f:folded)
+    {
+        out << f.first << ' ' << std::dec << f.second << '\n';
+    }
+    out.flush();
+    return folded.size();
+}
+
+void TikiProfile::show_stats(std::ostream& out,double seconds,unsigned hz) const
+{
+    out << std::dec << stop_ns.size() << " samples (" << static_cast<uint64_t>(seconds*hz) << " expected) in "
+        << std::fixed << std::setprecision(2) << seconds << " s, " << samples << " thread samples, "
+        << stacks.size() << " distinct stacks" << std::endl;
+    if(stop_ns.empty()) return;
+    auto sorted=stop_ns;
+    std::sort(sorted.begin(),sorted.end());
+    uint64_t sum=0;
+    for(auto ns:sorted) sum+=ns;
+    auto pct=[&sorted](double p){return sorted[static_cast<size_t>(p*(sorted.size()-1))]/1000.0;};
+    out << "stop time per sample: avg " << sum/1000.0/sorted.size() << " us, p50 " << pct(0.5)
+        << " us, p99 " << pct(0.99) << " us, max " << sorted.back()/1000.0 << " us, "
+        << "stopped " << sum/1e7/seconds << "% of the time" << std::endl;
+    out << std::defaultfloat;
+}
+
+size_t walk_frame_pointers(pid_t pid,const user_regs_struct& regs,uint64_t* frames,size_t max,std::vector<uint8_t>& scratch)
+{
+    if(max==0) return 0;
+    size_t n=0;
+    frames[n++]=regs.rip;
+    //rsp 往上的一段栈一次读完, 大部分帧都在里面; 超出的帧再单独读
+    scratch.resize(stack_window);
+    uint64_t base=regs.rsp;
+    size_t got=read_remote_some(pid,base,scratch.data(),scratch.size());
+    uint64_t fp=regs.rbp;
+    while(n<max)
+    {
+        //帧指针必须在栈上, 8 字节对齐, 并且单调向上
+        if(fp<base || (fp&7)!=0) break;
+        uint64_t link[2];
+        if(fp-base+sizeof(link)<=got)
+        {
+            std::copy_n(scratch.data()+(fp-base),sizeof(link),reinterpret_cast<uint8_t*>(link));
+        }
+        else if(!read_remote(pid,fp,link,sizeof(link)))
+        {
+            break;
+        }
+        if(link[1]==0) break;
+        //返回地址减一落在 call 指令上, 符号化时不会算到下一个函数
+        frames[n++]=link[1]-1;
+        if(link[0]<=fp) break;
+        fp=link[0];
+    }
+    return n;
+}
+
+bool parse_duration(std::string_view s,uint64_t& ns)
+{
+    double v=0;
+    auto r=std::from_chars(s.data(),s.data()+s.size(),v);
+    if(r.ec!=std::errc{} || v<0) return false;
+    std::string_view unit{r.ptr,static_cast<size_t>(s.data()+s.size()-r.ptr)};
+    double scale;
+    if(unit.empty() || unit=="s") scale=1e9;
+    else if(unit=="ms") scale=1e6;
+    else if(unit=="us") scale=1e3;
+    else if(unit=="m") scale=60e9;
+    else return false;
+    ns=static_cast<uint64_t>(v*scale);
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef __TIKIPROFILE_H__
+#define __TIKIPROFILE_H__
+
+#include<iostream>
+#include<sys/types.h>
+#include<sys/user.h>
+#include<unordered_map>
+#include<functional>
+#include<string>
+#include<string_view>
+#include<vector>
+#include<cstdint>
+
+/*
+    profile --hz N --duration T [FILE]: 只用 ptrace 的采样 profiler
+    定时器每次到期: PTRACE_INTERRUPT 停下所有线程 -> 每个线程 GETREGS, 一次 process_vm_readv 读 rsp 往上的一段栈,
+    沿 rbp 链回溯 -> 立即恢复运行
+    采样时只按 (进程, 地址序列) 计数, 不做符号化; 结束后每个不同的地址符号化一次,
+    输出 Brendan Gregg 的 folded 格式: 进程名;最外层;...;叶子 次数
+    没有帧指针的代码 (-fomit-frame-pointer) 回溯会在那里截断
+*/
+class TikiProfile{
+    public:
+        void clear();
+
+        // frames[0] 是叶子 (pc), 之后是返回地址 - 1
+        void add_sample(pid_t tgid,const uint64_t* frames,size_t n);
+        // 一次采样从发出 PTRACE_INTERRUPT 到全部线程恢复的时间
+        void add_stop_time(uint64_t ns){stop_ns.push_back(ns);}
+
+        // 返回写出的行数; root(tgid) 是第一帧, name(addr) 是函数名
+        size_t write_folded(std::ostream& out,const std::function<std::string(pid_t)>& root,
+            const std::function<std::string(uint64_t)>& name) const;
+        void show_stats(std::ostream& out,double seconds,unsigned hz) const;
+
+        auto get_samples() const -> uint64_t {return samples;}
+        auto get_stacks() const -> size_t {return stacks.size();}
+
+    private:
+        struct stack_hash{
+            size_t operator()(const std::vector<uint64_t>& v) const;
+        };
+        // key[0] 是 tgid, 之后是 frames
+        std::unordered_map<std::vector<uint64_t>,uint64_t,stack_hash> stacks;
+        std::vector<uint64_t> key;      // 复用, 已有的栈查找时不分配
+        std::vector<uint32_t> stop_ns;
+        uint64_t samples=0;             // 线程样本数
+};
+
+// 沿 rbp 链回溯, 返回帧数; scratch 是栈内容的缓冲区
+size_t walk_frame_pointers(pid_t pid,const user_regs_struct& regs,uint64_t* frames,size_t max,std::vector<uint8_t>& scratch);
+// 30s 500ms 2m, 不带单位是秒
+bool parse_duration(std::string_view s,uint64_t& ns);
+
+#endif
@@ -0,0 +1,189 @@
+#include"TikiRecord.h"
+#include"TikiMem.h"
+
+static const size_t chunk_bytes=1<<20;
+static const size_t max_write_size=64;
+
+static const std::array<reg,17> g_record_regs {{
+    reg::rflags, reg::rsp, reg::rax, reg::rdx,
+    reg::rcx, reg::rdi, reg::rsi, reg::rbp,
+    reg::rbx, reg::r8,  reg::r9,  reg::r10,
+    reg::r11, reg::r12, reg::r13, reg::r14,
+    reg::r15
+}};
+
+static void put_varint(std::vector<uint8_t>& buf,uint64_t v)
+{
+    while(v>=0x80)
+    {
+        buf.push_back(static_cast<uint8_t>(v)|0x80);
+        v>>=7;
+    }
+    buf.push_back(static_cast<uint8_t>(v));
+}
+
+static uint64_t get_varint(const std::vector<uint8_t>& buf,size_t& pos)
+{
+    uint64_t v=0;
+    for(int shift=0; pos<buf.size() && shift<64; shift+=7)
+    {
+        auto b=buf[pos++];
+        v|=static_cast<uint64_t>(b&0x7f)<<shift;
+        if(!(b&0x80)) break;
+    }
+    return v;
+}
+
+// 倒着读的 varint: 最低 7 位放在最后, 除了第一个写入的字节都带 0x80
+static void put_back_varint(std::vector<uint8_t>& buf,uint64_t v)
+{
+    uint8_t groups[10];
+    int n=0;
+    do{
+        groups[n++]=v&0x7f;
+        v>>=7;
+    }while(v);
+    for(int i=n-1;i>=0;i--)
+    {
+        buf.push_back(groups[i]|(i==n-1? 0 : 0x80));
+    }
+}
+
+static uint64_t get_back_varint(const std::vector<uint8_t>& buf,size_t& pos)
+{
+    uint64_t v=0;
+    int shift=0;
+    uint8_t b;
+    do{
+        b=buf[--pos];
+        v|=static_cast<uint64_t>(b&0x7f)<<shift;
+        shift+=7;
+    }while((b&0x80) && pos>0);
+    return v;
+}
+
+static uint64_t zigzag(uint64_t delta)
+{
+    auto v=static_cast<int64_t>(delta);
+    return (static_cast<uint64_t>(v)<<1) ^ static_cast<uint64_t>(v>>63);
+}
+
+static uint64_t unzigzag(uint64_t v)
+{
+    return (v>>1) ^ (~(v&1)+1);
+}
+
+void TikiRecord::clear()
+{
+    chunks.clear();
+    pending=false;
+    r_count=0;
+    r_bytes=0;
+    r_dropped=0;
+}
+
+void TikiRecord::begin(pid_t pid,const user_regs_struct& before,const std::vector<std::pair<uint64_t,size_t>>& writes)
+{
+    pending=true;
+    pending_regs=before;
+    pending_mem.clear();
+    pending_writes=0;
+    uint8_t old[max_write_size];
+    for(auto& w:writes)
+    {
+        //读不到的地址, 执行时会出错, 不用记
+        if(w.second>max_write_size || !read_remote(pid,w.first,old,w.second)) continue;
+        put_varint(pending_mem,zigzag(w.first-before.rsp));
+        put_varint(pending_mem,w.second);
+        pending_mem.insert(pending_mem.end(),old,old+w.second);
+        ++pending_writes;
+    }
+}
+
+void TikiRecord::commit(const user_regs_struct& after)
+{
+    if(!pending)
+    {
+        return;
+    }
+    pending=false;
+    if(chunks.empty() || chunks.back().data.size()>=chunk_bytes)
+    {
+        chunks.push_back(record_chunk{pending_regs,{},0});
+        chunks.back().data.reserve(chunk_bytes+0x100);
+    }
+    auto& c=chunks.back();
+    auto start=c.data.size();
+
+    put_varint(c.data,zigzag(after.rip-pending_regs.rip));
+    uint64_t mask=0;
+    uint64_t deltas[g_record_regs.size()];
+    for(size_t i=0;i<g_record_regs.size();i++)
+    {
+        deltas[i]=get_register_value(after,g_record_regs[i])-get_register_value(pending_regs,g_record_regs[i]);
+        if(deltas[i]) mask|=1ull<<i;
+    }
+    put_varint(c.data,mask);
+    for(size_t i=0;i<g_record_regs.size();i++)
+    {
+        if(mask&(1ull<<i)) put_varint(c.data,zigzag(deltas[i]));
+    }
+    c.data.insert(c.data.end(),pending_mem.begin(),pending_mem.end());
+    c.data.push_back(pending_writes);
+    put_back_varint(c.data,c.data.size()-start);
+    ++c.count;
+    ++r_count;
+    r_bytes+=c.data.size()-start;
+
+    //只保留最近的记录
+    while(r_bytes>r_limit && chunks.size()>1)
+    {
+        auto& old=chunks.front();
+        r_bytes-=old.data.size();
+        r_count-=old.count;
+        r_dropped+=old.count;
+        chunks.pop_front();
+    }
+}
+
+bool TikiRecord::undo(pid_t pid,user_regs_struct& regs)
+{
+    if(chunks.empty())
+    {
+        return false;
+    }
+    auto& c=chunks.back();
+    auto end=c.data.size();
+    auto len=get_back_varint(c.data,end);
+    auto start=end-len;
+    auto pos=start;
+
+    regs.rip-=unzigzag(get_varint(c.data,pos));
+    auto mask=get_varint(c.data,pos);
+    for(size_t i=0;i<g_record_regs.size();i++)
+    {
+        if(!(mask&(1ull<<i))) continue;
+        auto r=g_record_regs[i];
+        set_register_value(regs,r,get_register_value(regs,r)-unzigzag(get_varint(c.data,pos)));
+    }
+    auto n_writes=c.data[end-1];
+    for(int i=0;i<n_writes;i++)
+    {
+        auto addr=regs.rsp+unzigzag(get_varint(c.data,pos));
+        auto size=get_varint(c.data,pos);
+        write_remote(pid,addr,c.data.data()+pos,size);
+        pos+=size;
+    }
+
+    r_bytes-=c.data.size()-start;
+    c.data.resize(start);
+    --r_count;
+    if(--c.count==0)
+    {//块的开头, 用快照校正一次
+        auto orig_rax=regs.orig_rax;
+        regs=c.start;
+        regs.orig_rax=orig_rax;
+        chunks.pop_back();
+    }
+    return true;
+}
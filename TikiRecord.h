@@ -0,0 +1,59 @@
+#ifndef __TIKIRECORD_H__
+#define __TIKIRECORD_H__
+
+#include<iostream>
+#include<sys/user.h>
+#include<vector>
+#include<deque>
+#include"TikiReg.h"
+
+/*
+    记录模式的执行日志, 每条指令一条记录:
+        varint(zigzag(rip 变化))
+        varint(mask)                   哪些寄存器变了, 顺序见 g_record_regs (常变的在前, mask 通常一个字节)
+        每个变了的寄存器 varint(zigzag(新值 - 旧值))
+        每块被写的内存: varint(zigzag(地址 - 执行前 rsp)), varint(长度), 原内容
+        内存块个数 (1 字节)
+        记录长度 (倒着读的 varint, 用来从尾部往回找记录开头)
+    只往回走: 撤销一条记录就把它删掉, 之后继续执行会重新记录
+    日志按块存放, 每块开头有一份完整的寄存器快照; 超过上限时丢掉最老的块
+*/
+class TikiRecord{
+    public:
+        void clear();
+        void set_limit(uint64_t bytes){r_limit=bytes;}
+
+        // 执行一条指令之前: 保存将被写的内存的原内容
+        void begin(pid_t pid,const user_regs_struct& before,const std::vector<std::pair<uint64_t,size_t>>& writes);
+        // 执行之后: 记下寄存器变化
+        void commit(const user_regs_struct& after);
+        // 指令没有执行 (信号, int3)
+        void cancel(){pending=false;}
+
+        // 撤销最后一条记录: regs 改成执行前的值, 内存写回原内容; 没有记录返回 false
+        bool undo(pid_t pid,user_regs_struct& regs);
+
+        auto get_count() const -> uint64_t {return r_count;}
+        auto get_bytes() const -> uint64_t {return r_bytes;}
+        auto get_dropped() const -> uint64_t {return r_dropped;}
+
+    private:
+        struct record_chunk {
+            user_regs_struct start;     // 块中第一条指令执行前的寄存器
+            std::vector<uint8_t> data;
+            uint64_t count;
+        };
+
+        std::deque<record_chunk> chunks;
+        bool pending=false;
+        user_regs_struct pending_regs;
+        std::vector<uint8_t> pending_mem;
+        uint8_t pending_writes=0;
+
+        uint64_t r_limit=64<<20;
+        uint64_t r_count=0;
+        uint64_t r_bytes=0;
+        uint64_t r_dropped=0;
+};
+
+#endif
@@ -66,6 +66,9 @@ const std::array<reg_descriptor, n_registers> g_register_descriptors {{
 
 uint64_t get_register_value(pid_t pid, reg r);
 void set_register_value(pid_t pid,reg r,uint64_t value);
+// 直接操作已经读出的寄存器, 避免每个寄存器都 PTRACE_GETREGS 一次
+uint64_t get_register_value(const user_regs_struct& regs, reg r);
+void set_register_value(user_regs_struct& regs,reg r,uint64_t value);
 uint64_t get_register_value_from_register(pid_t pid, unsigned r);
 std::string get_register_name(reg r);
 reg get_register_by_name(const std::string& name);
@@ -0,0 +1,232 @@
+#include"TikiScript.h"
+#include<fstream>
+#include<cstring>
+#include<cerrno>
+#include<unistd.h>
+
+static const size_t batch_buffer_size=1<<16;
+
+std::vector<std::string> split_words(const std::string& s)
+{
+    std::vector<std::string> out;
+    size_t pos=0;
+    while(true)
+    {
+        auto b=s.find_first_not_of(" \t\r",pos);
+        if(b==std::string::npos) break;
+        auto e=s.find_first_of(" \t\r",b);
+        out.emplace_back(s,b,e==std::string::npos? std::string::npos : e-b);
+        if(e==std::string::npos) break;
+        pos=e;
+    }
+    return out;
+}
+
+static std::string unescape_echo(const std::string& s)
+{
+    std::string out;
+    out.reserve(s.size());
+    for(size_t i=0;i<s.size();i++)
+    {
+        if(s[i]!='\\' || i+1==s.size())
+        {
+            out+=s[i];
+            continue;
+        }
+        switch(s[++i])
+        {
+            case 'n': out+='\n'; break;
+            case 't': out+='\t'; break;
+            default: out+=s[i];
+        }
+    }
+    return out;
+}
+
+bool TikiScript::add_file(const std::string& path,std::string& err)
+{
+    std::ifstream in(path);
+    if(!in)
+    {
+        err=path+": "+strerror(errno);
+        return false;
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while(std::getline(in,line))
+    {
+        lines.push_back(std::move(line));
+    }
+    return parse(lines,path,err);
+}
+
+bool TikiScript::add_command(const std::string& line,std::string& err)
+{
+    return parse({line},"-ex",err);
+}
+
+auto TikiScript::find_define(const std::string& name) const -> const std::vector<script_cmd>*
+{
+    auto it=defines.find(name);
+    return it==defines.end()? nullptr : &it->second;
+}
+
+bool TikiScript::parse(const std::vector<std::string>& lines,const std::string& origin,std::string& err)
+{
+    size_t pos=0;
+    std::string stop;
+    if(!parse_block(lines,pos,commands,stop,origin,err))
+    {
+        return false;
+    }
+    if(!stop.empty())
+    {
+        err=origin+":"+std::to_string(pos)+": "+stop+" without while/if/define";
+        return false;
+    }
+    return true;
+}
+
+bool TikiScript::parse_block(const std::vector<std::string>& lines,size_t& pos,std::vector<script_cmd>& out,
+    std::string& stop,const std::string& origin,std::string& err)
+{
+    stop.clear();
+    auto where=[&origin](size_t n){return origin+":"+std::to_string(n)+": ";};
+    while(pos<lines.size())
+    {
+        auto& raw=lines[pos++];
+        auto b=raw.find_first_not_of(" \t\r");
+        if(b==std::string::npos || raw[b]=='#') continue;
+        auto e=raw.find_last_not_of(" \t\r");
+        auto text=raw.substr(b,e-b+1);
+        auto words=split_words(text);
+        auto& head=words[0];
+        if(head=="end" || head=="else")
+        {
+            stop=head;
+            return true;
+        }
+        script_cmd cmd{script_cmd::plain,{},text,{},{},static_cast<int>(pos)};
+        if(head=="echo")
+        {
+            cmd.kind=script_cmd::echo;
+            cmd.line= text.size()>5? unescape_echo(text.substr(5)) : "";
+            out.push_back(std::move(cmd));
+            continue;
+        }
+        if(head=="define")
+        {
+            if(words.size()!=2)
+            {
+                err=where(pos)+"usage: define NAME";
+                return false;
+            }
+            //先占位, 命令体里可以递归调用自己
+            auto& body=defines[words[1]];
+            std::vector<script_cmd> parsed;
+            std::string end;
+            if(!parse_block(lines,pos,parsed,end,origin,err)) return false;
+            if(end!="end")
+            {
+                err=where(pos)+(end.empty()? "missing end for define "+words[1] : "else inside define");
+                return false;
+            }
+            body=std::move(parsed);
+            continue;
+        }
+        if(head=="while" || head=="if")
+        {
+            if(words.size()<2)
+            {
+                err=where(pos)+"missing condition";
+                return false;
+            }
+            cmd.kind= head=="while"? script_cmd::while_loop : script_cmd::if_block;
+            cmd.args.assign(words.begin()+1,words.end());
+            std::string end;
+            if(!parse_block(lines,pos,cmd.body,end,origin,err)) return false;
+            if(end=="else" && head=="if")
+            {
+                if(!parse_block(lines,pos,cmd.else_body,end,origin,err)) return false;
+            }
+            if(end!="end")
+            {
+                err=where(pos)+(end.empty()? "missing end for "+head : "else inside while");
+                return false;
+            }
+            out.push_back(std::move(cmd));
+            continue;
+        }
+        if(defines.count(head)) cmd.kind=script_cmd::user_call;
+        cmd.args=std::move(words);
+        out.push_back(std::move(cmd));
+    }
+    return true;
+}
+
+
+TikiBatchWriter::TikiBatchWriter(int fd,bool lazy,TikiBatchWriter* ahead): fd{fd},lazy{lazy},ahead{ahead},buf(batch_buffer_size)
+{
+    setp(buf.data(),buf.data()+buf.size());
+}
+
+bool TikiBatchWriter::write_out(const char* s,size_t n)
+{
+    while(n>0)
+    {
+        auto w=write(fd,s,n);
+        if(w<0 && errno==EINTR) continue;
+        if(w<=0) return false;
+        ++writes;
+        s+=w;
+        n-=w;
+    }
+    return true;
+}
+
+bool TikiBatchWriter::flush_all()
+{
+    if(ahead) ahead->flush_all();
+    bool ok=write_out(pbase(),pptr()-pbase());
+    setp(buf.data(),buf.data()+buf.size());
+    return ok;
+}
+
+TikiBatchWriter::int_type TikiBatchWriter::overflow(int_type c)
+{
+    if(!flush_all())
+    {
+        return traits_type::eof();
+    }
+    if(!traits_type::eq_int_type(c,traits_type::eof()))
+    {
+        *pptr()=traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+std::streamsize TikiBatchWriter::xsputn(const char* s,std::streamsize n)
+{
+    auto len=static_cast<size_t>(n);
+    if(len>static_cast<size_t>(epptr()-pptr()))
+    {
+        if(!flush_all()) return 0;
+        if(len>=buf.size())
+        {//比缓冲区还大的直接写
+            return write_out(s,len)? n : 0;
+        }
+    }
+    std::memcpy(pptr(),s,len);
+    pbump(static_cast<int>(len));
+    return n;
+}
+
+int TikiBatchWriter::sync()
+{
+    if(lazy)
+    {
+        return 0;
+    }
+    return flush_all()? 0 : -1;
+}
@@ -0,0 +1,85 @@
+#ifndef __TIKISCRIPT_H__
+#define __TIKISCRIPT_H__
+
+#include<iostream>
+#include<streambuf>
+#include<vector>
+#include<map>
+#include<string>
+
+/*
+    -x script.tdb / -ex 'cmd': 不进命令行, 按顺序执行完就结束
+    脚本在开始前整体解析一次, 每条命令只切分一次, 循环体重复执行时不再解析
+        define NAME ... end         用户命令, 体内 $arg0.. $argc 在调用时替换
+        while COND ... end
+        if COND ... else ... end
+        echo TEXT                   支持 \n \t
+        output EXPR                 十进制打印表达式的值
+        set $name EXPR              脚本变量 (不是寄存器名时)
+        # 注释
+    COND: A 或 A OP B (用空格分开), OP 是 == != < <= > >= + - &
+          操作数: 数字, $寄存器, $变量 (set $i 0), $_alive, $_exitcode, $_signo, *ADDR (8 字节)
+*/
+struct script_cmd {
+    enum kind_t {plain,while_loop,if_block,user_call,echo};
+    kind_t kind;
+    std::vector<std::string> args;      // 命令 / 条件 (不含 while, if)
+    std::string line;                   // 原始的一行, call 这类命令自己解析
+    std::vector<script_cmd> body,else_body;
+    int line_no;
+};
+
+class TikiScript{
+    public:
+        // 文件和 -ex 按命令行上的顺序加入
+        bool add_file(const std::string& path,std::string& err);
+        bool add_command(const std::string& line,std::string& err);
+
+        auto empty() const -> bool {return commands.empty() && defines.empty();}
+        auto get_commands() const -> const std::vector<script_cmd>& {return commands;}
+        auto find_define(const std::string& name) const -> const std::vector<script_cmd>*;
+
+    private:
+        bool parse(const std::vector<std::string>& lines,const std::string& origin,std::string& err);
+        // 解析到 end/else 为止; stop 返回遇到的结束词
+        bool parse_block(const std::vector<std::string>& lines,size_t& pos,std::vector<script_cmd>& out,
+            std::string& stop,const std::string& origin,std::string& err);
+
+        std::vector<script_cmd> commands;
+        std::map<std::string,std::vector<script_cmd>> defines;
+};
+
+// 按空白切分, 连续的空白算一个
+std::vector<std::string> split_words(const std::string& s);
+
+/*
+    批处理模式的 std::cout: 只在缓冲区满或者 flush_all 时写 fd
+    std::endl 触发的 sync 什么都不做, 十万条命令的输出不会变成十万次 write
+    lazy=false 的实例 (std::cerr) 每次 sync 都写, 写之前先把 ahead 的内容写出去保持顺序
+*/
+class TikiBatchWriter: public std::streambuf{
+    public:
+        TikiBatchWriter(int fd,bool lazy,TikiBatchWriter* ahead=nullptr);
+        ~TikiBatchWriter() override {flush_all();}
+        TikiBatchWriter(const TikiBatchWriter&)=delete;
+        TikiBatchWriter& operator=(const TikiBatchWriter&)=delete;
+
+        bool flush_all();
+        auto get_writes() const -> size_t {return writes;}
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* s,std::streamsize n) override;
+        int sync() override;
+
+    private:
+        bool write_out(const char* s,size_t n);
+
+        int fd;
+        bool lazy;
+        TikiBatchWriter* ahead;
+        std::vector<char> buf;
+        size_t writes=0;
+};
+
+#endif
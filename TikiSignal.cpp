@@ -0,0 +1,133 @@
+#include"TikiSignal.h"
+#include<cstring>
+#include<iomanip>
+#include<algorithm>
+
+static const char* const signal_names[]={
+    nullptr,"SIGHUP","SIGINT","SIGQUIT","SIGILL","SIGTRAP","SIGABRT","SIGBUS","SIGFPE",
+    "SIGKILL","SIGUSR1","SIGSEGV","SIGUSR2","SIGPIPE","SIGALRM","SIGTERM","SIGSTKFLT",
+    "SIGCHLD","SIGCONT","SIGSTOP","SIGTSTP","SIGTTIN","SIGTTOU","SIGURG","SIGXCPU",
+    "SIGXFSZ","SIGVTALRM","SIGPROF","SIGWINCH","SIGIO","SIGPWR","SIGSYS",
+};
+
+TikiSignals::TikiSignals()
+{
+    //默认和 gdb 一样: 大部分信号停下并投递, 程序自己常用的几个不打扰用户
+    for(auto& p:policies) p={true,true,true};
+    for(auto sig:{SIGALRM,SIGURG,SIGCHLD,SIGWINCH,SIGPROF,SIGVTALRM,SIGIO})
+    {
+        policies[sig]={false,false,true};
+    }
+    //glibc 内部用的实时信号 (线程取消, setxid)
+    for(int sig=32;sig<SIGRTMIN;sig++)
+    {
+        policies[sig]={false,false,true};
+    }
+    //断点和中断是调试器自己的
+    policies[SIGTRAP]={true,true,false};
+    policies[SIGINT]={true,true,false};
+}
+
+int TikiSignals::number(const std::string& name)
+{
+    if(!name.empty() && std::all_of(name.begin(),name.end(),::isdigit))
+    {
+        auto sig=std::stoi(name);
+        return sig>0 && sig<NSIG? sig : 0;
+    }
+    auto full= name.compare(0,3,"SIG")==0? name : "SIG"+name;
+    for(int sig=1;sig<static_cast<int>(sizeof(signal_names)/sizeof(signal_names[0]));sig++)
+    {
+        if(full==signal_names[sig]) return sig;
+    }
+    //SIG34 这样的实时信号
+    if(full.size()>3 && std::all_of(full.begin()+3,full.end(),::isdigit))
+    {
+        return number(full.substr(3));
+    }
+    return 0;
+}
+
+std::string TikiSignals::name(int sig)
+{
+    if(sig>0 && sig<static_cast<int>(sizeof(signal_names)/sizeof(signal_names[0])))
+    {
+        return signal_names[sig];
+    }
+    return "SIG"+std::to_string(sig);
+}
+
+bool TikiSignals::update(const std::vector<std::string>& args)
+{
+    if(args.empty())
+    {
+        return false;
+    }
+    std::vector<int> sigs;
+    if(args[0]=="all")
+    {//和 gdb 一样, all 不包括调试器自己用的信号
+        for(int sig=1;sig<NSIG;sig++)
+        {
+            if(sig!=SIGTRAP && sig!=SIGINT) sigs.push_back(sig);
+        }
+    }
+    else{
+        auto sig=number(args[0]);
+        if(sig==0)
+        {
+            std::cerr << "Unknown signal " << args[0] << std::endl;
+            return false;
+        }
+        if((sig==SIGKILL || sig==SIGSTOP) && args.size()>1)
+        {
+            std::cerr << name(sig) << " cannot be caught" << std::endl;
+            return false;
+        }
+        sigs.push_back(sig);
+    }
+    for(size_t i=1;i<args.size();i++)
+    {
+        auto& k=args[i];
+        if(k!="stop" && k!="nostop" && k!="print" && k!="noprint" && k!="pass" && k!="nopass")
+        {
+            std::cerr << "Unknown keyword " << k << std::endl;
+            return false;
+        }
+    }
+    for(auto sig:sigs)
+    {
+        auto& p=policies[sig];
+        for(size_t i=1;i<args.size();i++)
+        {
+            //stop 隐含 print, noprint 隐含 nostop
+            auto& k=args[i];
+            if(k=="stop") p.stop=p.print=true;
+            else if(k=="nostop") p.stop=false;
+            else if(k=="print") p.print=true;
+            else if(k=="noprint") p.print=p.stop=false;
+            else if(k=="pass") p.pass=true;
+            else p.pass=false;
+        }
+    }
+    return true;
+}
+
+void TikiSignals::show(int sig) const
+{
+    auto& p=policies[sig];
+    std::cout << std::left << std::setw(12) << name(sig)
+        << std::setw(8) << (p.stop? "Yes" : "No")
+        << std::setw(8) << (p.print? "Yes" : "No")
+        << std::setw(8) << (p.pass? "Yes" : "No")
+        << strsignal(sig) << std::right << std::endl;
+}
+
+void TikiSignals::show_all() const
+{
+    std::cout << std::left << std::setw(12) << "Signal" << std::setw(8) << "Stop" << std::setw(8) << "Print"
+        << std::setw(8) << "Pass" << "Description" << std::right << std::endl;
+    for(int sig=1;sig<NSIG;sig++)
+    {
+        if(sig!=SIGKILL && sig!=SIGSTOP) show(sig);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef __TIKISIGNAL_H__
+#define __TIKISIGNAL_H__
+
+#include<iostream>
+#include<csignal>
+#include<string>
+#include<vector>
+
+/*
+    handle SIG stop|nostop print|noprint pass|nopass
+    stop: 停下交给用户      print: 收到时打印一行      pass: 恢复运行时投递给被调试进程
+    nostop 的信号在 dispatch_event 里直接恢复, 不经过命令行
+*/
+struct signal_policy {
+    bool stop;
+    bool print;
+    bool pass;
+};
+
+class TikiSignals{
+    public:
+        TikiSignals();
+
+        auto get(int sig) const -> const signal_policy& {return policies[sig>0 && sig<NSIG? sig : 0];}
+
+        // 名字 (SIGUSR1, USR1) 或编号; 不认识返回 0
+        static int number(const std::string& name);
+        static std::string name(int sig);
+
+        // handle 命令: 第一个参数是信号或 "all", 其余是关键字
+        bool update(const std::vector<std::string>& args);
+        void show(int sig) const;
+        void show_all() const;
+
+    private:
+        signal_policy policies[NSIG];
+};
+
+#endif
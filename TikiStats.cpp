@@ -0,0 +1,170 @@
+#include"TikiStats.h"
+#include<sys/ptrace.h>
+#include<sys/wait.h>
+#include<sys/uio.h>
+#include<sys/epoll.h>
+#include<capstone/capstone.h>
+#include<algorithm>
+#include<cstdarg>
+#include<iomanip>
+#include<vector>
+
+TikiStats g_stats;
+
+void TikiStats::reset()
+{
+    slots.fill(stat_slot{});
+    latency_count=0;
+    current=0;
+}
+
+void TikiStats::begin_command(size_t slot)
+{
+    if(!enabled) return;
+    current= slot<max_slots? slot : 0;
+    command_start=stat_now();
+}
+
+void TikiStats::end_command()
+{
+    if(!enabled || command_start==0) return;
+    auto& s=slots[current];
+    ++s.runs;
+    s.wall_ns+=stat_now()-command_start;
+    command_start=0;
+    current=0;
+}
+
+void TikiStats::add_stop_latency(uint64_t ns)
+{
+    latencies[latency_count%max_latencies]=static_cast<uint32_t>(std::min<uint64_t>(ns,UINT32_MAX));
+    ++latency_count;
+}
+
+void TikiStats::show(std::ostream& out,const std::function<std::string_view(size_t)>& name) const
+{
+    auto ms=[](uint64_t ns){return ns/1e6;};
+    //别的输出可能留下了 hex 和 '0' 填充
+    out << std::dec << std::setfill(' ') << std::left << std::setw(18) << "command" << std::right << std::setw(6) << "runs" << std::setw(10) << "wall ms"
+        << std::setw(9) << "ptrace" << std::setw(9) << "ms" << std::setw(8) << "readv" << std::setw(8) << "writev"
+        << std::setw(11) << "bytes" << std::setw(9) << "ms" << std::setw(8) << "waitpid" << std::setw(9) << "ms" << std::setw(7) << "epoll" << std::setw(10) << "ms"
+        << std::setw(8) << "disasm" << std::setw(8) << "insns" << std::setw(9) << "ms"
+        << std::setw(11) << "sys/run" << std::setw(10) << "other ms" << std::endl;
+    out << std::fixed << std::setprecision(2);
+    for(size_t i=0;i<max_slots;i++)
+    {
+        auto& s=slots[i];
+        uint64_t calls=0;
+        for(auto c:s.calls) calls+=c;
+        if(s.runs==0 && calls==0) continue;
+        uint64_t measured=0;
+        for(auto n:s.ns) measured+=n;
+        auto syscalls=s.calls[stat_ptrace]+s.calls[stat_readv]+s.calls[stat_writev]+s.calls[stat_waitpid];
+        out << std::left << std::setw(18) << (i==0? std::string_view{"(between commands)"} : name(i)) << std::right
+            << std::setw(6) << s.runs << std::setw(10) << ms(s.wall_ns)
+            << std::setw(9) << s.calls[stat_ptrace] << std::setw(9) << ms(s.ns[stat_ptrace])
+            << std::setw(8) << s.calls[stat_readv] << std::setw(8) << s.calls[stat_writev] << std::setw(11) << s.bytes
+            << std::setw(9) << ms(s.ns[stat_readv]+s.ns[stat_writev])
+            << std::setw(8) << s.calls[stat_waitpid] << std::setw(9) << ms(s.ns[stat_waitpid])
+            << std::setw(7) << s.calls[stat_epoll] << std::setw(10) << ms(s.ns[stat_epoll])
+            << std::setw(8) << s.calls[stat_disasm] << std::setw(8) << s.insns << std::setw(9) << ms(s.ns[stat_disasm])
+            << std::setw(11) << (s.runs? static_cast<double>(syscalls)/s.runs : 0.0)
+            << std::setw(10) << (s.wall_ns>measured? ms(s.wall_ns-measured) : 0.0) << std::endl;
+    }
+    auto n= latency_count<max_latencies? latency_count : max_latencies;
+    if(n!=0)
+    {
+        std::vector<uint32_t> sorted(latencies.begin(),latencies.begin()+n);
+        std::sort(sorted.begin(),sorted.end());
+        auto pct=[&sorted](double p){return sorted[static_cast<size_t>(p*(sorted.size()-1))]/1000.0;};
+        out << "stop handling: " << std::dec << latency_count << " stops, p50 " << pct(0.5) << " us, p99 " << pct(0.99)
+            << " us, max " << sorted.back()/1000.0 << " us" << std::endl;
+    }
+    out << std::defaultfloat;
+}
+
+/*
+    链接时的 --wrap 包装; 关闭时直接转给原函数
+    ptrace 是变参函数, 和 glibc 一样总是取出 pid, addr, data 三个参数
+*/
+extern "C" {
+
+long __real_ptrace(enum __ptrace_request request,...);
+pid_t __real_waitpid(pid_t pid,int* status,int options);
+ssize_t __real_process_vm_readv(pid_t pid,const iovec* local,unsigned long liovcnt,const iovec* remote,unsigned long riovcnt,unsigned long flags);
+ssize_t __real_process_vm_writev(pid_t pid,const iovec* local,unsigned long liovcnt,const iovec* remote,unsigned long riovcnt,unsigned long flags);
+size_t __real_cs_disasm(csh handle,const uint8_t* code,size_t code_size,uint64_t address,size_t count,cs_insn** insn);
+bool __real_cs_disasm_iter(csh handle,const uint8_t** code,size_t* size,uint64_t* address,cs_insn* insn);
+int __real_epoll_wait(int epfd,epoll_event* events,int maxevents,int timeout);
+
+long __wrap_ptrace(enum __ptrace_request request,...)
+{
+    va_list ap;
+    va_start(ap,request);
+    auto pid=va_arg(ap,pid_t);
+    auto addr=va_arg(ap,void*);
+    auto data=va_arg(ap,void*);
+    va_end(ap);
+    if(!g_stats.is_enabled()) return __real_ptrace(request,pid,addr,data);
+    auto start=stat_now();
+    auto ret=__real_ptrace(request,pid,addr,data);
+    bool word= request==PTRACE_PEEKDATA || request==PTRACE_PEEKTEXT || request==PTRACE_POKEDATA || request==PTRACE_POKETEXT;
+    g_stats.add_call(stat_ptrace,stat_now()-start,word? sizeof(long) : 0);
+    return ret;
+}
+
+pid_t __wrap_waitpid(pid_t pid,int* status,int options)
+{
+    if(!g_stats.is_enabled()) return __real_waitpid(pid,status,options);
+    auto start=stat_now();
+    auto ret=__real_waitpid(pid,status,options);
+    g_stats.add_call(stat_waitpid,stat_now()-start);
+    return ret;
+}
+
+ssize_t __wrap_process_vm_readv(pid_t pid,const iovec* local,unsigned long liovcnt,const iovec* remote,unsigned long riovcnt,unsigned long flags)
+{
+    if(!g_stats.is_enabled()) return __real_process_vm_readv(pid,local,liovcnt,remote,riovcnt,flags);
+    auto start=stat_now();
+    auto ret=__real_process_vm_readv(pid,local,liovcnt,remote,riovcnt,flags);
+    g_stats.add_call(stat_readv,stat_now()-start,ret>0? ret : 0);
+    return ret;
+}
+
+ssize_t __wrap_process_vm_writev(pid_t pid,const iovec* local,unsigned long liovcnt,const iovec* remote,unsigned long riovcnt,unsigned long flags)
+{
+    if(!g_stats.is_enabled()) return __real_process_vm_writev(pid,local,liovcnt,remote,riovcnt,flags);
+    auto start=stat_now();
+    auto ret=__real_process_vm_writev(pid,local,liovcnt,remote,riovcnt,flags);
+    g_stats.add_call(stat_writev,stat_now()-start,ret>0? ret : 0);
+    return ret;
+}
+
+int __wrap_epoll_wait(int epfd,epoll_event* events,int maxevents,int timeout)
+{
+    if(!g_stats.is_enabled()) return __real_epoll_wait(epfd,events,maxevents,timeout);
+    auto start=stat_now();
+    auto ret=__real_epoll_wait(epfd,events,maxevents,timeout);
+    g_stats.add_call(stat_epoll,stat_now()-start);
+    return ret;
+}
+
+size_t __wrap_cs_disasm(csh handle,const uint8_t* code,size_t code_size,uint64_t address,size_t count,cs_insn** insn)
+{
+    if(!g_stats.is_enabled()) return __real_cs_disasm(handle,code,code_size,address,count,insn);
+    auto start=stat_now();
+    auto ret=__real_cs_disasm(handle,code,code_size,address,count,insn);
+    g_stats.add_call(stat_disasm,stat_now()-start,0,ret);
+    return ret;
+}
+
+bool __wrap_cs_disasm_iter(csh handle,const uint8_t** code,size_t* size,uint64_t* address,cs_insn* insn)
+{
+    if(!g_stats.is_enabled()) return __real_cs_disasm_iter(handle,code,size,address,insn);
+    auto start=stat_now();
+    auto ret=__real_cs_disasm_iter(handle,code,size,address,insn);
+    g_stats.add_call(stat_disasm,stat_now()-start,0,ret? 1 : 0);
+    return ret;
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef __TIKISTATS_H__
+#define __TIKISTATS_H__
+
+#include<iostream>
+#include<functional>
+#include<string_view>
+#include<array>
+#include<cstdint>
+#include<ctime>
+
+/*
+    stats: 调试器自己的开销, 按命令统计
+    链接时用 -Wl,--wrap 把 ptrace, waitpid, process_vm_readv/writev, epoll_wait, cs_disasm/cs_disasm_iter 换成 TikiStats.cpp 里的包装,
+    所有调用点都不用改; 关闭时包装只多一次函数调用和一个分支
+    每条命令一个槽位 (下标是命令在命令表里的位置 + 1, 0 是命令之外, 比如后台事件), 表的大小固定
+        调用次数和耗时, 读写的字节数 (process_vm_* 和 PEEK/POKE), 反汇编的指令数
+        epoll_wait 基本是在等被调试进程运行, 单独列出
+        其余时间 = 命令总耗时 - 上面这些, 主要是格式化输出和调试器自己的数据结构
+    停止处理延迟: 从 waitpid 拿到事件到停止信息打印完, 最近 4096 次取 p50/p99
+*/
+enum stat_kind {
+    stat_ptrace,
+    stat_readv,
+    stat_writev,
+    stat_waitpid,
+    stat_epoll,
+    stat_disasm,
+    stat_kinds
+};
+
+struct stat_slot {
+    uint64_t runs=0;
+    uint64_t wall_ns=0;
+    uint64_t calls[stat_kinds]={};
+    uint64_t ns[stat_kinds]={};
+    uint64_t bytes=0;
+    uint64_t insns=0;
+};
+
+inline uint64_t stat_now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000ull+ts.tv_nsec;
+}
+
+class TikiStats{
+    public:
+        static const size_t max_slots=64;
+        static const size_t max_latencies=4096;
+
+        auto is_enabled() const -> bool {return enabled;}
+        void set_enabled(bool on){enabled=on;}
+        void reset();
+
+        // 命令开始/结束; 槽位超出表大小时记到 0
+        void begin_command(size_t slot);
+        void end_command();
+        void add_call(stat_kind kind,uint64_t ns,uint64_t bytes=0,uint64_t insns=0)
+        {
+            auto& s=slots[current];
+            ++s.calls[kind];
+            s.ns[kind]+=ns;
+            s.bytes+=bytes;
+            s.insns+=insns;
+        }
+        void add_stop_latency(uint64_t ns);
+
+        // name(slot) 是槽位对应的命令名
+        void show(std::ostream& out,const std::function<std::string_view(size_t)>& name) const;
+
+    private:
+        bool enabled=false;
+        size_t current=0;
+        uint64_t command_start=0;
+        std::array<stat_slot,max_slots> slots{};
+        std::array<uint32_t,max_latencies> latencies{};     // 环形, 纳秒 (最多 4 秒)
+        uint64_t latency_count=0;
+};
+
+extern TikiStats g_stats;
+
+#endif
@@ -0,0 +1,210 @@
+#include"TikiSyscall.h"
+#include"TikiMem.h"
+#include<algorithm>
+#include<sstream>
+#include<iomanip>
+#include<cstring>
+#include<cstddef>
+#include<linux/seccomp.h>
+#include<linux/audit.h>
+
+// 按编号排序
+static const syscall_desc syscall_table[]={
+    {0,"read","dxu"},           {1,"write","dbu"},          {2,"open","sxx"},
+    {3,"close","d"},            {4,"stat","sx"},            {5,"fstat","dx"},
+    {6,"lstat","sx"},           {7,"poll","xud"},           {8,"lseek","dld"},
+    {9,"mmap","xuxxdl"},        {10,"mprotect","xux"},      {11,"munmap","xu"},
+    {12,"brk","x"},             {13,"rt_sigaction","dxx"},  {14,"rt_sigprocmask","dxx"},
+    {16,"ioctl","dxx"},         {17,"pread64","dxul"},      {18,"pwrite64","dbul"},
+    {19,"readv","dxd"},         {20,"writev","dxd"},        {21,"access","sx"},
+    {22,"pipe","x"},            {23,"select","dxxxx"},      {24,"sched_yield",""},
+    {28,"madvise","xud"},       {32,"dup","d"},             {33,"dup2","dd"},
+    {35,"nanosleep","xx"},      {39,"getpid",""},           {41,"socket","ddd"},
+    {42,"connect","dxu"},       {43,"accept","dxx"},        {44,"sendto","dbuxxu"},
+    {45,"recvfrom","dxuxxx"},   {46,"sendmsg","dxx"},       {47,"recvmsg","dxx"},
+    {49,"bind","dxu"},          {50,"listen","dd"},         {56,"clone","xxxxx"},
+    {57,"fork",""},             {58,"vfork",""},            {59,"execve","sxx"},
+    {60,"exit","d"},            {61,"wait4","dxxx"},        {62,"kill","dd"},
+    {63,"uname","x"},           {72,"fcntl","ddx"},         {78,"getdents","dxu"},
+    {79,"getcwd","xu"},         {80,"chdir","s"},           {82,"rename","ss"},
+    {83,"mkdir","sx"},          {84,"rmdir","s"},           {87,"unlink","s"},
+    {89,"readlink","sxu"},      {96,"gettimeofday","xx"},   {102,"getuid",""},
+    {110,"getppid",""},         {157,"prctl","dxxxx"},      {158,"arch_prctl","dx"},
+    {186,"gettid",""},          {202,"futex","xdxxxd"},     {217,"getdents64","dxu"},
+    {218,"set_tid_address","x"},{228,"clock_gettime","dx"}, {230,"clock_nanosleep","ddxx"},
+    {231,"exit_group","d"},     {232,"epoll_wait","dxdd"},  {233,"epoll_ctl","dddx"},
+    {257,"openat","dsxx"},      {262,"newfstatat","dsxx"},  {270,"pselect6","dxxxxx"},
+    {273,"set_robust_list","xu"},{281,"epoll_pwait","dxddxu"},{288,"accept4","dxxx"},
+    {290,"eventfd2","ux"},      {291,"epoll_create1","x"},  {292,"dup3","ddx"},
+    {293,"pipe2","xx"},         {302,"prlimit64","ddxx"},   {317,"seccomp","dxx"},
+    {318,"getrandom","xux"},    {332,"statx","dsxxx"},      {334,"rseq","xudx"},
+    {435,"clone3","xu"},
+};
+
+const syscall_desc* find_syscall(long nr)
+{
+    auto it=std::lower_bound(std::begin(syscall_table),std::end(syscall_table),nr,
+        [](const syscall_desc& d,long n){return d.nr<n;});
+    return it!=std::end(syscall_table) && it->nr==nr? it : nullptr;
+}
+
+std::string syscall_name(long nr)
+{
+    auto d=find_syscall(nr);
+    return d? d->name : "syscall_"+std::to_string(nr);
+}
+
+long syscall_number(const std::string& name)
+{
+    if(!name.empty() && std::all_of(name.begin(),name.end(),::isdigit))
+    {
+        return std::stol(name);
+    }
+    for(auto& d:syscall_table)
+    {
+        if(name==d.name) return d.nr;
+    }
+    return -1;
+}
+
+bool parse_syscall_list(const std::string& list,std::set<long>& out)
+{
+    std::stringstream ss{list};
+    std::string item;
+    while(std::getline(ss,item,','))
+    {
+        if(item.empty()) continue;
+        auto nr=syscall_number(item);
+        if(nr<0)
+        {
+            std::cerr << "Unknown syscall " << item << std::endl;
+            return false;
+        }
+        out.insert(nr);
+    }
+    return true;
+}
+
+static void put_escaped(std::ostream& out,const char* data,size_t len,bool more)
+{
+    out << '"';
+    for(size_t i=0;i<len;i++)
+    {
+        auto c=static_cast<unsigned char>(data[i]);
+        switch(c)
+        {
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            default:
+                if(c>=0x20 && c<0x7f)
+                {
+                    out << c;
+                }
+                else{
+                    out << "\\x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(c) << std::setfill(' ');
+                }
+        }
+    }
+    out << '"';
+    if(more) out << "...";
+}
+
+std::string format_syscall(pid_t pid,const user_regs_struct& regs)
+{
+    static const size_t max_shown=32;
+    const unsigned long long args[6]={regs.rdi,regs.rsi,regs.rdx,regs.r10,regs.r8,regs.r9};
+    auto nr=static_cast<long>(regs.orig_rax);
+    auto d=find_syscall(nr);
+    std::stringstream out;
+    out << syscall_name(nr) << '(';
+    //不认识的系统调用按 6 个十六进制参数打印
+    std::string kinds= d? d->args : "xxxxxx";
+    for(size_t i=0;i<kinds.size() && i<6;i++)
+    {
+        if(i) out << ", ";
+        auto v=args[i];
+        switch(kinds[i])
+        {
+            case 'd':
+                out << std::dec << static_cast<int>(v);
+                break;
+            case 'l':
+                out << std::dec << static_cast<long long>(v);
+                break;
+            case 'u':
+                out << std::dec << v;
+                break;
+            case 's':
+            {
+                if(v==0)
+                {
+                    out << "NULL";
+                    break;
+                }
+                auto s=read_remote_string(pid,v);
+                put_escaped(out,s.data(),std::min(s.size(),max_shown*2),s.size()>max_shown*2);
+                break;
+            }
+            case 'b':
+            {
+                auto len= i+1<6? args[i+1] : 0;
+                char buf[max_shown];
+                auto n=std::min<size_t>(len,max_shown);
+                if(v!=0 && read_remote(pid,v,buf,n))
+                {
+                    put_escaped(out,buf,n,len>n);
+                    break;
+                }
+                out << "0x" << std::hex << v;
+                break;
+            }
+            default:
+                out << "0x" << std::hex << v;
+        }
+    }
+    out << ')';
+    return out.str();
+}
+
+std::string format_syscall_ret(long ret)
+{
+    std::stringstream out;
+    if(ret<0 && ret>-4096)
+    {
+        out << std::dec << ret << " (" << strerror(-ret) << ")";
+    }
+    else if(ret>=0 && ret<0x10000)
+    {
+        out << std::dec << ret;
+    }
+    else{
+        out << "0x" << std::hex << static_cast<unsigned long>(ret);
+    }
+    return out.str();
+}
+
+std::vector<sock_filter> build_syscall_filter(const std::set<long>& nrs)
+{
+    std::vector<sock_filter> f;
+    if(nrs.empty() || nrs.size()>255)
+    {
+        return f;
+    }
+    //其他架构 (int 0x80 进来的 32 位调用) 直接放行, x32 的编号带 0x40000000 也不会匹配
+    f.push_back(BPF_STMT(BPF_LD|BPF_W|BPF_ABS,offsetof(seccomp_data,arch)));
+    f.push_back(BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,AUDIT_ARCH_X86_64,1,0));
+    f.push_back(BPF_STMT(BPF_RET|BPF_K,SECCOMP_RET_ALLOW));
+    f.push_back(BPF_STMT(BPF_LD|BPF_W|BPF_ABS,offsetof(seccomp_data,nr)));
+    //第 i 个比较命中时跳过后面 n-1-i 个比较和一条 ALLOW
+    size_t i=0,n=nrs.size();
+    for(auto nr:nrs)
+    {
+        f.push_back(BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K,static_cast<uint32_t>(nr),static_cast<uint8_t>(n-i),0));
+        ++i;
+    }
+    f.push_back(BPF_STMT(BPF_RET|BPF_K,SECCOMP_RET_ALLOW));
+    f.push_back(BPF_STMT(BPF_RET|BPF_K,SECCOMP_RET_TRACE));
+    return f;
+}
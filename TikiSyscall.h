@@ -0,0 +1,41 @@
+#ifndef __TIKISYSCALL_H__
+#define __TIKISYSCALL_H__
+
+#include<iostream>
+#include<sys/types.h>
+#include<sys/user.h>
+#include<linux/filter.h>
+#include<vector>
+#include<set>
+#include<string>
+
+/*
+    catch syscall 用的系统调用表 (x86_64) 和 seccomp 过滤器
+    参数类型:
+        d int           l long          u 无符号整数    x 十六进制 (指针, 标志)
+        s 字符串        b 输入缓冲区, 长度是下一个参数
+*/
+struct syscall_desc {
+    long nr;
+    const char* name;
+    const char* args;
+};
+
+const syscall_desc* find_syscall(long nr);
+std::string syscall_name(long nr);
+// 名字或者编号; 不认识返回 -1
+long syscall_number(const std::string& name);
+// "open,mmap,write" 或 "2,9,1"
+bool parse_syscall_list(const std::string& list,std::set<long>& out);
+
+// 解码参数, 每个字符串/缓冲区只用一次 process_vm_readv
+std::string format_syscall(pid_t pid,const user_regs_struct& regs);
+std::string format_syscall_ret(long ret);
+
+/*
+    只对 nrs 中的系统调用返回 SECCOMP_RET_TRACE, 其余 SECCOMP_RET_ALLOW, 不经过 ptrace
+    跳转偏移只有 8 位, 一个过滤器最多 255 个系统调用
+*/
+std::vector<sock_filter> build_syscall_filter(const std::set<long>& nrs);
+
+#endif
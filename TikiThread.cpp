@@ -0,0 +1,56 @@
+#include"TikiThread.h"
+
+user_regs_struct& TikiThread::get_regs()
+{
+    if(!regs_valid)
+    {
+        ptrace(PTRACE_GETREGS, t_tid, nullptr, &regs_cache);
+        regs_valid=true;
+    }
+    return regs_cache;
+}
+
+void TikiThread::set_regs(const user_regs_struct& regs)
+{
+    regs_cache=regs;
+    regs_valid=true;
+    ptrace(PTRACE_SETREGS, t_tid, nullptr, &regs_cache);
+}
+
+void TikiThread::mark_stopped(int status,bool fetch_info)
+{
+    t_state=thread_state::stopped;
+    stop_status=status;
+    regs_valid=false;
+    if(fetch_info)
+    {
+        ptrace(PTRACE_GETSIGINFO, t_tid, nullptr, &stop_info);
+    }
+    else{
+        stop_info.si_signo=0;
+    }
+}
+
+bool TikiThread::interrupt()
+{
+    if(t_state!=thread_state::running) return false;
+    if(ptrace(PTRACE_INTERRUPT, t_tid, nullptr, nullptr) < 0) return false;
+    t_state=thread_state::interrupting;
+    return true;
+}
+
+bool TikiThread::resume(int request)
+{
+    if(t_state!=thread_state::stopped) return false;
+    auto sig=pending_sig;
+    pending_sig=0;
+    if(ptrace(static_cast<__ptrace_request>(request), t_tid, nullptr, sig) < 0) return false;
+    mark_running();
+    return true;
+}
+
+bool TikiThread::stopped_at_breakpoint() const
+{
+    if(t_state!=thread_state::stopped || stop_info.si_signo!=SIGTRAP) return false;
+    return stop_info.si_code==SI_KERNEL || stop_info.si_code==TRAP_BRKPT;
+}
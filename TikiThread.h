@@ -0,0 +1,66 @@
+#ifndef __TIKITHREAD_H__
+#define __TIKITHREAD_H__
+
+#include<iostream>
+#include<unistd.h>
+#include<sys/types.h>
+#include<sys/ptrace.h>
+#include<sys/user.h>
+#include<signal.h>
+
+enum class thread_state {
+    running,
+    interrupting,   // 已发送 PTRACE_INTERRUPT, 等待停下
+    stopped
+};
+
+/*
+    被调试进程中的一个线程
+    寄存器在每次停下后第一次使用时读取一次 (PTRACE_GETREGS), 恢复运行时失效
+*/
+class TikiThread{
+    public:
+        TikiThread(pid_t tid,pid_t tgid,int num):t_tid{tid},t_tgid{tgid},t_num{num}{};
+
+        auto get_tid() const -> pid_t {return t_tid;}
+        auto get_tgid() const -> pid_t {return t_tgid;}
+        auto get_num() const -> int {return t_num;}
+        auto get_state() const -> thread_state {return t_state;}
+        auto is_stopped() const -> bool {return t_state==thread_state::stopped;}
+        auto get_stop_info() const -> const siginfo_t& {return stop_info;}
+        auto get_stop_status() const -> int {return stop_status;}
+
+        user_regs_struct& get_regs();
+        void set_regs(const user_regs_struct& regs);
+        // 下次 get_regs 重新 GETREGS (bench registers 测的就是这一次)
+        void invalidate_regs(){regs_valid=false;}
+
+        // 记录一次 ptrace-stop, reportable 的停止会同时读取 siginfo
+        void mark_stopped(int status,bool fetch_info);
+        void mark_running(){t_state=thread_state::running;regs_valid=false;}
+
+        bool interrupt();
+        bool resume(int request=PTRACE_CONT);
+
+        void set_pending_signal(int sig){pending_sig=sig;}
+        auto get_pending_signal() const -> int {return pending_sig;}
+        // 是否因为命中 int3 停下 (继续运行前需要 step over)
+        bool stopped_at_breakpoint() const;
+        void clear_stop_reason(){stop_info.si_signo=0;}
+        // inferior call 结束后恢复调用前的停止原因
+        void set_stop_info(const siginfo_t& info){stop_info=info;}
+
+    private:
+        pid_t t_tid;
+        pid_t t_tgid;
+        int t_num;
+        thread_state t_state=thread_state::stopped;
+        int stop_status=0;
+        int pending_sig=0;
+        siginfo_t stop_info{};
+
+        bool regs_valid=false;
+        user_regs_struct regs_cache;
+};
+
+#endif
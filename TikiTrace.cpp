@@ -0,0 +1,188 @@
+#include"TikiTrace.h"
+#include<fstream>
+#include<iterator>
+#include<cstring>
+#include<fcntl.h>
+#include<unistd.h>
+
+static const char trace_magic[8]={'T','I','K','I','T','R','C','\1'};
+static const size_t trace_buffer_size=1<<20;
+
+const std::array<reg,n_trace_regs> g_trace_regs {{
+    reg::rax, reg::rbx, reg::rcx, reg::rdx,
+    reg::rdi, reg::rsi, reg::rbp, reg::rsp,
+    reg::r8,  reg::r9,  reg::r10, reg::r11,
+    reg::r12, reg::r13, reg::r14, reg::r15,
+    reg::rflags
+}};
+
+static uint64_t zigzag(uint64_t delta)
+{
+    auto v=static_cast<int64_t>(delta);
+    return (static_cast<uint64_t>(v)<<1) ^ static_cast<uint64_t>(v>>63);
+}
+
+static uint64_t unzigzag(uint64_t v)
+{
+    return (v>>1) ^ (~(v&1)+1);
+}
+
+bool TikiTraceWriter::open(const std::string& path)
+{
+    close();
+    t_fd=::open(path.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(t_fd<0)
+    {
+        return false;
+    }
+    t_count=0;
+    t_bytes=0;
+    prev_pc=0;
+    prev_regs.fill(0);
+    t_done=false;
+    t_buf.reserve(trace_buffer_size);
+    t_buf.insert(t_buf.end(),trace_magic,trace_magic+sizeof(trace_magic));
+    t_thread=std::thread{&TikiTraceWriter::writer_loop,this};
+    return true;
+}
+
+void TikiTraceWriter::put_varint(uint64_t v)
+{
+    while(v>=0x80)
+    {
+        t_buf.push_back(static_cast<uint8_t>(v)|0x80);
+        v>>=7;
+    }
+    t_buf.push_back(static_cast<uint8_t>(v));
+}
+
+void TikiTraceWriter::record(const user_regs_struct& regs)
+{
+    uint64_t values[n_trace_regs];
+    uint32_t mask=0;
+    for(size_t i=0;i<n_trace_regs;i++)
+    {
+        values[i]=get_register_value(regs,g_trace_regs[i]);
+        if(values[i]!=prev_regs[i]) mask|=1u<<i;
+    }
+
+    auto pc=get_register_value(regs,reg::rip);
+    put_varint(zigzag(pc-prev_pc));
+    put_varint(mask);
+    for(size_t i=0;i<n_trace_regs;i++)
+    {
+        if(!(mask&(1u<<i))) continue;
+        put_varint(zigzag(values[i]-prev_regs[i]));
+        prev_regs[i]=values[i];
+    }
+    prev_pc=pc;
+    ++t_count;
+
+    if(t_buf.size()>=trace_buffer_size-0x100)
+    {
+        flush_buffer();
+    }
+}
+
+void TikiTraceWriter::flush_buffer()
+{
+    if(t_buf.empty()) return;
+    t_bytes+=t_buf.size();
+    std::vector<uint8_t> next;
+    {
+        std::lock_guard<std::mutex> lock{t_mutex};
+        t_full.push_back(std::move(t_buf));
+        if(!t_spare.empty())
+        {
+            next=std::move(t_spare.back());
+            t_spare.pop_back();
+        }
+    }
+    t_cond.notify_one();
+    next.clear();
+    next.reserve(trace_buffer_size);
+    t_buf=std::move(next);
+}
+
+void TikiTraceWriter::writer_loop()
+{
+    std::unique_lock<std::mutex> lock{t_mutex};
+    while(true)
+    {
+        t_cond.wait(lock,[this]{return t_done || !t_full.empty();});
+        if(t_full.empty() && t_done) break;
+        auto buf=std::move(t_full.front());
+        t_full.pop_front();
+        lock.unlock();
+        size_t off=0;
+        while(off<buf.size())
+        {
+            auto n=::write(t_fd,buf.data()+off,buf.size()-off);
+            if(n<=0) break;
+            off+=n;
+        }
+        lock.lock();
+        t_spare.push_back(std::move(buf));
+    }
+}
+
+void TikiTraceWriter::close()
+{
+    if(t_fd<0) return;
+    flush_buffer();
+    {
+        std::lock_guard<std::mutex> lock{t_mutex};
+        t_done=true;
+    }
+    t_cond.notify_one();
+    t_thread.join();
+    ::close(t_fd);
+    t_fd=-1;
+    t_spare.clear();
+}
+
+
+bool TikiTraceReader::open(const std::string& path)
+{
+    std::ifstream file{path,std::ios::binary};
+    if(!file) return false;
+    t_data.assign(std::istreambuf_iterator<char>{file},std::istreambuf_iterator<char>{});
+    if(t_data.size()<sizeof(trace_magic) || std::memcmp(t_data.data(),trace_magic,sizeof(trace_magic))!=0)
+    {
+        return false;
+    }
+    t_pos=sizeof(trace_magic);
+    t_index=0;
+    t_cur=trace_record{};
+    return true;
+}
+
+bool TikiTraceReader::get_varint(uint64_t& v)
+{
+    v=0;
+    for(int shift=0; t_pos<t_data.size() && shift<64; shift+=7)
+    {
+        auto b=t_data[t_pos++];
+        v|=static_cast<uint64_t>(b&0x7f)<<shift;
+        if(!(b&0x80)) return true;
+    }
+    return false;
+}
+
+bool TikiTraceReader::next(trace_record& rec)
+{
+    uint64_t pc_delta,mask;
+    if(!get_varint(pc_delta) || !get_varint(mask)) return false;
+    t_cur.pc+=unzigzag(pc_delta);
+    t_cur.changed=static_cast<uint32_t>(mask);
+    for(size_t i=0;i<n_trace_regs;i++)
+    {
+        if(!(mask&(1u<<i))) continue;
+        uint64_t delta;
+        if(!get_varint(delta)) return false;
+        t_cur.regs[i]+=unzigzag(delta);
+    }
+    ++t_index;
+    rec=t_cur;
+    return true;
+}
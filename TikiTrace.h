@@ -0,0 +1,83 @@
+#ifndef __TIKITRACE_H__
+#define __TIKITRACE_H__
+
+#include<iostream>
+#include<sys/user.h>
+#include<vector>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include"TikiReg.h"
+
+/*
+    指令 trace 文件格式:
+        文件头 "TIKITRC\1"
+        每条指令一条记录, 与上一条记录做差分:
+            varint(zigzag(pc - 上一个 pc))
+            varint(mask)                      哪些寄存器变了, 第 i 位对应 g_trace_regs[i]
+            mask 中每个置位的寄存器: varint(zigzag(新值 - 旧值))
+    第一条记录与全 0 做差分
+*/
+constexpr std::size_t n_trace_regs = 17;
+extern const std::array<reg,n_trace_regs> g_trace_regs;
+
+struct trace_record {
+    uint64_t pc;
+    uint32_t changed;       // 相对上一条记录
+    std::array<uint64_t,n_trace_regs> regs;
+};
+
+/*
+    编码在调用线程里完成 (几个字节), 写文件交给后台线程,
+    单步循环不会被磁盘 IO 拖慢
+*/
+class TikiTraceWriter{
+    public:
+        TikiTraceWriter()=default;
+        ~TikiTraceWriter(){close();}
+
+        bool open(const std::string& path);
+        void record(const user_regs_struct& regs);
+        void close();
+
+        auto get_count() const -> uint64_t {return t_count;}
+        auto get_bytes() const -> uint64_t {return t_bytes;}
+
+    private:
+        void put_varint(uint64_t v);
+        void flush_buffer();
+        void writer_loop();
+
+        int t_fd=-1;
+        uint64_t t_count=0;
+        uint64_t t_bytes=0;
+        uint64_t prev_pc=0;
+        std::array<uint64_t,n_trace_regs> prev_regs{};
+
+        std::vector<uint8_t> t_buf;
+        std::deque<std::vector<uint8_t>> t_full;
+        std::vector<std::vector<uint8_t>> t_spare;   // 写完的缓冲区循环使用
+        std::mutex t_mutex;
+        std::condition_variable t_cond;
+        bool t_done=false;
+        std::thread t_thread;
+};
+
+class TikiTraceReader{
+    public:
+        bool open(const std::string& path);
+        // 读下一条记录, 文件结束返回 false
+        bool next(trace_record& rec);
+        auto get_index() const -> uint64_t {return t_index;}
+
+    private:
+        bool get_varint(uint64_t& v);
+
+        std::vector<uint8_t> t_data;
+        size_t t_pos=0;
+        uint64_t t_index=0;
+        trace_record t_cur{};
+};
+
+#endif
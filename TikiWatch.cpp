@@ -0,0 +1,123 @@
+#include"TikiWatch.h"
+#include<fstream>
+#include<sstream>
+#include<sys/mman.h>
+
+void TikiWatchTable::add_span(std::vector<page_span>& out,uint64_t page,int prot)
+{
+    //相邻且权限相同的页合并, 一次 mprotect
+    if(!out.empty() && out.back().addr+out.back().len==page && out.back().prot==prot)
+    {
+        out.back().len+=page_size;
+        return;
+    }
+    out.push_back({page,page_size,prot});
+}
+
+int TikiWatchTable::add(pid_t pid,uint64_t addr,uint64_t len,std::vector<page_span>& to_protect,std::string& err)
+{
+    if(len==0 || addr+len<addr)
+    {
+        err="bad range";
+        return 0;
+    }
+    auto lo=addr&~(page_size-1);
+    auto hi=(addr+len+page_size-1)&~(page_size-1);
+    //先从 maps 查出每一页原来的权限, 全部可写才修改
+    std::vector<std::pair<uint64_t,int>> fresh;
+    std::ifstream map("/proc/"+std::to_string(pid)+"/maps");
+    std::string line;
+    auto page=lo;
+    while(page<hi && std::getline(map,line))
+    {
+        std::istringstream ls{line};
+        std::string addrs,perms;
+        ls >> addrs >> perms;
+        auto dash=addrs.find('-');
+        if(dash==std::string::npos || perms.size()<3) continue;
+        auto start=std::stoull(addrs.substr(0,dash),0,16);
+        auto end=std::stoull(addrs.substr(dash+1),0,16);
+        if(end<=page) continue;
+        if(start>page) break;
+        int prot=(perms[0]=='r'? PROT_READ : 0)|(perms[1]=='w'? PROT_WRITE : 0)|(perms[2]=='x'? PROT_EXEC : 0);
+        for(;page<end && page<hi;page+=page_size)
+        {
+            if(pages.count(page)) continue;
+            if(!(prot&PROT_WRITE))
+            {
+                std::stringstream ss;
+                ss << "0x" << std::hex << page << " is not writable";
+                err=ss.str();
+                return 0;
+            }
+            fresh.push_back({page,prot});
+        }
+    }
+    if(page<hi)
+    {
+        std::stringstream ss;
+        ss << "0x" << std::hex << page << " is not mapped";
+        err=ss.str();
+        return 0;
+    }
+    for(auto p=lo;p<hi;p+=page_size)
+    {
+        if(pages.count(p)) ++pages[p].refs;
+    }
+    for(auto& f:fresh)
+    {
+        pages[f.first]={f.second,1};
+        add_span(to_protect,f.first,f.second);
+    }
+    auto num=next_num++;
+    ranges[num]={num,addr,len,0};
+    return num;
+}
+
+bool TikiWatchTable::remove(int num,std::vector<page_span>& to_restore)
+{
+    auto it=ranges.find(num);
+    if(it==ranges.end())
+    {
+        return false;
+    }
+    auto lo=it->second.addr&~(page_size-1);
+    auto hi=(it->second.addr+it->second.len+page_size-1)&~(page_size-1);
+    for(auto p=lo;p<hi;p+=page_size)
+    {
+        auto pi=pages.find(p);
+        if(pi==pages.end() || --pi->second.refs>0) continue;
+        add_span(to_restore,p,pi->second.prot);
+        pages.erase(pi);
+    }
+    ranges.erase(it);
+    return true;
+}
+
+void TikiWatchTable::all_pages(std::vector<page_span>& out) const
+{
+    for(auto& p:pages)
+    {
+        add_span(out,p.first,p.second.prot);
+    }
+}
+
+bool TikiWatchTable::is_protected(uint64_t addr) const
+{
+    return pages.count(addr&~(page_size-1))!=0;
+}
+
+int TikiWatchTable::original_prot(uint64_t addr) const
+{
+    auto it=pages.find(addr&~(page_size-1));
+    return it==pages.end()? 0 : it->second.prot;
+}
+
+watch_range* TikiWatchTable::find_range(uint64_t addr)
+{
+    for(auto& r:ranges)
+    {
+        if(addr>=r.second.addr && addr<r.second.addr+r.second.len) return &r.second;
+    }
+    return nullptr;
+}
@@ -0,0 +1,62 @@
+#ifndef __TIKIWATCH_H__
+#define __TIKIWATCH_H__
+
+#include<iostream>
+#include<sys/types.h>
+#include<cstdint>
+#include<map>
+#include<vector>
+#include<string>
+
+/*
+    watch-range: 调试寄存器最多 4 个 8 字节, 大块内存用页保护代替
+    覆盖到的页改成只读, 写入时被调试进程收到 SIGSEGV (SEGV_ACCERR):
+        地址在范围内 -> 报告; 同一页的范围外 -> 不报告
+        两种情况都临时放开这一页单步执行那条指令, 再保护回去
+    多个范围可以共用一页, 按引用计数恢复原来的权限
+*/
+struct watch_range {
+    int num;
+    uint64_t addr;
+    uint64_t len;
+    uint64_t hits;
+};
+
+// 一段连续的页和它原来的权限 (PROT_*)
+struct page_span {
+    uint64_t addr;
+    uint64_t len;
+    int prot;
+};
+
+class TikiWatchTable{
+    public:
+        // 成功返回编号, 需要改成只读的页放进 to_protect; 不可写的映射返回 0
+        int add(pid_t pid,uint64_t addr,uint64_t len,std::vector<page_span>& to_protect,std::string& err);
+        // 不再被任何范围引用的页放进 to_restore
+        bool remove(int num,std::vector<page_span>& to_restore);
+        // 所有被保护的页 (fork 出的子进程不再被跟踪时要恢复)
+        void all_pages(std::vector<page_span>& out) const;
+        void clear(){ranges.clear();pages.clear();}
+
+        bool is_protected(uint64_t addr) const;
+        int original_prot(uint64_t addr) const;
+        watch_range* find_range(uint64_t addr);
+        auto get_ranges() const -> const std::map<int,watch_range>& {return ranges;}
+        auto empty() const -> bool {return ranges.empty();}
+
+        static const uint64_t page_size=0x1000;
+
+    private:
+        struct page_info {
+            int prot;
+            int refs;
+        };
+        static void add_span(std::vector<page_span>& out,uint64_t page,int prot);
+
+        std::map<int,watch_range> ranges;
+        std::map<uint64_t,page_info> pages;
+        int next_num=1;
+};
+
+#endif
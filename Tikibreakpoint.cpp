@@ -1,17 +1,16 @@
 #include"Tikibreakpoint.h"
+#include"TikiMem.h"
 
+//通过 /proc/pid/mem 修改, 其他线程在运行 (non-stop) 时也能插入/删除断点
 void Tikibreakpoint::enable(){
-    auto data = ptrace(PTRACE_PEEKDATA, b_pid,b_addr, nullptr);
-    save_byte=static_cast<uint8_t>(data&0xff);
-    uint64_t data_with_int3 = ((data & ~0xff) | int3_byte); //set bottom byte to 0xcc
-    ptrace(PTRACE_POKEDATA, b_pid, b_addr, data_with_int3);
+    read_remote(b_pid,b_addr,&save_byte,1);
+    uint8_t int3=int3_byte;
+    write_remote(b_pid,b_addr,&int3,1);
 
     enabled = true;
 }
 
 void Tikibreakpoint::disable(){
-    auto data = ptrace(PTRACE_PEEKDATA, b_pid,b_addr, nullptr);
-    uint64_t data_with_int3 = ((data & ~0xff) | save_byte); //set bottom byte to 0xcc
-    ptrace(PTRACE_POKEDATA, b_pid, b_addr, data_with_int3);
+    write_remote(b_pid,b_addr,&save_byte,1);
     enabled = false;
-}
\ No newline at end of file
+}
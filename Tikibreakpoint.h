@@ -15,6 +15,8 @@ class Tikibreakpoint{
     public:
         Tikibreakpoint(pid_t pid,std::intptr_t addr):b_pid{pid},b_addr{addr},enabled{true},save_byte{0}{};
         Tikibreakpoint():b_pid{0},b_addr{0},enabled{true},save_byte{0}{};
+        // fork 出的子进程继承了内存里的 int3, 拷贝一份状态即可
+        Tikibreakpoint(pid_t pid,std::intptr_t addr,const Tikibreakpoint& from):b_pid{pid},b_addr{addr},enabled{from.enabled},save_byte{from.save_byte}{};
         void enable();
         void disable();
 
@@ -3,6 +3,30 @@
 #include"Tikibreakpoint.h"
 #include <unordered_map>
 #include"TikiReg.h"
+#include"TikiModule.h"
+#include"TikiThread.h"
+#include"TikiMem.h"
+#include"TikiTrace.h"
+#include"TikiBlock.h"
+#include"TikiEmu.h"
+#include"TikiRecord.h"
+#include"TikiFuzz.h"
+#include"TikiSyscall.h"
+#include"TikiFastTrace.h"
+#include"TikiSignal.h"
+#include"TikiEventLoop.h"
+#include"TikiWatch.h"
+#include"TikiGdbServer.h"
+#include"TikiScript.h"
+#include"TikiJson.h"
+#include"TikiCommand.h"
+#include"TikiProfile.h"
+#include"TikiPerf.h"
+#include"TikiStats.h"
+#include"TikiBench.h"
+#include<map>
+#include<set>
+#include<deque>
 #include <iomanip>
 #include"libelfin/elf/elf++.hh"
 #include"libelfin/dwarf/dwarf++.hh"
@@ -12,9 +36,72 @@
 #include<fstream>
 #include<capstone/capstone.h>
 #include <sys/uio.h>
+#include <sys/auxv.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include <linux/seccomp.h>
+#include <sys/mman.h>
+#include <chrono>
+enum class follow_fork {
+    parent, child, both
+};
+
+enum class reverse_mode {
+    stepi, cont, finish
+};
+
+static const long trace_options = PTRACE_O_TRACECLONE|PTRACE_O_TRACEEXEC|
+    PTRACE_O_TRACEFORK|PTRACE_O_TRACEVFORK|PTRACE_O_TRACEVFORKDONE|
+    PTRACE_O_TRACESECCOMP|PTRACE_O_TRACESYSGOOD;
+
+/*
+    follow-fork-mode both 时, 不是当前选中的进程的状态放在这里
+    切换进程时和 TikiDbg 中对应的成员交换
+*/
+struct TikiInferior {
+    std::string program_name;
+    std::unordered_map<std::intptr_t,Tikibreakpoint> breakpoints;
+    TikiModuleTable modules;
+    uint64_t binary_addr_base;
+    uint64_t solib_event_addr;
+    uint64_t displaced_addr;
+};
+
+/*
+    checkpoint: 在被调试进程里注入 fork 得到的子进程, 一直停在 ptrace 下不运行
+    内存靠写时复制保存, 几乎不占开销
+*/
+struct TikiCheckpoint {
+    pid_t pid;
+    uint64_t pc;
+    std::unordered_map<std::intptr_t,uint8_t> breakpoints;     // 建立时内存里已有的 int3 (地址 -> 原字节)
+    std::vector<std::pair<uint64_t,uint8_t>> fast_patches;     // 建立时已有的 fast tracepoint 的 jmp (地址 -> 原字节)
+    std::vector<page_span> watched_pages;                      // 建立时被 watch 去掉写权限的页
+};
+
+/*
+    call func(args): 调用前的寄存器, 嵌套调用 (条件断点里再调用) 时一层一层压栈
+    被调用函数返回到 call_trap 处的 int3
+*/
+struct TikiCallFrame {
+    pid_t tid;
+    uint64_t func;
+    user_regs_struct regs;
+    user_fpregs_struct fpregs;
+    siginfo_t stop_info;
+    int pending_sig;            // 停下时挂着的 pass 信号, 不能在被调用的函数里投递掉
+};
+
+struct call_arg {
+    bool is_string;
+    uint64_t value;
+    std::string str;        // 字符串参数复制到被调试进程的栈上, 传地址
+};
+
 class TikiDbg{
     public:
-        TikiDbg(std::string program,pid_t pid): program_name{std::move(program)},pid_me{pid}{
+        TikiDbg(std::string program,pid_t pid,bool attach=false): program_name{std::move(program)},pid_me{pid},tgid_me{pid},attach_mode{attach}{
             auto fd = open(program_name.c_str(),0);
             // create_mmap_loader: args is UNIX file descriptor
             // open is used  instead of std::ifstream
@@ -23,7 +110,8 @@ class TikiDbg{
         }
 
         void run();
-        void handle_command(const std::string &line);
+        void handle_command(std::string_view line);
+        void execute_command(const cmd_args& args);
         void continue_execution();
 
         void set_breakpoint_at_addr(std::intptr_t addr);
@@ -33,12 +121,15 @@ class TikiDbg{
         uint64_t read_memory(uint64_t addr);
         void write_memory(uint64_t addr,uint64_t value);
 
-        uint64_t get_pc(){return get_register_value(pid_me,reg::rip);};
-        void set_pc(uint64_t value){set_register_value(pid_me,reg::rip,value);};
+        uint64_t get_pc(){return get_reg(reg::rip);};
+        void set_pc(uint64_t value){set_reg(reg::rip,value);};
+        uint64_t get_reg(reg r){return get_register_value(cur_thread().get_regs(),r);};
+        void set_reg(reg r,uint64_t value);
 
         void step_over_breakpoint();
         void single_step_instruction_with_breakpoint_check();
         void wait_for_signal();
+        void report_stop();
 
         // dwarf::die get_function_from_pc(uint64_t pc);
         // dwarf::line_table::iterator get_line_entry_from_pc(uint64_t pc);
@@ -51,15 +142,269 @@ class TikiDbg{
         siginfo_t get_signal_info();
         void handle_sigtrap(siginfo_t info);
 
+        uint64_t parse_break_target(std::string_view addr);
+
+        void start_inferior();
+        bool attach_inferior();
+        void detach();
+        TikiThread& add_thread(pid_t tid,pid_t tgid=0);
+        TikiThread& cur_thread(){return add_thread(pid_me);};
+        bool dispatch_event(pid_t tid,int status);
+        bool pop_event(pid_t& tid);
+        bool next_event(pid_t& tid);
+        pid_t wait_any(int& status);
+        void poll_events();
+        char* read_command(const char* prompt);
+        void handle_background_events(uint32_t ready);
+        void continue_background();
+        bool interrupt_threads(bool all);
+        pid_t take_interrupt_event(pid_t want);
+        void stop_all_threads();
+        void resume_all_threads();
+        void step_over_thread_breakpoint(TikiThread& th);
+        void list_threads();
+        void select_thread(int num);
+        bool require_stopped();
+
+        bool step_thread_quietly(TikiThread& th);
+        bool displaced_step(uint64_t bp_addr);
+        void step_over_breakpoint_non_stop(uint64_t bp_addr);
+        void continue_all_non_stop();
+        bool step_over_breakpoint_quietly();
+
+        bool step_thread_fast(pid_t tid,int request,int& status,int* resume_err=nullptr);
+        uint64_t step_instructions(uint64_t count,uint64_t until,TikiTraceWriter* trace);
+        TikiEmu& emulator();
+        uint64_t emulate_batch(TikiThread& th,uint64_t max,uint64_t until,TikiTraceWriter* trace);
+        void check_emulation(uint64_t count);
+
+        bool inject_syscall(pid_t tid,uint64_t scratch,long nr,std::initializer_list<uint64_t> args,uint64_t& ret,pid_t* forked=nullptr);
+        void create_checkpoint();
+        void restart_checkpoint(int num);
+        void delete_checkpoint(int num);
+        void list_checkpoints();
+
+        void record_before(TikiThread& th);
+        void reverse_execute(reverse_mode mode,uint64_t count);
+        void fuzz(uint64_t start,uint64_t end,uint64_t input,size_t len,uint64_t iterations,uint64_t timeout_ns);
+        void profile(unsigned hz,uint64_t duration_ns,const std::string& path);
+        void profile_sample(std::vector<uint64_t>& frames,std::vector<uint8_t>& scratch);
+        std::string profile_frame_name(uint64_t addr);
+
+        void set_launch_syscalls(const std::set<long>& nrs){caught_syscalls=filtered_syscalls=nrs;}
+        void set_gdbserver(const std::string& spec){gdbserver_spec=spec;}
+        void set_script(TikiScript script){t_script=std::move(script);}
+        void set_json(TikiJsonWriter* w){t_json=w;}
+        bool install_syscall_filter(const std::set<long>& nrs);
+        void catch_syscalls(const std::set<long>& nrs);
+        bool syscall_entry(TikiThread& th);
+        void syscall_exit(TikiThread& th);
+        void flush_syscall_log(pid_t tid);
+
+        bool call_function(uint64_t func,const std::vector<call_arg>& args,uint64_t& ret);
+        void finish_call(bool print_value);
+
+        bool fast_trace_setup(uint64_t near,uint64_t& tramp);
+        void add_fast_tracepoint(uint64_t addr);
+        void delete_fast_tracepoint(uint64_t addr);
+        bool protect_pages(pid_t tid,const std::vector<page_span>& spans,bool watched);
+        void add_watch_range(uint64_t addr,uint64_t len);
+        void delete_watch_range(int num);
+        bool handle_watch_fault(TikiThread& th,bool& report);
+        void add_hw_watch(uint64_t addr,size_t len);
+        void set_counters(bool on);
+        void report_counters();
+
+        // --interpreter=json: 停止事件的公共字段, 调用者补充字段后 end()
+        TikiJsonWriter& json_stop(const char* reason);
+        void bench_output(uint64_t n);
+        bool bench_breakpoint(uint64_t n,uint64_t addr,bench_result& r);
+        bool bench_step(uint64_t n,bench_result& r);
+        bool bench_read(uint64_t n,uint64_t chunk,bench_result& r);
+        bool bench_per_stop(uint64_t n,bool registers,bench_result& r);
+        bool bench_backtrace(uint64_t n,bench_result& r);
+        bool bench_symbols(uint64_t n,bench_result& by_addr,bench_result& by_name);
+
+        // 命令表和命令; 表在编译期排好序, 见 TikiCommand.h
+        using command_handler=void (TikiDbg::*)(const cmd_args&);
+        static const auto& command_table();
+        static void complete_command(const char* buf,linenoiseCompletions* lc);
+        static char* command_hint(const char* buf,int* color,int* bold);
+        void cmd_continue(const cmd_args& args);
+        void cmd_break(const cmd_args& args);
+        void cmd_delete(const cmd_args& args);
+        void cmd_register(const cmd_args& args);
+        void cmd_set(const cmd_args& args);
+        void cmd_memory(const cmd_args& args);
+        void cmd_modules(const cmd_args& args);
+        void cmd_detach(const cmd_args& args);
+        void cmd_thread(const cmd_args& args);
+        void cmd_instep(const cmd_args& args);
+        void cmd_blockstep(const cmd_args& args);
+        void cmd_branches(const cmd_args& args);
+        void cmd_emucheck(const cmd_args& args);
+        void cmd_checkpoint(const cmd_args& args);
+        void cmd_restart(const cmd_args& args);
+        void cmd_record(const cmd_args& args);
+        void cmd_reverse_stepi(const cmd_args& args);
+        void cmd_reverse_continue(const cmd_args& args);
+        void cmd_reverse_finish(const cmd_args& args);
+        void reverse_command(const cmd_args& args,reverse_mode mode);
+        bool require_record_thread();
+        void cmd_call(const cmd_args& args);
+        void cmd_interrupt(const cmd_args& args);
+        void cmd_output_bench(const cmd_args& args);
+        void cmd_event_loop(const cmd_args& args);
+        void cmd_handle(const cmd_args& args);
+        void cmd_ftrace_fast(const cmd_args& args);
+        void cmd_catch(const cmd_args& args);
+        void cmd_watch(const cmd_args& args);
+        void cmd_watch_range(const cmd_args& args);
+        void cmd_fuzz(const cmd_args& args);
+        void cmd_trace_insn(const cmd_args& args);
+        void cmd_trace_view(const cmd_args& args);
+        void cmd_profile(const cmd_args& args);
+        void cmd_stats(const cmd_args& args);
+        void cmd_bench(const cmd_args& args);
+        void cmd_next(const cmd_args& args);
+
+        void run_batch();
+        bool run_script(const std::vector<script_cmd>& cmds,const std::vector<std::string>* call_args,int depth);
+        bool eval_condition(const std::vector<std::string>& expr,size_t from,int64_t& value);
+        bool eval_operand(const std::string& tok,int64_t& value);
+
+        void serve_gdb();
+        bool rsp_handle(const std::string& pkt);
+        void rsp_resume(const std::string& actions);
+        bool rsp_step(TikiThread& th);
+        pid_t rsp_wait();
+        void rsp_rewind_breakpoints();
+        std::string rsp_stop_reply(pid_t tid);
+        user_fpregs_struct& rsp_fpregs_of(pid_t tid);
+        std::string rsp_read_memory(uint64_t addr,size_t len);
+        bool rsp_write_memory(uint64_t addr,const uint8_t* data,size_t len);
+
+        size_t drain_fast_trace();
+        void show_fast_trace(size_t count);
+        size_t read_code(uint64_t addr,uint8_t* buf,size_t size);
+        TikiBlockCache& block_cache();
+        void record_branch(uint64_t block,uint64_t pc);
+        void step_blocks(uint64_t count,uint64_t until);
+        void list_branches(uint64_t count,bool with_insns);
+        void view_trace(const std::string& path,uint64_t start,uint64_t count);
+
+        void select_tid(pid_t tid);
+        void switch_inferior(pid_t tgid,bool park_current=true);
+        std::unordered_map<std::intptr_t,Tikibreakpoint>& breakpoints_of(pid_t tgid);
+        void resume_after_event(TikiThread& th,bool was_interrupting);
+        void handle_fork(pid_t tid,bool is_vfork);
+        void handle_vfork_done(pid_t tid);
+        void handle_exec(pid_t tid);
+        void detach_process(pid_t tgid);
+
     private:
         std::string program_name;
-        pid_t pid_me;
+        pid_t pid_me;       // 当前选中的线程
+        pid_t tgid_me;
         std::unordered_map<std::intptr_t,Tikibreakpoint> t_breakpoints;
 
         dwarf::dwarf dwarf_me;
         elf::elf elf_me;
         uint64_t binary_addr_base;
         csh cs_handle;
+
+        TikiModuleTable t_modules;
+        uint64_t solib_event_addr=0;
+        bool internal_stop=false;
+
+        std::map<pid_t,TikiThread> t_threads;
+        std::deque<pid_t> t_events;     // 已经停下但还没报告的线程
+        int next_thread_num=1;
+        bool threads_running=false;
+        bool process_exited=false;
+        pid_t stepping_tid=0;           // 正在单步的线程, 其他线程的事件先排队
+        int stepping_request=PTRACE_SINGLESTEP;
+
+        bool attach_mode;
+        bool detached=false;
+
+        bool non_stop=false;
+        uint64_t displaced_addr=0;      // displaced stepping 用的临时代码区 (程序入口点)
+
+        follow_fork follow_mode=follow_fork::parent;
+        std::map<pid_t,TikiInferior> t_inferiors;   // 其他被跟踪的进程
+        std::set<pid_t> fork_children;              // 初始停止先于 fork 事件到达的子进程
+        std::set<pid_t> vfork_stripped;             // vfork 期间临时去掉了断点的父线程
+        std::set<pid_t> detach_on_vfork_done;       // 跟随 vfork 子进程, 等子进程 exec/exit 后再放开父进程
+
+        std::unique_ptr<TikiBlockCache> t_blocks;
+        std::vector<branch_edge> branch_edges;      // 上一次 blockstep 经过的跳转
+        uint64_t branch_trace_start=0;
+
+        std::unique_ptr<TikiEmu> t_emu;
+        bool emulate=false;
+        uint64_t emu_batch=4096;        // 最多连续模拟多少条再同步回被调试进程
+        bool emu_maps_stale=true;
+
+        std::map<int,TikiCheckpoint> t_checkpoints;
+        int next_checkpoint=1;
+
+        TikiRecord t_record;
+        bool recording=false;           // 打开后 continue/instep 都逐条单步并记录
+        pid_t record_tid=0;             // 日志只属于开始记录时的线程
+
+        bool quiet_stops=false;         // fuzz 循环中不打印停止信息
+        uint64_t wait_deadline=0;       // 非 0 时等待到这个时刻 (CLOCK_MONOTONIC ns) 为止, 然后像 Ctrl-C 一样停下
+        bool wait_timed_out=false;
+
+        std::set<long> caught_syscalls;     // catch syscall 选中的
+        std::set<long> filtered_syscalls;   // 已经装进 seccomp 过滤器的, 过滤器装上后不能撤销
+        bool syscall_log=false;             // 只打印不停下 (类似 strace)
+        std::map<pid_t,std::string> syscall_pending;    // 日志模式下等返回值的系统调用
+
+        TikiSignals t_signals;
+
+        std::vector<TikiCallFrame> call_frames;
+        uint64_t call_trap=0;
+        uint8_t call_trap_save=0;
+
+        TikiFastTrace t_fast;
+        std::deque<fast_record> fast_history;   // 已经从环形缓冲区读出的记录, 保留最近的
+        uint64_t fast_lost=0;
+        uint64_t fast_new=0;            // 上次 show 之后读出的记录数
+
+        TikiProfile t_profile;
+        std::vector<pid_t> profile_running;     // 这次采样前在运行的线程
+
+        TikiWatchTable t_watch;
+        struct watch_hit {
+            int num;
+            uint64_t addr,pc;
+            uint64_t old_value,new_value;
+            size_t size;
+        };
+        std::map<pid_t,watch_hit> watch_hits;  // 已经单步过写入指令, 等待报告
+        TikiPerfWatches t_hwwatch;      // watch: perf 硬件断点, 只加在当前进程的线程上
+
+        TikiPerfCounters t_counters;
+        bool counters_on=false;
+        std::vector<uint64_t> counter_values;
+
+        TikiJsonWriter* t_json=nullptr;
+        TikiScript t_script;
+        std::map<std::string,int64_t> script_vars;     // 脚本里 set $name 设置的变量
+        bool script_quit=false;
+
+        std::string gdbserver_spec;
+        TikiRspConnection t_rsp;
+        std::map<pid_t,user_fpregs_struct> rsp_fpregs;  // 每次停下后第一次用到时读取
+        std::set<pid_t> rsp_swbreak;                    // 这次停下时 pc 已经退回到断点地址的线程
+        std::set<uint64_t> rsp_breakpoints;             // gdb 用 Z0 插入的断点
+        int last_exit_status=0;
+
+        TikiEventLoop t_loop;
+        bool interrupt_stop=false;      // 这次停下是被打断的, 没有信号
+        uint64_t drain_interval_us=10000;
 };
 
 void TikiDbg::single_step_instruction_with_breakpoint_check()
@@ -70,8 +415,10 @@ void TikiDbg::single_step_instruction_with_breakpoint_check()
         step_over_breakpoint();
     }
     else {
-        ptrace(PTRACE_SINGLESTEP, pid_me, nullptr, nullptr);
+        stepping_tid=pid_me;
+        cur_thread().resume(PTRACE_SINGLESTEP);
         wait_for_signal();
+        stepping_tid=0;
     }
 }
 
@@ -101,7 +448,18 @@ void TikiDbg::print_disassembly(uint64_t addr,uint64_t size,size_t n_code)
     }
 
     count = cs_disasm(cs_handle, buf1, 255, addr, n_code, &insn);
-    if(count > 0)
+    if(count > 0 && t_json)
+    {
+        t_json->begin("disassembly").open_array("insns");
+        for(size_t i=0; i<count; i++)
+        {
+            t_json->open_object(nullptr).hex("addr",insn[i].address).num("size",insn[i].size)
+                .str("mnemonic",insn[i].mnemonic).str("operands",insn[i].op_str).close_object();
+        }
+        t_json->close_array().end();
+        cs_free(insn, count);
+    }
+    else if(count > 0)
     {
         std::cout << "----------------TikiDbg----------------" << std::endl ;
         for(int i=0; i<count; i++)
@@ -123,18 +481,84 @@ void TikiDbg::handle_sigtrap(siginfo_t info)
         case SI_KERNEL:
         case TRAP_BRKPT:
         {
-            // set_pc(get_pc()-1); //put the pc back where it should be
-            std::cout << "Hit breakpoint at address 0x" << std::hex << get_pc()-1 << std::endl;
-            // auto offset_pc = offset_load_address(get_pc()); //rember to offset the pc for querying DWARF
-            // auto line_entry = get_line_entry_from_pc(offset_pc);
             uint64_t now_pc= get_pc()-1;
+            if(!call_frames.empty() && now_pc==call_trap && call_frames.back().tid==pid_me)
+            {//call 中途停下后继续运行, 函数返回了
+                finish_call(true);
+                print_disassembly(get_pc(),0x50,7);
+                return;
+            }
+            if(solib_event_addr!=0 && now_pc==solib_event_addr)
+            {//dlopen/dlclose, 更新模块表后由 continue_execution 继续运行
+                t_modules.update_from_link_map();
+                internal_stop=true;
+                return;
+            }
+            // set_pc(get_pc()-1); //put the pc back where it should be
+            auto sym = t_modules.symbolize(now_pc);
+            std::string file;
+            unsigned line=0;
+            auto m = t_modules.find_by_addr(now_pc);
+            bool has_line= m && m->lookup_line(now_pc,file,line);
+            if(t_json)
+            {
+                auto& j=json_stop("breakpoint").hex("addr",now_pc);
+                if(!sym.empty()) j.str("symbol",sym);
+                if(has_line) j.str("file",file).num("line",line);
+                j.end();
+            }
+            else{
+                std::cout << "Hit breakpoint at address 0x" << std::hex << now_pc;
+                if(!sym.empty()) std::cout << " <" << sym << ">";
+                std::cout << std::endl;
+                if(has_line) std::cout << file << ":" << std::dec << line << std::endl;
+            }
             print_disassembly(now_pc,0x50,7);
             return;
         }
+        //seccomp 过滤器返回 SECCOMP_RET_TRACE, 停在系统调用入口
+        case SIGTRAP|(PTRACE_EVENT_SECCOMP<<8):
+        {
+            if(t_json)
+            {
+                json_stop("syscall").str("call",format_syscall(tgid_me,cur_thread().get_regs())).end();
+            }
+            else{
+                std::cout << "Catchpoint: syscall " << format_syscall(tgid_me,cur_thread().get_regs()) << std::endl;
+            }
+            print_disassembly(get_pc(),0x50,7);
+            return;
+        }
+        //watch 的 perf 断点, 写入指令已经执行完
+        case TRAP_PERF:
+        {
+            auto w=t_hwwatch.find(static_cast<int>(perf_sig_data(info)));
+            if(w==nullptr)
+            {
+                std::cout << "Unknown perf event trap" << std::endl;
+                return;
+            }
+            uint64_t value=0;
+            read_remote(pid_me,w->addr,&value,w->len);
+            ++w->hits;
+            if(t_json)
+            {
+                json_stop("watch").num("num",w->num).hex("addr",w->addr).hex("old",w->value).hex("new",value).end();
+            }
+            else{
+                std::cout << "Watch " << std::dec << w->num << ": 0x" << std::hex << w->addr
+                    << "\nOld value = 0x" << std::setw(w->len*2) << std::setfill('0') << w->value
+                    << "\nNew value = 0x" << std::setw(w->len*2) << value << std::setfill(' ') << std::endl;
+            }
+            w->value=value;
+            print_disassembly(get_pc(),0x50,7);
+            return;
+        }
         //this will be set if the signal was sent by single stepping
         case TRAP_TRACE:
         {
             uint64_t now_pc= get_pc();
+            if(t_json) json_stop("step").end();
             print_disassembly(now_pc,0x50,7);
             return;
         }
@@ -148,9 +572,8 @@ void TikiDbg::handle_sigtrap(siginfo_t info)
 
 siginfo_t TikiDbg::get_signal_info()
 {
-    siginfo_t info;
-    ptrace(PTRACE_GETSIGINFO,pid_me,nullptr,&info);
-    return info;
+    //停下时已经读过一次
+    return cur_thread().get_stop_info();
 }
 
 void TikiDbg::print_source(const std::string & filename,unsigned line,unsigned n_lines_context)
@@ -192,6 +615,27 @@ void TikiDbg::initialise_load_address()
     std::string addr;
     std::getline(map, addr,'-');
     binary_addr_base = std::stoll(addr, 0, 16);
+
+    t_modules = TikiModuleTable{tgid_me};
+    t_modules.load_from_maps();
+    solib_event_addr = t_modules.find_solib_event_addr();
+    if(solib_event_addr!=0 && !t_breakpoints.count(solib_event_addr))
+    {//内部断点, 不打印
+        Tikibreakpoint bp{tgid_me,static_cast<std::intptr_t>(solib_event_addr)};
+        bp.enable();
+        t_breakpoints[solib_event_addr]=bp;
+    }
+
+    //_start 只在启动时执行一次, 之后拿来做 displaced stepping 的临时代码区
+    std::ifstream auxv("/proc/"+ std::to_string(tgid_me)+"/auxv",std::ios::binary);
+    uint64_t entry[2];
+    while(auxv.read(reinterpret_cast<char*>(entry),sizeof(entry)) && entry[0]!=AT_NULL)
+    {
+        if(entry[0]==AT_ENTRY)
+        {
+            displaced_addr=entry[1];
+        }
+    }
 }
 
 // dwarf::line_table::iterator TikiDbg::get_line_entry_from_pc(uint64_t pc)
@@ -237,12 +681,83 @@ void TikiDbg::initialise_load_address()
 
 void TikiDbg::wait_for_signal()
 {
-    int wait_status;
-    auto options=0;
-    waitpid(pid_me,&wait_status,options);
-
+    internal_stop=false;
+    pid_t tid;
+    if(!next_event(tid) || process_exited)
+    {
+        threads_running=false;
+        if(!process_exited && !t_threads.count(pid_me) && !t_threads.empty())
+        {//单步的线程退出了
+            pid_me=t_threads.begin()->first;
+            std::cout << "Thread exited, switching to thread " << std::dec << cur_thread().get_num() << std::endl;
+        }
+        return;
+    }
+    //all-stop: 一个线程停下, 其余线程一起停下, 同时到达的事件进入 t_events
+    //non-stop: 只有这个线程停下
+    //停止处理延迟: 事件到达到停止信息打印完
+    auto start= g_stats.is_enabled()? stat_now() : 0;
+    if(!non_stop)
+    {
+        stop_all_threads();
+    }
+    select_tid(tid);
+    report_stop();
+    if(start) g_stats.add_stop_latency(stat_now()-start);
+}
 
+void TikiDbg::report_stop()
+{
+    if(interrupt_stop && quiet_stops)
+    {//调用者自己判断 (fuzz 的超时, Ctrl-C), interrupt_stop 留给它清掉
+        return;
+    }
+    if(interrupt_stop)
+    {
+        interrupt_stop=false;
+        if(t_json)
+        {
+            json_stop("interrupt").end();
+        }
+        else{
+            std::cout << "Program interrupted in thread " << std::dec << cur_thread().get_num() << std::endl;
+        }
+        print_disassembly(get_pc(),0x50,7);
+        return;
+    }
+    auto hit=watch_hits.find(pid_me);
+    if(hit!=watch_hits.end())
+    {
+        auto& h=hit->second;
+        if(t_json)
+        {
+            json_stop("watch").num("num",h.num).hex("addr",h.addr).hex("write_pc",h.pc)
+                .hex("old",h.old_value).hex("new",h.new_value).end();
+        }
+        else{
+            std::cout << "Watch range " << std::dec << h.num << ": 0x" << std::hex << h.addr << " written at 0x" << h.pc
+                << "\nOld value = 0x" << std::setw(h.size*2) << std::setfill('0') << h.old_value
+                << "\nNew value = 0x" << std::setw(h.size*2) << h.new_value << std::setfill(' ') << std::endl;
+        }
+        watch_hits.erase(hit);
+        print_disassembly(get_pc(),0x50,7);
+        return;
+    }
     auto siginfo = get_signal_info();
+    if(quiet_stops)
+    {//只处理 solib 事件断点, 停在哪里由调用者判断
+        if(siginfo.si_signo==SIGTRAP && solib_event_addr!=0 && get_pc()-1==solib_event_addr)
+        {
+            handle_sigtrap(siginfo);
+        }
+        return;
+    }
+    if(t_json && siginfo.si_signo!=SIGTRAP)
+    {
+        json_stop("signal").str("signal",TikiSignals::name(siginfo.si_signo)).str("desc",strsignal(siginfo.si_signo))
+            .num("code",siginfo.si_code).end();
+        return;
+    }
     switch (siginfo.si_signo) {
     case SIGTRAP:
         handle_sigtrap(siginfo);
@@ -251,7 +766,7 @@ void TikiDbg::wait_for_signal()
         std::cout << "segfault. Reason: " << siginfo.si_code << std::endl;
         break;
     default:
-        std::cout << "Got signal " << strsignal(siginfo.si_signo) << std::endl;
+        std::cout << "Program received signal " << TikiSignals::name(siginfo.si_signo) << ", " << strsignal(siginfo.si_signo) << std::endl;
     }
 
 }
@@ -265,9 +780,20 @@ void TikiDbg::step_over_breakpoint()
         if(bp.is_enabled())
         {
             set_pc(breakpoint_addr);
+            if(non_stop)
+            {
+                step_over_breakpoint_non_stop(breakpoint_addr);
+                if(t_threads.count(pid_me))
+                {
+                    print_disassembly(get_pc(),0x50,7);
+                }
+                return;
+            }
             bp.disable();
-            ptrace(PTRACE_SINGLESTEP,pid_me,nullptr,nullptr);
+            stepping_tid=pid_me;
+            cur_thread().resume(PTRACE_SINGLESTEP);
             wait_for_signal();
+            stepping_tid=0;
             bp.enable();
         }
     }
@@ -297,16 +823,40 @@ void TikiDbg::write_memory(uint64_t addr, uint64_t value)
 
 void TikiDbg::dump_registers()
 {
+    auto& regs=cur_thread().get_regs();
+    if(t_json)
+    {
+        t_json->begin("registers").num("thread",cur_thread().get_num()).open_object("values");
+        for(const auto& rd:g_register_descriptors)
+        {
+            t_json->hex(rd.name.c_str(),get_register_value(regs,rd.r));
+        }
+        t_json->close_object().end();
+        return;
+    }
     for(const auto& rd:g_register_descriptors)
     {
         std::cout << rd.name << " 0x" << std::setfill('0') << std::setw(16)
-            << std::hex << get_register_value(pid_me,rd.r) << std::endl;
+            << std::hex << get_register_value(regs,rd.r) << std::endl;
     }
 }
 
+void TikiDbg::set_reg(reg r,uint64_t value)
+{
+    auto& th=cur_thread();
+    auto regs=th.get_regs();
+    set_register_value(regs,r,value);
+    th.set_regs(regs);
+}
+
 void TikiDbg::set_breakpoint_at_addr(std::intptr_t addr)
 {
-    Tikibreakpoint bp{pid_me,addr};
+    if(t_fast.find_overlap(addr,1))
+    {//int3 会写进 jmp 里
+        std::cerr << "Address 0x" << std::hex << addr << " is patched by a fast tracepoint" << std::endl;
+        return;
+    }
+    Tikibreakpoint bp{tgid_me,addr};
     bp.enable();
     t_breakpoints[addr]=bp;
     std::cout << "Set breakpoint at address 0x" << std::hex << addr << std::endl;
@@ -321,6 +871,17 @@ void TikiDbg::delete_breakpoint_at_addr(std::intptr_t addr)
         auto bp=t_breakpoints[addr];
         bp.disable();
         t_breakpoints.erase(addr);
+        //停在这个断点上的线程 pc 在 int3 之后, 需要退回去
+        for(auto& t:t_threads)
+        {
+            auto& th=t.second;
+            if(th.get_tgid()!=tgid_me || !th.stopped_at_breakpoint()) continue;
+            auto regs=th.get_regs();
+            if(get_register_value(regs,reg::rip)-1!=static_cast<uint64_t>(addr)) continue;
+            set_register_value(regs,reg::rip,addr);
+            th.set_regs(regs);
+            th.clear_stop_reason();
+        }
         std::cout << "Delete breakpoint at address 0x" << std::hex << addr << std::endl;
     }
     else{
@@ -333,181 +894,5065 @@ void TikiDbg::run()
 {
     if (cs_open(CS_ARCH_X86, CS_MODE_64, &cs_handle) != CS_ERR_OK)
         throw std::runtime_error{"Couldn't open capstone"};
-    
+    //displaced stepping 需要操作数信息
+    cs_option(cs_handle, CS_OPT_DETAIL, CS_OPT_ON);
 
-    wait_for_signal();
-    initialise_load_address();
+
+    if(attach_mode)
+    {
+        if(!attach_inferior()) return;
+    }
+    else{
+        start_inferior();
+        initialise_load_address();
+    }
+    if(!gdbserver_spec.empty())
+    {
+        serve_gdb();
+        return;
+    }
+    if(!t_script.empty())
+    {
+        run_batch();
+        return;
+    }
+    //被调试进程已经 fork 出去了, 之后屏蔽 SIGCHLD/SIGINT 不影响它
+    t_loop.open(STDIN_FILENO);
+    //提示是表里的常量字符串, 不设置 free 回调
+    linenoiseSetCompletionCallback(complete_command);
+    linenoiseSetHintsCallback(command_hint);
     char *line =nullptr;
-    while((line=linenoise("TikiDbg> "))!=nullptr)
+    poll_events();
+    while(!detached && (line=read_command("TikiDbg> "))!=nullptr)
     {
         handle_command(line);
         linenoiseHistoryAdd(line);
         linenoiseFree(line);
+        poll_events();
+    }
+    if(t_json) t_json->flush();
+}
+
+const auto& TikiDbg::command_table()
+{
+    //按优先级排列, 前缀冲突时前面的优先 (c 是 continue, d 是 delete, re 是 register)
+    static const size_t any=max_command_words-1;
+    static constexpr command_desc<command_handler> entries[]={
+        {"continue",        &TikiDbg::cmd_continue,         0,1,    " [&|-a]",false,0},
+        {"break",           &TikiDbg::cmd_break,            1,1,    " ADDR|SYMBOL",false,0},
+        {"delete",          &TikiDbg::cmd_delete,           1,1,    " ADDR",false,0},
+        {"register",        &TikiDbg::cmd_register,         0,1,    " [$REG]",false,0},
+        {"set",             &TikiDbg::cmd_set,              2,2,    " $REG|*ADDR|OPTION VALUE",false,0},
+        {"memory",          &TikiDbg::cmd_memory,           1,1,    " ADDR",false,0},
+        {"modules",         &TikiDbg::cmd_modules,          0,0,    "",false,0},
+        {"detach",          &TikiDbg::cmd_detach,           0,0,    "",false,0},
+        {"thread",          &TikiDbg::cmd_thread,           0,1,    " [N]",false,0},
+        {"instep",          &TikiDbg::cmd_instep,           0,1,    " [N]",false,0},
+        {"blockstep",       &TikiDbg::cmd_blockstep,        0,2,    " [N] [ADDR]",false,0},
+        {"branches",        &TikiDbg::cmd_branches,         0,2,    " [-i] [COUNT]",false,0},
+        {"emucheck",        &TikiDbg::cmd_emucheck,         0,1,    " [N]",false,0},
+        {"checkpoint",      &TikiDbg::cmd_checkpoint,       0,2,    " [list|delete N]",false,0},
+        {"restart",         &TikiDbg::cmd_restart,          1,1,    " N",false,0},
+        {"record",          &TikiDbg::cmd_record,           0,2,    " [stop|info|limit BYTES]",false,0},
+        {"reverse-stepi",   &TikiDbg::cmd_reverse_stepi,    0,1,    " [N]",false,0},
+        {"reverse-continue",&TikiDbg::cmd_reverse_continue, 0,0,    "",false,0},
+        {"reverse-finish",  &TikiDbg::cmd_reverse_finish,   0,0,    "",false,0},
+        {"call",            &TikiDbg::cmd_call,             1,any,  " FUNC(ARGS)",false,0},
+        {"interrupt",       &TikiDbg::cmd_interrupt,        0,1,    " [-a]",false,0},
+        {"output-bench",    &TikiDbg::cmd_output_bench,     0,1,    " [N]",true,0},
+        {"event-loop",      &TikiDbg::cmd_event_loop,       0,0,    "",false,0},
+        {"handle",          &TikiDbg::cmd_handle,           0,any,  " [SIG|all [stop|nostop print|noprint pass|nopass ...]]",false,0},
+        {"ftrace-fast",     &TikiDbg::cmd_ftrace_fast,      1,2,    " ADDR | delete ADDR | show [N]",false,0},
+        {"catch",           &TikiDbg::cmd_catch,            1,3,    " syscall [LIST] | syscall delete [LIST]",false,0},
+        {"watch",           &TikiDbg::cmd_watch,            0,2,    " [ADDR [LEN] | delete N]",true,0},
+        {"watch-range",     &TikiDbg::cmd_watch_range,      0,2,    " [ADDR LEN | delete N]",false,0},
+        {"fuzz",            &TikiDbg::cmd_fuzz,             4,7,    " [--timeout T] START END ADDR LEN [N]",false,0},
+        {"trace-insn",      &TikiDbg::cmd_trace_insn,       2,3,    " FILE N [ADDR]",false,0},
+        {"trace-view",      &TikiDbg::cmd_trace_view,       1,3,    " FILE [START] [COUNT]",false,0},
+        {"next",            &TikiDbg::cmd_next,             0,0,    "",false,0},
+        {"profile",         &TikiDbg::cmd_profile,          0,5,    " [--hz N] [--duration T] [FILE]",false,0},
+        {"stats",           &TikiDbg::cmd_stats,            0,1,    " [on|off|reset]",false,0},
+        {"bench",           &TikiDbg::cmd_bench,            2,3,    " breakpoint|step|read|registers|disasm|backtrace|symbols N [ARG]",false,0},
+    };
+    static constexpr auto table=build_command_table(entries);
+    static_assert(command_table_reachable(table),"a command is shadowed by an earlier one");
+    static_assert(table.size()<TikiStats::max_slots,"stats has one slot per command");
+    return table;
+}
+
+void TikiDbg::complete_command(const char* buf,linenoiseCompletions* lc)
+{
+    //只补全命令名
+    std::string_view word{buf};
+    if(word.find(' ')!=std::string_view::npos) return;
+    for(auto& d:command_table())
+    {
+        if(d.name.substr(0,word.size())==word) linenoiseAddCompletion(lc,std::string{d.name}.c_str());
     }
+}
 
+char* TikiDbg::command_hint(const char* buf,int* color,int* bold)
+{
+    //命令名 (或者能唯一确定它的前缀) 后面还没有参数时提示参数格式
+    std::string_view word{buf};
+    if(word.empty() || word.find(' ')!=std::string_view::npos) return nullptr;
+    auto desc=find_command(command_table(),word);
+    if(!desc || desc->hint[0]==0) return nullptr;
+    *color=90;
+    *bold=0;
+    return const_cast<char*>(desc->hint);
 }
 
-void TikiDbg::handle_command(const std::string& line)
+void TikiDbg::handle_command(std::string_view line)
 {
-    auto args = split(line, ' ');
-    if(args.size()<=0)
+    cmd_args args;
+    if(!tokenize_command(line,args))
     {
+        std::cerr << "Too many arguments" << std::endl;
         return;
     }
-    auto command = args[0];
+    try{
+        execute_command(args);
+    }
+    catch(const std::invalid_argument& e)
+    {//参数写错 (cmd_number, 寄存器名) 不应该结束调试器
+        std::cerr << e.what() << std::endl;
+    }
+    catch(const std::out_of_range& e)
+    {
+        std::cerr << e.what() << std::endl;
+    }
+}
 
-    if(is_prefix(command,"continue"))
+void TikiDbg::execute_command(const cmd_args& args)
+{
+    if(args.size()==0)
     {
-        continue_execution();
+        return;
     }
-    else if(is_prefix(command,"break"))
+    auto desc=find_command(command_table(),args[0]);
+    if(!desc)
     {
-        if(args.size() == 2)
-        {
-            std::string addr {args[1]};
-            uint64_t target_addr=0;
-            if(addr[0]=='*')
-            {//rebase address
-                addr.erase(addr.begin());
-                target_addr += std::stoll(addr,0,16)+binary_addr_base;
-            }
-            else{
-                target_addr+=std::stoll(addr,0,16);
-            }
-            set_breakpoint_at_addr(target_addr);
-        }
-        else{
-            std::cerr << "Unknown command " << command << std::endl;
-        }
+        std::cerr << "Unknown command " << args[0] << std::endl;
+        return;
     }
-    else if (is_prefix(command,"delete"))
+    if(args.size()-1<desc->min_args || args.size()-1>desc->max_args)
     {
-        if(args.size() == 2)
-        {
-            std::string addr {args[1]};
-            delete_breakpoint_at_addr(std::stoll(addr,0,16));
-        }
-        else{
-            std::cerr << "Unknown command " << command << std::endl;
-        }
+        std::cerr << "Usage: " << desc->name << desc->hint << std::endl;
+        return;
     }
-    else if(is_prefix(command,"register"))
+    //槽位 0 留给命令之外的事件
+    g_stats.begin_command(desc-command_table().data()+1);
+    (this->*desc->handler)(args);
+    if(counters_on) report_counters();
+    g_stats.end_command();
+}
+
+void TikiDbg::cmd_continue(const cmd_args& args)
+{
+    if(non_stop && args.size()==2 && args[1]=="-a")
+    {//continue -a: 恢复所有停下的线程
+        continue_all_non_stop();
+        return;
+    }
+    if(!require_stopped()) return;
+    if(args.back()=="&")
     {
-        if(args.size()==1)
-        {
-            dump_registers();
-        }
-        else if(args.size()==2)
-        {
-            //register $rax
-            std::string val {args[1]}; //assume 0xVAL
-            if(val[0]=='$')
-            {
-                std::string reg_name(&val[1]);
-                //set $rax 0xaaa
-                
-                uint64_t ret= get_register_value(pid_me,get_register_by_name(reg_name));
-                std::cout << reg_name << ": "   << "0x" << std::hex << ret << std::endl;
-            }
-            else{
-                std::cout << "Bad register" << std::endl;
-            }
-        }
-        
+        continue_background();
+        return;
+    }
+    continue_execution();
+}
+
+void TikiDbg::cmd_break(const cmd_args& args)
+{
+    uint64_t target_addr=parse_break_target(args[1]);
+    if(target_addr==0)
+    {
+        std::cerr << "No symbol " << args[1] << std::endl;
+        return;
+    }
+    set_breakpoint_at_addr(target_addr);
+}
+
+void TikiDbg::cmd_delete(const cmd_args& args)
+{
+    delete_breakpoint_at_addr(cmd_number(args[1],16));
+}
+
+void TikiDbg::cmd_register(const cmd_args& args)
+{
+    if(!require_stopped()) return;
+    if(args.size()==1)
+    {
+        dump_registers();
     }
-    else if(is_prefix(command,"set"))
+    else if(args.size()==2)
     {
-        //set $rax 0xaaaa
+        //register $rax
         std::string val {args[1]}; //assume 0xVAL
-        std::string value {args[2]};
         if(val[0]=='$')
         {
             std::string reg_name(&val[1]);
             //set $rax 0xaaa
-            uint64_t input=std::stoll(value,0,16);
-            set_register_value(pid_me,get_register_by_name(reg_name),input);
-            std::cout << "set $"<<reg_name << ": "   << "0x" << std::hex << input << std::endl;
+            
+            uint64_t ret= get_reg(get_register_by_name(reg_name));
+            std::cout << reg_name << ": "   << "0x" << std::hex << ret << std::endl;
         }
-        else if(val[0]=='*')
-        {
-            //TODO: write memory
-            std::string addr_s(&val[1]);
-            uint64_t addr_input=std::stoll(addr_s,0,16);
-            uint64_t value_input=std::stoll(value,0,16);
-            write_memory(addr_input,value_input);
+        else{
+            std::cout << "Bad register" << std::endl;
         }
     }
-    else if(is_prefix(command,"memory")){
-        //memory 0xaaaaa
-        if(args.size() ==2)
+}
+
+void TikiDbg::cmd_set(const cmd_args& args)
+{
+    //set $rax 0xaaaa
+    std::string val {args[1]}; //assume 0xVAL
+    std::string value {args[2]};
+    if(val=="non-stop")
+    {
+        //set non-stop on|off
+        if(value=="on")
         {
-            std::string addr {args[1]};
-            uint64_t addr_=std::stoll(addr,0,16);
-            
-            std::cout<<"0x" << std::setfill('0') << std::setw(16)<< std::hex << addr_<< ":  " <<
-                std::setfill('0') << std::setw(16)<< read_memory(addr_) << std::endl;
+            non_stop=true;
+        }
+        else{
+            stop_all_threads();
+            non_stop=false;
         }
+        std::cout << "non-stop mode " << (non_stop? "on" : "off") << std::endl;
     }
-    else if(is_prefix(command,"instep"))
+    else if(val=="follow-fork-mode")
     {
-        single_step_instruction_with_breakpoint_check();
+        //set follow-fork-mode parent|child|both
+        if(value=="child") follow_mode=follow_fork::child;
+        else if(value=="both") follow_mode=follow_fork::both;
+        else follow_mode=follow_fork::parent;
+        std::cout << "follow-fork-mode " << value << std::endl;
     }
-    else if(is_prefix(command,"next"))
+    else if(val=="emulate")
     {
-        if( (read_memory(get_pc())&0xff) != 0xe8)
-        {
-            single_step_instruction_with_breakpoint_check();
-        }
-        else{
-            uint8_t little_buf[16];
-            uint64_t* temp_pointer=reinterpret_cast<uint64_t*>(little_buf);
-            cs_insn *insn;
-            uint64_t now_pc=get_pc();
-            temp_pointer[0]=read_memory(now_pc);
-            temp_pointer[1]=read_memory(now_pc+8);
-
-            size_t count = cs_disasm(cs_handle, little_buf, 255, get_pc(), 2, &insn);
-            if(count>0)
-            {
-                if(!std::strcmp(insn[0].mnemonic,"call"))
-                {
-                    set_breakpoint_at_addr(insn[1].address);
-                    continue_execution();
-                    delete_breakpoint_at_addr(insn[1].address);
-                    set_pc(get_pc()-1);
-                }
-                cs_free(insn,count);
-            }
-        }
-
+        //set emulate on|off: instep N / trace-insn 先在调试器里模拟简单指令
+        emulate= value=="on";
+        std::cout << "emulate " << (emulate? "on" : "off") << std::endl;
     }
-
-    else{
-        std::cerr << "Unknown command " << command << std::endl;
+    else if(val=="syscall-log")
+    {
+        //set syscall-log on|off: 选中的系统调用只打印 (参数和返回值), 不停下
+        syscall_log= value=="on";
+        std::cout << "syscall-log " << (syscall_log? "on" : "off") << std::endl;
+    }
+    else if(val=="counters")
+    {
+        //set counters on|off: 每条命令之后报告被调试进程执行了多少指令, 周期等
+        set_counters(value=="on");
+    }
+    else if(val=="emu-batch")
+    {
+        emu_batch=std::max<uint64_t>(1,cmd_number(value));
+        std::cout << "emu-batch " << std::dec << emu_batch << std::endl;
+    }
+    else if(!require_stopped())
+    {
+        return;
+    }
+    else if(val[0]=='$')
+    {
+        std::string reg_name(&val[1]);
+        //set $rax 0xaaa
+        uint64_t input=cmd_number(value,16);
+        set_reg(get_register_by_name(reg_name),input);
+        std::cout << "set $"<<reg_name << ": "   << "0x" << std::hex << input << std::endl;
+    }
+    else if(val[0]=='*')
+    {
+        //TODO: write memory
+        uint64_t addr_input=cmd_number(val.substr(1),16);
+        uint64_t value_input=cmd_number(value,16);
+        write_memory(addr_input,value_input);
     }
 }
 
-void TikiDbg::continue_execution(){
-    step_over_breakpoint();
-    ptrace(PTRACE_CONT, pid_me, nullptr, nullptr);
-    wait_for_signal();
-}
-
-
-std::vector<std::string> split(const std::string&s,char delim)
+void TikiDbg::cmd_memory(const cmd_args& args)
 {
-    std::vector<std::string> out{};
-    std::stringstream ss {s};
-    std::string item;
-
-    while(std::getline(ss,item,delim))
+    //memory 0xaaaaa
+    if(!require_stopped()) return;
+    if(args.size() ==2)
     {
-        out.push_back(item);
+        uint64_t addr_=cmd_number(args[1],16);
+        uint64_t value=0;
+        if(!read_remote(tgid_me,addr_,&value,sizeof(value)))
+        {//json 模式下 stderr 就是 error 记录
+            std::cerr << "Cannot access memory at 0x" << std::hex << addr_ << std::endl;
+            return;
+        }
+        if(t_json)
+        {
+            t_json->begin("memory").hex("addr",addr_).hex("value",value).end();
+            return;
+        }
+        std::cout<<"0x" << std::setfill('0') << std::setw(16)<< std::hex << addr_<< ":  " <<
+            std::setfill('0') << std::setw(16)<< value << std::endl;
     }
-    return out;
 }
 
-bool is_prefix(const std::string& s,const std::string&format)
+void TikiDbg::cmd_modules(const cmd_args& args)
+{
+    t_modules.dump();
+}
+
+void TikiDbg::cmd_detach(const cmd_args& args)
+{
+    detach();
+}
+
+void TikiDbg::cmd_thread(const cmd_args& args)
+{
+    if(args.size()==1)
+    {
+        list_threads();
+    }
+    else{
+        select_thread(static_cast<int>(cmd_number(args[1],10)));
+    }
+}
+
+void TikiDbg::cmd_instep(const cmd_args& args)
+{
+    if(!require_stopped()) return;
+    if(args.size()==2 || recording)
+    {//instep N
+        step_instructions(args.size()==2? cmd_number(args[1]) : 1,0,nullptr);
+    }
+    else{
+        single_step_instruction_with_breakpoint_check();
+    }
+}
+
+void TikiDbg::cmd_blockstep(const cmd_args& args)
+{
+    //blockstep [N] [ADDR]: 按基本块单步, 记录经过的跳转
+    if(!require_stopped()) return;
+    if(recording)
+    {
+        std::cerr << "blockstep is not available while recording" << std::endl;
+        return;
+    }
+    uint64_t count= args.size()>1? cmd_number(args[1]) : 1;
+    uint64_t until= args.size()>2? parse_break_target(args[2]) : 0;
+    step_blocks(count,until);
+}
+
+void TikiDbg::cmd_branches(const cmd_args& args)
+{
+    //branches [-i] [COUNT]
+    bool with_insns= args.size()>1 && args[1]=="-i";
+    auto rest= with_insns? 2u : 1u;
+    uint64_t count= args.size()>rest? cmd_number(args[rest]) : 20;
+    list_branches(count,with_insns);
+}
+
+void TikiDbg::cmd_emucheck(const cmd_args& args)
+{
+    //emucheck N: 逐条对比模拟结果和真实单步
+    if(!require_stopped()) return;
+    check_emulation(args.size()>1? cmd_number(args[1]) : 1000);
+}
+
+void TikiDbg::cmd_checkpoint(const cmd_args& args)
+{
+    //checkpoint | checkpoint list | checkpoint delete N
+    if(args.size()>1 && args[1]=="list")
+    {
+        list_checkpoints();
+    }
+    else if(args.size()>2 && args[1]=="delete")
+    {
+        delete_checkpoint(static_cast<int>(cmd_number(args[2],10)));
+    }
+    else{
+        if(!require_stopped()) return;
+        create_checkpoint();
+    }
+}
+
+void TikiDbg::cmd_restart(const cmd_args& args)
+{
+    //restart N: 回到第 N 个 checkpoint, 当前进程被结束
+    if(!process_exited) stop_all_threads();
+    restart_checkpoint(static_cast<int>(cmd_number(args[1],10)));
+}
+
+void TikiDbg::cmd_record(const cmd_args& args)
+{
+    //record | record stop | record info | record limit BYTES
+    if(args.size()>1 && args[1]=="stop")
+    {
+        recording=false;
+        t_record.clear();
+        std::cout << "Recording stopped" << std::endl;
+    }
+    else if(args.size()>1 && args[1]=="info")
+    {
+        auto count=t_record.get_count();
+        std::cout << "Recorded " << std::dec << count << " instructions, " << t_record.get_bytes() << " bytes";
+        if(count) std::cout << " (" << static_cast<double>(t_record.get_bytes())/count << " bytes/insn)";
+        if(t_record.get_dropped()) std::cout << ", " << t_record.get_dropped() << " oldest dropped";
+        std::cout << std::endl;
+    }
+    else if(args.size()>2 && args[1]=="limit")
+    {
+        t_record.set_limit(cmd_number(args[2]));
+    }
+    else{
+        if(!require_stopped()) return;
+        if(non_stop)
+        {
+            std::cerr << "Recording needs all-stop mode" << std::endl;
+            return;
+        }
+        recording=true;
+        record_tid=pid_me;
+        t_record.clear();
+        std::cout << "Recording started" << std::endl;
+    }
+}
+
+bool TikiDbg::require_record_thread()
+{
+    //日志里的寄存器和内存都是 record_tid 的, 在别的线程上前进或撤销会把两个线程混在一起
+    if(pid_me==record_tid) return true;
+    auto it=t_threads.find(record_tid);
+    if(it==t_threads.end())
+    {
+        std::cerr << "The recorded thread has exited" << std::endl;
+    }
+    else{
+        std::cerr << "Recording follows thread " << std::dec << it->second.get_num() << ", switch to it first" << std::endl;
+    }
+    return false;
+}
+
+void TikiDbg::reverse_command(const cmd_args& args,reverse_mode mode)
+{
+    if(!require_stopped()) return;
+    if(!recording)
+    {
+        std::cerr << "Not recording" << std::endl;
+        return;
+    }
+    if(!require_record_thread()) return;
+    if(mode==reverse_mode::stepi)
+    {
+        reverse_execute(mode,args.size()>1? cmd_number(args[1]) : 1);
+    }
+    else{
+        reverse_execute(mode,UINT64_MAX);
+    }
+}
+
+void TikiDbg::cmd_reverse_stepi(const cmd_args& args)
+{
+    reverse_command(args,reverse_mode::stepi);
+}
+
+void TikiDbg::cmd_reverse_continue(const cmd_args& args)
+{
+    reverse_command(args,reverse_mode::cont);
+}
+
+void TikiDbg::cmd_reverse_finish(const cmd_args& args)
+{
+    reverse_command(args,reverse_mode::finish);
+}
+
+void TikiDbg::cmd_call(const cmd_args& args)
+{
+    //call func(1, 0x10, "str")
+    if(!require_stopped()) return;
+    //命令名之后的部分, 空格不影响; 脚本里的词已经替换过 $arg, 不在原来那一行里, 用空格拼回去
+    std::string expr;
+    auto name_end=args[0].data()+args[0].size();
+    if(name_end>=args.line.data() && name_end<=args.line.data()+args.line.size())
+    {
+        expr=args.line.substr(name_end-args.line.data());
+    }
+    else{
+        for(size_t i=1;i<args.size();i++) (expr+=' ')+=args[i];
+    }
+    auto open=expr.find('(');
+    auto name=expr.substr(0,open);
+    name.erase(std::remove(name.begin(),name.end(),' '),name.end());
+    auto func= name.empty()? 0 : parse_break_target(name);
+    if(func==0)
+    {
+        std::cerr << "Usage: call FUNC(ARGS)" << std::endl;
+        return;
+    }
+    std::vector<call_arg> call_args;
+    if(open!=std::string::npos)
+    {
+        //逗号分隔, 引号里的逗号不算
+        std::string cur;
+        bool quoted=false;
+        auto finish_arg=[&]{
+            auto b=cur.find_first_not_of(' ');
+            auto e=cur.find_last_not_of(' ');
+            if(b==std::string::npos) return;
+            auto text=cur.substr(b,e-b+1);
+            if(text[0]=='"')
+            {
+                call_args.push_back({true,0,text.substr(1,text.size()-2)});
+            }
+            else{
+                call_args.push_back({false,cmd_number(text),{}});
+            }
+            cur.clear();
+        };
+        for(size_t i=open+1;i<expr.size();i++)
+        {
+            auto c=expr[i];
+            if(c=='\\' && quoted && i+1<expr.size())
+            {
+                auto n=expr[++i];
+                cur+= n=='n'? '\n' : n=='t'? '\t' : n;
+                continue;
+            }
+            if(c=='"') quoted=!quoted;
+            if(!quoted && (c==',' || c==')'))
+            {
+                finish_arg();
+                if(c==')') break;
+                continue;
+            }
+            cur+=c;
+        }
+    }
+    uint64_t ret;
+    if(call_function(func,call_args,ret))
+    {
+        std::cout << "$ = 0x" << std::hex << ret << " (" << std::dec << static_cast<int64_t>(ret) << ")" << std::endl;
+    }
+}
+
+void TikiDbg::cmd_interrupt(const cmd_args& args)
+{
+    //interrupt [-a]: 停下后台运行的程序, non-stop 下默认只停当前线程
+    if(!non_stop)
+    {
+        if(threads_running) handle_background_events(src_interrupt);
+        else std::cout << "The program is not running" << std::endl;
+        return;
+    }
+    if(!interrupt_threads(args.size()>1 && args[1]=="-a"))
+    {
+        std::cout << "The program is not running" << std::endl;
+        return;
+    }
+    select_tid(take_interrupt_event(pid_me));
+    report_stop();
+}
+
+void TikiDbg::cmd_output_bench(const cmd_args& args)
+{
+    //output-bench [N]: 文本和 JSON 输出的速度
+    if(!require_stopped()) return;
+    bench_output(args.size()>1? cmd_number(args[1]) : 10000);
+}
+
+void TikiDbg::cmd_event_loop(const cmd_args& args)
+{
+    t_loop.show_stats();
+}
+
+void TikiDbg::cmd_handle(const cmd_args& args)
+{
+    //handle [SIG|all [stop|nostop print|noprint pass|nopass ...]]
+    if(args.size()==1)
+    {
+        t_signals.show_all();
+        return;
+    }
+    std::vector<std::string> words(args.begin()+1,args.end());
+    if(!t_signals.update(words)) return;
+    if(words[0]!="all") t_signals.show(TikiSignals::number(words[0]));
+}
+
+void TikiDbg::cmd_ftrace_fast(const cmd_args& args)
+{
+    //ftrace-fast ADDR | ftrace-fast delete ADDR | ftrace-fast show [N]
+    if(args[1]=="show")
+    {
+        show_fast_trace(args.size()>2? cmd_number(args[2]) : 20);
+        return;
+    }
+    if(!require_stopped()) return;
+    if(args[1]=="delete" && args.size()>2)
+    {
+        delete_fast_tracepoint(parse_break_target(args[2]));
+        return;
+    }
+    auto addr=parse_break_target(args[1]);
+    if(addr==0)
+    {
+        std::cerr << "No symbol " << args[1] << std::endl;
+        return;
+    }
+    add_fast_tracepoint(addr);
+}
+
+void TikiDbg::cmd_catch(const cmd_args& args)
+{
+    //catch syscall [open,mmap,write] | catch syscall delete [LIST]
+    if(args.size()<2 || args[1]!="syscall")
+    {
+        std::cerr << "Usage: catch syscall [LIST] | catch syscall delete [LIST]" << std::endl;
+        return;
+    }
+    if(args.size()==2)
+    {
+        std::cout << "Catching syscalls:";
+        for(auto nr:caught_syscalls) std::cout << " " << syscall_name(nr);
+        std::cout << std::endl;
+        return;
+    }
+    std::set<long> nrs;
+    if(args[2]=="delete")
+    {
+        if(args.size()==3)
+        {
+            caught_syscalls.clear();
+        }
+        else if(parse_syscall_list(args.str(3),nrs))
+        {
+            for(auto nr:nrs) caught_syscalls.erase(nr);
+        }
+        return;
+    }
+    if(!parse_syscall_list(args.str(2),nrs) || !require_stopped()) return;
+    catch_syscalls(nrs);
+}
+
+void TikiDbg::cmd_watch(const cmd_args& args)
+{
+    //watch ADDR [LEN] | watch delete N | watch
+    if(args.size()==1)
+    {
+        for(auto& w:t_hwwatch.get_watches())
+        {
+            std::cout << std::dec << w.first << "  0x" << std::hex << w.second.addr << "  len " << std::dec << w.second.len
+                << "  hits " << w.second.hits << std::endl;
+        }
+        return;
+    }
+    if(args[1]=="delete")
+    {
+        if(args.size()<3 || !t_hwwatch.remove(static_cast<int>(cmd_number(args[2],10))))
+        {
+            std::cerr << "No such watch" << std::endl;
+        }
+        return;
+    }
+    if(!require_stopped()) return;
+    add_hw_watch(parse_break_target(args[1]),args.size()>2? cmd_number(args[2]) : 8);
+}
+
+void TikiDbg::cmd_watch_range(const cmd_args& args)
+{
+    //watch-range ADDR LEN | watch-range delete N | watch-range
+    if(args.size()==1)
+    {
+        for(auto& r:t_watch.get_ranges())
+        {
+            std::cout << std::dec << r.first << "  0x" << std::hex << r.second.addr << "-0x" << r.second.addr+r.second.len
+                << std::dec << "  hits " << r.second.hits << std::endl;
+        }
+        return;
+    }
+    if(!require_stopped()) return;
+    if(args[1]=="delete" && args.size()>2)
+    {
+        delete_watch_range(static_cast<int>(cmd_number(args[2],10)));
+        return;
+    }
+    auto addr=parse_break_target(args[1]);
+    if(addr==0 || args.size()<3)
+    {
+        std::cerr << "Usage: watch-range ADDR LEN | delete N" << std::endl;
+        return;
+    }
+    add_watch_range(addr,cmd_number(args[2]));
+}
+
+void TikiDbg::cmd_fuzz(const cmd_args& args)
+{
+    //fuzz [--timeout T] START END ADDR LEN [N]: 从 START 到 END 反复执行, 每轮把 ADDR 处 LEN 字节换成变异的输入
+    //一轮超过 T (默认 1s) 没有到 END 算作卡死
+    uint64_t timeout=1000000000ull;
+    size_t first=1;
+    if(args[1]=="--timeout")
+    {
+        if(args.size()<7 || !parse_duration(args[2],timeout) || timeout==0)
+        {
+            std::cerr << "Usage: fuzz [--timeout T] START END ADDR LEN [N]" << std::endl;
+            return;
+        }
+        first=3;
+    }
+    else if(args.size()>6)
+    {
+        std::cerr << "Usage: fuzz [--timeout T] START END ADDR LEN [N]" << std::endl;
+        return;
+    }
+    if(!require_stopped()) return;
+    auto start=parse_break_target(args[first]);
+    auto end=parse_break_target(args[first+1]);
+    auto input=parse_break_target(args[first+2]);
+    if(start==0 || end==0 || input==0)
+    {
+        std::cerr << "Bad address" << std::endl;
+        return;
+    }
+    fuzz(start,end,input,cmd_number(args[first+3]),args.size()>first+4? cmd_number(args[first+4]) : 10000,timeout);
+}
+
+void TikiDbg::cmd_trace_insn(const cmd_args& args)
+{
+    //trace-insn FILE N [ADDR]: 单步 N 条指令或到 ADDR 为止, 记录到 FILE
+    if(!require_stopped()) return;
+    TikiTraceWriter writer;
+    if(!writer.open(args.str(1)))
+    {
+        std::cerr << "Couldn't open " << args[1] << std::endl;
+        return;
+    }
+    uint64_t until= args.size()>3? parse_break_target(args[3]) : 0;
+    step_instructions(cmd_number(args[2]),until,&writer);
+    writer.close();
+    std::cout << "Wrote " << std::dec << writer.get_count() << " records, "
+        << writer.get_bytes() << " bytes to " << args[1] << std::endl;
+}
+
+void TikiDbg::cmd_trace_view(const cmd_args& args)
+{
+    //trace-view FILE [START] [COUNT]
+    uint64_t start= args.size()>2? cmd_number(args[2]) : 0;
+    uint64_t count= args.size()>3? cmd_number(args[3]) : 20;
+    view_trace(args.str(1),start,count);
+}
+
+void TikiDbg::cmd_profile(const cmd_args& args)
+{
+    //profile [--hz N] [--duration T] [FILE]: 不给 FILE 时 folded 栈写到标准输出
+    unsigned hz=99;
+    uint64_t duration=10000000000ull;
+    std::string path;
+    for(size_t i=1;i<args.size();i++)
+    {
+        if(args[i]=="--hz" && i+1<args.size())
+        {
+            hz=static_cast<unsigned>(cmd_number(args[++i],10));
+        }
+        else if(args[i]=="--duration" && i+1<args.size())
+        {
+            if(!parse_duration(args[++i],duration))
+            {
+                std::cerr << "Bad duration " << args[i] << std::endl;
+                return;
+            }
+        }
+        else if(path.empty() && args[i][0]!='-')
+        {
+            path=args.str(i);
+        }
+        else{
+            std::cerr << "Usage: profile [--hz N] [--duration T] [FILE]" << std::endl;
+            return;
+        }
+    }
+    if(hz==0 || hz>10000)
+    {
+        std::cerr << "--hz must be between 1 and 10000" << std::endl;
+        return;
+    }
+    if(!require_stopped()) return;
+    profile(hz,duration,path);
+}
+
+void TikiDbg::cmd_stats(const cmd_args& args)
+{
+    //stats on|off|reset: 调试器自己的系统调用和耗时, 按命令统计; stats 打印
+    if(args.size()==2)
+    {
+        if(args[1]=="on") g_stats.set_enabled(true);
+        else if(args[1]=="off") g_stats.set_enabled(false);
+        else if(args[1]=="reset") g_stats.reset();
+        else std::cerr << "Usage: stats [on|off|reset]" << std::endl;
+        return;
+    }
+    if(!g_stats.is_enabled()) std::cout << "stats is off, use stats on" << std::endl;
+    g_stats.show(std::cout,[](size_t slot){return command_table()[slot-1].name;});
+}
+
+void TikiDbg::cmd_bench(const cmd_args& args)
+{
+    //bench WHAT N [ARG]: 结果格式见 TikiBench.h, junk_demo/bench.sh 按顺序跑全部
+    //  breakpoint N ADDR   断点命中往返: 从 ADDR 继续运行到再次停在 ADDR
+    //  step N              instep 的单步速度
+    //  read N [CHUNK]      每次从最大的可读写映射读 CHUNK 字节 (默认 1MB)
+    //  registers N         GETREGS + 输出寄存器
+    //  disasm N            每次停下时的反汇编输出
+    //  backtrace N         profile 的帧指针回溯
+    //  symbols N           主程序里 N 个地址的符号化, 以及用得到的名字反查地址
+    if(!require_stopped()) return;
+    auto n=cmd_number(args[2],10);
+    if(n==0)
+    {
+        std::cerr << "N must be at least 1" << std::endl;
+        return;
+    }
+    bench_result r{};
+    bench_result by_name{};
+    bool ok;
+    auto what=args[1];
+    if(what=="breakpoint")
+    {
+        if(args.size()<4)
+        {
+            std::cerr << "Usage: bench breakpoint N ADDR" << std::endl;
+            return;
+        }
+        ok=bench_breakpoint(n,parse_break_target(args[3]),r);
+    }
+    else if(what=="step") ok=bench_step(n,r);
+    else if(what=="read") ok=bench_read(n,args.size()>3? cmd_number(args[3],10) : 1<<20,r);
+    else if(what=="registers") ok=bench_per_stop(n,true,r);
+    else if(what=="disasm") ok=bench_per_stop(n,false,r);
+    else if(what=="backtrace") ok=bench_backtrace(n,r);
+    else if(what=="symbols") ok=bench_symbols(n,r,by_name);
+    else{
+        std::cerr << "Usage: bench breakpoint|step|read|registers|disasm|backtrace|symbols N [ARG]" << std::endl;
+        return;
+    }
+    if(!ok) return;
+    auto program=program_name.substr(program_name.rfind('/')+1);
+    if(program.empty())
+    {//attach 的进程
+        std::ifstream comm{"/proc/"+std::to_string(tgid_me)+"/comm"};
+        std::getline(comm,program);
+    }
+    uint64_t threads=std::count_if(t_threads.begin(),t_threads.end(),[this](auto&& t){return t.second.get_tgid()==tgid_me;});
+    for(auto res:{&r,&by_name})
+    {
+        if(res->ops==0) continue;
+        res->program=program;
+        res->threads=threads;
+        write_bench_result(*res,t_json,std::cout);
+    }
+}
+
+void TikiDbg::cmd_next(const cmd_args& args)
+{
+    if(!require_stopped()) return;
+    if(recording)
+    {
+        std::cerr << "next is not available while recording, use instep" << std::endl;
+        return;
+    }
+    if( (read_memory(get_pc())&0xff) != 0xe8)
+    {
+        single_step_instruction_with_breakpoint_check();
+    }
+    else{
+        uint8_t little_buf[16];
+        uint64_t* temp_pointer=reinterpret_cast<uint64_t*>(little_buf);
+        cs_insn *insn;
+        uint64_t now_pc=get_pc();
+        temp_pointer[0]=read_memory(now_pc);
+        temp_pointer[1]=read_memory(now_pc+8);
+
+        size_t count = cs_disasm(cs_handle, little_buf, 255, get_pc(), 2, &insn);
+        if(count>0)
+        {
+            if(!std::strcmp(insn[0].mnemonic,"call"))
+            {
+                set_breakpoint_at_addr(insn[1].address);
+                continue_execution();
+                delete_breakpoint_at_addr(insn[1].address);
+            }
+            cs_free(insn,count);
+        }
+    }
+}
+
+void TikiDbg::continue_execution(){
+    if(recording)
+    {//逐条单步, 到断点/信号/退出为止
+        step_instructions(UINT64_MAX,0,nullptr);
+        return;
+    }
+    if(non_stop)
+    {//只恢复当前线程, 等任意一个线程报告事件
+        do{
+            step_over_breakpoint();
+            cur_thread().resume();
+            wait_for_signal();
+        }while(internal_stop);
+        return;
+    }
+    do{
+        if(!t_events.empty())
+        {//上次停下时其他线程也命中了断点, 先报告它们, 不恢复运行
+            wait_for_signal();
+            continue;
+        }
+        step_over_breakpoint();
+        resume_all_threads();
+        wait_for_signal();
+    }while(internal_stop);
+}
+
+void TikiDbg::continue_all_non_stop()
+{
+    std::vector<pid_t> stopped;
+    for(auto& t:t_threads)
+    {
+        if(t.second.is_stopped()) stopped.push_back(t.first);
+    }
+    for(auto tid:stopped)
+    {
+        if(!t_threads.count(tid)) continue;
+        select_tid(tid);
+        step_over_breakpoint();
+        if(t_threads.count(tid)) cur_thread().resume();
+    }
+    do{
+        wait_for_signal();
+        if(internal_stop)
+        {
+            step_over_breakpoint();
+            cur_thread().resume();
+        }
+    }while(internal_stop);
+}
+
+void TikiDbg::start_inferior()
+{
+    //子进程在 execl 前 raise(SIGSTOP), 这里用 PTRACE_SEIZE 接管, 这样之后才能用 PTRACE_INTERRUPT
+    int status;
+    waitpid(pid_me,&status,WSTOPPED);
+    ptrace(PTRACE_SEIZE,pid_me,nullptr,trace_options|PTRACE_O_EXITKILL);
+    kill(pid_me,SIGCONT);
+    add_thread(pid_me,tgid_me);
+
+    while(waitpid(pid_me,&status,__WALL)==pid_me)
+    {
+        if(!WIFSTOPPED(status))
+        {
+            process_exited=true;
+            return;
+        }
+        if((status>>16)==PTRACE_EVENT_EXEC)
+        {
+            cur_thread().mark_stopped(status,false);
+            return;
+        }
+        //SIGCONT 的 signal-delivery-stop / group-stop
+        ptrace(PTRACE_CONT,pid_me,nullptr,nullptr);
+    }
+}
+
+bool TikiDbg::attach_inferior()
+{
+    //PTRACE_SEIZE 不会让线程停下; 反复扫描 task 目录, 直到没有新线程出现
+    auto task_dir="/proc/"+std::to_string(tgid_me)+"/task";
+    bool added=true;
+    while(added)
+    {
+        added=false;
+        auto dir=opendir(task_dir.c_str());
+        if(dir==nullptr)
+        {
+            std::cerr << "No such process " << tgid_me << std::endl;
+            return false;
+        }
+        while(auto ent=readdir(dir))
+        {
+            if(ent->d_name[0]=='.') continue;
+            pid_t tid=std::stoi(ent->d_name);
+            if(t_threads.count(tid)) continue;
+            if(ptrace(PTRACE_SEIZE,tid,nullptr,trace_options)<0)
+            {//已经通过 PTRACE_O_TRACECLONE 自动跟踪, 或者线程刚退出
+                if(tid==tgid_me)
+                {
+                    std::cerr << "Couldn't attach to " << tgid_me << ": " << strerror(errno) << std::endl;
+                    closedir(dir);
+                    return false;
+                }
+                continue;
+            }
+            add_thread(tid,tgid_me).mark_running();
+            added=true;
+        }
+        closedir(dir);
+    }
+
+    //maps / auxv / 断点都不需要进程停下, 在停下之前做完, 尽量缩短停顿时间
+    initialise_load_address();
+
+    auto start=std::chrono::steady_clock::now();
+    stop_all_threads();
+    auto us=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+    std::cout << "Attached to process " << std::dec << tgid_me << ", " << t_threads.size()
+        << " threads, stopped in " << us << " us" << std::endl;
+    return true;
+}
+
+void TikiDbg::detach()
+{
+    stop_all_threads();
+    if(!t_watch.empty() && t_threads.count(pid_me))
+    {//只读的页留下来会让程序崩溃
+        std::vector<page_span> spans;
+        t_watch.all_pages(spans);
+        protect_pages(pid_me,spans,false);
+        t_watch.clear();
+    }
+    //sigtrap 的事件留着会在下次写入时用 SIGTRAP 杀掉进程
+    t_hwwatch.clear();
+    t_counters.close_all();
+    counters_on=false;
+    std::set<pid_t> tgids;
+    for(auto& t:t_threads)
+    {
+        tgids.insert(t.second.get_tgid());
+    }
+    for(auto tgid:tgids)
+    {
+        detach_process(tgid);
+        std::cout << "Detached from process " << std::dec << tgid << std::endl;
+    }
+    if(!filtered_syscalls.empty())
+    {
+        std::cerr << "Warning: the syscall filter stays installed, caught syscalls will fail with ENOSYS" << std::endl;
+    }
+    t_breakpoints.clear();
+    t_inferiors.clear();
+    t_events.clear();
+    detached=true;
+}
+
+void TikiDbg::detach_process(pid_t tgid)
+{
+    //先让这个进程的线程都停下 (可能正在运行)
+    for(auto& t:t_threads)
+    {
+        if(t.second.get_tgid()!=tgid || !t.second.interrupt()) continue;
+        int status;
+        while(waitpid(t.first,&status,__WALL)==t.first && WIFSTOPPED(status))
+        {
+            bool is_signal=(status>>16)==0;
+            t.second.mark_stopped(status,is_signal);
+            if(!is_signal) break;
+            if(WSTOPSIG(status)!=SIGTRAP) t.second.set_pending_signal(WSTOPSIG(status));
+            if(t.second.stopped_at_breakpoint()) break;
+            t.second.resume();
+        }
+    }
+
+    //停在 int3 之后的线程先退回断点地址, 再一次性恢复所有原始字节
+    auto& bps=breakpoints_of(tgid);
+    std::vector<std::pair<uint64_t,uint8_t>> patches;
+    for(auto& b:bps)
+    {
+        if(b.second.is_enabled()) patches.push_back({b.first,b.second.get_save_byte()});
+    }
+    for(auto& t:t_threads)
+    {
+        auto& th=t.second;
+        if(th.get_tgid()!=tgid || !th.stopped_at_breakpoint()) continue;
+        auto regs=th.get_regs();
+        auto pc=get_register_value(regs,reg::rip)-1;
+        if(!bps.count(pc)) continue;
+        set_register_value(regs,reg::rip,pc);
+        th.set_regs(regs);
+    }
+    if(!patches.empty())
+    {
+        write_remote_bytes(tgid,patches);
+    }
+
+    for(auto it=t_threads.begin(); it!=t_threads.end();)
+    {
+        if(it->second.get_tgid()!=tgid)
+        {
+            ++it;
+            continue;
+        }
+        ptrace(PTRACE_DETACH,it->first,nullptr,it->second.get_pending_signal());
+        t_events.erase(std::remove(t_events.begin(),t_events.end(),it->first),t_events.end());
+        it=t_threads.erase(it);
+    }
+    t_inferiors.erase(tgid);
+}
+
+static pid_t read_tgid(pid_t tid,pid_t fallback)
+{
+    //从 /proc/tid/status 读所属进程
+    std::ifstream status("/proc/"+std::to_string(tid)+"/status");
+    std::string key;
+    while(status >> key)
+    {
+        if(key=="Tgid:")
+        {
+            pid_t tgid;
+            status >> tgid;
+            return tgid;
+        }
+    }
+    return fallback;
+}
+
+TikiThread& TikiDbg::add_thread(pid_t tid,pid_t tgid)
+{
+    auto it=t_threads.find(tid);
+    if(it==t_threads.end())
+    {
+        if(tgid==0)
+        {
+            tgid=read_tgid(tid,tgid_me);
+        }
+        it=t_threads.emplace(tid,TikiThread{tid,tgid,next_thread_num++}).first;
+        //新线程也要计数, 当前进程的线程还要加上 watch
+        std::string err;
+        if(counters_on && !t_counters.add_thread(tid,err))
+        {
+            std::cerr << "Couldn't open counters for thread " << std::dec << tid << ": " << err << std::endl;
+        }
+        if(!t_hwwatch.empty() && tgid==tgid_me) t_hwwatch.add_thread(tid);
+    }
+    return it->second;
+}
+
+bool TikiDbg::dispatch_event(pid_t tid,int status)
+{
+    //返回 true 表示需要报告给用户, 其余事件在这里处理掉
+    if(WIFEXITED(status) || WIFSIGNALED(status))
+    {
+        auto it=t_threads.find(tid);
+        if(it==t_threads.end())
+        {//exec 时已经移除的线程
+            return false;
+        }
+        auto tgid=it->second.get_tgid();
+        flush_syscall_log(tid);
+        t_threads.erase(it);
+        t_events.erase(std::remove(t_events.begin(),t_events.end(),tid),t_events.end());
+        bool has_thread=std::any_of(t_threads.begin(),t_threads.end(),[tgid](auto&& t){return t.second.get_tgid()==tgid;});
+        if(has_thread)
+        {
+            return false;
+        }
+        if(WIFEXITED(status))
+        {
+            if(t_json) t_json->begin("exit").num("pid",tgid).num("code",WEXITSTATUS(status)).end();
+            else std::cout << "Process " << std::dec << tgid << " exited with code " << WEXITSTATUS(status) << std::endl;
+            last_exit_status=status;
+        }
+        else{
+            if(t_json) t_json->begin("exit").num("pid",tgid).str("signal",TikiSignals::name(WTERMSIG(status))).end();
+            else std::cout << "Process " << std::dec << tgid << " killed by signal " << strsignal(WTERMSIG(status)) << std::endl;
+            last_exit_status=status;
+        }
+        if(t_threads.empty())
+        {
+            process_exited=true;
+            return true;
+        }
+        //还有别的进程 (follow-fork-mode both)
+        if(tgid==tgid_me)
+        {
+            auto next=t_threads.begin()->second.get_tgid();
+            switch_inferior(next,false);
+            pid_me=t_threads.begin()->first;
+        }
+        t_inferiors.erase(tgid);
+        return false;
+    }
+    if(!WIFSTOPPED(status))
+    {
+        return false;
+    }
+
+    if(!t_threads.count(tid))
+    {
+        auto tgid=read_tgid(tid,tgid_me);
+        if(tgid==tid && tgid!=tgid_me && !t_inferiors.count(tgid))
+        {//fork 出的子进程, 它的初始停止先于父进程的 fork 事件到达
+            fork_children.insert(tid);
+            return false;
+        }
+        add_thread(tid,tgid);
+    }
+
+    auto& th=add_thread(tid);
+    auto event=status>>16;
+    bool was_interrupting= th.get_state()==thread_state::interrupting;
+    if(event==PTRACE_EVENT_CLONE)
+    {
+        unsigned long new_tid;
+        ptrace(PTRACE_GETEVENTMSG,tid,nullptr,&new_tid);
+        //新线程会自己报告一次 PTRACE_EVENT_STOP, 在那之前当作已停下
+        auto& nt=add_thread(new_tid,th.get_tgid());
+        std::cout << "New thread " << std::dec << nt.get_num() << " (tid " << new_tid << ")" << std::endl;
+    }
+    if(event==PTRACE_EVENT_FORK || event==PTRACE_EVENT_VFORK)
+    {
+        th.mark_stopped(status,false);
+        handle_fork(tid,event==PTRACE_EVENT_VFORK);
+        return false;
+    }
+    if(event==PTRACE_EVENT_VFORK_DONE)
+    {
+        th.mark_stopped(status,false);
+        handle_vfork_done(tid);
+        return false;
+    }
+    if(event==PTRACE_EVENT_SECCOMP)
+    {
+        th.mark_stopped(status,false);
+        if(!syscall_entry(th))
+        {
+            resume_after_event(th,was_interrupting);
+            return false;
+        }
+        th.mark_stopped(status,true);
+        return true;
+    }
+    if(event==0 && WSTOPSIG(status)==(SIGTRAP|0x80))
+    {//日志模式下用 PTRACE_SYSCALL 恢复, 这里是系统调用返回
+        th.mark_stopped(status,false);
+        syscall_exit(th);
+        resume_after_event(th,was_interrupting);
+        return false;
+    }
+    if(event==PTRACE_EVENT_EXEC)
+    {
+        th.mark_stopped(status,false);
+        handle_exec(tid);
+        resume_after_event(add_thread(tid),was_interrupting);
+        return false;
+    }
+    if(event!=0)
+    {
+        //PTRACE_EVENT_CLONE, PTRACE_INTERRUPT 或新线程产生的 PTRACE_EVENT_STOP
+        th.mark_stopped(status,false);
+        resume_after_event(th,was_interrupting);
+        return false;
+    }
+    auto sig=WSTOPSIG(status);
+    if(sig==SIGSEGV && !t_watch.empty())
+    {//watch-range 保护的页被写
+        th.mark_stopped(status,true);
+        bool report;
+        if(handle_watch_fault(th,report))
+        {
+            if(report) return true;
+            resume_after_event(th,was_interrupting);
+            return false;
+        }
+    }
+    if(sig!=SIGTRAP)
+    {
+        auto& policy=t_signals.get(sig);
+        //pass 的信号在下次恢复这个线程时投递
+        if(policy.pass) th.set_pending_signal(sig);
+        if(!policy.stop)
+        {//不回到命令行, 只多一次 wait/cont
+            th.mark_stopped(status,false);
+            if(policy.print)
+            {
+                std::cout << "Thread " << std::dec << th.get_num() << " received signal " << TikiSignals::name(sig)
+                    << ", " << strsignal(sig) << std::endl;
+            }
+            resume_after_event(th,was_interrupting);
+            return false;
+        }
+    }
+    th.mark_stopped(status,true);
+    return true;
+}
+
+void TikiDbg::resume_after_event(TikiThread& th,bool was_interrupting)
+{
+    if(th.get_tid()==stepping_tid)
+    {//单步经过 clone 等系统调用
+        th.resume(stepping_request);
+    }
+    else if(threads_running || (non_stop && !was_interrupting))
+    {
+        th.resume(syscall_pending.count(th.get_tid())? PTRACE_SYSCALL : PTRACE_CONT);
+    }
+}
+
+void TikiDbg::handle_fork(pid_t tid,bool is_vfork)
+{
+    unsigned long child_pid;
+    ptrace(PTRACE_GETEVENTMSG,tid,nullptr,&child_pid);
+    pid_t child=child_pid;
+    if(!fork_children.erase(child))
+    {//等子进程的初始停止
+        int status;
+        waitpid(child,&status,__WALL);
+    }
+    auto parent=t_threads.at(tid).get_tgid();
+    auto& bps=breakpoints_of(parent);
+
+    if(follow_mode==follow_fork::parent)
+    {
+        //子进程继承了 int3, 一次写回原始字节后放开, 之后它的事件不再经过调试器
+        if(!bps.empty())
+        {
+            std::vector<std::pair<uint64_t,uint8_t>> patches;
+            for(auto& b:bps)
+            {
+                if(b.second.is_enabled()) patches.push_back({b.first,b.second.get_save_byte()});
+            }
+            write_remote_bytes(child,patches);
+            //vfork 的子进程与父进程共用内存, 断点等 VFORK_DONE 之后再插回去
+            if(is_vfork) vfork_stripped.insert(tid);
+        }
+        if(!t_watch.empty() && !is_vfork && parent==tgid_me)
+        {//子进程继承了只读的页, 放开之前恢复成原来的权限
+            std::vector<page_span> spans;
+            t_watch.all_pages(spans);
+            protect_pages(child,spans,false);
+        }
+        if(!filtered_syscalls.empty())
+        {//SECCOMP_RET_TRACE 在没有 tracer 时让系统调用返回 ENOSYS
+            std::cerr << "Warning: process " << std::dec << child << " inherits the syscall filter, caught syscalls will fail with ENOSYS" << std::endl;
+        }
+        ptrace(PTRACE_DETACH,child,nullptr,nullptr);
+        resume_after_event(t_threads.at(tid),false);
+        return;
+    }
+
+    //子进程接收一份断点表和模块表的拷贝
+    TikiInferior inf{program_name,{},TikiModuleTable{},binary_addr_base,solib_event_addr,displaced_addr};
+    if(parent!=tgid_me)
+    {
+        auto& p=t_inferiors.at(parent);
+        inf=TikiInferior{p.program_name,{},p.modules,p.binary_addr_base,p.solib_event_addr,p.displaced_addr};
+    }
+    else{
+        inf.modules=t_modules;
+    }
+    inf.modules.set_pid(child);
+    for(auto& b:bps)
+    {
+        inf.breakpoints.emplace(b.first,Tikibreakpoint{child,b.first,b.second});
+    }
+    t_inferiors.emplace(child,std::move(inf));
+    auto& cth=add_thread(child,child);
+    cth.mark_stopped(0,false);
+    std::cout << "Process " << std::dec << parent << (is_vfork? " vforked " : " forked ")
+        << "child process " << child << std::endl;
+
+    if(follow_mode==follow_fork::child)
+    {
+        select_tid(child);
+        if(is_vfork)
+        {//父进程在子进程 exec/exit 之前不会运行, 之后再去掉断点放开
+            detach_on_vfork_done.insert(parent);
+            resume_after_event(t_threads.at(tid),false);
+        }
+        else{
+            detach_process(parent);
+            std::cout << "Detached from process " << std::dec << parent << std::endl;
+        }
+    }
+    else{
+        resume_after_event(t_threads.at(tid),false);
+    }
+    resume_after_event(add_thread(child,child),false);
+}
+
+void TikiDbg::handle_vfork_done(pid_t tid)
+{
+    auto tgid=t_threads.at(tid).get_tgid();
+    if(vfork_stripped.erase(tid))
+    {//子进程已经 exec/exit, 把断点插回去
+        std::vector<std::pair<uint64_t,uint8_t>> patches;
+        for(auto& b:breakpoints_of(tgid))
+        {
+            if(b.second.is_enabled()) patches.push_back({b.first,int3_byte});
+        }
+        write_remote_bytes(tgid,patches);
+    }
+    if(detach_on_vfork_done.erase(tgid))
+    {
+        detach_process(tgid);
+        std::cout << "Detached from process " << std::dec << tgid << std::endl;
+        return;
+    }
+    resume_after_event(t_threads.at(tid),false);
+}
+
+void TikiDbg::handle_exec(pid_t tid)
+{
+    //exec 之后只剩一个线程, 且 tid 等于进程号; 旧映像里的断点随之消失
+    auto tgid=t_threads.at(tid).get_tgid();
+    for(auto it=t_threads.begin(); it!=t_threads.end();)
+    {
+        if(it->second.get_tgid()==tgid && it->first!=tid)
+        {
+            t_events.erase(std::remove(t_events.begin(),t_events.end(),it->first),t_events.end());
+            it=t_threads.erase(it);
+        }
+        else{
+            ++it;
+        }
+    }
+    auto old=tgid_me;
+    switch_inferior(tgid);
+    char exe[0x1000]={0};
+    readlink(("/proc/"+std::to_string(tgid)+"/exe").c_str(),exe,sizeof(exe)-1);
+    program_name=exe;
+    t_breakpoints.clear();
+    if(tgid==old)
+    {//跟踪点和环形缓冲区都在旧映像里
+        t_fast.reset();
+        call_frames.clear();
+        t_watch.clear();
+        watch_hits.clear();
+        t_hwwatch.clear();
+    }
+    initialise_load_address();
+    std::cout << "Process " << std::dec << tgid << " is executing new program: " << program_name << std::endl;
+    switch_inferior(old);
+}
+
+void TikiDbg::select_tid(pid_t tid)
+{
+    pid_me=tid;
+    switch_inferior(cur_thread().get_tgid());
+}
+
+void TikiDbg::switch_inferior(pid_t tgid,bool park_current)
+{
+    if(tgid==tgid_me) return;
+    auto it=t_inferiors.find(tgid);
+    if(it==t_inferiors.end()) return;
+    auto next=std::move(it->second);
+    t_inferiors.erase(it);
+    if(park_current)
+    {
+        t_inferiors.emplace(tgid_me,TikiInferior{std::move(program_name),std::move(t_breakpoints),std::move(t_modules),
+            binary_addr_base,solib_event_addr,displaced_addr});
+    }
+    tgid_me=tgid;
+    program_name=std::move(next.program_name);
+    t_breakpoints=std::move(next.breakpoints);
+    t_modules=std::move(next.modules);
+    binary_addr_base=next.binary_addr_base;
+    solib_event_addr=next.solib_event_addr;
+    displaced_addr=next.displaced_addr;
+}
+
+std::unordered_map<std::intptr_t,Tikibreakpoint>& TikiDbg::breakpoints_of(pid_t tgid)
+{
+    auto it=t_inferiors.find(tgid);
+    return it==t_inferiors.end()? t_breakpoints : it->second.breakpoints;
+}
+
+bool TikiDbg::pop_event(pid_t& tid)
+{
+    while(!t_events.empty())
+    {
+        tid=t_events.front();
+        t_events.pop_front();
+        auto it=t_threads.find(tid);
+        if(it==t_threads.end())
+        {
+            continue;
+        }
+        auto& th=it->second;
+        if(th.get_stop_info().si_signo==0)
+        {//delete 时已经处理掉了
+            continue;
+        }
+        if(th.stopped_at_breakpoint())
+        {
+            //排队期间断点被删掉了: 回退 pc, 丢弃这个事件
+            auto regs=th.get_regs();
+            auto bp_addr=get_register_value(regs,reg::rip)-1;
+            if(!breakpoints_of(th.get_tgid()).count(bp_addr))
+            {
+                set_register_value(regs,reg::rip,bp_addr);
+                th.set_regs(regs);
+                th.clear_stop_reason();
+                continue;
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool TikiDbg::next_event(pid_t& tid)
+{
+    if(stepping_tid==0 && pop_event(tid))
+    {
+        return true;
+    }
+
+    int status;
+    while((tid=wait_any(status))>=0)
+    {
+        if(tid==0)
+        {//Ctrl-C: 停下所有线程
+            interrupt_threads(true);
+            tid=take_interrupt_event(stepping_tid? stepping_tid : pid_me);
+            t_loop.stop_timer();
+            return true;
+        }
+        if(!dispatch_event(tid,status))
+        {
+            if(stepping_tid!=0 && !t_threads.count(stepping_tid))
+            {
+                t_loop.stop_timer();
+                return false;
+            }
+            continue;
+        }
+        if(process_exited || stepping_tid==0 || tid==stepping_tid)
+        {
+            //被调试进程和调试器同时收到终端的 SIGINT, 它已经作为信号报告了
+            t_loop.drain_interrupts();
+            t_loop.stop_timer();
+            return true;
+        }
+        t_events.push_back(tid);
+    }
+    t_loop.stop_timer();
+    process_exited=true;
+    return false;
+}
+
+pid_t TikiDbg::wait_any(int& status)
+{
+    //先 WNOHANG 收事件, 没有再睡在 epoll 上; 等待期间能响应 Ctrl-C, 定时读 ftrace-fast 的缓冲区
+    //返回 0 表示被 Ctrl-C 打断
+    if(!t_loop.is_open())
+    {
+        return waitpid(-1,&status,__WALL);
+    }
+    pid_t tid;
+    while((tid=waitpid(-1,&status,__WALL|WNOHANG))==0)
+    {
+        t_loop.start_timer(drain_interval_us);
+        int timeout=-1;
+        if(wait_deadline!=0)
+        {//fuzz 的超时: 返回 0, 由 next_event 打断所有线程
+            auto now=stat_now();
+            if(now>=wait_deadline)
+            {
+                wait_timed_out=true;
+                return 0;
+            }
+            timeout=static_cast<int>((wait_deadline-now)/1000000)+1;
+        }
+        auto ready=t_loop.wait(src_child|src_interrupt|src_timer,timeout);
+        if(ready&src_timer)
+        {
+            drain_fast_trace();
+        }
+        if(ready&src_interrupt)
+        {
+            return 0;
+        }
+    }
+    return tid;
+}
+
+char* TikiDbg::read_command(const char* prompt)
+{
+    //后台运行时一边编辑命令一边处理被调试进程的事件
+    //JSON 输出在等待输入之前写出
+    if(!t_loop.is_open() || !isatty(STDIN_FILENO))
+    {//管道输入由 stdio 缓冲, 不能用 epoll 判断是否可读; 读之前先处理已经到达的事件
+        handle_background_events(src_child);
+        if(t_json) t_json->flush();
+        return linenoise(prompt);
+    }
+    char buf[4096];
+    linenoiseState ls;
+    linenoiseEditStart(&ls,-1,-1,buf,sizeof(buf),prompt);
+    char* line=nullptr;
+    while(true)
+    {
+        bool running=std::any_of(t_threads.begin(),t_threads.end(),[](auto&& t){return !t.second.is_stopped();});
+        if(running) t_loop.start_timer(drain_interval_us);
+        else t_loop.stop_timer();
+        if(t_json) t_json->flush();
+        auto ready=t_loop.wait(src_input|src_child|src_interrupt|src_timer);
+        if(ready&(src_child|src_interrupt))
+        {//可能要打印停止信息, 先收起正在编辑的行
+            linenoiseHide(&ls);
+            handle_background_events(ready);
+            linenoiseShow(&ls);
+        }
+        else if(ready&src_timer)
+        {
+            drain_fast_trace();
+        }
+        if(ready&src_input)
+        {
+            line=linenoiseEditFeed(&ls);
+            if(line!=linenoiseEditMore) break;
+        }
+    }
+    linenoiseEditStop(&ls);
+    t_loop.stop_timer();
+    return line;
+}
+
+void TikiDbg::handle_background_events(uint32_t ready)
+{
+    if(ready&src_timer)
+    {
+        drain_fast_trace();
+    }
+    if((ready&src_interrupt) && !interrupt_threads(true))
+    {//没有在运行的线程
+        ready&=~src_interrupt;
+    }
+    poll_events();
+    if(non_stop || (!threads_running && !(ready&src_interrupt)))
+    {//non-stop 的事件 poll_events 已经报告了
+        return;
+    }
+    //all-stop 的 continue &: 一个线程停下就停下所有线程, 和前台 continue 一样报告
+    pid_t tid;
+    while(true)
+    {
+        if(!pop_event(tid))
+        {
+            if(!(ready&src_interrupt) || process_exited || !t_threads.count(pid_me)) return;
+            tid=take_interrupt_event(pid_me);
+            ready&=~src_interrupt;
+        }
+        internal_stop=false;
+        if(threads_running) stop_all_threads();
+        select_tid(tid);
+        report_stop();
+        if(!internal_stop || process_exited) return;
+        if(!t_events.empty()) continue;
+        step_over_breakpoint();
+        resume_all_threads();
+        return;
+    }
+}
+
+TikiJsonWriter& TikiDbg::json_stop(const char* reason)
+{
+    return t_json->begin("stop").str("reason",reason).num("thread",cur_thread().get_num()).num("tid",pid_me).hex("pc",get_pc());
+}
+
+void TikiDbg::bench_output(uint64_t n)
+{
+    //同一个停止点的寄存器和反汇编, 文本 (std::cout, 每行 endl) 和 JSON 各输出 n 次到 /dev/null
+    std::ofstream null_text{"/dev/null"};
+    auto null_fd=open("/dev/null",O_WRONLY);
+    if(!null_text || null_fd<0)
+    {
+        std::cerr << "Cannot open /dev/null" << std::endl;
+        if(null_fd>=0) close(null_fd);
+        return;
+    }
+    auto saved_json=t_json;
+    double rate[2][2];
+    for(int mode=0;mode<2;mode++)
+    {
+        TikiJsonWriter null_json{null_fd};
+        auto saved_out=std::cout.rdbuf();
+        if(mode==0)
+        {
+            t_json=nullptr;
+            std::cout.rdbuf(null_text.rdbuf());
+        }
+        else{
+            t_json=&null_json;
+        }
+        for(int what=0;what<2;what++)
+        {
+            auto start=std::chrono::steady_clock::now();
+            for(uint64_t i=0;i<n;i++)
+            {
+                if(what==0) dump_registers();
+                else print_disassembly(get_pc(),0x50,7);
+            }
+            std::chrono::duration<double> took=std::chrono::steady_clock::now()-start;
+            rate[mode][what]=n/took.count();
+        }
+        null_json.flush();
+        std::cout.rdbuf(saved_out);
+    }
+    t_json=saved_json;
+    close(null_fd);
+    std::cout << std::fixed << std::setprecision(0)
+        << "registers:    text " << rate[0][0] << " events/s, json " << rate[1][0] << " events/s\n"
+        << "disassembly:  text " << rate[0][1] << " events/s, json " << rate[1][1] << " events/s" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+bool TikiDbg::bench_breakpoint(uint64_t n,uint64_t addr,bench_result& r)
+{
+    //和 fuzz 一样用 quiet_stops 跑 continue_execution, 只少了停止信息的输出; 断点不存在时临时加上
+    if(addr==0)
+    {
+        std::cerr << "No such breakpoint target" << std::endl;
+        return false;
+    }
+    bool added=false,was_enabled=true;
+    auto it=t_breakpoints.find(addr);
+    if(it==t_breakpoints.end())
+    {
+        Tikibreakpoint bp{tgid_me,static_cast<std::intptr_t>(addr)};
+        bp.enable();
+        t_breakpoints[addr]=bp;
+        added=true;
+    }
+    else if(!it->second.is_enabled())
+    {//用户禁用的断点, 测完再禁用
+        was_enabled=false;
+        it->second.enable();
+    }
+    auto at_addr=[this,addr]{return !process_exited && t_threads.count(pid_me) && get_pc()-1==addr;};
+    quiet_stops=true;
+    if(!at_addr()) continue_execution();
+    uint64_t done=0;
+    auto start=std::chrono::steady_clock::now();
+    while(done<n && at_addr())
+    {
+        continue_execution();
+        if(at_addr()) ++done;
+    }
+    std::chrono::nanoseconds took=std::chrono::steady_clock::now()-start;
+    quiet_stops=false;
+    interrupt_stop=false;   //Ctrl-C 停下时 report_stop 不处理, 在这里清掉
+    if((added || !was_enabled) && t_breakpoints.count(addr))
+    {//停在临时 (或原本禁用的) 断点上时 pc 退回到原指令
+        if(at_addr()) set_pc(addr);
+        if(!process_exited) t_breakpoints.at(addr).disable();
+        if(added) t_breakpoints.erase(addr);
+    }
+    if(done<n)
+    {
+        std::cerr << "Stopped after " << std::dec << done << " hits, not at 0x" << std::hex << addr << std::endl;
+        return false;
+    }
+    r.name="breakpoint";
+    r.ops=done;
+    r.ns=took.count();
+    return true;
+}
+
+bool TikiDbg::bench_step(uint64_t n,bench_result& r)
+{
+    //instep 的路径 (emulate 打开时包括模拟), 输出丢掉
+    std::ofstream null_text{"/dev/null"};
+    auto saved_out=std::cout.rdbuf(null_text.rdbuf());
+    auto saved_json=t_json;
+    t_json=nullptr;
+    auto start=std::chrono::steady_clock::now();
+    auto done=step_instructions(n,0,nullptr);
+    std::chrono::nanoseconds took=std::chrono::steady_clock::now()-start;
+    t_json=saved_json;
+    std::cout.rdbuf(saved_out);
+    if(done<n)
+    {
+        std::cerr << "Stepped only " << std::dec << done << " instructions (breakpoint or signal)" << std::endl;
+        return false;
+    }
+    r.name= emulate? "step-emulated" : "step";
+    r.ops=done;
+    r.ns=took.count();
+    return true;
+}
+
+bool TikiDbg::bench_read(uint64_t n,uint64_t chunk,bench_result& r)
+{
+    //在最大的可读写映射里依次读, 到末尾后从头开始
+    uint64_t base,size;
+    if(!largest_writable_mapping(tgid_me,base,size))
+    {
+        std::cerr << "No writable mapping in process " << std::dec << tgid_me << std::endl;
+        return false;
+    }
+    if(chunk==0 || chunk>size) chunk=size;
+    std::vector<uint8_t> buf(chunk);
+    uint64_t off=0;
+    auto start=std::chrono::steady_clock::now();
+    for(uint64_t i=0;i<n;i++)
+    {
+        if(off+chunk>size) off=0;
+        if(!read_remote(tgid_me,base+off,buf.data(),chunk))
+        {
+            std::cerr << "Cannot read 0x" << std::hex << base+off << std::endl;
+            return false;
+        }
+        off+=chunk;
+    }
+    std::chrono::nanoseconds took=std::chrono::steady_clock::now()-start;
+    r.name="read-"+std::to_string(chunk);
+    r.ops=n;
+    r.ns=took.count();
+    r.unit="bytes";
+    r.units=n*chunk;
+    return true;
+}
+
+bool TikiDbg::bench_per_stop(uint64_t n,bool registers,bench_result& r)
+{
+    //每次停下都要做的输出, 用当前的输出模式 (文本或 JSON) 写到 /dev/null; 寄存器每次重新 GETREGS
+    std::ofstream null_text{"/dev/null"};
+    auto null_fd=open("/dev/null",O_WRONLY);
+    if(!null_text || null_fd<0)
+    {
+        std::cerr << "Cannot open /dev/null" << std::endl;
+        if(null_fd>=0) close(null_fd);
+        return false;
+    }
+    auto& th=cur_thread();
+    auto pc=get_pc();
+    auto saved_json=t_json;
+    auto saved_out=std::cout.rdbuf();
+    uint64_t ns;
+    {
+        TikiJsonWriter null_json{null_fd};
+        if(t_json)
+        {
+            t_json=&null_json;
+        }
+        else{
+            std::cout.rdbuf(null_text.rdbuf());
+        }
+        auto start=std::chrono::steady_clock::now();
+        for(uint64_t i=0;i<n;i++)
+        {
+            if(registers)
+            {
+                th.invalidate_regs();
+                dump_registers();
+            }
+            else{
+                print_disassembly(pc,0x50,7);
+            }
+        }
+        null_json.flush();
+        ns=std::chrono::nanoseconds{std::chrono::steady_clock::now()-start}.count();
+        std::cout.rdbuf(saved_out);
+        t_json=saved_json;
+    }
+    close(null_fd);
+    r.name= registers? "registers" : "disasm";
+    r.ops=n;
+    r.ns=ns;
+    return true;
+}
+
+bool TikiDbg::bench_backtrace(uint64_t n,bench_result& r)
+{
+    //profile 每个样本的回溯, 在 bench_recurse 的深栈上最慢
+    static const size_t max_frames=65536;
+    std::vector<uint64_t> frames(max_frames);
+    std::vector<uint8_t> scratch;
+    auto& th=cur_thread();
+    uint64_t total=0;
+    auto start=std::chrono::steady_clock::now();
+    for(uint64_t i=0;i<n;i++)
+    {
+        total+=walk_frame_pointers(tgid_me,th.get_regs(),frames.data(),frames.size(),scratch);
+    }
+    std::chrono::nanoseconds took=std::chrono::steady_clock::now()-start;
+    r.name="backtrace";
+    r.ops=n;
+    r.ns=took.count();
+    r.unit="frames";
+    r.units=total;
+    return true;
+}
+
+bool TikiDbg::bench_symbols(uint64_t n,bench_result& by_addr,bench_result& by_name)
+{
+    //主程序范围内的伪随机地址; 第一次符号化会加载符号表, 单独记为 first_ns
+    auto m=t_modules.get_main();
+    if(!m || m->get_end()<=m->get_start())
+    {
+        std::cerr << "No main module" << std::endl;
+        return false;
+    }
+    auto lo=m->get_start();
+    auto span=m->get_end()-lo;
+    uint64_t x=0x9e3779b97f4a7c15ull;
+    auto next_addr=[&x,lo,span]{
+        x^=x<<13;
+        x^=x>>7;
+        x^=x<<17;
+        return lo+x%span;
+    };
+    //成功时是 "name+0xoff", 留下名字给反查用
+    std::vector<std::string> names;
+    std::string sym;
+    auto cold=std::chrono::steady_clock::now();
+    if(m->symbolize(next_addr(),sym)) names.push_back(sym);
+    auto cold_found=names.size();
+    auto start=std::chrono::steady_clock::now();
+    for(uint64_t i=1;i<n;i++)
+    {
+        if(m->symbolize(next_addr(),sym)) names.push_back(sym);
+    }
+    auto end=std::chrono::steady_clock::now();
+    by_addr.name="symbolize";
+    by_addr.ops=n-1;
+    by_addr.ns=std::chrono::nanoseconds{end-start}.count();
+    by_addr.unit="found";
+    by_addr.units=names.size()-cold_found;
+    by_addr.first_ns=std::chrono::nanoseconds{start-cold}.count();
+    if(names.empty()) return true;
+    for(auto& s:names) s.erase(std::min(s.find('+'),s.size()));
+    uint64_t found=0;
+    start=std::chrono::steady_clock::now();
+    for(auto& s:names)
+    {
+        if(m->lookup_symbol(s)) ++found;
+    }
+    end=std::chrono::steady_clock::now();
+    by_name.name="lookup";
+    by_name.ops=names.size();
+    by_name.ns=std::chrono::nanoseconds{end-start}.count();
+    by_name.unit="found";
+    by_name.units=found;
+    return true;
+}
+
+void TikiDbg::continue_background()
+{
+    //continue &: 立即回到提示符, 停下时由 read_command 报告
+    if(recording)
+    {
+        std::cerr << "Cannot run in the background while recording" << std::endl;
+        return;
+    }
+    if(non_stop)
+    {
+        step_over_breakpoint();
+        if(t_threads.count(pid_me)) cur_thread().resume();
+        return;
+    }
+    if(!t_events.empty())
+    {//还有没报告的事件, 和前台一样先报告
+        continue_execution();
+        return;
+    }
+    step_over_breakpoint();
+    if(!process_exited) resume_all_threads();
+}
+
+bool TikiDbg::interrupt_threads(bool all)
+{
+    //PTRACE_INTERRUPT 之后统一收集, 同时到达的断点等事件照常排队
+    bool any=std::any_of(t_threads.begin(),t_threads.end(),[](auto&& t){return !t.second.is_stopped();});
+    if(!any)
+    {
+        return false;
+    }
+    if(all)
+    {
+        stop_all_threads();
+        return true;
+    }
+    auto& th=cur_thread();
+    auto tid=th.get_tid();
+    if(!th.interrupt())
+    {
+        return false;
+    }
+    int status;
+    while(t_threads.count(tid) && t_threads.at(tid).get_state()==thread_state::interrupting
+        && waitpid(tid,&status,__WALL)==tid)
+    {
+        if(dispatch_event(tid,status) && !process_exited)
+        {
+            t_events.push_back(tid);
+        }
+    }
+    return true;
+}
+
+pid_t TikiDbg::take_interrupt_event(pid_t want)
+{
+    //打断的同时恰好有事件 (比如被调试进程也收到了 SIGINT), 报告那个事件
+    auto it=std::find(t_events.begin(),t_events.end(),want);
+    if(it!=t_events.end())
+    {
+        t_events.erase(it);
+        return want;
+    }
+    pid_t tid;
+    if(stepping_tid==0 && pop_event(tid))
+    {
+        return tid;
+    }
+    interrupt_stop=true;
+    if(t_threads.count(want)) t_threads.at(want).clear_stop_reason();
+    return want;
+}
+
+void TikiDbg::poll_events()
+{
+    //non-stop 下其他线程在等待输入期间也可能停下, 每次读命令前处理掉
+    int status;
+    pid_t tid;
+    while((tid=waitpid(-1,&status,__WALL|WNOHANG))>0)
+    {
+        if(dispatch_event(tid,status) && !process_exited)
+        {
+            t_events.push_back(tid);
+        }
+    }
+    if(!non_stop)
+    {//all-stop 下由下一次 continue 报告
+        return;
+    }
+    auto old=pid_me;
+    while(pop_event(tid))
+    {
+        internal_stop=false;
+        select_tid(tid);
+        report_stop();
+        if(internal_stop)
+        {
+            step_over_breakpoint();
+            cur_thread().resume();
+            if(t_threads.count(old)) select_tid(old);
+        }
+    }
+}
+
+void TikiDbg::stop_all_threads()
+{
+    //先一次发出所有 PTRACE_INTERRUPT, 再统一收集
+    threads_running=false;
+    for(auto& t:t_threads)
+    {
+        t.second.interrupt();
+    }
+    auto pending=[this]{
+        return std::any_of(t_threads.begin(),t_threads.end(),[](auto&& t){return t.second.get_state()==thread_state::interrupting;});
+    };
+    while(pending())
+    {
+        int status;
+        pid_t tid=waitpid(-1,&status,__WALL);
+        if(tid<0)
+        {
+            break;
+        }
+        if(dispatch_event(tid,status) && !process_exited)
+        {//别的线程同时命中断点等, 排队稍后报告
+            t_events.push_back(tid);
+        }
+    }
+}
+
+void TikiDbg::step_over_thread_breakpoint(TikiThread& th)
+{
+    //其余线程都已停下, 临时去掉 int3 是安全的
+    auto regs=th.get_regs();
+    auto bp_addr=get_register_value(regs,reg::rip)-1;
+    auto& bps=breakpoints_of(th.get_tgid());
+    auto it=bps.find(bp_addr);
+    if(it==bps.end() || !it->second.is_enabled())
+    {
+        return;
+    }
+    set_register_value(regs,reg::rip,bp_addr);
+    th.set_regs(regs);
+    it->second.disable();
+    step_thread_quietly(th);
+    it->second.enable();
+}
+
+bool TikiDbg::step_thread_quietly(TikiThread& th)
+{
+    //只等这一个线程, 其他线程的事件留在内核里; 途中收到的信号 (和之前挂着的) 留到下次恢复时再投递
+    //单步期间不能投递: 处理函数的栈帧会记下临时代码区 (displaced_step) 里的 rip
+    auto tid=th.get_tid();
+    int deferred=th.get_pending_signal();
+    th.set_pending_signal(0);
+    int status;
+    while(th.resume(PTRACE_SINGLESTEP) && waitpid(tid,&status,__WALL)==tid)
+    {
+        if(!WIFSTOPPED(status))
+        {
+            dispatch_event(tid,status);
+            return false;
+        }
+        bool is_signal=(status>>16)==0;
+        th.mark_stopped(status,is_signal);
+        if(!is_signal)
+        {
+            continue;
+        }
+        if(WSTOPSIG(status)==SIGTRAP)
+        {
+            th.set_pending_signal(deferred);
+            return true;
+        }
+        if(deferred==0) deferred=WSTOPSIG(status);
+    }
+    th.set_pending_signal(deferred);
+    return false;
+}
+
+bool TikiDbg::displaced_step(uint64_t bp_addr)
+{
+    //把原指令拷到临时代码区单步执行, 断点处的 int3 保持不动, 其他线程不受影响
+    if(displaced_addr==0)
+    {
+        return false;
+    }
+    uint8_t code[16];
+    if(!read_remote(tgid_me,bp_addr,code,sizeof(code)))
+    {
+        return false;
+    }
+    for(auto& b:t_breakpoints)
+    {
+        auto off=static_cast<uint64_t>(b.first)-bp_addr;
+        if(off<sizeof(code) && b.second.is_enabled())
+        {
+            code[off]=b.second.get_save_byte();
+        }
+    }
+
+    cs_insn *insn;
+    if(cs_disasm(cs_handle, code, sizeof(code), bp_addr, 1, &insn)!=1)
+    {
+        return false;
+    }
+    bool rip_relative=false;
+    auto& x86=insn[0].detail->x86;
+    for(int i=0;i<x86.op_count;i++)
+    {
+        if(x86.operands[i].type==X86_OP_MEM && x86.operands[i].mem.base==X86_REG_RIP)
+        {
+            rip_relative=true;
+        }
+    }
+    bool is_call=cs_insn_group(cs_handle,insn,X86_GRP_CALL);
+    bool is_relative=cs_insn_group(cs_handle,insn,X86_GRP_BRANCH_RELATIVE);
+    uint64_t len=insn[0].size;
+    cs_free(insn,1);
+    if(rip_relative)
+    {//搬走之后地址就错了
+        return false;
+    }
+
+    uint8_t saved[16];
+    auto& th=cur_thread();
+    auto tid=th.get_tid();
+    read_remote(tgid_me,displaced_addr,saved,len);
+    write_remote(tgid_me,displaced_addr,code,len);
+    set_pc(displaced_addr);
+    bool alive=step_thread_quietly(th);
+    write_remote(tgid_me,displaced_addr,saved,len);
+    if(!alive || !t_threads.count(tid))
+    {
+        return true;
+    }
+
+    //修正 rip: 顺序执行 / 相对跳转按偏移换算回去 / 绝对跳转不变
+    auto regs=th.get_regs();
+    uint64_t pc=get_register_value(regs,reg::rip);
+    if(pc==displaced_addr+len)
+    {
+        pc=bp_addr+len;
+    }
+    else if(is_relative)
+    {
+        pc=pc-displaced_addr+bp_addr;
+    }
+    set_register_value(regs,reg::rip,pc);
+    th.set_regs(regs);
+    if(is_call)
+    {
+        uint64_t ret_addr=bp_addr+len;
+        write_remote(tgid_me,get_register_value(regs,reg::rsp),&ret_addr,sizeof(ret_addr));
+    }
+    return true;
+}
+
+void TikiDbg::step_over_breakpoint_non_stop(uint64_t bp_addr)
+{
+    if(!displaced_step(bp_addr))
+    {
+        //无法搬走的指令: 短暂停下其他线程, 按 all-stop 的方式去掉 int3 单步
+        std::vector<pid_t> running;
+        for(auto& t:t_threads)
+        {
+            if(t.first!=pid_me && !t.second.is_stopped()) running.push_back(t.first);
+        }
+        stop_all_threads();
+        auto& bp=t_breakpoints[bp_addr];
+        bp.disable();
+        step_thread_quietly(cur_thread());
+        bp.enable();
+        for(auto tid:running)
+        {
+            auto it=t_threads.find(tid);
+            if(it==t_threads.end() || std::find(t_events.begin(),t_events.end(),tid)!=t_events.end()) continue;
+            it->second.resume();
+        }
+    }
+}
+
+bool TikiDbg::step_over_breakpoint_quietly()
+{
+    auto bp_addr=get_pc()-1;
+    auto it=t_breakpoints.find(bp_addr);
+    if(it==t_breakpoints.end() || !it->second.is_enabled())
+    {
+        return false;
+    }
+    if(non_stop)
+    {
+        set_pc(bp_addr);
+        step_over_breakpoint_non_stop(bp_addr);
+    }
+    else{
+        step_over_thread_breakpoint(cur_thread());
+    }
+    return true;
+}
+
+bool TikiDbg::step_thread_fast(pid_t tid,int request,int& status,int* resume_err)
+{
+    //恢复一次并等到这个线程因信号停下; 线程退出或被事件停住返回 false
+    //写 watch-range 保护的页的 SIGSEGV 在这里单步完成写入: 命中范围时留在 watch_hits 里, 以 SIGSEGV 返回给调用者报告;
+    //同一页的其他地址不算停下, 单步时当作这一步已经完成
+    //resume_err: 恢复本身失败时的 errno (线程不是停止状态时为 0), 其他原因返回 false 时不动它
+    errno=0;
+    if(!t_threads.at(tid).resume(request))
+    {
+        if(resume_err) *resume_err=errno;
+        return false;
+    }
+    stepping_request=request;
+    //等所有线程: 进程退出时其他线程的退出要先收掉, 主线程才会报告
+    pid_t w;
+    while((w=waitpid(-1,&status,__WALL))>0)
+    {
+        if(w==tid && WIFSTOPPED(status) && (status>>16)==0)
+        {
+            if(WSTOPSIG(status)!=SIGSEGV || t_watch.empty())
+            {
+                return true;
+            }
+            auto& th=t_threads.at(tid);
+            th.mark_stopped(status,true);
+            bool report;
+            if(!handle_watch_fault(th,report))
+            {
+                return true;
+            }
+            if(!t_threads.count(tid) || !th.is_stopped())
+            {
+                return false;
+            }
+            if(report)
+            {
+                return true;
+            }
+            if(request==PTRACE_SINGLESTEP)
+            {
+                status=(SIGTRAP<<8)|0x7f;
+                return true;
+            }
+            errno=0;
+            if(!th.resume(request))
+            {
+                if(resume_err) *resume_err=errno;
+                return false;
+            }
+            continue;
+        }
+        //退出, 或 clone/fork 等事件 (dispatch_event 会继续单步)
+        if(dispatch_event(w,status) && !process_exited && w!=tid)
+        {
+            t_events.push_back(w);
+        }
+        if(!t_threads.count(tid) || t_threads.at(tid).is_stopped()) break;
+    }
+    return false;
+}
+
+uint64_t TikiDbg::step_instructions(uint64_t count,uint64_t until,TikiTraceWriter* trace)
+{
+    //不经过 wait_for_signal/handle_sigtrap, 每条指令只有 SINGLESTEP + waitpid + GETREGS, 不打印
+    //返回实际执行的指令数
+    if(recording && !require_record_thread()) return 0;
+    auto start=std::chrono::steady_clock::now();
+    auto tid=pid_me;
+    uint64_t n=0;
+    bool reported=false;
+    stepping_tid=tid;
+    //non-stop 下其他线程在跑, 内存镜像靠不住; 模拟的写入会绕过 watch-range 的页保护
+    bool use_emu=emulate && !non_stop && !recording && t_watch.empty();
+    if(use_emu || recording)
+    {
+        emulator().clear_code();
+        emu_maps_stale=true;
+    }
+    std::intptr_t held_bp=0;
+    if(recording)
+    {//断点处的那条指令也要记录, 临时去掉 int3 后走下面的循环 (其他线程都停着)
+        auto bp=t_breakpoints.find(get_pc()-1);
+        if(bp!=t_breakpoints.end() && bp->second.is_enabled())
+        {
+            set_pc(bp->first);
+            cur_thread().clear_stop_reason();
+            bp->second.disable();
+            held_bp=bp->first;
+        }
+    }
+    else if(step_over_breakpoint_quietly())
+    {
+        ++n;
+        if(trace && t_threads.count(tid)) trace->record(cur_thread().get_regs());
+    }
+    while(n<count && t_threads.count(tid))
+    {
+        auto& th=t_threads.at(tid);
+        auto prev_pc=get_register_value(th.get_regs(),reg::rip);
+        if(n>0 && prev_pc==until)
+        {
+            break;
+        }
+        if(use_emu)
+        {
+            auto done=emulate_batch(th,count-n,until,trace);
+            n+=done;
+            if(done>0) continue;
+        }
+        if(recording)
+        {
+            record_before(th);
+        }
+        int status;
+        bool stepped=step_thread_fast(tid,PTRACE_SINGLESTEP,status);
+        if(held_bp)
+        {
+            t_breakpoints.at(held_bp).enable();
+            held_bp=0;
+        }
+        if(!stepped)
+        {
+            t_record.cancel();
+            break;
+        }
+        auto& cur=t_threads.at(tid);
+        if((use_emu || recording) && get_register_value(cur.get_regs(),reg::orig_rax)!=~0ull)
+        {//刚执行了系统调用, 映射可能变了
+            emu_maps_stale=true;
+        }
+        if(WSTOPSIG(status)!=SIGTRAP)
+        {
+            if(watch_hits.count(tid))
+            {//写入指令已经执行完
+                ++n;
+                if(trace) trace->record(cur.get_regs());
+                if(recording) t_record.commit(cur.get_regs());
+            }
+            else{
+                t_record.cancel();
+            }
+            cur.mark_stopped(status,true);
+            report_stop();
+            reported=true;
+            break;
+        }
+        cur.mark_stopped(status,false);
+        auto pc=get_register_value(cur.get_regs(),reg::rip);
+        auto bp=t_breakpoints.find(prev_pc);
+        if(pc-1==prev_pc && bp!=t_breakpoints.end() && bp->second.is_enabled())
+        {//执行到了 int3
+            t_record.cancel();
+            cur.mark_stopped(status,true);
+            report_stop();
+            if(internal_stop && step_over_breakpoint_quietly())
+            {//_dl_debug_state, 跳过后继续
+                internal_stop=false;
+                ++n;
+                if(trace) trace->record(t_threads.at(tid).get_regs());
+                continue;
+            }
+            reported=true;
+            break;
+        }
+        ++n;
+        if(trace) trace->record(cur.get_regs());
+        if(recording) t_record.commit(cur.get_regs());
+    }
+    stepping_tid=0;
+    stepping_request=PTRACE_SINGLESTEP;
+
+    auto us=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+    std::cout << "Stepped " << std::dec << n << " instructions in " << us << " us";
+    if(us>0) std::cout << " (" << n*1000000/us << " insn/s)";
+    std::cout << std::endl;
+    if(!reported && t_threads.count(tid))
+    {
+        print_disassembly(get_pc(),0x50,7);
+    }
+    return n;
+}
+
+TikiEmu& TikiDbg::emulator()
+{
+    if(!t_emu)
+    {
+        t_emu.reset(new TikiEmu{cs_handle});
+    }
+    return *t_emu;
+}
+
+uint64_t TikiDbg::emulate_batch(TikiThread& th,uint64_t max,uint64_t until,TikiTraceWriter* trace)
+{
+    //在本地模拟, 碰到断点/不支持的指令/批次用完才同步回去
+    auto& emu=emulator();
+    emu.reset(th.get_tgid());
+    if(emu_maps_stale)
+    {
+        emu.load_maps();
+        emu_maps_stale=false;
+    }
+    auto regs=th.get_regs();
+    uint64_t done=0;
+    max=std::min(max,emu_batch);
+    while(done<max)
+    {
+        auto bp=t_breakpoints.find(regs.rip);
+        if(bp!=t_breakpoints.end() && bp->second.is_enabled())
+        {//int3 交给真正的单步去执行
+            break;
+        }
+        if(!emu.step(regs))
+        {
+            break;
+        }
+        ++done;
+        if(trace) trace->record(regs);
+        if(regs.rip==until) break;
+    }
+    if(done>0)
+    {
+        emu.flush();
+        th.set_regs(regs);
+    }
+    return done;
+}
+
+void TikiDbg::check_emulation(uint64_t count)
+{
+    //每条指令先在副本上模拟, 再真正单步, 比较寄存器和模拟时写过的内存
+    auto& emu=emulator();
+    emu.clear_code();
+    emu.reset(tgid_me);
+    emu.load_maps();
+    auto tid=pid_me;
+    uint64_t n=0,emulated=0;
+    bool stopped=false;
+    stepping_tid=tid;
+    step_over_breakpoint_quietly();
+    while(n<count && t_threads.count(tid))
+    {
+        auto before=t_threads.at(tid).get_regs();
+        auto bp=t_breakpoints.find(before.rip);
+        if(bp!=t_breakpoints.end() && bp->second.is_enabled())
+        {
+            std::cout << "Stopped before breakpoint at 0x" << std::hex << before.rip << std::endl;
+            break;
+        }
+        emu.reset(tgid_me);
+        auto emu_regs=before;
+        bool ok=emu.step(emu_regs);
+
+        int status;
+        if(!step_thread_fast(tid,PTRACE_SINGLESTEP,status))
+        {
+            break;
+        }
+        auto& cur=t_threads.at(tid);
+        if(WSTOPSIG(status)!=SIGTRAP)
+        {
+            cur.mark_stopped(status,true);
+            report_stop();
+            stopped=true;
+            break;
+        }
+        cur.mark_stopped(status,false);
+        ++n;
+        auto& real=cur.get_regs();
+        if(real.orig_rax!=~0ull)
+        {
+            emu.load_maps();
+        }
+        if(!ok)
+        {
+            continue;
+        }
+        ++emulated;
+
+        std::stringstream diff;
+        for(auto r:g_trace_regs)
+        {
+            auto e=get_register_value(emu_regs,r);
+            auto v=get_register_value(real,r);
+            if(r==reg::rflags)
+            {
+                auto mask=emu.get_flags_defined();
+                e&=mask;
+                v&=mask;
+            }
+            if(e!=v)
+            {
+                diff << "  " << get_register_name(r) << ": emulated 0x" << std::hex << e << ", real 0x" << v << std::endl;
+            }
+        }
+        if(emu_regs.rip!=real.rip)
+        {
+            diff << "  rip: emulated 0x" << std::hex << emu_regs.rip << ", real 0x" << real.rip << std::endl;
+        }
+        uint64_t bad_addr;
+        if(!emu.compare_memory(bad_addr))
+        {
+            diff << "  memory differs at 0x" << std::hex << bad_addr << std::endl;
+        }
+        if(!diff.str().empty())
+        {
+            std::cout << "Emulation mismatch at 0x" << std::hex << before.rip << ": " << emu.describe(before.rip) << std::endl << diff.str();
+            stopped=true;
+            break;
+        }
+    }
+    stepping_tid=0;
+    std::cout << "Checked " << std::dec << n << " instructions, " << emulated << " emulated" << std::endl;
+    if(!stopped && t_threads.count(tid))
+    {
+        print_disassembly(get_pc(),0x50,7);
+    }
+}
+
+bool TikiDbg::inject_syscall(pid_t tid,uint64_t scratch,long nr,std::initializer_list<uint64_t> args,uint64_t& ret,pid_t* forked)
+{
+    //在 scratch 处临时写一条 syscall 单步执行, 完成后恢复代码和寄存器
+    static const uint8_t syscall_insn[2]={0x0f,0x05};
+    static unsigned long long user_regs_struct::* const arg_regs[]={
+        &user_regs_struct::rdi,&user_regs_struct::rsi,&user_regs_struct::rdx,
+        &user_regs_struct::r10,&user_regs_struct::r8,&user_regs_struct::r9};
+    user_regs_struct saved,regs;
+    uint8_t old_code[2];
+    if(ptrace(PTRACE_GETREGS,tid,nullptr,&saved)<0
+        || !read_remote(tid,scratch,old_code,sizeof(old_code))
+        || !write_remote(tid,scratch,syscall_insn,sizeof(syscall_insn)))
+    {
+        return false;
+    }
+    regs=saved;
+    regs.rax=nr;
+    regs.rip=scratch;
+    //停在系统调用中间时, 不让内核按 orig_rax 重启原来的调用
+    regs.orig_rax=-1;
+    size_t i=0;
+    for(auto a:args)
+    {
+        regs.*arg_regs[i++]=a;
+    }
+    ptrace(PTRACE_SETREGS,tid,nullptr,&regs);
+
+    bool done=false;
+    pid_t child=0;
+    int status;
+    while(ptrace(PTRACE_SINGLESTEP,tid,nullptr,nullptr)==0 && waitpid(tid,&status,__WALL)==tid)
+    {
+        if(!WIFSTOPPED(status))
+        {
+            dispatch_event(tid,status);
+            return false;
+        }
+        auto event=status>>16;
+        if(event==PTRACE_EVENT_FORK || event==PTRACE_EVENT_VFORK || event==PTRACE_EVENT_CLONE)
+        {//子进程自己处理, 不走 follow-fork
+            unsigned long msg;
+            ptrace(PTRACE_GETEVENTMSG,tid,nullptr,&msg);
+            child=msg;
+            int child_status;
+            waitpid(child,&child_status,__WALL);
+            continue;
+        }
+        if(event!=0)
+        {
+            continue;
+        }
+        if(WSTOPSIG(status)==SIGTRAP)
+        {
+            done=true;
+            break;
+        }
+        //途中到达的信号留到恢复运行时再投递
+        if(t_threads.count(tid))
+        {
+            t_threads.at(tid).set_pending_signal(WSTOPSIG(status));
+        }
+    }
+
+    ptrace(PTRACE_GETREGS,tid,nullptr,&regs);
+    ret=regs.rax;
+    write_remote(tid,scratch,old_code,sizeof(old_code));
+    ptrace(PTRACE_SETREGS,tid,nullptr,&saved);
+    if(child!=0)
+    {//子进程复制的是注入时的状态, 一样恢复
+        write_remote(child,scratch,old_code,sizeof(old_code));
+        ptrace(PTRACE_SETREGS,child,nullptr,&saved);
+        if(forked) *forked=child;
+    }
+    return done;
+}
+
+void TikiDbg::create_checkpoint()
+{
+    auto scratch= displaced_addr? displaced_addr : get_pc();
+    uint64_t ret;
+    pid_t child=0;
+    if(!inject_syscall(pid_me,scratch,SYS_fork,{},ret,&child) || child==0)
+    {
+        std::cerr << "Checkpoint failed" << std::endl;
+        return;
+    }
+    TikiCheckpoint cp{child,get_pc(),{},{},{}};
+    for(auto& b:t_breakpoints)
+    {
+        if(b.second.is_enabled()) cp.breakpoints[b.first]=b.second.get_save_byte();
+    }
+    for(auto& t:t_fast.get_tracepoints())
+    {
+        for(size_t i=0;i<t.second.patch_len;i++) cp.fast_patches.push_back({t.first+i,t.second.orig[i]});
+    }
+    t_watch.all_pages(cp.watched_pages);
+    auto num=next_checkpoint++;
+    t_checkpoints[num]=cp;
+    std::cout << "Checkpoint " << std::dec << num << ": process " << child << " at 0x" << std::hex << cp.pc << std::endl;
+}
+
+void TikiDbg::restart_checkpoint(int num)
+{
+    auto it=t_checkpoints.find(num);
+    if(it==t_checkpoints.end())
+    {
+        std::cerr << "No checkpoint " << std::dec << num << std::endl;
+        return;
+    }
+    auto& cp=it->second;
+    //从 checkpoint 再 fork 一份来运行, checkpoint 本身不动, 可以反复回到这里
+    uint64_t ret;
+    pid_t child=0;
+    auto scratch= displaced_addr? displaced_addr : cp.pc;
+    if(!inject_syscall(cp.pid,scratch,SYS_fork,{},ret,&child) || child==0)
+    {
+        std::cerr << "Restart failed" << std::endl;
+        return;
+    }
+
+    //结束当前进程
+    std::vector<pid_t> old_threads;
+    for(auto& t:t_threads)
+    {
+        if(t.second.get_tgid()==tgid_me) old_threads.push_back(t.first);
+    }
+    if(!old_threads.empty())
+    {
+        kill(tgid_me,SIGKILL);
+        //其他线程全部回收之前, 内核不报告被跟踪的主线程退出, 主线程放到最后
+        std::stable_partition(old_threads.begin(),old_threads.end(),[this](pid_t t){return t!=tgid_me;});
+        for(auto tid:old_threads)
+        {
+            int status;
+            while(waitpid(tid,&status,__WALL)==tid && WIFSTOPPED(status));
+            t_threads.erase(tid);
+            //旧线程的计数不算进下一次报告
+            t_counters.remove_thread(tid);
+        }
+        t_events.erase(std::remove_if(t_events.begin(),t_events.end(),[this](pid_t t){return !t_threads.count(t);}),t_events.end());
+        t_hwwatch.prune([this](pid_t tid){return t_threads.count(tid)!=0;});
+    }
+
+    pid_me=tgid_me=child;
+    process_exited=false;
+    //日志和跟踪点记的是原来那个进程, 环形缓冲区也是
+    recording=false;
+    t_record.clear();
+    t_fast.reset();
+    fast_history.clear();
+    fast_lost=0;
+    fast_new=0;
+    call_frames.clear();
+    watch_hits.clear();
+    //counters 和 perf watch 在 add_thread 里加到新线程上
+    add_thread(child,child);
+    t_modules.set_pid(child);
+
+    //断点表沿用当前的: 先去掉 checkpoint 建立时内存里的 int3 和 fast tracepoint 的 jmp, 再按当前的断点重新插入
+    std::vector<std::pair<uint64_t,uint8_t>> patches(cp.breakpoints.begin(),cp.breakpoints.end());
+    patches.insert(patches.end(),cp.fast_patches.begin(),cp.fast_patches.end());
+    write_remote_bytes(child,patches);
+    std::unordered_map<std::intptr_t,Tikibreakpoint> bps;
+    for(auto& b:t_breakpoints)
+    {
+        Tikibreakpoint bp{child,b.first,b.second};
+        if(b.second.is_enabled())
+        {
+            bp=Tikibreakpoint{child,b.first};
+            bp.enable();
+        }
+        bps[b.first]=bp;
+    }
+    t_breakpoints=std::move(bps);
+
+    //watch 也沿用当前的: 放开 checkpoint 建立时的只读页, 再保护现在 watch 的页; perf watch 的旧值换成新进程里的
+    std::vector<page_span> spans;
+    t_watch.all_pages(spans);
+    bool protected_ok=(cp.watched_pages.empty() || protect_pages(child,cp.watched_pages,false))
+        && (spans.empty() || protect_pages(child,spans,true));
+    if(!protected_ok)
+    {
+        std::cerr << "Warning: couldn't reapply watch page protections in process " << std::dec << child << std::endl;
+    }
+    for(auto& w:t_hwwatch.get_watches())
+    {
+        auto hw=t_hwwatch.find(w.first);
+        hw->value=0;
+        read_remote(child,hw->addr,&hw->value,std::min<size_t>(hw->len,sizeof(hw->value)));
+    }
+
+    //checkpoint 停在 int3 之后, 而这个断点已经删掉了
+    auto pc=get_pc();
+    if(cp.breakpoints.count(pc-1) && !t_breakpoints.count(pc-1))
+    {
+        set_pc(pc-1);
+    }
+    std::cout << "Switched to checkpoint " << std::dec << num << " (process " << child << ")" << std::endl;
+    print_disassembly(get_pc(),0x50,7);
+}
+
+void TikiDbg::delete_checkpoint(int num)
+{
+    auto it=t_checkpoints.find(num);
+    if(it==t_checkpoints.end())
+    {
+        std::cerr << "No checkpoint " << std::dec << num << std::endl;
+        return;
+    }
+    kill(it->second.pid,SIGKILL);
+    int status;
+    while(waitpid(it->second.pid,&status,__WALL)==it->second.pid && WIFSTOPPED(status));
+    t_checkpoints.erase(it);
+}
+
+void TikiDbg::list_checkpoints()
+{
+    for(auto& c:t_checkpoints)
+    {
+        std::cout << std::dec << c.first << "  process " << c.second.pid << "  at 0x" << std::hex << c.second.pc;
+        auto sym=t_modules.symbolize(c.second.pc);
+        if(!sym.empty()) std::cout << " <" << sym << ">";
+        std::cout << std::endl;
+    }
+}
+
+void TikiDbg::record_before(TikiThread& th)
+{
+    //用模拟器的译码算出这条指令要写的内存, 先存下原内容
+    auto& emu=emulator();
+    emu.reset(th.get_tgid());
+    if(emu_maps_stale)
+    {
+        emu.load_maps();
+        emu_maps_stale=false;
+    }
+    std::vector<std::pair<uint64_t,size_t>> writes;
+    emu.mem_writes(th.get_regs(),writes);
+    t_record.begin(th.get_tgid(),th.get_regs(),writes);
+}
+
+void TikiDbg::reverse_execute(reverse_mode mode,uint64_t count)
+{
+    //按日志往回撤销, 不重新执行; 撤销掉的记录随之删除
+    auto& th=cur_thread();
+    auto bp=t_breakpoints.find(get_pc()-1);
+    if(bp!=t_breakpoints.end() && bp->second.is_enabled())
+    {//int3 本身没有记录, 先退回断点地址
+        set_pc(bp->first);
+        th.clear_stop_reason();
+    }
+    auto regs=th.get_regs();
+    auto start_rsp=regs.rsp;
+    uint64_t n=0;
+    bool hit=false,at_call=false;
+    while(n<count && t_record.undo(tgid_me,regs))
+    {
+        ++n;
+        if(mode==reverse_mode::stepi)
+        {
+            continue;
+        }
+        auto b=t_breakpoints.find(regs.rip);
+        if(b!=t_breakpoints.end() && b->second.is_enabled())
+        {
+            hit=true;
+            break;
+        }
+        if(mode==reverse_mode::finish && regs.rsp>start_rsp)
+        {//回到了调用当前函数的 call
+            auto& block=block_cache().get(regs.rip);
+            if(!block.empty() && block[0].kind==branch_kind::call)
+            {
+                at_call=true;
+                break;
+            }
+        }
+    }
+    auto pc=regs.rip;
+    if(hit)
+    {//和正向命中一样停在 int3 之后
+        regs.rip+=1;
+    }
+    th.set_regs(regs);
+
+    std::cout << "Reversed " << std::dec << n << " instructions" << std::endl;
+    if(hit)
+    {
+        std::cout << "Hit breakpoint at address 0x" << std::hex << pc;
+        auto sym=t_modules.symbolize(pc);
+        if(!sym.empty()) std::cout << " <" << sym << ">";
+        std::cout << std::endl;
+    }
+    else if(!at_call && n<count)
+    {
+        std::cout << "No more reverse-execution history" << std::endl;
+    }
+    print_disassembly(pc,0x50,7);
+}
+
+void TikiDbg::fuzz(uint64_t start,uint64_t end,uint64_t input,size_t len,uint64_t iterations,uint64_t timeout_ns)
+{
+    //停在 start 时保存快照, 之后每一轮: 写入变异的输入 -> 运行到 end, 崩溃或超时 -> 只恢复改过的页和寄存器
+    if(non_stop || recording)
+    {
+        std::cerr << "fuzz needs all-stop mode and no recording" << std::endl;
+        return;
+    }
+    if(!t_loop.is_open() && !t_loop.open(-1))
+    {//超时靠事件循环的等待
+        std::cerr << "Couldn't set up the fuzz timeout" << std::endl;
+        return;
+    }
+    if(std::count_if(t_threads.begin(),t_threads.end(),[this](auto&& t){return t.second.get_tgid()==tgid_me;})!=1)
+    {//其他线程的状态没法一起回滚
+        std::cerr << "fuzz needs a single-threaded process" << std::endl;
+        return;
+    }
+    std::vector<std::intptr_t> added;
+    for(auto a:{start,end})
+    {
+        auto it=t_breakpoints.find(a);
+        if(it==t_breakpoints.end())
+        {
+            Tikibreakpoint bp{tgid_me,static_cast<std::intptr_t>(a)};
+            bp.enable();
+            t_breakpoints[a]=bp;
+            added.push_back(a);
+        }
+        else if(!it->second.is_enabled())
+        {
+            it->second.enable();
+        }
+    }
+    auto remove_added=[this,&added]{
+        for(auto a:added)
+        {
+            auto it=t_breakpoints.find(a);
+            if(it==t_breakpoints.end()) continue;
+            if(it->second.is_enabled() && !process_exited) it->second.disable();
+            t_breakpoints.erase(it);
+        }
+    };
+
+    if(get_pc()-1!=start)
+    {
+        continue_execution();
+        if(process_exited || !t_threads.count(pid_me) || get_pc()-1!=start)
+        {
+            std::cerr << "Did not stop at 0x" << std::hex << start << std::endl;
+            remove_added();
+            return;
+        }
+    }
+
+    //start 处的 int3 在 fuzz 期间去掉, 每轮从 start 原指令开始执行
+    auto& th=cur_thread();
+    auto& start_bp=t_breakpoints.at(start);
+    start_bp.disable();
+    auto regs=th.get_regs();
+    regs.rip=start;
+    th.set_regs(regs);
+    th.clear_stop_reason();
+    user_fpregs_struct fpregs;
+    ptrace(PTRACE_GETFPREGS,pid_me,nullptr,&fpregs);
+
+    std::vector<uint8_t> seed(len);
+    TikiSnapshot snap;
+    if(!read_remote(tgid_me,input,seed.data(),len) || !snap.take(tgid_me))
+    {
+        std::cerr << "Cannot snapshot process " << std::dec << tgid_me << std::endl;
+        start_bp.enable();
+        regs.rip=start+1;
+        th.set_regs(regs);
+        remove_added();
+        return;
+    }
+    std::cout << "Snapshot: " << std::dec << snap.get_pages() << " writable pages, "
+        << (snap.has_soft_dirty()? "soft-dirty tracking" : "no soft-dirty, comparing pages") << std::endl;
+
+    TikiMutator mutator{std::random_device{}()};
+    std::vector<uint8_t> data;
+    std::map<uint64_t,uint64_t> crashes;     // 崩溃地址 -> 次数
+    uint64_t done=0,dirty_pages=0,reached_end=0,hangs=0;
+    bool lost=false,interrupted=false;
+    auto t0=std::chrono::steady_clock::now();
+    quiet_stops=true;
+    while(done<iterations)
+    {
+        mutator.mutate(seed,data);
+        struct iovec local[1]={{data.data(),len}};
+        struct iovec remote[1]={{reinterpret_cast<void*>(input),len}};
+        process_vm_writev(tgid_me,local,1,remote,1,0);
+
+        int sig=0;
+        bool hung=false;
+        wait_deadline=stat_now()+timeout_ns;
+        wait_timed_out=false;
+        while(true)
+        {
+            resume_all_threads();
+            wait_for_signal();
+            if(process_exited || !t_threads.count(pid_me))
+            {
+                lost=true;
+                break;
+            }
+            if(interrupt_stop)
+            {//超时或者 Ctrl-C, 线程已经全部停下
+                interrupt_stop=false;
+                hung=wait_timed_out;
+                interrupted=!wait_timed_out;
+                break;
+            }
+            auto& info=cur_thread().get_stop_info();
+            auto bp=get_pc()-1;
+            if(internal_stop || (info.si_signo==SIGTRAP && bp!=end && t_breakpoints.count(bp)))
+            {//solib 事件或区间内的其他断点
+                step_over_breakpoint_quietly();
+                continue;
+            }
+            if(info.si_signo==SIGTRAP && bp==end)
+            {
+                ++reached_end;
+                break;
+            }
+            if(info.si_signo==SIGTRAP || info.si_signo==SIGSEGV || info.si_signo==SIGBUS
+                || info.si_signo==SIGILL || info.si_signo==SIGFPE || info.si_signo==SIGABRT)
+            {
+                sig=info.si_signo;
+                break;
+            }
+            //其他信号照常投递
+            cur_thread().set_pending_signal(info.si_signo);
+        }
+        wait_deadline=0;
+        if(lost)
+        {
+            break;
+        }
+        if(!interrupted) ++done;
+        if(hung && hangs++==0)
+        {//只保存第一个卡死的输入
+            std::ofstream out{"hang",std::ios::binary};
+            out.write(reinterpret_cast<const char*>(data.data()),len);
+            std::cout << "Hang: no progress to 0x" << std::hex << end << " after " << std::dec << timeout_ns/1000000
+                << " ms at 0x" << std::hex << get_pc() << " (iteration " << std::dec << done << "), input saved to hang" << std::endl;
+        }
+        if(sig)
+        {
+            auto pc=get_pc();
+            if(crashes[pc]++==0)
+            {//每个崩溃地址保存第一个输入
+                std::stringstream name;
+                name << "crash-" << std::hex << pc;
+                std::ofstream out{name.str(),std::ios::binary};
+                out.write(reinterpret_cast<const char*>(data.data()),len);
+                std::cout << "Crash: " << strsignal(sig) << " at 0x" << std::hex << pc << " (iteration " << std::dec << done
+                    << "), input saved to " << name.str() << std::endl;
+            }
+        }
+
+        //信号不投递, 直接回到快照
+        auto& cur=cur_thread();
+        cur.set_pending_signal(0);
+        cur.set_regs(regs);
+        ptrace(PTRACE_SETFPREGS,pid_me,nullptr,&fpregs);
+        cur.clear_stop_reason();
+        auto n=snap.restore();
+        if(n<0)
+        {
+            std::cerr << "Restoring snapshot failed" << std::endl;
+            break;
+        }
+        dirty_pages+=n;
+        if(interrupted) break;
+    }
+    wait_deadline=0;
+    quiet_stops=false;
+    auto us=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-t0).count();
+
+    std::cout << "Fuzzed " << std::dec << done << " iterations in " << us << " us (" << (us? done*1000000/us : 0)
+        << " exec/s), " << reached_end << " reached 0x" << std::hex << end << ", " << std::dec << crashes.size() << " unique crashes, " << hangs << " hangs";
+    if(done) std::cout << ", " << static_cast<double>(dirty_pages)/done << " dirty pages/iteration";
+    std::cout << std::endl;
+    if(interrupted) std::cout << "Interrupted" << std::endl;
+    if(lost)
+    {
+        std::cout << "Process exited during iteration " << std::dec << done+1 << std::endl;
+        remove_added();
+        return;
+    }
+    //进程回到 start; 原来就有的断点恢复成刚命中时的样子
+    if(std::find(added.begin(),added.end(),start)==added.end())
+    {
+        start_bp.enable();
+        regs.rip=start+1;
+    }
+    cur_thread().set_regs(regs);
+    remove_added();
+}
+
+void TikiDbg::profile(unsigned hz,uint64_t duration_ns,const std::string& path)
+{
+    //每次定时器到期停下所有线程采一次栈, 马上恢复; 断点, 信号, 进程退出或 Ctrl-C 提前结束
+    if(non_stop || recording)
+    {
+        std::cerr << "profile needs all-stop mode and no recording" << std::endl;
+        return;
+    }
+    if(!t_loop.is_open() && !t_loop.open(-1))
+    {//批处理模式下事件循环还没打开
+        std::cerr << "Couldn't set up the profiling timer" << std::endl;
+        return;
+    }
+    std::ofstream file;
+    if(!path.empty())
+    {
+        file.open(path);
+        if(!file)
+        {
+            std::cerr << "Couldn't open " << path << std::endl;
+            return;
+        }
+    }
+    static const size_t max_frames=256;
+    std::vector<uint64_t> frames(max_frames);
+    std::vector<uint8_t> scratch;
+    t_profile.clear();
+
+    using clock=std::chrono::steady_clock;
+    auto start=clock::now();
+    auto deadline=start+std::chrono::nanoseconds(duration_ns);
+    const char* ended=nullptr;
+    step_over_breakpoint();
+    if(!process_exited)
+    {
+        resume_all_threads();
+        t_loop.start_timer(std::max(1u,1000000/hz));
+    }
+    while(!process_exited)
+    {
+        auto left=std::chrono::duration_cast<std::chrono::milliseconds>(deadline-clock::now()).count();
+        if(left<=0) break;
+        auto ready=t_loop.wait(src_child|src_interrupt|src_timer,static_cast<int>(left)+1);
+        if(ready&src_interrupt)
+        {
+            stop_all_threads();
+            t_loop.drain_interrupts();
+            ended="interrupted";
+            break;
+        }
+        if(ready&src_child)
+        {//两次采样之间的事件; 不需要报告的 dispatch_event 已经处理掉了
+            int status;
+            pid_t tid;
+            while(threads_running && (tid=waitpid(-1,&status,__WALL|WNOHANG))>0)
+            {
+                if(dispatch_event(tid,status) && !process_exited) t_events.push_back(tid);
+            }
+            if(!t_events.empty()) stop_all_threads();
+        }
+        else if(ready&src_timer)
+        {
+            profile_sample(frames,scratch);
+        }
+        if(!t_events.empty())
+        {//和 continue 一样报告; solib 事件这类内部断点处理完接着采样
+            wait_for_signal();
+            if(process_exited || !internal_stop)
+            {
+                ended="stopped";
+                break;
+            }
+            step_over_breakpoint();
+            resume_all_threads();
+        }
+    }
+    t_loop.stop_timer();
+    if(!process_exited && threads_running) stop_all_threads();
+    std::chrono::duration<double> took=clock::now()-start;
+
+    auto root=[this](pid_t tgid){
+        std::ifstream comm{"/proc/"+std::to_string(tgid)+"/comm"};
+        std::string name;
+        if(!std::getline(comm,name) || name.empty())
+        {//进程已经退出
+            name=program_name.substr(program_name.rfind('/')+1);
+        }
+        return name;
+    };
+    auto name=[this](uint64_t addr){return profile_frame_name(addr);};
+    //写到标准输出时统计信息走 stderr, 方便重定向
+    auto& info= path.empty()? std::cerr : std::cout;
+    size_t lines=t_profile.write_folded(path.empty()? std::cout : file,root,name);
+    if(ended) info << "Profile " << ended << " early" << std::endl;
+    t_profile.show_stats(info,took.count(),hz);
+    if(!path.empty()) info << "Wrote " << std::dec << lines << " folded stacks to " << path << std::endl;
+}
+
+void TikiDbg::profile_sample(std::vector<uint64_t>& frames,std::vector<uint8_t>& scratch)
+{
+    //只采这次被 PTRACE_INTERRUPT 停下的线程; 刚 clone 出来还没报告过停止的线程没有寄存器
+    auto t0=std::chrono::steady_clock::now();
+    profile_running.clear();
+    for(auto& t:t_threads)
+    {
+        if(t.second.get_state()==thread_state::running) profile_running.push_back(t.first);
+    }
+    stop_all_threads();
+    for(auto tid:profile_running)
+    {
+        auto it=t_threads.find(tid);
+        if(it==t_threads.end() || !it->second.is_stopped()) continue;
+        auto& th=it->second;
+        auto n=walk_frame_pointers(th.get_tgid(),th.get_regs(),frames.data(),frames.size(),scratch);
+        t_profile.add_sample(th.get_tgid(),frames.data(),n);
+    }
+    //计到发出恢复为止: 单核上 PTRACE_CONT 可能直接切到被调试进程, 之后的时间是它在运行
+    t_profile.add_stop_time(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-t0).count());
+    if(t_events.empty() && !process_exited)
+    {
+        resume_all_threads();
+    }
+}
+
+std::string TikiDbg::profile_frame_name(uint64_t addr)
+{
+    auto m=t_modules.find_by_addr(addr);
+    if(m==nullptr) return "[unknown]";
+    std::string sym;
+    if(!m->symbolize(addr,sym)) return "["+m->get_name()+"]";
+    //同一个函数里的不同位置合并成一帧
+    auto off=sym.rfind("+0x");
+    if(off!=std::string::npos) sym.resize(off);
+    //';' 是 folded 格式的分隔符
+    std::replace(sym.begin(),sym.end(),';',':');
+    return sym;
+}
+
+bool TikiDbg::install_syscall_filter(const std::set<long>& nrs)
+{
+    //过滤器程序和 sock_fprog 临时放在栈下面 (跳过 red zone), 再注入 prctl + seccomp
+    auto filter=build_syscall_filter(nrs);
+    if(filter.empty())
+    {
+        return false;
+    }
+    auto size=filter.size()*sizeof(sock_filter);
+    auto data=(get_reg(reg::rsp)-0x100-size-sizeof(sock_fprog))&~0xfull;
+    sock_fprog prog{static_cast<unsigned short>(filter.size()),reinterpret_cast<sock_filter*>(data+sizeof(sock_fprog))};
+    auto scratch= displaced_addr? displaced_addr : get_pc();
+    uint64_t ret;
+    //TSYNC: 过滤器同时装到所有线程
+    return write_remote(tgid_me,data,&prog,sizeof(prog))
+        && write_remote(tgid_me,data+sizeof(prog),filter.data(),size)
+        && inject_syscall(pid_me,scratch,SYS_prctl,{PR_SET_NO_NEW_PRIVS,1,0,0,0},ret) && ret==0
+        && inject_syscall(pid_me,scratch,SYS_seccomp,{SECCOMP_SET_MODE_FILTER,SECCOMP_FILTER_FLAG_TSYNC,data},ret) && ret==0;
+}
+
+void TikiDbg::catch_syscalls(const std::set<long>& nrs)
+{
+    //已经在过滤器里的不用再装; 新的系统调用叠加一个只含它们的过滤器
+    std::set<long> missing;
+    for(auto nr:nrs)
+    {
+        if(!filtered_syscalls.count(nr)) missing.insert(nr);
+    }
+    if(!missing.empty())
+    {
+        if(!install_syscall_filter(missing))
+        {
+            std::cerr << "Cannot install seccomp filter" << std::endl;
+            return;
+        }
+        filtered_syscalls.insert(missing.begin(),missing.end());
+    }
+    caught_syscalls.insert(nrs.begin(),nrs.end());
+    std::cout << "Catchpoint: syscall";
+    for(auto nr:nrs) std::cout << " " << syscall_name(nr);
+    std::cout << std::endl;
+}
+
+bool TikiDbg::syscall_entry(TikiThread& th)
+{
+    //返回 true 表示停下报告给用户; 过滤器撤不掉, 已删除的 catch 在这里直接放行
+    auto tid=th.get_tid();
+    flush_syscall_log(tid);
+    auto& regs=th.get_regs();
+    if(!caught_syscalls.count(static_cast<long>(regs.orig_rax)))
+    {
+        return false;
+    }
+    if(syscall_log)
+    {//等返回值, 到 syscall_exit 再一起打印
+        std::stringstream line;
+        if(t_threads.size()>1) line << "[tid " << std::dec << tid << "] ";
+        line << format_syscall(th.get_tgid(),regs);
+        syscall_pending[tid]=line.str();
+        return false;
+    }
+    //单步经过系统调用时不打断
+    return tid!=stepping_tid;
+}
+
+void TikiDbg::syscall_exit(TikiThread& th)
+{
+    auto it=syscall_pending.find(th.get_tid());
+    if(it==syscall_pending.end())
+    {
+        return;
+    }
+    std::cout << it->second << " = " << format_syscall_ret(static_cast<long>(th.get_regs().rax)) << std::endl;
+    syscall_pending.erase(it);
+}
+
+void TikiDbg::flush_syscall_log(pid_t tid)
+{
+    //没等到返回 (exit, 或者线程被别的方式恢复了)
+    auto it=syscall_pending.find(tid);
+    if(it==syscall_pending.end())
+    {
+        return;
+    }
+    std::cout << it->second << " = ?" << std::endl;
+    syscall_pending.erase(it);
+}
+
+bool TikiDbg::call_function(uint64_t func,const std::vector<call_arg>& args,uint64_t& ret)
+{
+    //SysV ABI: 前 6 个整数参数放寄存器, 其余放栈上; 进入函数时 rsp+8 16 字节对齐
+    static unsigned long long user_regs_struct::* const arg_regs[]={
+        &user_regs_struct::rdi,&user_regs_struct::rsi,&user_regs_struct::rdx,
+        &user_regs_struct::rcx,&user_regs_struct::r8,&user_regs_struct::r9};
+    if(displaced_addr==0)
+    {
+        std::cerr << "No place for the return trap" << std::endl;
+        return false;
+    }
+    auto& th=cur_thread();
+    auto tid=th.get_tid();
+    TikiCallFrame frame{tid,func,th.get_regs(),{},th.get_stop_info(),th.get_pending_signal()};
+    ptrace(PTRACE_GETFPREGS,tid,nullptr,&frame.fpregs);
+
+    //先算布局, 字符串/栈参数/返回地址在本地拼好后一次写进去
+    uint64_t top=(frame.regs.rsp-128)&~0xfull;      // 跳过 red zone
+    uint64_t sp=top;
+    std::vector<uint64_t> values;
+    std::vector<std::pair<uint64_t,const std::string*>> strings;
+    for(auto& a:args)
+    {
+        if(a.is_string)
+        {
+            sp=(sp-a.str.size()-1)&~0x7ull;
+            strings.push_back({sp,&a.str});
+            values.push_back(sp);
+        }
+        else{
+            values.push_back(a.value);
+        }
+    }
+    size_t n_stack= values.size()>6? values.size()-6 : 0;
+    sp&=~0xfull;
+    if(n_stack%2) sp-=8;
+    sp-=n_stack*8+8;
+    //displaced stepping 最多用入口处的前 16 字节
+    auto trap=displaced_addr+16;
+    std::vector<uint8_t> block(top-sp,0);
+    auto put=[&block,sp](uint64_t addr,const void* p,size_t n){std::memcpy(block.data()+(addr-sp),p,n);};
+    put(sp,&trap,8);
+    for(size_t i=0;i<n_stack;i++) put(sp+8+i*8,&values[6+i],8);
+    for(auto& s:strings) put(s.first,s.second->c_str(),s.second->size()+1);
+    struct iovec local[1]={{block.data(),block.size()}};
+    struct iovec remote[1]={{reinterpret_cast<void*>(sp),block.size()}};
+    if(process_vm_writev(tgid_me,local,1,remote,1,0)!=static_cast<ssize_t>(block.size()))
+    {
+        std::cerr << "Cannot write the call frame at 0x" << std::hex << sp << std::endl;
+        return false;
+    }
+    if(call_frames.empty())
+    {
+        static const uint8_t int3=int3_byte;
+        if(!read_remote(tgid_me,trap,&call_trap_save,1) || !write_remote(tgid_me,trap,&int3,1))
+        {
+            return false;
+        }
+        call_trap=trap;
+    }
+
+    auto regs=frame.regs;
+    regs.rip=func;
+    regs.rsp=sp;
+    regs.rax=0;                 // 可变参数函数: 没有用到向量寄存器
+    regs.orig_rax=-1;           // 停在系统调用里时不要重启它
+    regs.eflags&=~0x500ull;     // 清 DF 和 TF
+    for(size_t i=0;i<values.size() && i<6;i++)
+    {
+        regs.*arg_regs[i]=values[i];
+    }
+    th.set_regs(regs);
+    th.clear_stop_reason();
+    th.set_pending_signal(0);
+    call_frames.push_back(frame);
+
+    //只恢复这一个线程, 其他线程的事件排队
+    stepping_tid=tid;
+    bool done=false;
+    while(true)
+    {
+        int status;
+        if(!step_thread_fast(tid,PTRACE_CONT,status))
+        {
+            if(!t_threads.count(tid))
+            {
+                std::cout << "The program exited while in a function called from TikiDbg" << std::endl;
+                call_frames.clear();
+            }
+            else{
+                report_stop();
+            }
+            break;
+        }
+        auto& cur=t_threads.at(tid);
+        cur.mark_stopped(status,true);
+        auto sig=WSTOPSIG(status);
+        auto pc=get_register_value(cur.get_regs(),reg::rip);
+        if(sig==SIGTRAP && pc-1==call_trap)
+        {
+            ret=cur.get_regs().rax;
+            finish_call(false);
+            done=true;
+            break;
+        }
+        if(sig==SIGTRAP || watch_hits.count(tid))
+        {//被调用的函数里命中断点或 watch-range: 停在那里, continue 之后返回到 trap 时再恢复
+            report_stop();
+            std::cout << "The program stopped in a function called from TikiDbg, continue to finish the call" << std::endl;
+            break;
+        }
+        if(sig==SIGSEGV || sig==SIGBUS || sig==SIGILL || sig==SIGFPE || sig==SIGABRT)
+        {
+            std::cout << "Program received signal " << strsignal(sig) << " in the called function, state restored" << std::endl;
+            finish_call(false);
+            break;
+        }
+        cur.set_pending_signal(sig);
+    }
+    stepping_tid=0;
+    stepping_request=PTRACE_SINGLESTEP;
+    return done;
+}
+
+void TikiDbg::finish_call(bool print_value)
+{
+    //一次 SETREGS + SETFPREGS 回到调用前
+    auto frame=call_frames.back();
+    call_frames.pop_back();
+    if(call_frames.empty() && !process_exited)
+    {
+        write_remote(tgid_me,call_trap,&call_trap_save,1);
+    }
+    auto it=t_threads.find(frame.tid);
+    if(it==t_threads.end())
+    {
+        return;
+    }
+    auto ret=it->second.get_regs().rax;
+    auto regs=frame.regs;
+    it->second.set_stop_info(frame.stop_info);
+    if(it->second.stopped_at_breakpoint() && !breakpoints_of(it->second.get_tgid()).count(regs.rip-1))
+    {//调用期间原来停下的断点被删了, 和 delete 一样回退 pc
+        regs.rip-=1;
+        it->second.clear_stop_reason();
+    }
+    it->second.set_regs(regs);
+    ptrace(PTRACE_SETFPREGS,frame.tid,nullptr,&frame.fpregs);
+    it->second.set_pending_signal(frame.pending_sig);
+    if(print_value)
+    {
+        std::cout << "Value returned from 0x" << std::hex << frame.func << ": 0x" << ret
+            << " (" << std::dec << static_cast<int64_t>(ret) << ")" << std::endl;
+    }
+}
+
+bool TikiDbg::fast_trace_setup(uint64_t near,uint64_t& tramp)
+{
+    //第一次用时在被调试进程里映射共享的环形缓冲区; 代码区按需在 near 附近分配
+    auto scratch= displaced_addr? displaced_addr : get_pc();
+    uint64_t ret;
+    if(t_fast.get_remote_ring()==0)
+    {
+        if(!t_fast.create_ring(tgid_me))
+        {
+            std::cerr << "Cannot create shared memory" << std::endl;
+            return false;
+        }
+        //路径字符串临时放在栈下面
+        auto& path=t_fast.get_shm_path();
+        auto str=(get_reg(reg::rsp)-0x100-path.size()-1)&~0xfull;
+        uint64_t fd=~0ull,ring=~0ull;
+        bool ok=write_remote(tgid_me,str,path.c_str(),path.size()+1)
+            && inject_syscall(pid_me,scratch,SYS_open,{str,O_RDWR},fd) && static_cast<int64_t>(fd)>=0
+            && inject_syscall(pid_me,scratch,SYS_mmap,{0,t_fast.get_ring_bytes(),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0},ring);
+        if(static_cast<int64_t>(fd)>=0)
+        {
+            inject_syscall(pid_me,scratch,SYS_close,{fd},ret);
+        }
+        t_fast.unlink_ring();
+        if(!ok || ring>=~0xfffull)
+        {
+            std::cerr << "Cannot map the ring buffer into process " << std::dec << tgid_me << std::endl;
+            t_fast.reset();
+            return false;
+        }
+        t_fast.attach_ring(ring);
+    }
+    tramp=t_fast.alloc_code(near,TikiFastTrace::tramp_size);
+    if(tramp!=0)
+    {
+        return true;
+    }
+    static const size_t region_size=0x10000;
+    auto gap=TikiFastTrace::find_code_gap(tgid_me,near,region_size);
+    if(gap==0 || !inject_syscall(pid_me,scratch,SYS_mmap,{gap,region_size,PROT_READ|PROT_EXEC,
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED_NOREPLACE,~0ull,0},ret) || ret>=~0xfffull)
+    {
+        std::cerr << "Cannot allocate trampoline memory near 0x" << std::hex << near << std::endl;
+        return false;
+    }
+    t_fast.add_code_region(ret,region_size);
+    tramp=t_fast.alloc_code(near,TikiFastTrace::tramp_size);
+    return tramp!=0;
+}
+
+void TikiDbg::add_fast_tracepoint(uint64_t addr)
+{
+    if(t_fast.find_overlap(addr,16))
+    {
+        std::cerr << "Address 0x" << std::hex << addr << " is already patched" << std::endl;
+        return;
+    }
+    for(auto& b:t_breakpoints)
+    {
+        if(b.second.is_enabled() && static_cast<uint64_t>(b.first)>=addr && static_cast<uint64_t>(b.first)<addr+16)
+        {//jmp 会盖掉 int3, 先删断点
+            std::cerr << "Breakpoint at 0x" << std::hex << b.first << " overlaps the patch" << std::endl;
+            return;
+        }
+    }
+    //所有线程停下后再改代码, 不会有线程执行到写了一半的指令
+    std::vector<pid_t> running;
+    for(auto& t:t_threads)
+    {
+        if(!t.second.is_stopped()) running.push_back(t.first);
+    }
+    stop_all_threads();
+
+    uint64_t tramp;
+    uint8_t code[32];
+    fast_tracepoint tp{addr,0,0,{},0};
+    std::vector<uint8_t> body;
+    std::string err;
+    if(fast_trace_setup(addr,tramp) && read_code(addr,code,sizeof(code))>=16)
+    {
+        tp.tramp=tramp;
+        if(!t_fast.build(cs_handle,addr,code,sizeof(code),tramp,body,tp.patch_len,err))
+        {
+            std::cerr << "Cannot patch 0x" << std::hex << addr << ": " << err << std::endl;
+            tramp=0;
+        }
+    }
+    else{
+        tramp=0;
+    }
+    for(auto& t:t_threads)
+    {//线程停在被覆盖的指令中间时 jmp 会被执行到一半
+        if(!tramp) break;
+        auto pc=get_register_value(t.second.get_regs(),reg::rip);
+        if(pc>addr && pc<addr+tp.patch_len)
+        {
+            std::cerr << "Thread " << std::dec << t.second.get_num() << " is inside the patched instructions" << std::endl;
+            tramp=0;
+        }
+    }
+    if(tramp)
+    {
+        std::memcpy(tp.orig,code,tp.patch_len);
+        uint8_t patch[16];
+        std::memset(patch,0x90,sizeof(patch));
+        patch[0]=0xe9;
+        auto rel=static_cast<int32_t>(tramp-(addr+5));
+        std::memcpy(patch+1,&rel,4);
+        if(write_remote(tgid_me,tramp,body.data(),body.size()) && write_remote(tgid_me,addr,patch,tp.patch_len))
+        {
+            t_fast.add(tp);
+            std::cout << "Fast tracepoint at 0x" << std::hex << addr << ", trampoline at 0x" << tramp
+                << " (" << std::dec << tp.patch_len << " bytes moved)" << std::endl;
+        }
+    }
+    for(auto tid:running)
+    {
+        auto it=t_threads.find(tid);
+        if(it==t_threads.end() || std::find(t_events.begin(),t_events.end(),tid)!=t_events.end()) continue;
+        it->second.resume();
+    }
+    if(!running.empty()) threads_running=!non_stop;
+}
+
+void TikiDbg::delete_fast_tracepoint(uint64_t addr)
+{
+    auto tp=t_fast.find(addr);
+    if(!tp)
+    {
+        std::cerr << "No fast tracepoint at 0x" << std::hex << addr << std::endl;
+        return;
+    }
+    //原字节一次写回; trampoline 留着, 正在里面执行的线程仍然能跳回来
+    std::vector<pid_t> running;
+    for(auto& t:t_threads)
+    {
+        if(!t.second.is_stopped()) running.push_back(t.first);
+    }
+    stop_all_threads();
+    write_remote(tgid_me,addr,tp->orig,tp->patch_len);
+    t_fast.remove(addr);
+    for(auto tid:running)
+    {
+        auto it=t_threads.find(tid);
+        if(it==t_threads.end() || std::find(t_events.begin(),t_events.end(),tid)!=t_events.end()) continue;
+        it->second.resume();
+    }
+    if(!running.empty()) threads_running=!non_stop;
+    std::cout << "Deleted fast tracepoint at 0x" << std::hex << addr << std::endl;
+}
+
+bool TikiDbg::protect_pages(pid_t tid,const std::vector<page_span>& spans,bool watched)
+{
+    //watched: 去掉写权限; 否则恢复原来的权限
+    auto& th=t_threads.at(tid);
+    auto scratch= displaced_addr? displaced_addr : get_register_value(th.get_regs(),reg::rip);
+    bool ok=true;
+    for(auto& s:spans)
+    {
+        uint64_t ret;
+        auto prot= watched? s.prot&~PROT_WRITE : s.prot;
+        if(!inject_syscall(tid,scratch,SYS_mprotect,{s.addr,s.len,static_cast<uint64_t>(prot)},ret) || ret!=0)
+        {
+            ok=false;
+        }
+    }
+    return ok;
+}
+
+void TikiDbg::add_hw_watch(uint64_t addr,size_t len)
+{
+    std::vector<pid_t> tids;
+    for(auto& t:t_threads)
+    {
+        if(t.second.get_tgid()==tgid_me) tids.push_back(t.first);
+    }
+    t_hwwatch.prune([this](pid_t tid){return t_threads.count(tid)!=0;});
+    uint64_t value=0;
+    read_remote(tgid_me,addr,&value,std::min<size_t>(len,sizeof(value)));
+    std::string err;
+    auto num=t_hwwatch.add(addr,len,value,tids,err);
+    if(num==0)
+    {
+        std::cerr << "Cannot watch 0x" << std::hex << addr << ": " << err << std::endl;
+        return;
+    }
+    std::cout << "Watch " << std::dec << num << ": 0x" << std::hex << addr << " (" << std::dec << len << " bytes)" << std::endl;
+}
+
+void TikiDbg::set_counters(bool on)
+{
+    if(!on)
+    {
+        t_counters.close_all();
+        counters_on=false;
+        std::cout << "counters off" << std::endl;
+        return;
+    }
+    if(!require_stopped()) return;
+    std::string err;
+    for(auto& t:t_threads)
+    {
+        if(!t_counters.add_thread(t.first,err))
+        {
+            std::cerr << "perf_event_open failed: " << err << std::endl;
+            t_counters.close_all();
+            return;
+        }
+    }
+    counters_on=true;
+    std::cout << "counters on:";
+    for(auto& e:t_counters.get_events()) std::cout << " " << e.name;
+    std::cout << std::endl;
+    if(t_counters.get_events().front().type!=PERF_TYPE_HARDWARE)
+    {
+        std::cout << "Hardware counters are not available (" << err << "), using software events" << std::endl;
+    }
+}
+
+void TikiDbg::report_counters()
+{
+    //计数器只在被调试进程运行时增加, 没有运行过的命令不打印
+    if(!t_counters.read_and_reset(counter_values,[this](pid_t tid){return t_threads.count(tid)!=0;})) return;
+    if(std::all_of(counter_values.begin(),counter_values.end(),[](uint64_t v){return v==0;})) return;
+    auto& events=t_counters.get_events();
+    if(t_json)
+    {
+        t_json->begin("counters");
+        for(size_t i=0;i<events.size();i++) t_json->num(events[i].name,counter_values[i]);
+        t_json->end();
+        return;
+    }
+    std::cout << "Executed";
+    for(size_t i=0;i<events.size();i++)
+    {
+        std::cout << (i? ", " : " ");
+        if(events[i].type==PERF_TYPE_SOFTWARE && events[i].config==PERF_COUNT_SW_TASK_CLOCK)
+        {//纳秒
+            std::cout << std::fixed << std::setprecision(3) << counter_values[i]/1e6 << std::defaultfloat << " ms ";
+        }
+        else{
+            std::cout << format_count(counter_values[i]) << " ";
+        }
+        std::cout << events[i].name;
+    }
+    std::cout << std::endl;
+}
+
+void TikiDbg::add_watch_range(uint64_t addr,uint64_t len)
+{
+    std::vector<page_span> spans;
+    std::string err;
+    auto num=t_watch.add(tgid_me,addr,len,spans,err);
+    if(num==0)
+    {
+        std::cerr << "Cannot watch 0x" << std::hex << addr << ": " << err << std::endl;
+        return;
+    }
+    if(!protect_pages(pid_me,spans,true))
+    {
+        std::cerr << "mprotect failed" << std::endl;
+        std::vector<page_span> undo;
+        t_watch.remove(num,undo);
+        protect_pages(pid_me,undo,false);
+    }
+    else{
+        std::cout << "Watch range " << std::dec << num << ": 0x" << std::hex << addr << "-0x" << addr+len << std::endl;
+    }
+}
+
+void TikiDbg::delete_watch_range(int num)
+{
+    std::vector<page_span> spans;
+    if(!t_watch.remove(num,spans))
+    {
+        std::cerr << "No watch range " << std::dec << num << std::endl;
+        return;
+    }
+    protect_pages(pid_me,spans,false);
+    std::cout << "Deleted watch range " << std::dec << num << std::endl;
+}
+
+bool TikiDbg::handle_watch_fault(TikiThread& th,bool& report)
+{
+    //返回 false 表示不是 watch-range 引起的 SIGSEGV
+    auto& info=th.get_stop_info();
+    auto addr=reinterpret_cast<uint64_t>(info.si_addr);
+    if(info.si_code!=SEGV_ACCERR || !t_watch.is_protected(addr))
+    {
+        return false;
+    }
+    auto tid=th.get_tid();
+    auto pc=get_register_value(th.get_regs(),reg::rip);
+    auto range=t_watch.find_range(addr);
+    //写之前的值, 不超出范围和这一页
+    watch_hit hit{range? range->num : 0,addr,pc,0,0,0};
+    if(range)
+    {
+        auto page_end=(addr|(TikiWatchTable::page_size-1))+1;
+        hit.size=std::min<uint64_t>({8,range->addr+range->len-addr,page_end-addr});
+        read_remote(tid,addr,&hit.old_value,hit.size);
+    }
+
+    //放开这一页单步执行写入指令; 跨页写到下一个被保护的页时再放开那一页
+    std::vector<page_span> lifted;
+    auto lift=[&](uint64_t a){
+        page_span s{a&~(TikiWatchTable::page_size-1),TikiWatchTable::page_size,t_watch.original_prot(a)};
+        lifted.push_back(s);
+        protect_pages(tid,{s},false);
+    };
+    lift(addr);
+    int status;
+    bool alive=true;
+    while(true)
+    {
+        if(!th.resume(PTRACE_SINGLESTEP) || waitpid(tid,&status,__WALL)!=tid)
+        {
+            alive=false;
+            break;
+        }
+        if(!WIFSTOPPED(status))
+        {
+            dispatch_event(tid,status);
+            alive=false;
+            break;
+        }
+        bool is_signal=(status>>16)==0;
+        th.mark_stopped(status,is_signal);
+        if(!is_signal) continue;
+        auto sig=WSTOPSIG(status);
+        if(sig==SIGTRAP) break;
+        if(sig==SIGSEGV)
+        {
+            auto& again=th.get_stop_info();
+            auto a=reinterpret_cast<uint64_t>(again.si_addr);
+            if(again.si_code==SEGV_ACCERR && t_watch.is_protected(a)
+                && std::none_of(lifted.begin(),lifted.end(),[a](auto&& s){return s.addr==(a&~(TikiWatchTable::page_size-1));}))
+            {
+                lift(a);
+                continue;
+            }
+        }
+        //真正的错误或者其他信号: 保留到恢复运行时投递
+        th.set_pending_signal(sig);
+        break;
+    }
+    if(!alive)
+    {
+        report=false;
+        return true;
+    }
+    protect_pages(tid,lifted,true);
+    if(!range)
+    {//同一页的其他地址
+        report=false;
+        return true;
+    }
+    read_remote(tid,addr,&hit.new_value,hit.size);
+    ++range->hits;
+    watch_hits[tid]=hit;
+    report=true;
+    return true;
+}
+
+void TikiDbg::run_batch()
+{
+    //标准输出只在缓冲区满和结束时写; std::cerr 立刻写出, 之前先写出已经缓冲的输出
+    //--interpreter=json 已经有自己的缓冲区
+    TikiBatchWriter out{STDOUT_FILENO,true};
+    TikiBatchWriter err{STDERR_FILENO,false,&out};
+    auto old_out= t_json? std::cout.rdbuf() : std::cout.rdbuf(&out);
+    auto old_err= t_json? std::cerr.rdbuf() : std::cerr.rdbuf(&err);
+    //不读 stdin (自动化运行时常常是关掉的管道), 事件循环只等 SIGCHLD 和 Ctrl-C
+    t_loop.open(-1);
+    run_script(t_script.get_commands(),nullptr,0);
+    if(attach_mode && !detached && !process_exited)
+    {//启动的程序随调试器退出被杀掉 (PTRACE_O_EXITKILL), attach 的要放开
+        detach();
+    }
+    t_loop.close();
+    out.flush_all();
+    if(t_json) t_json->flush();
+    std::cout.rdbuf(old_out);
+    std::cerr.rdbuf(old_err);
+}
+
+bool TikiDbg::run_script(const std::vector<script_cmd>& cmds,const std::vector<std::string>* call_args,int depth)
+{
+    //返回 false 表示出错或者 quit, 整个脚本到此为止
+    static const int max_depth=1000;
+    std::vector<std::string> sub_args;
+    std::string sub_line;
+    //用户命令体内的 $argc, $arg0.. 换成调用时的参数
+    auto substitute=[call_args](const std::string& s,std::string& out)->bool{
+        out.clear();
+        size_t pos=0,at;
+        while((at=s.find("$arg",pos))!=std::string::npos)
+        {
+            out.append(s,pos,at-pos);
+            auto p=at+4;
+            if(p<s.size() && s[p]=='c')
+            {
+                out+=std::to_string(call_args->size()-1);
+                pos=p+1;
+                continue;
+            }
+            size_t n=0;
+            auto digits=p;
+            while(digits<s.size() && std::isdigit(static_cast<unsigned char>(s[digits]))) n=n*10+(s[digits++]-'0');
+            if(digits==p)
+            {
+                out+="$arg";
+                pos=p;
+                continue;
+            }
+            if(n+1>=call_args->size())
+            {
+                std::cerr << "Missing argument $arg" << n << std::endl;
+                return false;
+            }
+            out+=(*call_args)[n+1];
+            pos=digits;
+        }
+        out.append(s,pos,std::string::npos);
+        return true;
+    };
+    for(auto& c:cmds)
+    {
+        if(script_quit) return false;
+        auto* args=&c.args;
+        auto* line=&c.line;
+        if(call_args && c.line.find("$arg")!=std::string::npos)
+        {
+            sub_args.resize(c.args.size());
+            for(size_t i=0;i<c.args.size();i++)
+            {
+                if(!substitute(c.args[i],sub_args[i])) return false;
+            }
+            if(!substitute(c.line,sub_line)) return false;
+            args=&sub_args;
+            line=&sub_line;
+        }
+        int64_t value;
+        switch(c.kind)
+        {
+            case script_cmd::echo:
+                std::cout << *line;
+                break;
+            case script_cmd::while_loop:
+                while(true)
+                {
+                    if(!eval_condition(*args,0,value)) return false;
+                    if(!value) break;
+                    if(!run_script(c.body,call_args,depth)) return false;
+                }
+                break;
+            case script_cmd::if_block:
+                if(!eval_condition(*args,0,value)) return false;
+                if(!run_script(value? c.body : c.else_body,call_args,depth)) return false;
+                break;
+            case script_cmd::user_call:
+            {
+                if(depth>=max_depth)
+                {
+                    std::cerr << "Line " << std::dec << c.line_no << ": user commands nested too deeply" << std::endl;
+                    return false;
+                }
+                //参数表要在下一层继续用, 复制一份
+                std::vector<std::string> params{*args};
+                if(!run_script(*t_script.find_define(params[0]),&params,depth+1)) return false;
+                break;
+            }
+            case script_cmd::plain:
+            {
+                auto& a=*args;
+                if(a[0]=="quit")
+                {
+                    script_quit=true;
+                    return false;
+                }
+                if(a[0]=="output")
+                {//output EXPR: 十进制, 不换行
+                    if(!eval_condition(a,1,value)) return false;
+                    std::cout << std::dec << value;
+                    break;
+                }
+                if(a[0]=="set" && a.size()>=3 && a[1].size()>1 && a[1][0]=='$')
+                {//set $name VALUE: 不是寄存器名就是脚本变量
+                    auto name=a[1].substr(1);
+                    bool is_var= script_vars.count(name) || std::none_of(g_register_descriptors.begin(),g_register_descriptors.end(),
+                        [&name](auto&& rd){return rd.name==name;});
+                    if(is_var)
+                    {
+                        if(!eval_condition(a,2,value)) return false;
+                        script_vars[name]=value;
+                        break;
+                    }
+                }
+                //脚本里已经切分过了, 这里只是把 string_view 指过去
+                if(a.size()>max_command_words)
+                {
+                    std::cerr << "Line " << std::dec << c.line_no << ": too many arguments" << std::endl;
+                    return false;
+                }
+                cmd_args ca;
+                ca.line=*line;
+                for(auto& w:a) ca.words[ca.count++]=w;
+                try{
+                    execute_command(ca);
+                }
+                catch(const std::exception& e)
+                {
+                    std::cerr << "Line " << std::dec << c.line_no << ": " << e.what() << std::endl;
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool TikiDbg::eval_condition(const std::vector<std::string>& expr,size_t from,int64_t& value)
+{
+    //A 或 A OP B, 各部分用空格分开
+    auto n=expr.size()-from;
+    int64_t a,b;
+    if((n!=1 && n!=3) || !eval_operand(expr[from],a))
+    {
+        if(n!=1 && n!=3) std::cerr << "Bad expression, expected A or A OP B" << std::endl;
+        return false;
+    }
+    if(n==1)
+    {
+        value=a;
+        return true;
+    }
+    if(!eval_operand(expr[from+2],b)) return false;
+    auto& op=expr[from+1];
+    if(op=="==") value= a==b;
+    else if(op=="!=") value= a!=b;
+    else if(op=="<") value= a<b;
+    else if(op=="<=") value= a<=b;
+    else if(op==">") value= a>b;
+    else if(op==">=") value= a>=b;
+    else if(op=="+") value= a+b;
+    else if(op=="-") value= a-b;
+    else if(op=="&") value= a&b;
+    else{
+        std::cerr << "Unknown operator " << op << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TikiDbg::eval_operand(const std::string& tok,int64_t& value)
+{
+    bool alive= !process_exited && t_threads.count(pid_me);
+    if(std::isdigit(static_cast<unsigned char>(tok[0])) || (tok[0]=='-' && tok.size()>1))
+    {
+        size_t used=0;
+        try{
+            value=static_cast<int64_t>(std::stoull(tok,&used,0));
+        }
+        catch(const std::exception&){
+            used=0;
+        }
+        if(used==tok.size()) return true;
+    }
+    else if(tok[0]=='*' && tok.size()>1)
+    {
+        int64_t addr;
+        if(!eval_operand(tok.substr(1),addr)) return false;
+        if(alive && read_remote(tgid_me,addr,&value,sizeof(value))) return true;
+        std::cerr << "Cannot access memory at 0x" << std::hex << addr << std::endl;
+        return false;
+    }
+    else if(tok[0]=='$' && tok.size()>1)
+    {
+        auto name=tok.substr(1);
+        if(name=="_alive")
+        {
+            value=alive;
+            return true;
+        }
+        if(name=="_exitcode")
+        {//还没结束时是 -1
+            value= process_exited && WIFEXITED(last_exit_status)? WEXITSTATUS(last_exit_status) : -1;
+            return true;
+        }
+        if(name=="_signo")
+        {
+            value= alive? cur_thread().get_stop_info().si_signo : 0;
+            return true;
+        }
+        auto var=script_vars.find(name);
+        if(var!=script_vars.end())
+        {
+            value=var->second;
+            return true;
+        }
+        auto rd=std::find_if(g_register_descriptors.begin(),g_register_descriptors.end(),[&name](auto&& d){return d.name==name;});
+        if(rd!=g_register_descriptors.end())
+        {
+            if(!alive)
+            {
+                std::cerr << "No registers, the program is not running" << std::endl;
+                return false;
+            }
+            value=static_cast<int64_t>(get_reg(rd->r));
+            return true;
+        }
+    }
+    std::cerr << "Bad value " << tok << std::endl;
+    return false;
+}
+
+void TikiDbg::serve_gdb()
+{
+    if(!t_rsp.listen(gdbserver_spec))
+    {
+        std::cerr << "Cannot listen on " << gdbserver_spec << std::endl;
+        return;
+    }
+    std::cout << "Listening on " << gdbserver_spec << std::endl;
+    if(!t_rsp.accept())
+    {
+        return;
+    }
+    std::cout << "Remote debugging connected" << std::endl;
+    //等待运行中的事件时同时看 socket (gdb 发 0x03 中断)
+    t_loop.open(t_rsp.get_fd());
+    //信号都停下交给 gdb, 是否投递由 C/S 包决定; QPassSignals 列出的直接放过
+    t_signals.update({"all","stop","nopass"});
+    bool alive=true;
+    while(alive && !detached)
+    {
+        //一次读到的所有包处理完, 回复一起写出
+        std::string pkt;
+        bool interrupt;
+        while(alive && t_rsp.next_packet(pkt,interrupt))
+        {
+            if(interrupt) continue;     // 已经停着
+            try{
+                alive=rsp_handle(pkt);
+            }
+            catch(const std::exception& e)
+            {//漏掉的格式错误也只回复错误, 调试器和被调试进程都留着
+                std::cerr << "Bad packet " << pkt << ": " << e.what() << std::endl;
+                t_rsp.send("E01");
+            }
+        }
+        if(!t_rsp.flush() || !alive || !t_rsp.fill())
+        {
+            break;
+        }
+    }
+    if(!detached && !process_exited)
+    {//连接断开: 启动的进程结束掉, attach 的放开
+        if(attach_mode)
+        {
+            detach();
+        }
+        else{
+            kill(tgid_me,SIGKILL);
+        }
+    }
+    t_loop.close();
+    t_rsp.close();
+}
+
+user_fpregs_struct& TikiDbg::rsp_fpregs_of(pid_t tid)
+{
+    auto it=rsp_fpregs.find(tid);
+    if(it==rsp_fpregs.end())
+    {
+        it=rsp_fpregs.emplace(tid,user_fpregs_struct{}).first;
+        ptrace(PTRACE_GETFPREGS,tid,nullptr,&it->second);
+    }
+    return it->second;
+}
+
+std::string TikiDbg::rsp_read_memory(uint64_t addr,size_t len)
+{
+    //一次 process_vm_readv; 跨到不可读的页时返回能读的前缀
+    std::vector<uint8_t> buf(len);
+    if(!read_remote(tgid_me,addr,buf.data(),len))
+    {
+        size_t done=0;
+        while(done<len)
+        {
+            auto chunk=std::min<size_t>(len-done,0x1000-((addr+done)&0xfff));
+            if(!read_remote(tgid_me,addr+done,buf.data()+done,chunk)) break;
+            done+=chunk;
+        }
+        buf.resize(done);
+    }
+    if(buf.empty())
+    {
+        return "E14";
+    }
+    //gdb 看到的是原始字节
+    for(auto& b:t_breakpoints)
+    {
+        auto a=static_cast<uint64_t>(b.first);
+        if(b.second.is_enabled() && a>=addr && a<addr+buf.size()) buf[a-addr]=b.second.get_save_byte();
+    }
+    return rsp_hex(buf.data(),buf.size());
+}
+
+bool TikiDbg::rsp_write_memory(uint64_t addr,const uint8_t* data,size_t len)
+{
+    //覆盖到断点时先拿掉 int3, 写完再插回去, 原始字节随之更新
+    std::vector<Tikibreakpoint*> held;
+    for(auto& b:t_breakpoints)
+    {
+        auto a=static_cast<uint64_t>(b.first);
+        if(b.second.is_enabled() && a>=addr && a<addr+len)
+        {
+            b.second.disable();
+            held.push_back(&b.second);
+        }
+    }
+    bool ok= len==0 || write_remote(tgid_me,addr,data,len);
+    for(auto bp:held) bp->enable();
+    return ok;
+}
+
+void TikiDbg::rsp_rewind_breakpoints()
+{
+    //和 gdbserver 一样把 pc 退回断点地址; 其他线程的断点事件丢掉, 恢复运行后会再次命中
+    rsp_swbreak.clear();
+    for(auto& t:t_threads)
+    {
+        auto& th=t.second;
+        if(th.get_tgid()!=tgid_me || !th.is_stopped() || !th.stopped_at_breakpoint()) continue;
+        auto regs=th.get_regs();
+        auto bp=get_register_value(regs,reg::rip)-1;
+        if(!t_breakpoints.count(bp)) continue;
+        set_register_value(regs,reg::rip,bp);
+        th.set_regs(regs);
+        th.clear_stop_reason();
+        rsp_swbreak.insert(t.first);
+    }
+}
+
+std::string TikiDbg::rsp_stop_reply(pid_t tid)
+{
+    if(process_exited || !t_threads.count(tid))
+    {
+        char buf[8];
+        if(WIFSIGNALED(last_exit_status))
+        {
+            snprintf(buf,sizeof(buf),"X%02x",gdb_signal_from_host(WTERMSIG(last_exit_status)));
+        }
+        else{
+            snprintf(buf,sizeof(buf),"W%02x",WEXITSTATUS(last_exit_status));
+        }
+        return buf;
+    }
+    auto& th=t_threads.at(tid);
+    int sig=SIGTRAP;
+    std::string reason;
+    auto hit=watch_hits.find(tid);
+    if(hit!=watch_hits.end())
+    {
+        reason="watch:"+rsp_hex_number(hit->second.addr)+";";
+        watch_hits.erase(hit);
+    }
+    else if(rsp_swbreak.count(tid))
+    {
+        reason="swbreak:;";
+    }
+    else if(interrupt_stop)
+    {
+        sig=SIGINT;
+    }
+    else if(th.get_stop_info().si_signo!=0)
+    {
+        sig=th.get_stop_info().si_signo;
+    }
+    interrupt_stop=false;
+    //顺带给出 rbp/rsp/rip, gdb 停下后不用马上再要 g
+    auto& regs=th.get_regs();
+    char buf[8];
+    snprintf(buf,sizeof(buf),"T%02x",gdb_signal_from_host(sig));
+    return std::string{buf}+"06:"+rsp_hex(&regs.rbp,8)+";07:"+rsp_hex(&regs.rsp,8)+";10:"+rsp_hex(&regs.rip,8)+";"
+        +reason+"thread:"+rsp_hex_number(tid)+";";
+}
+
+bool TikiDbg::rsp_step(TikiThread& th)
+{
+    //pc 在断点地址上: 去掉 int3 单步, 其他线程都停着
+    auto tid=th.get_tid();
+    auto pc=get_register_value(th.get_regs(),reg::rip);
+    auto it=t_breakpoints.find(pc);
+    bool held= it!=t_breakpoints.end() && it->second.is_enabled();
+    if(held) it->second.disable();
+    bool ok=step_thread_quietly(th);
+    if(held && !process_exited && t_breakpoints.count(pc)) t_breakpoints[pc].enable();
+    return ok && t_threads.count(tid);
+}
+
+pid_t TikiDbg::rsp_wait()
+{
+    //运行期间 gdb 只会发 0x03; 返回要报告的线程, 进程结束返回 0
+    while(true)
+    {
+        int status;
+        pid_t tid;
+        while((tid=waitpid(-1,&status,__WALL|WNOHANG))>0)
+        {
+            if(!dispatch_event(tid,status)) continue;
+            if(process_exited) return 0;
+            auto& th=t_threads.at(tid);
+            auto pc=get_register_value(th.get_regs(),reg::rip)-1;
+            if(th.stopped_at_breakpoint() && pc==solib_event_addr && !rsp_breakpoints.count(pc))
+            {//dlopen/dlclose: 更新模块表, 跨过 int3 继续
+                t_modules.update_from_link_map();
+                auto regs=th.get_regs();
+                set_register_value(regs,reg::rip,pc);
+                th.set_regs(regs);
+                rsp_step(th);
+                th.resume(syscall_pending.count(tid)? PTRACE_SYSCALL : PTRACE_CONT);
+                continue;
+            }
+            stop_all_threads();
+            return tid;
+        }
+        if(tid<0)
+        {
+            process_exited=true;
+            return 0;
+        }
+        auto ready=t_loop.wait(src_child|src_input|src_interrupt);
+        bool interrupt=(ready&src_interrupt)!=0;
+        if(ready&src_input)
+        {
+            //连接断开也当作中断, 停下来由 serve_gdb 收尾
+            interrupt|= !t_rsp.fill() || t_rsp.take_interrupt();
+        }
+        if(interrupt)
+        {
+            interrupt_threads(true);
+            return take_interrupt_event(pid_me);
+        }
+    }
+}
+
+void TikiDbg::rsp_resume(const std::string& actions)
+{
+    //;s:tid;c 或 ;r start,end:tid;c 或 ;C05:tid ... 每个线程用最左边匹配的动作
+    struct action {
+        char type;
+        int sig;
+        pid_t tid;
+        uint64_t start,end;
+    };
+    std::vector<action> list;
+    std::stringstream ss{actions};
+    std::string item;
+    while(std::getline(ss,item,';'))
+    {
+        if(item.empty()) continue;
+        action a{item[0],0,-1,0,0};
+        auto colon=item.find(':');
+        auto body=item.substr(1,colon==std::string::npos? std::string::npos : colon-1);
+        bool ok= colon==std::string::npos || rsp_parse_thread(std::string_view{item}.substr(colon+1),a.tid);
+        if(a.tid==0) a.tid=-1;
+        uint64_t sig=0;
+        if((a.type=='C' || a.type=='S') && !body.empty())
+        {
+            ok=ok && rsp_parse_number(body,sig);
+            a.sig=gdb_signal_to_host(static_cast<int>(sig));
+        }
+        if(a.type=='r')
+        {
+            auto comma=body.find(',');
+            ok=ok && comma!=std::string::npos && rsp_parse_number(std::string_view{body}.substr(0,comma),a.start)
+                && rsp_parse_number(std::string_view{body}.substr(comma+1),a.end);
+        }
+        if(!ok)
+        {//格式错误的包不恢复运行
+            t_rsp.send("E01");
+            return;
+        }
+        list.push_back(a);
+    }
+    auto action_of=[&list](pid_t tid)->const action*{
+        for(auto& a:list)
+        {
+            if(a.tid==-1 || a.tid==tid) return &a;
+        }
+        return nullptr;
+    };
+    rsp_fpregs.clear();
+    for(auto& t:t_threads)
+    {
+        if(t.second.get_tgid()!=tgid_me) continue;
+        auto a=action_of(t.first);
+        //gdb 不带信号恢复就是不投递
+        t.second.set_pending_signal(a? a->sig : 0);
+    }
+    //要单步的线程: 指明了线程号的优先, 没指明就是当前线程
+    pid_t stepper=0;
+    for(auto& a:list)
+    {
+        if(a.type=='c' || a.type=='C') continue;
+        stepper= a.tid==-1? pid_me : a.tid;
+        break;
+    }
+    if(stepper!=0 && !t_threads.count(stepper))
+    {
+        t_rsp.send("E01");
+        return;
+    }
+    if(stepper!=0)
+    {//只有这一个线程单步, 其他线程保持停止 (gdb 的 scheduler-locking step)
+        auto a=*action_of(stepper);
+        select_tid(stepper);
+        auto& th=cur_thread();
+        uint64_t n=0;
+        while(rsp_step(th))
+        {
+            auto pc=get_register_value(th.get_regs(),reg::rip);
+            if(a.type!='r' || pc<a.start || pc>=a.end || th.get_pending_signal()) break;
+            auto it=t_breakpoints.find(pc);
+            if(it!=t_breakpoints.end() && it->second.is_enabled()) break;
+            //范围单步可能很长, 隔一段看一次 gdb 有没有中断
+            if(++n%1024==0 && t_rsp.poll_interrupt()) break;
+        }
+        rsp_swbreak.clear();
+        t_rsp.send(rsp_stop_reply(stepper));
+        return;
+    }
+
+    pid_t tid;
+    if(pop_event(tid))
+    {//上次停下时其他线程的信号还没报告
+        select_tid(tid);
+        rsp_rewind_breakpoints();
+        t_rsp.send(rsp_stop_reply(tid));
+        return;
+    }
+    //停在断点地址上的线程先单步跨过去
+    std::vector<pid_t> stopped;
+    for(auto& t:t_threads)
+    {
+        if(t.second.get_tgid()==tgid_me && t.second.is_stopped()) stopped.push_back(t.first);
+    }
+    for(auto t:stopped)
+    {
+        if(!t_threads.count(t)) continue;
+        auto& th=t_threads.at(t);
+        auto pc=get_register_value(th.get_regs(),reg::rip);
+        auto it=t_breakpoints.find(pc);
+        if(it!=t_breakpoints.end() && it->second.is_enabled())
+        {
+            auto sig=th.get_pending_signal();
+            th.set_pending_signal(0);
+            rsp_step(th);
+            if(t_threads.count(t) && !th.get_pending_signal()) th.set_pending_signal(sig);
+        }
+    }
+    if(process_exited)
+    {
+        t_rsp.send(rsp_stop_reply(0));
+        return;
+    }
+    resume_all_threads();
+    tid=rsp_wait();
+    if(tid!=0)
+    {
+        select_tid(tid);
+        rsp_rewind_breakpoints();
+    }
+    t_rsp.send(rsp_stop_reply(tid));
+}
+
+bool TikiDbg::rsp_handle(const std::string& pkt)
+{
+    //返回 false 结束会话
+    auto starts=[&pkt](const char* prefix){return pkt.compare(0,std::strlen(prefix),prefix)==0;};
+    //包里的数都用 rsp_parse_number 检查, 格式错误回复 E01, 不能让异常结束调试器
+    auto parse_addr_len=[&pkt](size_t from,uint64_t& addr,uint64_t& len)->size_t{
+        auto comma=pkt.find(',',from);
+        if(from>pkt.size() || comma==std::string::npos) return std::string::npos;
+        size_t end;
+        std::string_view v{pkt};
+        if(!rsp_parse_number(v.substr(from,comma-from),addr) || !rsp_parse_number(v.substr(comma+1),len,&end)) return std::string::npos;
+        return comma+1+end;
+    };
+    switch(pkt.empty()? 0 : pkt[0])
+    {
+        case '?':
+            rsp_rewind_breakpoints();
+            t_rsp.send(rsp_stop_reply(pid_me));
+            return true;
+        case 'q':
+        {
+            if(starts("qSupported"))
+            {
+                t_rsp.send("PacketSize=20000;QStartNoAckMode+;qXfer:features:read+;vContSupported+;swbreak+;QPassSignals+");
+            }
+            else if(starts("qXfer:features:read:target.xml:"))
+            {
+                uint64_t off,len;
+                std::string xml=rsp_target_xml();
+                if(parse_addr_len(31,off,len)==std::string::npos)
+                {
+                    t_rsp.send("E01");
+                }
+                else if(off>=xml.size())
+                {
+                    t_rsp.send("l");
+                }
+                else{
+                    auto chunk=xml.substr(off,len);
+                    t_rsp.send((off+chunk.size()<xml.size()? "m" : "l")+rsp_escape(chunk));
+                }
+            }
+            else if(starts("qfThreadInfo"))
+            {
+                std::string list="m";
+                for(auto& t:t_threads)
+                {
+                    if(t.second.get_tgid()!=tgid_me) continue;
+                    if(list.size()>1) list+=',';
+                    list+=rsp_hex_number(t.first);
+                }
+                t_rsp.send(list.size()>1? list : "l");
+            }
+            else if(starts("qsThreadInfo"))
+            {
+                t_rsp.send("l");
+            }
+            else if(starts("qC"))
+            {
+                t_rsp.send("QC"+rsp_hex_number(pid_me));
+            }
+            else if(starts("qAttached"))
+            {
+                t_rsp.send(attach_mode? "1" : "0");
+            }
+            else if(starts("qSymbol"))
+            {
+                t_rsp.send("OK");
+            }
+            else{
+                t_rsp.send("");
+            }
+            return true;
+        }
+        case 'Q':
+            if(pkt=="QStartNoAckMode")
+            {//这个包本身的 + 已经发了
+                t_rsp.send("OK");
+                t_rsp.set_no_ack();
+            }
+            else if(starts("QPassSignals:"))
+            {
+                t_signals.update({"all","stop","nopass"});
+                std::stringstream list{pkt.substr(13)};
+                std::string item;
+                while(std::getline(list,item,';'))
+                {
+                    uint64_t num;
+                    auto sig= rsp_parse_number(item,num)? gdb_signal_to_host(static_cast<int>(num)) : 0;
+                    if(sig>0 && sig!=SIGTRAP && sig!=SIGINT) t_signals.update({std::to_string(sig),"nostop","noprint","pass"});
+                }
+                t_rsp.send("OK");
+            }
+            else{
+                t_rsp.send("");
+            }
+            return true;
+        case 'H':
+        {
+            pid_t tid=0;
+            if(pkt.size()<2 || (pkt.size()>2 && !rsp_parse_thread(std::string_view{pkt}.substr(2),tid)))
+            {
+                t_rsp.send("E01");
+                return true;
+            }
+            if(pkt[1]=='g' && tid>0)
+            {
+                if(!t_threads.count(tid))
+                {
+                    t_rsp.send("E01");
+                    return true;
+                }
+                select_tid(tid);
+            }
+            t_rsp.send("OK");
+            return true;
+        }
+        case 'T':
+        {
+            pid_t tid;
+            t_rsp.send(rsp_parse_thread(std::string_view{pkt}.substr(1),tid) && t_threads.count(tid)? "OK" : "E01");
+            return true;
+        }
+        case 'g':
+        {
+            auto img=rsp_pack_registers(cur_thread().get_regs(),rsp_fpregs_of(pid_me));
+            t_rsp.send(rsp_hex(img.data(),img.size()));
+            return true;
+        }
+        case 'G':
+        case 'P':
+        {
+            auto regs=cur_thread().get_regs();
+            auto& fp=rsp_fpregs_of(pid_me);
+            auto img=rsp_pack_registers(regs,fp);
+            std::vector<uint8_t> bytes;
+            bool ok;
+            if(pkt[0]=='G')
+            {
+                ok=rsp_unhex(pkt.substr(1),bytes) && bytes.size()<=img.size();
+                if(ok) std::copy(bytes.begin(),bytes.end(),img.begin());
+            }
+            else{
+                auto eq=pkt.find('=');
+                uint64_t n;
+                int num= eq!=std::string::npos && rsp_parse_number(std::string_view{pkt}.substr(1,eq-1),n) && n<INT32_MAX? static_cast<int>(n) : -1;
+                ok= num>=0 && num<rsp_register_count() && rsp_unhex(pkt.substr(eq+1),bytes)
+                    && bytes.size()==rsp_register_size(num);
+                if(ok) std::copy(bytes.begin(),bytes.end(),img.begin()+rsp_register_offset(num));
+            }
+            if(!ok)
+            {
+                t_rsp.send("E01");
+                return true;
+            }
+            rsp_unpack_registers(img,regs,fp);
+            cur_thread().set_regs(regs);
+            ptrace(PTRACE_SETFPREGS,pid_me,nullptr,&fp);
+            t_rsp.send("OK");
+            return true;
+        }
+        case 'p':
+        {
+            uint64_t num;
+            if(!rsp_parse_number(std::string_view{pkt}.substr(1),num) || num>=static_cast<uint64_t>(rsp_register_count()))
+            {
+                t_rsp.send("E01");
+                return true;
+            }
+            auto img=rsp_pack_registers(cur_thread().get_regs(),rsp_fpregs_of(pid_me));
+            t_rsp.send(rsp_hex(img.data()+rsp_register_offset(num),rsp_register_size(num)));
+            return true;
+        }
+        case 'm':
+        {
+            uint64_t addr,len;
+            if(parse_addr_len(1,addr,len)==std::string::npos)
+            {
+                t_rsp.send("E01");
+                return true;
+            }
+            t_rsp.send(rsp_read_memory(addr,std::min<uint64_t>(len,0x10000)));
+            return true;
+        }
+        case 'M':
+        case 'X':
+        {
+            uint64_t addr,len;
+            auto end=parse_addr_len(1,addr,len);
+            if(end==std::string::npos || end>=pkt.size() || pkt[end]!=':')
+            {
+                t_rsp.send("E01");
+                return true;
+            }
+            std::vector<uint8_t> bytes;
+            if(pkt[0]=='X')
+            {
+                auto raw=rsp_unescape(pkt.substr(end+1));
+                bytes.assign(raw.begin(),raw.end());
+            }
+            else if(!rsp_unhex(pkt.substr(end+1),bytes))
+            {
+                bytes.clear();
+            }
+            bool ok= bytes.size()==len && rsp_write_memory(addr,bytes.data(),len);
+            t_rsp.send(ok? "OK" : "E14");
+            return true;
+        }
+        case 'Z':
+        case 'z':
+        {
+            uint64_t addr,kind;
+            if(pkt.size()<3 || parse_addr_len(3,addr,kind)==std::string::npos)
+            {
+                t_rsp.send("E01");
+                return true;
+            }
+            bool insert=pkt[0]=='Z';
+            if(pkt[1]=='0')
+            {
+                if(insert)
+                {
+                    if(!t_breakpoints.count(addr)) set_breakpoint_at_addr(addr);
+                    if(t_breakpoints.count(addr)) rsp_breakpoints.insert(addr);
+                    t_rsp.send(t_breakpoints.count(addr)? "OK" : "E01");
+                }
+                else{
+                    //dlopen 事件断点自己还要用
+                    if(rsp_breakpoints.erase(addr) && addr!=solib_event_addr) delete_breakpoint_at_addr(addr);
+                    t_rsp.send("OK");
+                }
+            }
+            else if(pkt[1]=='2')
+            {//写观察点用 watch-range 实现, 长度不受调试寄存器限制
+                if(insert)
+                {
+                    add_watch_range(addr,kind);
+                    bool found=std::any_of(t_watch.get_ranges().begin(),t_watch.get_ranges().end(),
+                        [addr,kind](auto&& r){return r.second.addr==addr && r.second.len==kind;});
+                    t_rsp.send(found? "OK" : "E01");
+                }
+                else{
+                    for(auto& r:t_watch.get_ranges())
+                    {
+                        if(r.second.addr==addr && r.second.len==kind)
+                        {
+                            delete_watch_range(r.first);
+                            break;
+                        }
+                    }
+                    t_rsp.send("OK");
+                }
+            }
+            else{
+                t_rsp.send("");
+            }
+            return true;
+        }
+        case 'v':
+            if(pkt=="vCont?")
+            {
+                t_rsp.send("vCont;c;C;s;S;r");
+            }
+            else if(starts("vCont;"))
+            {
+                rsp_resume(pkt.substr(5));
+                return !process_exited;
+            }
+            else if(starts("vKill"))
+            {
+                kill(tgid_me,SIGKILL);
+                t_rsp.send("OK");
+                return false;
+            }
+            else{
+                t_rsp.send("");
+            }
+            return true;
+        case 'c':
+        case 's':
+            //旧式的 c/s [addr]
+            if(pkt.size()>1)
+            {
+                uint64_t pc;
+                if(!rsp_parse_number(std::string_view{pkt}.substr(1),pc))
+                {
+                    t_rsp.send("E01");
+                    return true;
+                }
+                auto regs=cur_thread().get_regs();
+                regs.rip=pc;
+                cur_thread().set_regs(regs);
+            }
+            rsp_resume(pkt[0]=='c'? ";c" : ";s:"+rsp_hex_number(pid_me));
+            return !process_exited;
+        case 'C':
+        case 'S':
+        {
+            auto sig=pkt.substr(1,pkt.find(';')-1);
+            rsp_resume(pkt[0]=='C'? ";C"+sig : ";S"+sig+":"+rsp_hex_number(pid_me));
+            return !process_exited;
+        }
+        case 'D':
+            detach();
+            t_rsp.send("OK");
+            return false;
+        case 'k':
+            kill(tgid_me,SIGKILL);
+            return false;
+        default:
+            t_rsp.send("");
+            return true;
+    }
+}
+
+size_t TikiDbg::drain_fast_trace()
+{
+    //读出新记录, 只保留最近的一部分; 运行期间定时器也会调用, 缓冲区写满前读走
+    static const size_t history_max=1<<16;
+    std::vector<fast_record> recs;
+    fast_lost+=t_fast.drain(recs);
+    fast_history.insert(fast_history.end(),recs.begin(),recs.end());
+    while(fast_history.size()>history_max) fast_history.pop_front();
+    fast_new+=recs.size();
+    return recs.size();
+}
+
+void TikiDbg::show_fast_trace(size_t count)
+{
+    drain_fast_trace();
+
+    for(auto& t:t_fast.get_tracepoints())
+    {
+        std::cout << "0x" << std::hex << t.first;
+        auto sym=t_modules.symbolize(t.first);
+        if(!sym.empty()) std::cout << " <" << sym << ">";
+        std::cout << "  hits " << std::dec << t.second.hits << std::endl;
+    }
+    std::cout << std::dec << fast_new << " new records";
+    fast_new=0;
+    if(fast_lost) std::cout << ", " << fast_lost << " lost to overruns";
+    std::cout << std::endl;
+    auto n=std::min(count,fast_history.size());
+    for(auto it=fast_history.end()-n;it!=fast_history.end();++it)
+    {
+        std::cout << "  tsc " << std::dec << it->tsc << "  0x" << std::hex << it->addr
+            << "  rdi=0x" << it->arg0 << " rsi=0x" << it->arg1 << std::endl;
+    }
+}
+
+size_t TikiDbg::read_code(uint64_t addr,uint8_t* buf,size_t size)
+{
+    if(!read_remote(tgid_me,addr,buf,size))
+    {//后面的页不可读, 只读到页尾
+        size=std::min<uint64_t>(size,0x1000-(addr&0xfff));
+        if(!read_remote(tgid_me,addr,buf,size)) return 0;
+    }
+    for(auto& bp:t_breakpoints)
+    {
+        uint64_t a=bp.first;
+        if(bp.second.is_enabled() && a>=addr && a<addr+size)
+        {
+            buf[a-addr]=bp.second.get_save_byte();
+        }
+    }
+    return size;
+}
+
+TikiBlockCache& TikiDbg::block_cache()
+{
+    if(!t_blocks)
+    {
+        t_blocks.reset(new TikiBlockCache{cs_handle,[this](uint64_t addr,uint8_t* buf,size_t size){
+            return read_code(addr,buf,size);
+        }});
+    }
+    return *t_blocks;
+}
+
+void TikiDbg::record_branch(uint64_t block,uint64_t pc)
+{
+    uint64_t from;
+    if(block_cache().find_branch(block,pc,from))
+    {
+        branch_edges.push_back({from,pc});
+    }
+}
+
+void TikiDbg::step_blocks(uint64_t count,uint64_t until)
+{
+    //PTRACE_SINGLEBLOCK (BTF) 只在发生跳转后停下, 块内的指令不产生停止
+    auto start=std::chrono::steady_clock::now();
+    auto tid=pid_me;
+    uint64_t n=0;
+    bool reported=false;
+    //代码可能变了 (dlopen/exec), 每次重新译码
+    block_cache().clear();
+    branch_edges.clear();
+    stepping_tid=tid;
+
+    auto block=get_pc();
+    if(step_over_breakpoint_quietly())
+    {//断点处的指令本身也可能是跳转
+        block-=1;
+        if(t_threads.count(tid)) record_branch(block,get_pc());
+    }
+    branch_trace_start=block;
+    if(t_threads.count(tid)) block=get_pc();
+
+    while(n<count && t_threads.count(tid))
+    {
+        if(n>0 && block==until)
+        {
+            break;
+        }
+        int status;
+        int resume_err=0;
+        if(!step_thread_fast(tid,PTRACE_SINGLEBLOCK,status,&resume_err))
+        {
+            if(n==0 && resume_err==EIO)
+            {
+                std::cerr << "PTRACE_SINGLEBLOCK is not supported" << std::endl;
+            }
+            break;
+        }
+        auto& cur=t_threads.at(tid);
+        if(WSTOPSIG(status)!=SIGTRAP)
+        {
+            cur.mark_stopped(status,true);
+            report_stop();
+            reported=true;
+            break;
+        }
+        cur.mark_stopped(status,false);
+        auto pc=get_register_value(cur.get_regs(),reg::rip);
+        auto bp=t_breakpoints.find(pc-1);
+        if(bp!=t_breakpoints.end() && bp->second.is_enabled())
+        {
+            cur.mark_stopped(status,true);
+            if(cur.stopped_at_breakpoint())
+            {//块中间的 int3, 停在断点之后一个字节
+                record_branch(block,pc-1);
+                report_stop();
+                if(internal_stop && step_over_breakpoint_quietly())
+                {//_dl_debug_state, 跳过后继续
+                    internal_stop=false;
+                    block=get_pc();
+                    continue;
+                }
+                reported=true;
+                break;
+            }
+        }
+        record_branch(block,pc);
+        block=pc;
+        ++n;
+    }
+    stepping_tid=0;
+    stepping_request=PTRACE_SINGLESTEP;
+
+    auto us=std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+    std::cout << "Stepped " << std::dec << n << " blocks (" << branch_edges.size() << " branches) in " << us << " us" << std::endl;
+    if(!reported && t_threads.count(tid))
+    {
+        print_disassembly(get_pc(),0x50,7);
+    }
+}
+
+void TikiDbg::list_branches(uint64_t count,bool with_insns)
+{
+    //只列最后 count 条; 带 -i 时用缓存的反汇编补出两次跳转之间执行的指令
+    auto first= branch_edges.size()>count? branch_edges.size()-count : 0;
+    auto from=first==0? branch_trace_start : branch_edges[first-1].to;
+    for(auto i=first; i<branch_edges.size(); i++)
+    {
+        auto& e=branch_edges[i];
+        if(with_insns)
+        {
+            block_cache().walk(from,e.from,[](const block_insn& in){
+                std::cout << "    0x" << std::hex << in.addr << ":\t" << in.text << std::endl;
+            });
+        }
+        std::cout << "#" << std::dec << i << "  0x" << std::hex << e.from;
+        auto sym=t_modules.symbolize(e.from);
+        if(!sym.empty()) std::cout << " <" << sym << ">";
+        std::cout << " -> 0x" << e.to;
+        sym=t_modules.symbolize(e.to);
+        if(!sym.empty()) std::cout << " <" << sym << ">";
+        std::cout << std::endl;
+        from=e.to;
+    }
+}
+
+void TikiDbg::view_trace(const std::string& path,uint64_t start,uint64_t count)
+{
+    TikiTraceReader reader;
+    if(!reader.open(path))
+    {
+        std::cout << "Bad trace file " << path << std::endl;
+        return;
+    }
+    trace_record rec;
+    while(reader.get_index()<start && reader.next(rec));
+    for(uint64_t i=0; i<count && reader.next(rec); i++)
+    {
+        std::cout << "#" << std::dec << reader.get_index()-1 << "  0x" << std::hex << rec.pc;
+        for(size_t r=0; r<n_trace_regs; r++)
+        {
+            if(rec.changed&(1u<<r))
+            {
+                std::cout << "  " << get_register_name(g_trace_regs[r]) << "=0x" << rec.regs[r];
+            }
+        }
+        std::cout << std::endl;
+    }
+}
+
+void TikiDbg::resume_all_threads()
+{
+    for(auto& t:t_threads)
+    {
+        if(t.first!=pid_me && t.second.stopped_at_breakpoint())
+        {
+            step_over_thread_breakpoint(t.second);
+        }
+    }
+    threads_running=true;
+    for(auto& t:t_threads)
+    {
+        t.second.resume(syscall_pending.count(t.first)? PTRACE_SYSCALL : PTRACE_CONT);
+    }
+}
+
+void TikiDbg::list_threads()
+{
+    for(auto& t:t_threads)
+    {
+        auto& th=t.second;
+        std::cout << (th.get_tid()==pid_me? "* " : "  ") << std::dec << th.get_num()
+            << "  tid " << th.get_tid();
+        if(!t_inferiors.empty())
+        {
+            std::cout << "  process " << th.get_tgid();
+        }
+        if(th.is_stopped())
+        {
+            auto pc=get_register_value(th.get_regs(),reg::rip);
+            std::cout << "  0x" << std::hex << pc;
+            auto sym=t_modules.symbolize(pc);
+            if(!sym.empty()) std::cout << " <" << sym << ">";
+        }
+        else{
+            std::cout << "  running";
+        }
+        std::cout << std::endl;
+    }
+}
+
+bool TikiDbg::require_stopped()
+{
+    if(process_exited)
+    {
+        std::cout << "The program is not being run" << std::endl;
+        return false;
+    }
+    if(t_threads.count(pid_me) && cur_thread().is_stopped())
+    {
+        return true;
+    }
+    std::cout << "Thread " << std::dec << cur_thread().get_num() << " is running" << std::endl;
+    return false;
+}
+
+void TikiDbg::select_thread(int num)
+{
+    for(auto& t:t_threads)
+    {
+        if(t.second.get_num()!=num)
+        {
+            continue;
+        }
+        if(!t.second.is_stopped())
+        {
+            std::cout << "Thread " << std::dec << num << " is running" << std::endl;
+            return;
+        }
+        select_tid(t.first);
+        std::cout << "Switching to thread " << std::dec << num << " (tid " << pid_me << ")" << std::endl;
+        print_disassembly(get_pc(),0x50,7);
+        return;
+    }
+    std::cout << "No thread " << std::dec << num << std::endl;
+}
+
+uint64_t TikiDbg::parse_break_target(std::string_view addr)
+{
+    //*0x1149: 相对主程序基址; 数字开头 (401000, 0x401000) 是十六进制地址; 其余先当符号 (main, libc.so.6:malloc)
+    //add, feed 这样全是十六进制字母的名字找不到符号时才当地址
+    if(addr[0]=='*')
+    {//rebase address
+        return cmd_number(addr.substr(1),16)+binary_addr_base;
+    }
+    bool is_hex = addr.find(':')==std::string_view::npos &&
+        addr.find_first_not_of("0123456789abcdefABCDEFx")==std::string_view::npos;
+    if(is_hex && addr[0]>='0' && addr[0]<='9')
+    {
+        return cmd_number(addr,16);
+    }
+    auto sym=t_modules.resolve(std::string{addr});
+    if(sym==0 && is_hex)
+    {
+        return cmd_number(addr,16);
+    }
+    return sym;
+}
+
+
+std::vector<std::string> split(const std::string&s,char delim)
+{
+    //和 getline 的结果一样: 连续的分隔符之间是空串, 结尾的分隔符不产生空串
+    std::vector<std::string> out{};
+    size_t pos=0;
+    while(pos<s.size())
+    {
+        auto next=s.find(delim,pos);
+        if(next==std::string::npos) next=s.size();
+        out.emplace_back(s,pos,next-pos);
+        pos=next+1;
+    }
+    return out;
+}
+
+bool is_prefix(const std::string& s,const std::string&format)
 {
     if(s.size()> format.size()) return false;
     return std::equal(s.begin(),s.end(),format.begin());
@@ -516,23 +5961,107 @@ bool is_prefix(const std::string& s,const std::string&format)
 
 int main(int argc, char **argv)
 {
-    if(argc < 2)
+    //--catch-syscall open,mmap,write: 启动时就装好 seccomp 过滤器
+    //--gdbserver unix:/path 或 :PORT: 不进命令行, 等 gdb 用 target remote 连上来
+    //-x FILE / -ex CMD: 按顺序执行完就退出, 可以给多次
+    std::set<long> catch_list;
+    //--interpreter=json: 输出改成 JSON lines, 格式见 TikiJson.h
+    std::string gdbserver;
+    TikiScript script;
+    bool json=false;
+    int argi=1;
+    while(argc > argi+1)
+    {
+        std::string err;
+        if(!std::strncmp(argv[argi],"--interpreter=",14))
+        {
+            std::string mode{argv[argi]+14};
+            if(mode!="json" && mode!="console")
+            {
+                std::cerr << "Unknown interpreter " << mode << std::endl;
+                return -1;
+            }
+            json= mode=="json";
+            argi+=1;
+            continue;
+        }
+        if(!std::strcmp(argv[argi],"--catch-syscall"))
+        {
+            if(!parse_syscall_list(argv[argi+1],catch_list)) return -1;
+        }
+        else if(!std::strcmp(argv[argi],"--gdbserver"))
+        {
+            gdbserver=argv[argi+1];
+        }
+        else if(!std::strcmp(argv[argi],"-x") || !std::strcmp(argv[argi],"-ex"))
+        {
+            bool ok= argv[argi][1]=='x'? script.add_file(argv[argi+1],err) : script.add_command(argv[argi+1],err);
+            if(!ok)
+            {
+                std::cerr << err << std::endl;
+                return -1;
+            }
+        }
+        else{
+            break;
+        }
+        argi+=2;
+    }
+    if(argc < argi+1)
     {
-        std::cerr << "Usage: " << argv[0]<< " [program]"<<std::endl;
+        std::cerr << "Usage: " << argv[0]<< " [--catch-syscall LIST] [--gdbserver unix:PATH|:PORT] [-x FILE] [-ex CMD] [--interpreter=json] [program] | -p [pid]"<<std::endl;
         return -1;
     }
-    auto program = argv[1];
+    TikiJsonWriter json_writer{STDOUT_FILENO};
+    std::unique_ptr<TikiJsonStreams> json_streams;
+    if(json) json_streams=std::make_unique<TikiJsonStreams>(json_writer);
+    if(!std::strcmp(argv[argi],"-p"))
+    {
+        if(argc < argi+2)
+        {
+            std::cerr << "Usage: " << argv[0]<< " -p [pid]"<<std::endl;
+            return -1;
+        }
+        pid_t pid = std::stoi(argv[argi+1]);
+        char exe[0x1000]={0};
+        readlink(("/proc/"+std::to_string(pid)+"/exe").c_str(),exe,sizeof(exe)-1);
+        std::cout << "Attaching to process " << pid << '\n' << exe << '\n';
+        TikiDbg tikidbg{exe, pid, true};
+        if(!catch_list.empty())
+        {//已经在运行的进程只能注入过滤器
+            std::cerr << "--catch-syscall is for launched programs, use catch syscall after attaching" << std::endl;
+        }
+        tikidbg.set_gdbserver(gdbserver);
+        tikidbg.set_script(std::move(script));
+        tikidbg.set_json(json? &json_writer : nullptr);
+        tikidbg.run();
+        return 0;
+    }
+    auto program = argv[argi];
     auto pid = fork();
     if(pid==0)
     {// fork path
-        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        personality(ADDR_NO_RANDOMIZE);
+        //等待父进程 PTRACE_SEIZE
+        raise(SIGSTOP);
+        //必须在 tracer 接管之后装: 没有 tracer 时 SECCOMP_RET_TRACE 让系统调用直接失败
+        if(!catch_list.empty())
+        {//只有选中的系统调用会停给调试器, 其余的不经过 ptrace
+            auto filter=build_syscall_filter(catch_list);
+            sock_fprog prog{static_cast<unsigned short>(filter.size()),filter.data()};
+            prctl(PR_SET_NO_NEW_PRIVS,1,0,0,0);
+            prctl(PR_SET_SECCOMP,SECCOMP_MODE_FILTER,&prog);
+        }
         execl(program, program, nullptr);
     }
     else if(pid>=1)
     {
         std::cout << "Started debugging process " << pid << '\n' << program << '\n';
         TikiDbg tikidbg{program, pid};
-        personality(ADDR_NO_RANDOMIZE);
+        tikidbg.set_launch_syscalls(catch_list);
+        tikidbg.set_gdbserver(gdbserver);
+        tikidbg.set_script(std::move(script));
+        tikidbg.set_json(json? &json_writer : nullptr);
         tikidbg.run();
     }
 }
\ No newline at end of file
@@ -5,8 +5,10 @@
 #include <sys/wait.h>
 
 #include<stdlib.h>
+#include<cstring>
 #include "linenoise.h"
 #include<vector>
+#include<memory>
 
 #include <sstream>
 
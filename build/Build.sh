@@ -2,4 +2,32 @@ g++ -o tiki.o -g -c ../Tikidbg.cpp
 g++ -o bk.o -g -c ../Tikibreakpoint.cpp
 g++ -o reg.o -g -c ../TikiReg.cpp
 gcc -o line.o -g -c ../linenoise.c 
-g++ bk.o tiki.o line.o  reg.o -o tiki ../libelfin/dwarf/libdwarf++.a  ../libelfin/elf/libelf++.a -lcapstone
\ No newline at end of file
+g++ -o module.o -g -c ../TikiModule.cpp
+g++ -o thread.o -g -c ../TikiThread.cpp
+g++ -o mem.o -g -c ../TikiMem.cpp
+g++ -o trace.o -g -c ../TikiTrace.cpp
+g++ -o block.o -g -c ../TikiBlock.cpp
+g++ -o emu.o -g -c ../TikiEmu.cpp
+g++ -o record.o -g -c ../TikiRecord.cpp
+g++ -o fuzz.o -g -c ../TikiFuzz.cpp
+g++ -o syscall.o -g -c ../TikiSyscall.cpp
+g++ -o fasttrace.o -g -c ../TikiFastTrace.cpp
+g++ -o signal.o -g -c ../TikiSignal.cpp
+g++ -o eventloop.o -g -c ../TikiEventLoop.cpp
+g++ -o watch.o -g -c ../TikiWatch.cpp
+g++ -o gdbserver.o -g -c ../TikiGdbServer.cpp
+g++ -o script.o -g -c ../TikiScript.cpp
+g++ -o json.o -g -c ../TikiJson.cpp
+g++ -o command.o -g -c ../TikiCommand.cpp
+g++ -o profile.o -g -c ../TikiProfile.cpp
+g++ -o perf.o -g -c ../TikiPerf.cpp
+g++ -o stats.o -g -c ../TikiStats.cpp
+g++ -o bench.o -g -c ../TikiBench.cpp
+g++ bk.o tiki.o line.o  reg.o module.o thread.o mem.o trace.o block.o emu.o record.o fuzz.o syscall.o fasttrace.o signal.o eventloop.o watch.o gdbserver.o script.o json.o command.o profile.o perf.o stats.o bench.o -o tiki ../libelfin/dwarf/libdwarf++.a  ../libelfin/elf/libelf++.a -lcapstone -pthread -Wl,--wrap=ptrace,--wrap=waitpid,--wrap=process_vm_readv,--wrap=process_vm_writev,--wrap=epoll_wait,--wrap=cs_disasm,--wrap=cs_disasm_iter
+gcc -o bench_loop -g -O1 -fno-omit-frame-pointer ../junk_demo/bench_loop.c
+gcc -o bench_recurse -g -O1 -fno-omit-frame-pointer ../junk_demo/bench_recurse.c
+gcc -o bench_threads -g -O1 -fno-omit-frame-pointer ../junk_demo/bench_threads.c -pthread
+gcc -o bench_heap -g -O1 -fno-omit-frame-pointer ../junk_demo/bench_heap.c
+gcc -o bench_funcs -g -O1 -fno-omit-frame-pointer ../junk_demo/bench_funcs.c
+gcc -o bench_funcs_nodebug -O1 -fno-omit-frame-pointer ../junk_demo/bench_funcs.c
+gcc -o rsp_test -g -O1 -no-pie ../junk_demo/rsp_test.c
\ No newline at end of file
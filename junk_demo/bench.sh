@@ -0,0 +1,42 @@
+#!/bin/sh
+# 调试器热路径的基准, 在 build/ 下先跑 Build.sh, 再在 build/ 下运行:
+#   ../junk_demo/bench.sh [结果文件]          默认追加到 bench.jsonl
+# 每项一行 JSON (bench 命令的记录, 见 TikiBench.h), 加上 "commit" 和 "time", 不同提交的结果放在同一个文件里比较
+# BENCH_N 调整次数 (默认 10000), 次数少的项按它的比例缩放; 每次运行调试器最多 BENCH_TIMEOUT 秒 (默认 600)
+set -e
+out=${1:-bench.jsonl}
+n=${BENCH_N:-10000}
+limit=${BENCH_TIMEOUT:-600}
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+now=$(date +%s)
+
+record() {
+    sed -n "s/^{\"type\":\"bench\",/{\"type\":\"bench\",\"commit\":\"$commit\",\"time\":$now,/p" | tee -a "$out"
+}
+
+run() {
+    timeout "$limit" ./tiki --interpreter=json "$@" | record
+}
+
+# 启动到第一次停在 bench_hit 的墙钟时间, 5 次取最快; 停止报告查行号, 有调试信息时会读 DWARF
+startup() {
+    best=0
+    for i in 1 2 3 4 5; do
+        t0=$(date +%s%N)
+        timeout "$limit" ./tiki -ex 'break bench_hit' -ex continue "./$1" >/dev/null 2>&1
+        t1=$(date +%s%N)
+        d=$((t1-t0))
+        if [ $best -eq 0 ] || [ $d -lt $best ]; then best=$d; fi
+    done
+    echo "{\"type\":\"bench\",\"name\":\"startup\",\"program\":\"$1\",\"threads\":1,\"ops\":1,\"ns\":$best,\"ns_per_op\":$best,\"ops_per_sec\":$((1000000000/best))}" | record
+}
+
+# bench breakpoint 自己加临时断点, 其余的项先停到 bench_hit; emulate 放在最后, 模拟出错时不影响前面的项
+run -ex "bench breakpoint $n bench_hit" -ex "bench step $((n*10))" -ex "bench registers $n" -ex "bench disasm $n" \
+    -ex 'set emulate on' -ex "bench step $((n*10))" ./bench_loop
+run -ex "bench breakpoint $((n/10)) bench_hit" ./bench_threads
+run -ex 'break bench_hit' -ex continue -ex "bench read $((n/10))" -ex "bench read $n 4096" ./bench_heap
+run -ex 'break bench_hit' -ex continue -ex "bench backtrace $((n/100))" ./bench_recurse
+run -ex 'break bench_hit' -ex continue -ex "bench symbols $((n*10))" ./bench_funcs
+startup bench_funcs
+startup bench_funcs_nodebug
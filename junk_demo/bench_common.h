@@ -0,0 +1,18 @@
+#ifndef __BENCH_COMMON_H__
+#define __BENCH_COMMON_H__
+
+#include<stdint.h>
+
+/*
+    bench.sh 的被调试程序共用: 每个程序准备好自己的状态后循环调用 bench_hit,
+    bench breakpoint 把断点打在这里, 其余的基准都在停在这里时测
+*/
+volatile uint64_t bench_counter;
+
+__attribute__((noinline)) void bench_hit(void)
+{
+    bench_counter++;
+    __asm__ volatile("");
+}
+
+#endif
@@ -0,0 +1,26 @@
+#include"bench_common.h"
+
+//很多函数 (4000 个 bench_func_NNNN): 符号查找; 不带 -g 编译的同一个程序比较启动时间
+#define X10(M,n) M(n##0) M(n##1) M(n##2) M(n##3) M(n##4) M(n##5) M(n##6) M(n##7) M(n##8) M(n##9)
+#define X100(M,n) X10(M,n##0) X10(M,n##1) X10(M,n##2) X10(M,n##3) X10(M,n##4) \
+    X10(M,n##5) X10(M,n##6) X10(M,n##7) X10(M,n##8) X10(M,n##9)
+#define X1000(M,n) X100(M,n##0) X100(M,n##1) X100(M,n##2) X100(M,n##3) X100(M,n##4) \
+    X100(M,n##5) X100(M,n##6) X100(M,n##7) X100(M,n##8) X100(M,n##9)
+
+#define FUNC(n) __attribute__((noinline)) int bench_func_##n(int x){return x*n+1;}
+#define ENTRY(n) bench_func_##n,
+
+X1000(FUNC,1) X1000(FUNC,2) X1000(FUNC,3) X1000(FUNC,4)
+
+int (*const bench_funcs[])(int)={X1000(ENTRY,1) X1000(ENTRY,2) X1000(ENTRY,3) X1000(ENTRY,4)};
+
+int main(void)
+{
+    int acc=0;
+    for(;;)
+    {
+        for(unsigned i=0;i<sizeof(bench_funcs)/sizeof(bench_funcs[0]);i++) acc=bench_funcs[i](acc);
+        bench_counter+=acc;
+        bench_hit();
+    }
+}
@@ -0,0 +1,15 @@
+#include<stdlib.h>
+#include<string.h>
+#include"bench_common.h"
+
+//大堆 (默认 256MB, 全部写过一遍): bench read 从最大的可读写映射读
+char* heap;
+
+int main(int argc,char** argv)
+{
+    size_t mb= argc>1? strtoul(argv[1],NULL,0) : 256;
+    heap=malloc(mb<<20);
+    if(!heap) return 1;
+    memset(heap,0x5a,mb<<20);
+    for(;;) bench_hit();
+}
@@ -0,0 +1,11 @@
+#include"bench_common.h"
+
+//紧密循环: 断点命中往返, 单步, 寄存器和反汇编输出
+int main(void)
+{
+    for(;;)
+    {
+        for(int i=0;i<16;i++) bench_counter+=i;
+        bench_hit();
+    }
+}
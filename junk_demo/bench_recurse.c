@@ -0,0 +1,20 @@
+#include<stdlib.h>
+#include"bench_common.h"
+
+//深递归 (默认 10000 层): 在最深处循环, backtrace 走完整条 rbp 链
+__attribute__((noinline)) int down(int n)
+{
+    volatile char pad[64];
+    pad[n&63]=(char)n;
+    if(n==0)
+    {
+        while(bench_counter!=UINT64_MAX) bench_hit();
+        return 0;
+    }
+    return down(n-1)+pad[n&63];
+}
+
+int main(int argc,char** argv)
+{
+    return down(argc>1? atoi(argv[1]) : 10000);
+}
@@ -0,0 +1,25 @@
+#include<pthread.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include"bench_common.h"
+
+//很多线程 (默认 32): 每次停下都要停住和恢复全部线程; 其他线程大部分时间在 sleep, 像一般的服务程序
+static void* worker(void* arg)
+{
+    volatile uint64_t* work=arg;
+    for(;;)
+    {
+        for(int i=0;i<1000;i++) (*work)++;
+        usleep(1000);
+    }
+    return NULL;
+}
+
+int main(int argc,char** argv)
+{
+    int n= argc>1? atoi(argv[1]) : 32;
+    static volatile uint64_t work[1024];
+    pthread_t t;
+    for(int i=0;i<n && i<1024;i++) pthread_create(&t,NULL,worker,(void*)&work[i]);
+    for(;;) bench_hit();
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# checkpoint/restart 的检查, 在 build/ 下先跑 Build.sh, 再在 build/ 下运行 ../junk_demo/checkpoint_test.sh
+# bench_threads 停下时有 9 个线程, restart 要先结束它们 (主线程最后回收), 卡住时 timeout 让检查失败
+# 两次 restart 都要切换成功并再次停在 bench_hit; 全部通过时退出码为 0
+out=$(timeout 20 ./tiki -ex 'break bench_hit' -ex continue -ex checkpoint -ex 'restart 1' -ex continue \
+    -ex 'restart 1' -ex continue ./bench_threads 2>&1)
+rc=$?
+switched=$(echo "$out" | grep -c '^Switched to checkpoint 1')
+hits=$(echo "$out" | grep -c '^Hit breakpoint')
+if [ $rc -ne 0 ] || [ "$switched" -ne 2 ] || [ "$hits" -ne 3 ]; then
+    echo "$out" | grep -v '^New thread'
+    echo "FAILED (exit $rc, $switched restarts, $hits breakpoint hits)"
+    exit 1
+fi
+echo "PASSED"
@@ -0,0 +1,246 @@
+/*
+    --gdbserver 的回环测试, 不需要 gdb: 在 build/ 下运行 ./rsp_test ./tiki
+    不带参数时自己就是被调试程序 (循环调用 rsp_target_hit); 带参数时启动 tiki --gdbserver unix:SOCK 调试自己,
+    按顺序发包并检查回复: qSupported, QStartNoAckMode, ?, g/G, Z0/z0, vCont;c, 一次写出的多个 M/m, vCont;r, 格式错误的包
+    -no-pie 编译, 两个进程里 rsp_target_hit 和 rsp_target_data 的地址相同; 全部通过时退出码为 0
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<unistd.h>
+#include<signal.h>
+#include<fcntl.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/wait.h>
+
+volatile uint64_t rsp_target_data[2];
+
+__attribute__((noinline)) void rsp_target_hit(void)
+{
+    rsp_target_data[1]++;
+    __asm__ volatile("");
+}
+
+static int sock=-1;
+static int no_ack=0;
+static int acks=0;
+static char inbuf[1<<16];
+static size_t in_len=0,in_pos=0;
+static int failures=0;
+
+static int next_char(void)
+{
+    if(in_pos==in_len)
+    {
+        ssize_t n=read(sock,inbuf,sizeof(inbuf));
+        if(n<=0) return -1;
+        in_len=n;
+        in_pos=0;
+    }
+    return (unsigned char)inbuf[in_pos++];
+}
+
+static void append_packet(char* out,const char* body)
+{
+    unsigned sum=0;
+    for(const char* p=body;*p;p++) sum+=(unsigned char)*p;
+    sprintf(out+strlen(out),"$%s#%02x",body,sum&0xff);
+}
+
+//多个包拼在一起一次写出
+static void send_packets(const char** bodies,int n)
+{
+    static char out[1<<16];
+    out[0]=0;
+    for(int i=0;i<n;i++) append_packet(out,bodies[i]);
+    if(write(sock,out,strlen(out))!=(ssize_t)strlen(out))
+    {
+        perror("write");
+        exit(2);
+    }
+}
+
+static void send_packet(const char* body)
+{
+    send_packets(&body,1);
+}
+
+//跳过 '+', 校验和错误算失败; 没关 ack 时回 '+'
+static char* read_packet(void)
+{
+    static char body[1<<16];
+    int c;
+    while((c=next_char())!='$')
+    {
+        if(c<0)
+        {
+            fprintf(stderr,"connection closed\n");
+            exit(2);
+        }
+        if(c=='+') acks++;
+    }
+    size_t n=0;
+    unsigned sum=0;
+    while((c=next_char())!='#' && c>=0)
+    {
+        sum+=c;
+        if(n<sizeof(body)-1) body[n++]=(char)c;
+    }
+    body[n]=0;
+    char hex[3]={(char)next_char(),(char)next_char(),0};
+    if(strtoul(hex,NULL,16)!=(sum&0xff))
+    {
+        fprintf(stderr,"bad checksum on %s\n",body);
+        failures++;
+    }
+    if(!no_ack && write(sock,"+",1)!=1) exit(2);
+    return body;
+}
+
+static void check(int ok,const char* what,const char* reply)
+{
+    printf("%s %s\n",ok? "PASS" : "FAIL",what);
+    if(!ok)
+    {
+        printf("    reply: %.200s\n",reply);
+        failures++;
+    }
+}
+
+static char* request(const char* body)
+{
+    send_packet(body);
+    return read_packet();
+}
+
+//停止回复里的 "10:" 是 rip, 小端 8 字节
+static uint64_t stop_rip(const char* reply)
+{
+    const char* p=strstr(reply,";10:");
+    uint64_t v=0;
+    if(!p) return 0;
+    for(int i=7;i>=0;i--)
+    {
+        char b[3]={p[4+i*2],p[5+i*2],0};
+        v=v<<8|strtoul(b,NULL,16);
+    }
+    return v;
+}
+
+static int run_client(const char* tiki)
+{
+    char path[64],self[4096],spec[80];
+    snprintf(path,sizeof(path),"/tmp/rsp_test.%d",getpid());
+    snprintf(spec,sizeof(spec),"unix:%s",path);
+    ssize_t len=readlink("/proc/self/exe",self,sizeof(self)-1);
+    if(len<0) return 2;
+    self[len]=0;
+    pid_t child=fork();
+    if(child==0)
+    {
+        int null=open("/dev/null",O_RDWR);
+        dup2(null,0);
+        dup2(null,1);
+        execl(tiki,tiki,"--gdbserver",spec,self,(char*)NULL);
+        _exit(127);
+    }
+    struct sockaddr_un addr={0};
+    addr.sun_family=AF_UNIX;
+    strcpy(addr.sun_path,path);
+    for(int i=0;i<500;i++)
+    {
+        sock=socket(AF_UNIX,SOCK_STREAM,0);
+        if(connect(sock,(struct sockaddr*)&addr,sizeof(addr))==0) break;
+        close(sock);
+        sock=-1;
+        usleep(10000);
+    }
+    if(sock<0)
+    {
+        fprintf(stderr,"cannot connect to %s\n",path);
+        kill(child,SIGKILL);
+        return 2;
+    }
+
+    char* r=request("qSupported:swbreak+");
+    check(strstr(r,"QStartNoAckMode+") && acks==1,"qSupported (acked)",r);
+    r=request("QStartNoAckMode");
+    check(!strcmp(r,"OK"),"QStartNoAckMode",r);
+    no_ack=1;
+    acks=0;
+    r=request("?");
+    check(r[0]=='T',"? stop reply",r);
+
+    static char regs[4096],g[4096+1];
+    r=request("g");
+    strcpy(regs,r);
+    check(strlen(regs)>=17*16,"g",r);
+    snprintf(g,sizeof(g),"G%s",regs);
+    r=request(g);
+    check(!strcmp(r,"OK"),"G",r);
+    r=request("g");
+    check(!strcmp(r,regs),"g after G unchanged",r);
+
+    char pkt[256],want[64];
+    uint64_t hit=(uint64_t)(uintptr_t)rsp_target_hit;
+    snprintf(pkt,sizeof(pkt),"Z0,%lx,1",(unsigned long)hit);
+    r=request(pkt);
+    check(!strcmp(r,"OK"),"Z0",r);
+    snprintf(pkt,sizeof(pkt),"m%lx,1",(unsigned long)hit);
+    snprintf(want,sizeof(want),"%02x",*(const unsigned char*)rsp_target_hit);
+    r=request(pkt);
+    check(!strcmp(r,want),"m hides the int3",r);
+    r=request("vCont;c");
+    check(r[0]=='T' && strstr(r,"swbreak:") && stop_rip(r)==hit,"vCont;c stops at Z0 with pc rewound",r);
+
+    //M 和两个 m 一次写出, 回复按顺序到达
+    char m1[64],m2[64],m3[64];
+    uint64_t data=(uint64_t)(uintptr_t)rsp_target_data;
+    snprintf(m1,sizeof(m1),"M%lx,8:0123456789abcdef",(unsigned long)data);
+    snprintf(m2,sizeof(m2),"m%lx,8",(unsigned long)data);
+    snprintf(m3,sizeof(m3),"m%lx,4",(unsigned long)data+4);
+    const char* batch[]={m1,m2,m3};
+    send_packets(batch,3);
+    r=read_packet();
+    check(!strcmp(r,"OK"),"pipelined M",r);
+    r=read_packet();
+    check(!strcmp(r,"0123456789abcdef"),"pipelined m reads the M",r);
+    r=read_packet();
+    check(!strcmp(r,"89abcdef"),"pipelined m at offset",r);
+
+    snprintf(pkt,sizeof(pkt),"vCont;r%lx,%lx",(unsigned long)hit,(unsigned long)hit+0x10);
+    r=request(pkt);
+    uint64_t pc=stop_rip(r);
+    check(r[0]=='T' && (pc<hit || pc>=hit+0x10),"vCont;r stops outside the range",r);
+    snprintf(pkt,sizeof(pkt),"z0,%lx,1",(unsigned long)hit);
+    r=request(pkt);
+    check(!strcmp(r,"OK"),"z0",r);
+    snprintf(pkt,sizeof(pkt),"m%lx,1",(unsigned long)hit);
+    r=request(pkt);
+    check(!strcmp(r,want),"m after z0",r);
+
+    //格式错误的包只回复错误, 会话继续
+    r=request("mzz,4");
+    check(!strcmp(r,"E01"),"malformed m",r);
+    r=request("T");
+    check(!strcmp(r,"E01"),"T without thread",r);
+    r=request("p");
+    check(!strcmp(r,"E01"),"p without register",r);
+
+    r=request("vKill;1");
+    check(!strcmp(r,"OK"),"vKill",r);
+    close(sock);
+    int status;
+    waitpid(child,&status,0);
+    unlink(path);
+    printf("%s\n",failures? "FAILED" : "ALL PASSED");
+    return failures? 1 : 0;
+}
+
+int main(int argc,char** argv)
+{
+    if(argc>1) return run_client(argv[1]);
+    for(;;) rsp_target_hit();
+}